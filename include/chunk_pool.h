@@ -0,0 +1,98 @@
+#ifndef CHUNK_POOL_H
+#define CHUNK_POOL_H
+
+/**
+ * @file chunk_pool.h
+ *
+ * @brief Pool of reference-counted receive buffers.
+ *
+ * The pool provides fixed-size buffers where messages can be received.
+ * A chunk decoded from one of these buffers (see decodeChunkBorrow())
+ * does not copy its payload and attributes, but points inside the
+ * receive buffer and holds a reference to it. The buffer goes back to
+ * the pool when the chunk buffer discards the last chunk referencing it
+ * (and the receiver released its own reference), so that in steady state
+ * receiving a chunk does not require any dynamic memory allocation.
+ * See @link chunk_pool_test.c chunk_pool_test.c @endlink for an usage
+ * example.
+ *
+ * The pool is not thread-safe.
+ */
+
+/** @example chunk_pool_test.c
+ *
+ * A test program showing how to receive chunks without copying them.
+ *
+ */
+
+/**
+ * @brief Initialise the pool of receive buffers.
+ *
+ * @param config a text string containing the number of buffers
+ *        ("buffers", default 64) and their size in bytes ("buffer_size",
+ *        default 65536)
+ * @return 0 on success, <0 on error
+ */
+int chunk_pool_init(const char *config);
+
+/**
+ * @brief Get a buffer from the pool.
+ *
+ * @param size minimum size of the buffer
+ * @return a pointer to a buffer holding one reference, or NULL if the
+ *         pool is exhausted or size is larger than the pool buffers
+ */
+uint8_t *chunk_pool_get(int size);
+
+/**
+ * @brief Check if the pool has been initialised.
+ *
+ * @return 1 if chunk_pool_init() succeeded (and the pool has not been
+ *         destroyed), 0 otherwise
+ */
+int chunk_pool_enabled(void);
+
+/**
+ * @brief Check if some memory belongs to a pool buffer.
+ *
+ * @param p a pointer anywhere inside a buffer
+ * @return 1 if p points inside a pool buffer, 0 otherwise
+ */
+int chunk_pool_owns(const void *p);
+
+/**
+ * @brief Take a reference to a pool buffer.
+ *
+ * @param p a pointer anywhere inside a pool buffer
+ * @return p (as a pointer to the buffer's writable memory)
+ */
+uint8_t *chunk_pool_ref(const void *p);
+
+/**
+ * @brief Release a reference to a pool buffer.
+ *
+ * When the last reference is released, the buffer is returned to the
+ * pool.
+ *
+ * @param p a pointer anywhere inside a pool buffer
+ */
+void chunk_pool_put(const void *p);
+
+/**
+ * @brief Release the memory of a chunk's payload or attributes.
+ *
+ * Release a reference if p points inside a pool buffer, otherwise free
+ * it with grapes_free() (which also handles memory coming from malloc()).
+ * This is used by whoever owns a chunk that may have been decoded with
+ * decodeChunkBorrow() (for example, the chunk buffer).
+ *
+ * @param p pointer to the memory to be released (can be NULL)
+ */
+void chunk_data_free(void *p);
+
+/**
+ * @brief Destroy the pool, freeing all of its buffers.
+ */
+void chunk_pool_destroy(void);
+
+#endif	/* CHUNK_POOL_H */
@@ -42,7 +42,10 @@ typedef struct chunk_buffer ChunkBuffer;
  *
  * @param config a text string containing some configuration parameters for
  *        the buffer, such as the playout delay and maybe some additional
- *        parameters (estimated size of the buffer, etc...)
+ *        parameters (estimated size of the buffer, etc...).
+ *        "type=ring" selects a buffer indexed by chunk ID, where lookup,
+ *        insertion and eviction are O(1); all the stored chunks must then
+ *        fit in a window of "window" consecutive IDs (default: 4 * size)
  * @return a pointer to the allocated chunk buffer in case of success, NULL
  *         otherwise
  */
@@ -35,7 +35,19 @@ typedef struct chunkID_set ChunkIDSet;
   *                   the chunk ID set. For example, the "size" tag indicates
   *                   the expected number of chunk IDs that will be stored
   *                   in the set; 0 or not present if such a number is not
-  *                   known.
+  *                   known. The "type" tag can be "priority" (default),
+  *                   "bitmap" (IDs sorted in increasing order, encoded as
+  *                   a bitmap) or "window" (as "bitmap", but stored in
+  *                   memory as a bitmap too, so that adding and checking
+  *                   IDs, and getting the earliest and latest ones, are
+  *                   O(1); IDs must be non-negative, and the set spans
+  *                   at most 262144 consecutive IDs: adding a later ID
+  *                   drops the earliest ones, and earlier IDs are
+  *                   refused). If the "compact"
+  *                   tag is not 0 (default), the set is sent with a
+  *                   delta or run-length encoding when it is smaller than
+  *                   the native one (peers running older versions cannot
+  *                   decode it: use "compact=0" to interoperate with them).
   * @return the pointer to the new set on success, NULL on error
   */
 struct chunkID_set *chunkID_set_init(const char *config);
@@ -99,7 +111,76 @@ int chunkID_set_check(const struct chunkID_set *h, int chunk_id);
   * @return > 0 if the chunk ID is correctly inserted in the set, 0 if chunk_id
   *         is already in the set, < 0 on error
   */
-int chunkID_set_union(struct chunkID_set *h, struct chunkID_set *a);
+int chunkID_set_union(struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Intersect a chunk ID set with another one
+  *
+  * Remove from a set all the chunk IDs that are not in another set.
+  * When the two sets have the same type, the operation is performed on
+  * the whole sets at once (merging sorted arrays, or word-wise on
+  * "window" sets) instead of checking the chunk IDs one by one.
+  *
+  * @param h a pointer to the set to be modified
+  * @param a a pointer to the other set
+  * @return the new size of h, or < 0 on error
+  */
+int chunkID_set_intersect(struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Remove the chunk IDs of a set from another one
+  *
+  * Remove from h all the chunk IDs that are in a (for example, the
+  * chunks a peer has and the local node is missing are obtained removing
+  * the local buffer map from the peer's one).
+  *
+  * @param h a pointer to the set to be modified
+  * @param a a pointer to the set of chunk IDs to be removed
+  * @return the new size of h, or < 0 on error
+  */
+int chunkID_set_difference(struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Compute the symmetric difference of two chunk ID sets
+  *
+  * Remove from h the chunk IDs that are in a, and add to h the chunk IDs
+  * of a that are not in h: if h and a are two versions of a buffer map,
+  * the result contains the chunk IDs that have been added or removed.
+  * Applying it again to the old version gives the new one.
+  *
+  * @param h a pointer to the set to be modified
+  * @param a a pointer to the other set
+  * @return the new size of h, or < 0 on error
+  */
+int chunkID_set_xor(struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Count the chunk IDs two sets have in common
+  *
+  * @param h a pointer to a set
+  * @param a a pointer to another set
+  * @return the number of chunk IDs that are both in h and in a
+  */
+int chunkID_set_intersect_count(const struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Count the chunk IDs of a set that are not in another one
+  *
+  * @param h a pointer to a set
+  * @param a a pointer to another set
+  * @return the number of chunk IDs that are in h but not in a
+  */
+int chunkID_set_difference_count(const struct chunkID_set *h, const struct chunkID_set *a);
+
+ /**
+  * @brief Count the chunk IDs of a set in a range
+  *
+  * @param h a pointer to the set
+  * @param from the first chunk ID of the range
+  * @param to the chunk ID following the last one of the range
+  * @return the number of chunk IDs c in the set with from <= c < to
+  */
+int chunkID_set_count_in_range(const struct chunkID_set *h, int from, int to);
 
  /**
   * Clear a set
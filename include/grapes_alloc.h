@@ -0,0 +1,105 @@
+#ifndef GRAPES_ALLOC_H
+#define GRAPES_ALLOC_H
+
+/**
+ * @file grapes_alloc.h
+ *
+ * @brief Memory allocator used by the library.
+ *
+ * Objects which are allocated and freed very often (nodeIDs, peers,...)
+ * come from fixed-size slab pools, and variable-size data (chunk
+ * payloads, cache arrays) from pools of power-of-two size classes. Freed
+ * objects are kept in the pools and reused, so in steady state most of
+ * the allocations do not hit malloc().
+ *
+ * Memory coming from the pools is recognised by its address, so
+ * grapes_free() can be used on any memory obtained from malloc() too.
+ */
+
+/**
+ * Opaque type describing a pool of fixed-size objects.
+ */
+struct grapes_slab;
+
+/**
+ * Usage statistics of a pool.
+ */
+struct grapes_alloc_stats {
+  const char *name;     ///< name of the pool
+  int size;             ///< size of the pool objects
+  unsigned long hits;   ///< allocations served from the pool
+  unsigned long misses; ///< allocations which had to call malloc()
+  int in_use;           ///< objects currently allocated
+};
+
+/**
+ * @brief Configure the allocator.
+ *
+ * @param config a text string containing "allocator=slab" (the default)
+ *        or "allocator=malloc" (every allocation is forwarded to malloc()),
+ *        and the amount of memory allocated for a pool when it runs out
+ *        of objects ("slab_size", default 65536 bytes)
+ * @return 0 on success, <0 on error
+ */
+int grapes_alloc_init(const char *config);
+
+/**
+ * @brief Create a pool of fixed-size objects.
+ *
+ * If a pool with the same name and size already exists, it is returned.
+ *
+ * @param name name of the pool (used for statistics)
+ * @param size size of the objects
+ * @return the pool, or NULL on error
+ */
+struct grapes_slab *grapes_slab_create(const char *name, int size);
+
+/**
+ * @brief Allocate an object from a pool.
+ *
+ * @param s the pool
+ * @return a pointer to the object, or NULL on error
+ */
+void *grapes_slab_alloc(struct grapes_slab *s);
+
+/**
+ * @brief Allocate some memory from the size-class pools.
+ *
+ * Sizes up to 64KB are rounded up to a power of 2 and served by the
+ * size-class pools; larger allocations are forwarded to malloc().
+ *
+ * @param size the size of the memory to be allocated, in bytes
+ * @return a pointer to the allocated memory, or NULL on error
+ */
+void *grapes_malloc(int size);
+
+/**
+ * @brief Resize some memory allocated with grapes_malloc().
+ *
+ * @param p pointer to the memory (can be NULL, or come from malloc())
+ * @param size new size, in bytes
+ * @return a pointer to the resized memory, or NULL on error (p is then
+ *         left untouched)
+ */
+void *grapes_realloc(void *p, int size);
+
+/**
+ * @brief Release some memory.
+ *
+ * Return an object to its pool. If p does not come from a pool, free()
+ * it.
+ *
+ * @param p pointer to the memory to be released (can be NULL)
+ */
+void grapes_free(void *p);
+
+/**
+ * @brief Get the usage statistics of the pools.
+ *
+ * @param stats array where the statistics are stored
+ * @param n size of the array
+ * @return the number of pools, which can be larger than n
+ */
+int grapes_alloc_stats(struct grapes_alloc_stats *stats, int n);
+
+#endif	/* GRAPES_ALLOC_H */
@@ -4,6 +4,14 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#else
+struct iovec {                    /* Scatter/gather array items */
+  void  *iov_base;              /* Starting address */
+  size_t iov_len;               /* Number of bytes to transfer */
+};
+#endif
 
 /**
 * @file net_helper.h
@@ -48,6 +56,16 @@ int nodeid_equal(const struct nodeID *s1, const struct nodeID *s2);
 */
 int nodeid_cmp(const struct nodeID *s1, const struct nodeID *s2);
 
+/**
+* @brief Compute a hash of a nodeID.
+*
+* Compute a hash value suitable for building hash indexes of nodeIDs:
+* nodeIDs that are identical according to #nodeid_equal have the same hash.
+* @param[in] s A pointer to the nodeID to be hashed.
+* @return The hash of the nodeID.
+*/
+uint32_t nodeid_hash(const struct nodeID *s);
+
 /**
 * @brief Create a new nodeID.
 *
@@ -72,7 +90,12 @@ void nodeid_free(struct nodeID *s);
 * Initialize the parameters for the networking facilities and create a nodeID representing the caller.
 * @param[in] IPaddr The IP in string form to be associated to the caller.
 * @param[in] port The port to be associated to the caller.
-* @param[in] config Additional configuration options.
+* @param[in] config Additional configuration options. "nodeid_wire=legacy"
+*            makes #nodeid_dump use the old (full sockaddr) encoding, which is
+*            needed to talk to peers that cannot decode the compact one.
+*            "reassembly_mem" (bytes) and "reassembly_timeout" (ms) bound
+*            the memory used to reassemble large messages whose fragments
+*            are interleaved, and the time a partial message is kept.
 * @return A pointer to a nodeID representing the caller, initialized with all the necessary data.
 */
 struct nodeID *net_helper_init(const char *IPaddr, int port,const char *config);
@@ -103,7 +126,9 @@ int send_to_peer(const struct nodeID *from, const struct nodeID *to, const uint8
 /**
 * @brief Receive data from a remote peer.
 *
-* This function transparently handles the receiving routines.
+* This function transparently handles the receiving routines. Large
+* messages are reassembled even if their fragments are interleaved with
+* other messages; such other messages are returned by the next calls.
 * @param[in] local A pointer to the nodeID representing the caller.
 * @param[out] remote The address to a pointer that has to be set to a new nodeID representing the sender peer.
 * @param[out] buffer_ptr A pointer to the buffer containing the received data.
@@ -113,6 +138,53 @@ int send_to_peer(const struct nodeID *from, const struct nodeID *to, const uint8
 int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size);
 
 
+/**
+* @brief Send data scattered in many buffers to a remote peer.
+*
+* Same as #send_to_peer, but the message is the concatenation of the
+* buffers described by iov, which are sent without being copied.
+* @param[in] from A pointer to the nodeID representing the caller.
+* @param[in] to A pointer to the nodeID representing the remote peer.
+* @param[in] iov The buffers containing the data to be sent.
+* @param[in] iovlen The number of buffers (at most 16).
+* @return The number of bytes sent or -1 if some error occurred.
+*/
+int send_to_peer_iov(const struct nodeID *from, const struct nodeID *to, const struct iovec *iov, int iovlen);
+
+/**
+* @brief Send data to many remote peers.
+*
+* Send n messages (buffers[i] to to[i]) using as few system calls as
+* possible. The same buffer can be sent to different peers.
+* @param[in] from A pointer to the nodeID representing the caller.
+* @param[in] to An array of n pointers to the nodeIDs of the remote peers.
+* @param[in] buffers An array of n pointers to the data to be sent.
+* @param[in] buffer_sizes An array containing the n buffer lengths.
+* @param[in] n The number of messages to be sent.
+* @return The number of messages sent or -1 if some error occurred.
+*/
+int send_to_peers(const struct nodeID *from, const struct nodeID *const *to, const uint8_t *const *buffers, const int *buffer_sizes, int n);
+
+/**
+* @brief Receive many messages from remote peers.
+*
+* Wait for at least one message, then receive all the queued ones (up to n)
+* with as few system calls as possible. Only messages that fit in a single
+* datagram can be received in this way: for the fragments of larger ones,
+* buffer_sizes[i] is set to -1, and the message is returned by
+* #recv_from_peer once it is complete.
+* @param[in] local A pointer to the nodeID representing the caller.
+* @param[in,out] remote An array of n nodeID pointers, set to the senders of
+*                the messages; non-NULL entries are reused instead of
+*                allocating new nodeIDs.
+* @param[out] buffers An array of n pointers to the receive buffers.
+* @param[in,out] buffer_sizes The sizes of the receive buffers; on return,
+*                the sizes of the received messages.
+* @param[in] n The number of buffers.
+* @return The number of received messages or -1 if some error occurred.
+*/
+int recv_from_peer_batch(const struct nodeID *local, struct nodeID **remote, uint8_t **buffers, int *buffer_sizes, int n);
+
 /**
 * @brief Check for newly arrived data.
 *
@@ -124,6 +196,93 @@ int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *
 */
 int wait4data(const struct nodeID *n, struct timeval *tout, int *user_fds);
 
+/**
+* Opaque event loop, created by #net_helper_loop_create.
+*/
+struct net_helper_loop;
+
+#define NH_EV_NET 1	/**< Data from the network: call recv_from_peer() */
+#define NH_EV_FD 2	/**< A user FD is ready to be read */
+#define NH_EV_TIMER 3	/**< A periodic timer expired */
+
+/**
+* An event reported by #net_helper_loop_wait.
+*/
+struct nh_event {
+  int type;	/**< NH_EV_NET, NH_EV_FD or NH_EV_TIMER */
+  int id;	/**< The ready FD, or the expired timer */
+};
+
+/**
+* @brief Create an event loop.
+*
+* Create an event loop monitoring the network socket of the caller and,
+* possibly, some other FDs and periodic timers. Unlike #wait4data, FDs are
+* registered once, there is no limit on their number and all the ready
+* ones are reported at once.
+* @param[in] s A pointer to the nodeID representing the caller (can be NULL).
+* @return A pointer to the new event loop, or NULL in case of error.
+*/
+struct net_helper_loop *net_helper_loop_create(const struct nodeID *s);
+
+/**
+* @brief Monitor an FD in an event loop.
+*
+* @param[in] l The event loop.
+* @param[in] fd The FD to be monitored for reading.
+* @return 0 on success, < 0 on error.
+*/
+int net_helper_loop_add_fd(struct net_helper_loop *l, int fd);
+
+/**
+* @brief Stop monitoring an FD in an event loop.
+*
+* @param[in] l The event loop.
+* @param[in] fd The FD to be removed.
+* @return 0 on success, < 0 on error.
+*/
+int net_helper_loop_del_fd(struct net_helper_loop *l, int fd);
+
+/**
+* @brief Add a periodic timer to an event loop.
+*
+* The timer can be used, for example, to drive the periodic gossiping of
+* the peer sampler.
+* @param[in] l The event loop.
+* @param[in] period The timer period.
+* @return The timer identifier (>= 0) on success, < 0 on error.
+*/
+int net_helper_loop_add_timer(struct net_helper_loop *l, const struct timeval *period);
+
+/**
+* @brief Remove a timer from an event loop.
+*
+* @param[in] l The event loop.
+* @param[in] id The timer identifier.
+* @return 0 on success, < 0 on error.
+*/
+int net_helper_loop_del_timer(struct net_helper_loop *l, int id);
+
+/**
+* @brief Wait for events.
+*
+* Wait until some of the monitored FDs is ready, some timer expires, or
+* the timeout expires.
+* @param[in] l The event loop.
+* @param[in] tout The maximum time to wait (NULL to wait forever).
+* @param[out] events The array where the events are stored.
+* @param[in] max_events The size of the events array.
+* @return The number of events (0 if the timeout expired), or -1 on error.
+*/
+int net_helper_loop_wait(struct net_helper_loop *l, struct timeval *tout, struct nh_event *events, int max_events);
+
+/**
+* @brief Destroy an event loop.
+*
+* @param[in] l The event loop.
+*/
+void net_helper_loop_destroy(struct net_helper_loop *l);
+
 /**
 * @brief Give a string representation of a nodeID.
 *
@@ -145,10 +304,25 @@ int node_addr(const struct nodeID *s, char *addr, int len);
 */
 struct nodeID *nodeid_undump(const uint8_t *b, int *len);
 
+/**
+* @brief Deserialize a nodeID in an existing nodeID structure.
+*
+* Like #nodeid_undump, but overwriting the address of a nodeID which
+* was built by #nodeid_undump (not one bound to a socket), so that
+* received nodeIDs can be decoded, compared and hashed without
+* allocating memory.
+* @param[in] s A pointer to the nodeID to be overwritten.
+* @param[in] b A pointer to the byte array containing the serialized nodeID.
+* @return The number of bytes read from the buffer, or < 0 on error.
+*/
+int nodeid_undump_into(struct nodeID *s, const uint8_t *b);
+
 /**
 * @brief Serialize a nodeID in a byte array.
 *
-* Serialize a nodeID in a byte array.
+* Serialize a nodeID in a byte array. By default, a compact encoding
+* tagged with its version and address family is used;
+* #nodeid_undump understands both this and the legacy encoding.
 * @param[in] b A pointer to the byte array that will contain the nodeID serialization.
 * @param[in] s A pointer to the nodeID to be serialized.
 * @param[in] max_write_size A number of bytes available in b
@@ -0,0 +1,87 @@
+#ifndef NET_HELPER_SIM_H
+#define NET_HELPER_SIM_H
+
+#include <stdint.h>
+
+/** @file net_helper_sim.h
+ *
+ * @brief In-memory network, for simulations.
+ *
+ * net_helper-sim.c implements the @link net_helper.h net_helper @endlink
+ * API on top of in-memory message queues, so that many peers can run in
+ * a single process. The messages are delivered after a configurable latency,
+ * and can be randomly lost. Time is virtual: it only moves when
+ * net_sim_run() is called, and nothing ever blocks. Linking with
+ * -Wl,--wrap=gettimeofday makes the rest of the library (the peer samplers'
+ * timers, for example) run on the same virtual clock.
+ *
+ * See @link overlay_sim.c overlay_sim.c @endlink for an example.
+ */
+
+struct nodeID;
+
+/** @example overlay_sim.c
+ *
+ * A simulator running thousands of peer samplers in one process, and
+ * measuring the properties of the overlay they build.
+ *
+ */
+
+/**
+* Traffic counters of a simulated node.
+*/
+struct net_sim_counters {
+  uint64_t sent_msgs;	/**< Messages sent by the node */
+  uint64_t sent_bytes;	/**< Bytes sent by the node */
+  uint64_t recv_msgs;	/**< Messages delivered to the node */
+  uint64_t recv_bytes;	/**< Bytes delivered to the node */
+  uint64_t lost_msgs;	/**< Messages sent by the node and lost */
+};
+
+/**
+* @brief Configure the simulated network.
+*
+* @param[in] config "latency" and "jitter" (us): each message is delivered
+*            after latency plus a random delay up to jitter; "loss": the
+*            probability to lose a message; "seed": the seed of the random
+*            numbers used for jitter and losses.
+* @return 0 on success, -1 on error.
+*/
+int net_sim_configure(const char *config);
+
+/**
+* @brief Get the virtual time.
+*
+* @return The current virtual time, in us.
+*/
+uint64_t net_sim_time(void);
+
+/**
+* @brief Advance the virtual time.
+*
+* Move the virtual clock to a given time, making the messages due by
+* then available to recv_from_peer().
+* @param[in] t The new virtual time, in us (nothing happens if it is in the past).
+* @return The number of messages which became available.
+*/
+int net_sim_run(uint64_t t);
+
+/**
+* @brief Get the index of a simulated node.
+*
+* Nodes are numbered by net_helper_init(), starting from 0.
+* @param[in] id A nodeID with the address of the node.
+* @return The index of the node, or -1 if no node has been created with such address.
+*/
+int net_sim_index(const struct nodeID *id);
+
+/**
+* @brief Get the traffic counters of a simulated node.
+*
+* @param[in] id A nodeID with the address of the node.
+* @param[out] c The counters.
+* @return 0 on success, -1 if no node has been created with such address.
+*/
+int net_sim_counters(const struct nodeID *id, struct net_sim_counters *c);
+
+#endif /* NET_HELPER_SIM_H */
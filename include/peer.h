@@ -10,12 +10,15 @@
 #define	_PEER_H
 
 #include <sys/time.h>
+#include <stdint.h>
 
 struct peer {
     struct nodeID *id; ///< NodeId associated to the peer
     struct timeval creation_timestamp; ///< creation timestamp
     struct chunkID_set *bmap; ///< buffermap of the peer
     struct timeval bmap_timestamp; ///< buffermap timestamp
+    uint16_t bmap_seq; ///< sequence number of the buffermap
+    struct bmap_diff *bmap_sent; ///< buffermaps sent to the peer as differences (see sendBufferMapDiff())
     int cb_size; ///< chunk buffer size
     double capacity; ///< chunk buffer size
     int subnet;
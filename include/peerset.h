@@ -31,6 +31,11 @@ void peerset_destroy(struct peerset **h);
   *                   For example, the "size" tag indicates the expected
   *                   number of peers that will be stored in the set;
   *                   0 or not present if such a number is not known.
+  *                   The "type" tag selects how peers are indexed:
+  *                   "sorted" (default) keeps the peers sorted by nodeID,
+  *                   while "hash" keeps them in insertion order and
+  *                   finds them through a hash table on their address,
+  *                   so that lookup, insertion and removal are O(1).
   * @return the pointer to the new set on success, NULL on error
   */
 struct peerset *peerset_init(const char *config);
@@ -64,7 +69,9 @@ void peerset_add_peers(struct peerset *h, struct nodeID **ids, int n);
   * @brief Remove a peer from the set.
   * 
   * Remove a peer from the set, distroying all associated data.
-  * If peer exists, pointers of peerset_get_peers move backwards.
+  * If peer exists, pointers of peerset_get_peers move backwards (in a
+  * "type=hash" set, the last peer is moved to the position of the removed
+  * one instead).
   *
   * @param h a pointer to the set where the peer has to be added
   * @param id the ID of the peer to be removed from the set
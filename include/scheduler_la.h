@@ -1,6 +1,8 @@
 #ifndef SCHEDULER_LA_H
 #define SCHEDULER_LA_H
 
+#include <stdint.h>
+
 #include "scheduler_common.h"
 
 /** @file scheduler_la.h
@@ -21,6 +23,9 @@
 
 /**
   * Scheduler ordering methods
+  *
+  * SCHED_WEIGHTED uses log(), so programs using the scheduler must be
+  * linked with the math library (-lm).
   */
 typedef enum {SCHED_BEST,SCHED_WEIGHTED} SchedOrdering;
 
@@ -146,6 +151,8 @@ void schedSelectPeersForChunks(SchedOrdering ordering, schedPeerID *peers, size_
   * @brief Low level scheduler function for selecting peer-chunk pairs based on a hybrid evaluation function.
 
   A maximum of selected_len peer-chunk pairs are selected based on the given evaluation function.
+  The pairs are filtered and evaluated one at a time, and only the selected ones are kept, so
+  the memory used does not depend on peers_len * chunks_len.
   @param [in] pairevaluate function to assign a weight to each peer-chunk pair
   */
 void schedSelectHybrid(SchedOrdering ordering, schedPeerID  *peers, size_t peers_len, schedChunkID  *chunks, size_t chunks_len, 	//in
@@ -165,4 +172,152 @@ typedef double (*evaluateFunction)(void*);
   */
 void selectWithOrdering(SchedOrdering ordering, size_t size, unsigned char *base, size_t nmemb, double(*evaluate)(void *), unsigned char *selected,size_t *selected_len);
 
+/*---reentrant versions----------------*/
+/**
+  * @brief Scheduler context.
+
+  A scheduler context carries the data passed to the filter and evaluator
+  functions, a random number generator and scratch buffers reused from
+  one selection to the next. The _r functions use only their context, so
+  schedulers with different contexts can run in parallel, and they do
+  not allocate memory once the buffers have grown to the needed size.
+  The functions without a context draw from rand() and allocate their
+  buffers at each call, so they can be called from different threads
+  too, but only the _r functions avoid the allocations.
+  */
+struct sched_ctx;
+
+/**
+  * @brief Filter function with user data
+  */
+typedef int (*filterFunction_r)(schedPeerID, schedChunkID, void *data);
+
+/**
+  * @brief Peer evaluator with user data
+  */
+typedef double (*peerEvaluateFunction_r)(schedPeerID*, void *data);
+
+/**
+  * @brief Chunk evaluator with user data
+  */
+typedef double (*chunkEvaluateFunction_r)(schedChunkID*, void *data);
+
+/**
+  * @brief Peer-chunk pair evaluator with user data
+  */
+typedef double (*pairEvaluateFunction_r)(struct PeerChunk*, void *data);
+
+/**
+  * @brief Generic evaluator with user data
+  */
+typedef double (*evaluateFunction_r)(void*, void *data);
+
+/**
+  * @brief Batch filter: bit i of the result is set if peers[i] can be selected with chunk.
+  * n is at most 64.
+  */
+typedef uint64_t (*filterBatchFunction)(const schedPeerID *peers, int n, schedChunkID chunk, void *data);
+
+/**
+  * @brief Batch peer evaluator: store the weight of peers[i] in weights[i], for i < n
+  */
+typedef void (*peerBatchEvaluateFunction)(const schedPeerID *peers, size_t n, double *weights, void *data);
+
+/**
+  * @brief Batch chunk evaluator: store the weight of chunks[i] in weights[i], for i < n
+  */
+typedef void (*chunkBatchEvaluateFunction)(const schedChunkID *chunks, size_t n, double *weights, void *data);
+
+/**
+  * @brief Batch pair evaluator: store the weight of pairs[i] in weights[i], for i < n
+  */
+typedef void (*pairBatchEvaluateFunction)(const struct PeerChunk *pairs, size_t n, double *weights, void *data);
+
+/**
+  * @brief Create a scheduler context.
+
+  @param [in] config configuration string; "seed=<n>" sets the seed of the
+              random number generator (by default, it is taken from rand())
+  @param [in] data user data, passed to the filter and evaluator functions
+  @return the context, or NULL on error
+  */
+struct sched_ctx *sched_ctx_init(const char *config, void *data);
+
+/**
+  * @brief Destroy a scheduler context, and set the pointer to NULL
+  */
+void sched_ctx_destroy(struct sched_ctx **ctx);
+
+/**
+  * @brief Get the user data of a scheduler context
+  */
+void *sched_ctx_data(const struct sched_ctx *ctx);
+
+/**
+  * @brief Register batch filter and evaluators in a scheduler context.
+
+  When registered (not NULL), the batch functions are used by the _r
+  functions instead of the filter and evaluators passed to them, which
+  can then be NULL. They are called on arrays of candidates (up to 64
+  peers for the filter), so that the weights can be computed in a
+  tight loop instead of with one indirect call per candidate.
+  schedSelectComposed_r() calls the batch peer and chunk evaluators once
+  on all the peers and all the chunks.
+  */
+void sched_ctx_set_batch(struct sched_ctx *ctx, filterBatchFunction filter, peerBatchEvaluateFunction peerevaluate,
+                         chunkBatchEvaluateFunction chunkevaluate, pairBatchEvaluateFunction pairevaluate);
+
+/**
+  * @brief Reentrant schedSelectPeerFirst()
+  */
+void schedSelectPeerFirst_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate);
+
+/**
+  * @brief Reentrant schedSelectChunkFirst()
+  */
+void schedSelectChunkFirst_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate);
+
+/**
+  * @brief Reentrant schedSelectComposed()
+  */
+void schedSelectComposed_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate, double2op weightcombine);
+
+/**
+  * @brief Reentrant schedSelectPeersForChunks()
+  */
+void schedSelectPeersForChunks_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     schedPeerID *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r evaluate);
+
+/**
+  * @brief Reentrant version of the chunk selection for a list of peers
+  */
+void schedSelectChunksForPeers_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     schedChunkID *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     chunkEvaluateFunction_r evaluate);
+
+/**
+  * @brief Reentrant schedSelectHybrid()
+  */
+void schedSelectHybrid_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     pairEvaluateFunction_r pairevaluate);
+
+/**
+  * @brief Reentrant selectWithOrdering()
+  */
+void selectWithOrdering_r(struct sched_ctx *ctx, SchedOrdering ordering, size_t size, unsigned char *base, size_t nmemb, evaluateFunction_r evaluate, unsigned char *selected, size_t *selected_len);
+
 #endif /* SCHEDULER_LA_H */
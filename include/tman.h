@@ -5,7 +5,10 @@
  *
  * @brief Topology Manager interface.
  *
- * This is the Topology Manager interface.
+ * This is the Topology Manager interface. The functions taking a
+ * struct tman_context work on independent Topology Manager instances,
+ * so that a process can build more than one overlay; the other ones
+ * work on a single, global instance created by tmanInit().
  *
  */
 
@@ -152,5 +155,114 @@ int tmanShrinkNeighbourhood(int n);
  */
 int tmanRemoveNeighbour(struct nodeID *neighbour);
 
+/**
+   @brief Maintains the context of a Topology Manager instance.
+ */
+struct tman_context;
+
+/**
+  @brief Create a Topology Manager instance.
+
+  Like tmanInit(), but returning a new instance instead of (re)initialising
+  the global one.
+
+  @param myID the ID of this peer.
+  @param metadata Pointer to data associated with the local peer.
+  @param metadata_size Size (number of bytes) of the metadata associated with the local peer.
+  @param rfun Ranking function that may be used to order the peers in tman cache.
+  @param config configuration parameters; "protocol" selects the
+         algorithm ("tman" or "dumb", the default).
+  @return the Topology Manager context in case of success; NULL in case of error.
+*/
+struct tman_context *tman_init(struct nodeID *myID, void *metadata, int metadata_size, tmanRankingFunction rfun, const char *config);
+
+/**
+  @brief Insert a peer in the neighbourhood of an instance; see tmanAddNeighbour().
+  @param tc the Topology Manager context.
+  @param neighbour the id of the peer to be added to the neighbourhood.
+  @param metadata Pointer to the array of metadata belonging to the peers to be added.
+  @param metadata_size Number of bytes of each metadata.
+  @return 0 in case of success; -1 in case of error.
+*/
+int tman_add_neighbour(struct tman_context *tc, struct nodeID *neighbour, void *metadata, int metadata_size);
+
+/**
+  @brief Pass a received packet to an instance; see tmanParseData().
+  @param tc the Topology Manager context.
+  @param buff a memory buffer containing the received message.
+  @param len the size of such a memory buffer.
+  @param peers Array of nodeID pointers to be added in Topology Manager cache.
+  @param size Number of elements in peers.
+  @param metadata Pointer to the array of metadata belonging to the peers to be added.
+  @param metadata_size Number of bytes of each metadata.
+  @return 0 in case of success; -1 in case of error.
+*/
+int tman_parse_data(struct tman_context *tc, const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size);
+
+/**
+  @brief Change the metadata of the local peer in an instance; see tmanChangeMetadata().
+  @param tc the Topology Manager context.
+  @param metadata Pointer to the metadata belonging to the peer.
+  @param metadata_size Number of bytes of the metadata.
+  @return 1 if successful, -1 otherwise.
+ */
+int tman_change_metadata(struct tman_context *tc, void *metadata, int metadata_size);
+
+/**
+  @brief Get the metadata of the neighbours of an instance; see tmanGetMetadata().
+  @param tc the Topology Manager context.
+  @param metadata_size Address of the integer that will be set to the size of each metadata.
+  @return a pointer to the array of metadata associated with the peers in the neighbourhood. NULL
+          in case of error, or if the neighbourhood is empty.
+*/
+const void *tman_get_metadata(struct tman_context *tc, int *metadata_size);
+
+/**
+  @brief Get the current neighbourhood size of an instance; see tmanGetNeighbourhoodSize().
+  @param tc the Topology Manager context.
+  @return The current size of the neighborhood.
+*/
+int tman_get_neighbourhood_size(struct tman_context *tc);
+
+/**
+  @brief Get the best peers of an instance; see tmanGivePeers().
+  @param tc the Topology Manager context.
+  @param n The number of peer the Topology Manager is asked for.
+  @param peers Array of nodeID pointers to be filled.
+  @param metadata Pointer to the array of metadata belonging to the peers to be given.
+  @return The number of elements in peers.
+*/
+int tman_give_peers(struct tman_context *tc, int n, struct nodeID **peers, void *metadata);
+
+/**
+  @brief Increase the neighbourhood size of an instance; see tmanGrowNeighbourhood().
+  @param tc the Topology Manager context.
+  @param n number of peers by which the neighbourhood size must be incremented.
+  @return the new neighbourhood size in case of success; -1 in case of error.
+*/
+int tman_grow_neighbourhood(struct tman_context *tc, int n);
+
+/**
+  @brief Decrease the neighbourhood size of an instance; see tmanShrinkNeighbourhood().
+  @param tc the Topology Manager context.
+  @param n number of peers by which the neighbourhood size must be decreased.
+  @return the new neighbourhood size in case of success; -1 in case of error.
+*/
+int tman_shrink_neighbourhood(struct tman_context *tc, int n);
+
+/**
+  @brief Remove a neighbour from an instance; see tmanRemoveNeighbour().
+  @param tc the Topology Manager context.
+  @param neighbour Pointer to the nodeID of the neighbor to be removed.
+  @return 1 if removal was successful, -1 if it was not.
+ */
+int tman_remove_neighbour(struct tman_context *tc, struct nodeID *neighbour);
+
+/**
+  @brief Destroy a Topology Manager instance, freeing all its resources.
+  @param tc the Topology Manager context.
+ */
+void tman_destroy(struct tman_context *tc);
+
 #endif /* TMAN_H */
 
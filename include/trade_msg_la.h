@@ -32,6 +32,22 @@
   */
 int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len);
 
+struct iovec;
+
+ /**
+  * @brief Encode a chunk without copying its payload.
+  *
+  * Encode the chunk header in a buffer, and describe the payload and the
+  * attributes (which are not copied) with an array of iovecs, so that the
+  * encoded chunk can be sent with send_to_peer_iov().
+  *
+  * @param[in] c Chunk to send
+  * @param[out] header Buffer of CHUNK_HEADER_SIZE bytes, filled with the chunk header
+  * @param[out] iov Array of (at least) 2 iovecs, filled with pointers to the chunk data and attributes
+  * @return the number of iovecs used on success, <0 on error
+  */
+int encodeChunkIov(const struct chunk *c, uint8_t *header, struct iovec *iov);
+
 /**
   * @brief Decode the bit stream.
   *
@@ -43,3 +59,22 @@ int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len);
   * @return 0 on success, <0 on error
   */
 int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len);
+
+ /**
+  * @brief Decode a chunk without copying its payload.
+  *
+  * If the bit stream is stored in a buffer from the chunk pool (see
+  * chunk_pool.h), the payload and the attributes of the decoded chunk
+  * point inside the buffer, and take a reference to it; they must then be
+  * released with chunk_data_free() (the chunk buffer does this when
+  * discarding the chunk). Otherwise, the payload and the attributes are
+  * copied as in decodeChunk(); if the pool has been initialised, they are
+  * allocated with grapes_malloc() and must be released with
+  * chunk_data_free() as well.
+  *
+  * @param[out] c Chunk to be filled with the decoded information
+  * @param[in] buff Buffer containing the bit stream to decode
+  * @param[in] buff_len length of the buffer
+  * @return the number of decoded bytes on success, <0 on error
+  */
+int decodeChunkBorrow(struct chunk *c, const uint8_t *buff, int buff_len);
@@ -20,8 +20,11 @@
   */
 enum signaling_type {
   sig_offer, sig_accept, sig_request, sig_deliver, sig_send_buffermap, sig_request_buffermap, sig_ack,
+  sig_send_buffermap_diff, sig_ack_buffermap,
 };
 
+struct peer;
+
 /**
  * @brief Set current node identifier.
  *
@@ -50,6 +53,26 @@ int parseSignaling(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
                    struct chunkID_set **cset, int *max_deliver, uint16_t *trans_id,
                    enum signaling_type *sig_type);
 
+/**
+ * @brief Parse an incoming signaling message in an existing chunk ID set.
+ *
+ * As parseSignaling(), but the chunk IDs are stored in a set provided by
+ * the caller (see decodeChunkSignalingInto()), so that parsing does not
+ * allocate memory in steady state (owner_id comes from the nodeID slab).
+ *
+ * @param[in] buff containing the incoming message.
+ * @param[in] buff_len length of the buffer.
+ * @param[out] owner_id identifier of the node on which refer the message just received.
+ * @param[out] cset the set to be filled (emptied if the message has no chunk IDs).
+ * @param[out] max_deliver deliver at most this number of Chunks.
+ * @param[out] trans_id transaction number associated with this message.
+ * @param[out] sig_type Type of signaling message.
+ * @return 1 on success, <0 on error.
+ */
+int parseSignalingInto(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
+                       struct chunkID_set *cset, int *max_deliver, uint16_t *trans_id,
+                       enum signaling_type *sig_type);
+
 /**
  * @brief Request a set of chunks from a Peer.
  *
@@ -142,4 +165,133 @@ int requestBufferMap(const struct nodeID *to, const struct nodeID *owner, uint16
  */
 int sendAck(const struct nodeID *to, struct chunkID_set *cset, uint16_t trans_id);
 
+/**
+ * @brief Send our BufferMap to a Peer, as a difference from a previous one.
+ *
+ * Once the Peer acknowledged one of the BufferMaps sent to it (see
+ * ackBufferMap()), only the chunk IDs changed since that BufferMap are
+ * sent (sig_send_buffermap_diff message): the ones added to it and the
+ * ones removed from it, in two separate sets (see parseSignalingDiff()).
+ * The difference covers all the BufferMaps sent since the acknowledged
+ * one, so it can be applied whichever of them the Peer received last,
+ * and differences keep being sent while acknowledgements are in flight
+ * or lost. The whole BufferMap is sent instead (sig_send_buffermap
+ * message) until the first acknowledgement, after the Peer requested it
+ * (see bufferMapRequested()), when no acknowledgement arrived for the
+ * last 32 BufferMaps, or when the difference is larger than the
+ * BufferMap. In both cases the trans_id of the message is the sequence
+ * number of the BufferMap. The state needed to compute the differences
+ * is stored in the bmap_sent field of the peer, and is released by
+ * freeBufferMapDiff().
+ *
+ * Sending differences is optional (sendBufferMap() can still be used, and
+ * peers must handle the sig_send_buffermap_diff, sig_ack_buffermap and
+ * sig_request_buffermap messages to use them): they make the messages
+ * smaller (about 40% for a sliding window of 500 chunks with a few new
+ * chunks per BufferMap) but do not reduce the CPU time, which is dominated
+ * by the system calls, and they need per-peer state and acknowledgements.
+ * Use them when the signaling bandwidth matters.
+ *
+ * @param[in] to the Peer.
+ * @param[in] owner Owner of the BufferMap to send (NULL for our own).
+ * @param[in] bmap the BufferMap to send.
+ * @param[in] cb_size the size of the chunk buffer.
+ * @return 1 Success, <0 on error.
+ */
+int sendBufferMapDiff(struct peer *to, const struct nodeID *owner, const struct chunkID_set *bmap, int cb_size);
+
+/**
+ * @brief Parse an incoming signaling message, including BufferMap differences.
+ *
+ * As parseSignalingInto(), but the chunk IDs removed from the BufferMap
+ * by a sig_send_buffermap_diff message are stored in a second set (for
+ * that message, cset contains the chunk IDs added to the BufferMap).
+ *
+ * @param[in] buff containing the incoming message.
+ * @param[in] buff_len length of the buffer.
+ * @param[out] owner_id identifier of the node on which refer the message just received.
+ * @param[out] added the chunk IDs of the message (see parseSignalingInto()).
+ * @param[out] removed the chunk IDs removed from the BufferMap (emptied
+ *                     for the other messages).
+ * @param[out] max_deliver deliver at most this number of Chunks.
+ * @param[out] trans_id transaction number associated with this message.
+ * @param[out] sig_type Type of signaling message.
+ * @return 1 on success, <0 on error.
+ */
+int parseSignalingDiff(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
+                       struct chunkID_set *added, struct chunkID_set *removed,
+                       int *max_deliver, uint16_t *trans_id, enum signaling_type *sig_type);
+
+/**
+ * @brief Acknowledge a BufferMap received from a Peer.
+ *
+ * Acknowledging only some of the BufferMaps (for example, one every few
+ * ones) is enough: the differences get smaller when an acknowledgement
+ * arrives, but they do not wait for it.
+ *
+ * @param[in] to PeerID.
+ * @param[in] seq the sequence number (trans_id) of the BufferMap.
+ * @return 1 Success, <0 on error.
+ */
+int ackBufferMap(const struct nodeID *to, uint16_t seq);
+
+/**
+ * @brief Update the BufferMap of a Peer with a received one.
+ *
+ * Copy a BufferMap received in a sig_send_buffermap message in the
+ * BufferMap stored in the peer, or apply a difference received in a
+ * sig_send_buffermap_diff message to it (adding the added chunk IDs and
+ * removing the removed ones). Messages older than the stored BufferMap
+ * (according to seq) are refused, so reordered messages cannot replace
+ * newer information. A difference also needs a stored BufferMap: if there
+ * is none (for example, the peer has just been added to a peerset) or
+ * updating it fails, the whole BufferMap is requested to the peer (with
+ * requestBufferMap(), so chunkSignalingInit() must have been called) and
+ * differences are refused until it arrives. Acknowledge the BufferMaps
+ * applied successfully with ackBufferMap().
+ *
+ * @param[in] p the Peer the BufferMap refers to.
+ * @param[in] added the BufferMap, or the chunk IDs added to it (not
+ *                  modified, so it can be reused with parseSignalingDiff()).
+ * @param[in] removed the chunk IDs removed from the BufferMap (only for
+ *                    sig_send_buffermap_diff; can be NULL).
+ * @param[in] type sig_send_buffermap or sig_send_buffermap_diff.
+ * @param[in] seq the trans_id of the message.
+ * @return 0 on success, <0 if the message is stale, the difference cannot
+ *         be applied, or on error.
+ */
+int applyBufferMap(struct peer *p, const struct chunkID_set *added,
+                   const struct chunkID_set *removed, enum signaling_type type, uint16_t seq);
+
+/**
+ * @brief Handle the acknowledgement of a BufferMap sent to a Peer.
+ *
+ * After this, sendBufferMapDiff() sends the differences from a BufferMap
+ * the Peer is known to have.
+ *
+ * @param[in] p the Peer that sent the sig_ack_buffermap message.
+ * @param[in] seq the trans_id of the message.
+ */
+void bufferMapAcked(struct peer *p, uint16_t seq);
+
+/**
+ * @brief Handle a request of our BufferMap from a Peer.
+ *
+ * The Peer lost its copy of our BufferMap (see applyBufferMap()), so
+ * sendBufferMapDiff() sends it whole until the Peer acknowledges it.
+ *
+ * @param[in] p the Peer that sent the sig_request_buffermap message.
+ */
+void bufferMapRequested(struct peer *p);
+
+/**
+ * @brief Release the state of the BufferMaps sent to a Peer.
+ *
+ * Free the bmap_sent field of the peer (see sendBufferMapDiff()), when
+ * the peer is destroyed or to restart sending whole BufferMaps.
+ *
+ * @param[in] p the Peer.
+ */
+void freeBufferMapDiff(struct peer *p);
+
 #endif //TRADE_SIG_HA_H 
@@ -38,5 +38,25 @@ int encodeChunkSignaling(const struct chunkID_set *h, const void *meta, int meta
   */
 struct chunkID_set *decodeChunkSignaling(void **meta, int *meta_len, const uint8_t *buff, int buff_len);
 
+ /**
+  * @brief Decode the bit stream in an existing chunk ID set.
+  *
+  * As decodeChunkSignaling(), but the chunk IDs are stored in a set
+  * provided by the caller, which can be reused for all the received
+  * messages, and the metadata are not copied: once the set has grown to
+  * the size of the received sets, decoding does not allocate memory.
+  * The set takes the type of the received one ("priority" or "bitmap"; a
+  * "window" set stays a "window" set when receiving a "bitmap" set).
+  *
+  * @param[in] h the set to be filled (emptied if the message contains no set).
+  * @param[out] meta pointer to the metadata, in buff (NULL if there are none).
+  * @param[out] meta_len length of the metadata.
+  * @param[in] buff Buffer which contain the bit stream to decode.
+  * @param[in] buff_len length of the buffer that contain the bit stream.
+  * @return 1 if the message contains a set, 0 if it contains only metadata, <0 on error.
+  */
+int decodeChunkSignalingInto(struct chunkID_set *h, const void **meta, int *meta_len,
+                             const uint8_t *buff, int buff_len);
+
 
 #endif /* TRADE_SIG_LA_H */
@@ -12,6 +12,7 @@
 
 #include "net_helper.h"
 #include "blist_cache.h"
+#include "cache_rank.h"
 #include "int_coding.h"
 
 #define NOREPLY_FLAG_UNSET 254
@@ -324,14 +325,26 @@ struct peer_cache *blist_entries_undump(const uint8_t *buff, int size)
   metadata_size = int_rcpy(buff + 4);
   p = buff + 8;
   res = blist_cache_init(cache_size, metadata_size, 0);
+  if (res == NULL) {
+    return NULL;
+  }
   meta = res->metadata;
-  while (p - buff < size) {
+  while (p - buff < size && i < res->cache_size) {
     int len;
 
     res->entries[i].timestamp = int_rcpy(p);
     p += sizeof(uint32_t);
     res->entries[i].flags = p[0];
-    res->entries[i++].id = nodeid_undump(++p, &len);
+    res->entries[i].id = nodeid_undump(++p, &len);
+    if (res->entries[i].id == NULL || len <= 0) {
+      /* Malformed nodeID: keep the entries decoded so far */
+      nodeid_free(res->entries[i].id);
+      res->entries[i].id = NULL;
+      res->current_size = i;
+
+      return res;
+    }
+    i++;
     p += len;
     if (metadata_size) {
       memcpy(meta, p, metadata_size);
@@ -345,6 +358,61 @@ if (p - buff != size) { fprintf(stderr, "Waz!! %d != %d\n", (int)(p - buff), siz
   return res;
 }
 
+struct peer_cache *blist_entries_undump_into(struct peer_cache *c, const uint8_t *buff, int size)
+{
+  const uint8_t *p;
+  int i, n, cache_size, metadata_size;
+
+  cache_size = int_rcpy(buff);
+  metadata_size = int_rcpy(buff + 4);
+  if (c == NULL) {
+    c = blist_cache_init(cache_size, metadata_size, 0);
+    if (c == NULL) {
+      return NULL;
+    }
+  }
+  if (metadata_size != c->metadata_size) {
+    free(c->metadata);
+    c->metadata = metadata_size ? malloc(metadata_size * c->cache_size) : NULL;
+    c->metadata_size = c->metadata ? metadata_size : 0;
+  }
+  if (cache_size > c->cache_size) {
+    blist_cache_resize(c, cache_size);
+  }
+
+  /* The nodeIDs of the old entries are overwritten with the received ones */
+  n = c->current_size;
+  p = buff + 8;
+  i = 0;
+  while (p - buff < size && i < c->cache_size) {
+    int len;
+
+    if (c->entries[i].id) {
+      len = nodeid_undump_into(c->entries[i].id, p + sizeof(uint32_t) + 1);
+    } else {
+      c->entries[i].id = nodeid_undump(p + sizeof(uint32_t) + 1, &len);
+    }
+    if (c->entries[i].id == NULL || len <= 0) {
+      break;
+    }
+    c->entries[i].timestamp = int_rcpy(p);
+    c->entries[i].flags = p[sizeof(uint32_t)];
+    p += sizeof(uint32_t) + 1 + len;
+    if (c->metadata_size) {
+      memcpy(c->metadata + i * c->metadata_size, p, c->metadata_size);
+    }
+    p += metadata_size;
+    i++;
+  }
+  c->current_size = i;
+  for (; i < n || (i < c->cache_size && c->entries[i].id); i++) {
+    nodeid_free(c->entries[i].id);
+    c->entries[i].id = NULL;
+  }
+
+  return c;
+}
+
 int blist_cache_header_dump(uint8_t *b, const struct peer_cache *c)
 {
   int_cpy(b, c->cache_size);
@@ -380,38 +448,46 @@ int blist_entry_dump(uint8_t *b, struct peer_cache *c, int i, size_t max_write_s
   return size;
 }
 
-struct peer_cache *blist_cache_rank (const struct peer_cache *c, ranking_function rank, const struct nodeID *target, const void *target_meta)
+/* The positions of the entries to be ranked (all but target) */
+static int *rank_candidates(const struct peer_cache *c, const struct nodeID *target, int *n)
+{
+	int *order;
+	int i;
+
+	order = malloc(sizeof(int) * (c->current_size + 1));
+	if (order == NULL) {
+		return NULL;
+	}
+	*n = 0;
+	for (i = 0; i < c->current_size; i++) {
+		if (!target || !nodeid_equal(c->entries[i].id,target)) {
+			order[(*n)++] = i;
+		}
+	}
+
+	return order;
+}
+
+/* A new cache with the entries of c in the given order, and its black list */
+static struct peer_cache *ranked_copy(const struct peer_cache *c, const int *order, int n)
 {
 	struct peer_cache *res;
-	int i,j,pos;
+	int i;
 
 	res = blist_cache_init(c->cache_size, c->metadata_size, c->max_timestamp);
 	if (res == NULL) {
 		return res;
 	}
 
-	for (i = 0; i < c->current_size; i++) {
-		if (!target || !nodeid_equal(c->entries[i].id,target)) {
-			pos = 0;
-			for (j=0; j<res->current_size;j++) {
-				if (((rank != NULL) && rank(target_meta, c->metadata+(c->metadata_size * i), res->metadata+(res->metadata_size * j)) == 2) ||
-					((rank == NULL) && res->entries[j].timestamp < c->entries[i].timestamp)) {
-					pos++;
-				}
-			}
-			if (c->metadata_size) {
-				memmove(res->metadata + (pos + 1) * res->metadata_size, res->metadata + pos * res->metadata_size, (res->current_size - pos) * res->metadata_size);
-				memcpy(res->metadata + pos * res->metadata_size, c->metadata+(c->metadata_size * i), res->metadata_size);
-			}
-			for (j = res->current_size; j > pos; j--) {
-				res->entries[j] = res->entries[j - 1];
-			}
-			res->entries[pos].id = nodeid_dup(c->entries[i].id);
-			res->entries[pos].timestamp = c->entries[i].timestamp;
-			res->entries[pos].flags = c->entries[i].flags;
-			res->current_size++;
+	for (i = 0; i < n; i++) {
+		if (c->metadata_size) {
+			memcpy(res->metadata + i * res->metadata_size, c->metadata+(c->metadata_size * order[i]), res->metadata_size);
 		}
+		res->entries[i].id = nodeid_dup(c->entries[order[i]].id);
+		res->entries[i].timestamp = c->entries[order[i]].timestamp;
+		res->entries[i].flags = c->entries[order[i]].flags;
 	}
+	res->current_size = n;
 
 	for (i = 0; i < c->blist_size; i++) {
 		res->blist[i] = nodeid_dup(c->blist[i]);
@@ -421,6 +497,59 @@ struct peer_cache *blist_cache_rank (const struct peer_cache *c, ranking_functio
 	return res;
 }
 
+struct peer_cache *blist_cache_rank (const struct peer_cache *c, ranking_function rank, const struct nodeID *target, const void *target_meta)
+{
+	struct peer_cache *res = NULL;
+	double *keys = NULL;
+	int *order;
+	int i, n, err;
+
+	order = rank_candidates(c, target, &n);
+	if (order == NULL) {
+		return NULL;
+	}
+	if (rank) {
+		err = rank_by_function(order, n, rank, target_meta, c->metadata, c->metadata_size);
+	} else {
+		/* Oldest entries last */
+		keys = malloc(sizeof(double) * (c->current_size + 1));
+		for (i = 0; keys && i < c->current_size; i++) {
+			keys[i] = c->entries[i].timestamp;
+		}
+		err = keys ? rank_by_key(order, n, keys) : -1;
+	}
+	if (err == 0) {
+		res = ranked_copy(c, order, n);
+	}
+	free(keys);
+	free(order);
+
+	return res;
+}
+
+struct peer_cache *blist_cache_rank_key(const struct peer_cache *c, ranking_key key, const struct nodeID *target, const void *target_meta)
+{
+	struct peer_cache *res = NULL;
+	double *keys;
+	int *order;
+	int i, n;
+
+	order = rank_candidates(c, target, &n);
+	keys = malloc(sizeof(double) * (c->current_size + 1));
+	if (order && keys) {
+		for (i = 0; i < c->current_size; i++) {
+			keys[i] = key(target_meta, c->metadata + c->metadata_size * i);
+		}
+		if (rank_by_key(order, n, keys) == 0) {
+			res = ranked_copy(c, order, n);
+		}
+	}
+	free(keys);
+	free(order);
+
+	return res;
+}
+
 // It MUST always be called with c1 = current local_cache to ensure black_list continuity
 struct peer_cache *blist_cache_union(struct peer_cache *c1, struct peer_cache *c2, int *size) {
 	int n,pos;
@@ -479,6 +608,81 @@ struct peer_cache *blist_cache_union(struct peer_cache *c1, struct peer_cache *c
 	return new_cache;
 }
 
+// Same as blist_cache_union(c, c2), but adding the new entries of c2 to c (and taking their nodeIDs)
+int blist_cache_merge_union(struct peer_cache *c, struct peer_cache *c2)
+{
+	int n,pos,i;
+
+	if (c->metadata_size != c2->metadata_size) {
+		return -1;
+	}
+	blist_cache_resize(c, c->current_size + c2->current_size);
+
+	for (n = 0, i = 0; n < c->blist_size; n++) {
+		if (!nodeid_equal(c->blist[n], c2->entries[0].id)) { // sender should never be blacklisted
+			c->blist[i++] = c->blist[n];
+		} else {
+			nodeid_free(c->blist[n]);
+		}
+	}
+	c->blist_size = i;
+
+	for (n = 0; n < c2->current_size; n++) {
+		pos = in_cache(c, &c2->entries[n]);
+		if (pos >= 0) {
+			if (!n) c->entries[pos].flags &= NOREPLY_FLAG_UNSET; // reset flags of sender
+			if (c->entries[pos].timestamp > c2->entries[n].timestamp) {
+				blist_cache_metadata_update(c, c2->entries[n].id, c2->metadata + n * c2->metadata_size, c2->metadata_size);
+				c->entries[pos].timestamp = c2->entries[n].timestamp;
+				c->entries[pos].flags = c2->entries[n].flags;
+			}
+		}
+		if (pos < 0 && find_in_bl(c, c2->entries[n].id) == c->blist_size) {
+			if (c->metadata_size) {
+				memcpy(c->metadata + c->current_size * c->metadata_size, c2->metadata + n * c2->metadata_size, c2->metadata_size);
+			}
+			c->entries[c->current_size++] = c2->entries[n];
+			c2->entries[n].id = NULL;
+		}
+	}
+
+	return c->current_size;
+}
+
+// Same as blist_cache_rank(c, rank, NULL, target_meta), reordering the entries of c
+int blist_cache_sort(struct peer_cache *c, ranking_function rank, const void *target_meta)
+{
+	struct cache_entry *entries;
+	uint8_t *metadata = NULL;
+	int *order;
+	int i, n, res = -1;
+
+	order = rank_candidates(c, NULL, &n);
+	entries = malloc(sizeof(struct cache_entry) * (c->current_size + 1));
+	if (c->metadata_size) {
+		metadata = malloc(c->metadata_size * (c->current_size + 1));
+	}
+	if (order && entries && (metadata || !c->metadata_size) &&
+	    rank_by_function(order, n, rank, target_meta, c->metadata, c->metadata_size) == 0) {
+		for (i = 0; i < n; i++) {
+			entries[i] = c->entries[order[i]];
+			if (c->metadata_size) {
+				memcpy(metadata + i * c->metadata_size, c->metadata + order[i] * c->metadata_size, c->metadata_size);
+			}
+		}
+		memcpy(c->entries, entries, sizeof(struct cache_entry) * n);
+		if (c->metadata_size) {
+			memcpy(c->metadata, metadata, c->metadata_size * n);
+		}
+		res = n;
+	}
+	free(order);
+	free(entries);
+	free(metadata);
+
+	return res;
+}
+
 int blist_cache_resize (struct peer_cache *c, int size) {
 
 	int i,dif = size - c->cache_size;
@@ -486,6 +690,9 @@ int blist_cache_resize (struct peer_cache *c, int size) {
 		return c->current_size;
 	}
 
+	for (i = size; i < c->current_size; i++) {
+		nodeid_free(c->entries[i].id);
+	}
 	c->entries = realloc(c->entries, sizeof(struct cache_entry) * size);
 	if (dif > 0) {
 		memset(c->entries + c->cache_size, 0, sizeof(struct cache_entry) * dif);
@@ -16,16 +16,18 @@
 
 #define MAX_MSG_SIZE 1500
 
-static struct peer_cache *myEntry;
+struct blist_proto_context {
+  struct peer_cache *myEntry;
+};
 
-static int blist_payload_fill(uint8_t *payload, int size, struct peer_cache *c, struct nodeID *snot, int max_peers)
+static int blist_payload_fill(struct blist_proto_context *context, uint8_t *payload, int size, struct peer_cache *c, struct nodeID *snot, int max_peers)
 {
   int i;
   uint8_t *p = payload;
 
   if (!max_peers) max_peers = MAX_MSG_SIZE; // just to be sure to dump the whole cache...
   p += blist_cache_header_dump(p, c);
-  p += blist_entry_dump(p, myEntry, 0, size - (p - payload));
+  p += blist_entry_dump(p, context->myEntry, 0, size - (p - payload));
   for (i = 0; blist_nodeid(c, i) && max_peers; i++) {
     if (!nodeid_equal(blist_nodeid(c, i), snot)) {
       int res;
@@ -42,7 +44,7 @@ static int blist_payload_fill(uint8_t *payload, int size, struct peer_cache *c,
   return p - payload;
 }
 
-static int blist_topo_reply(const struct peer_cache *c, struct peer_cache *local_cache, int protocol, int type, int max_peers)
+static int blist_topo_reply(struct blist_proto_context *context, const struct peer_cache *c, struct peer_cache *local_cache, int protocol, int type, int max_peers)
 {
   uint8_t pkt[MAX_MSG_SIZE];
   struct topo_header *h = (struct topo_header *)pkt;
@@ -59,14 +61,14 @@ static int blist_topo_reply(const struct peer_cache *c, struct peer_cache *local
   dst = blist_nodeid(c, 0);
   h->protocol = protocol;
   h->type = type;
-  len = blist_payload_fill(pkt + sizeof(struct topo_header), MAX_MSG_SIZE - sizeof(struct topo_header), local_cache, dst, max_peers);
+  len = blist_payload_fill(context, pkt + sizeof(struct topo_header), MAX_MSG_SIZE - sizeof(struct topo_header), local_cache, dst, max_peers);
 
-  res = len > 0 ? send_to_peer(blist_nodeid(myEntry, 0), dst, pkt, sizeof(struct topo_header) + len) : len;
+  res = len > 0 ? send_to_peer(blist_nodeid(context->myEntry, 0), dst, pkt, sizeof(struct topo_header) + len) : len;
 
   return res;
 }
 
-static int blist_topo_query_peer(struct peer_cache *local_cache, struct nodeID *dst, int protocol, int type, int max_peers)
+static int blist_topo_query_peer(struct blist_proto_context *context, struct peer_cache *local_cache, struct nodeID *dst, int protocol, int type, int max_peers)
 {
   uint8_t pkt[MAX_MSG_SIZE];
   struct topo_header *h = (struct topo_header *)pkt;
@@ -74,31 +76,31 @@ static int blist_topo_query_peer(struct peer_cache *local_cache, struct nodeID *
 
   h->protocol = protocol;
   h->type = type;
-  len = blist_payload_fill(pkt + sizeof(struct topo_header), MAX_MSG_SIZE - sizeof(struct topo_header), local_cache, dst, max_peers);
-  return len > 0  ? send_to_peer(blist_nodeid(myEntry, 0), dst, pkt, sizeof(struct topo_header) + len) : len;
+  len = blist_payload_fill(context, pkt + sizeof(struct topo_header), MAX_MSG_SIZE - sizeof(struct topo_header), local_cache, dst, max_peers);
+  return len > 0  ? send_to_peer(blist_nodeid(context->myEntry, 0), dst, pkt, sizeof(struct topo_header) + len) : len;
 }
 
-int blist_ncast_reply(const struct peer_cache *c, struct peer_cache *local_cache)
+int blist_ncast_reply(struct blist_proto_context *context, const struct peer_cache *c, struct peer_cache *local_cache)
 {
-  return blist_topo_reply(c, local_cache, MSG_TYPE_TOPOLOGY, NCAST_REPLY, 0);
+  return blist_topo_reply(context, c, local_cache, MSG_TYPE_TOPOLOGY, NCAST_REPLY, 0);
 }
 
-int blist_tman_reply(const struct peer_cache *c, struct peer_cache *local_cache, int max_peers)
+int blist_tman_reply(struct blist_proto_context *context, const struct peer_cache *c, struct peer_cache *local_cache, int max_peers)
 {
-  return blist_topo_reply(c, local_cache, MSG_TYPE_TMAN, TMAN_REPLY, max_peers);
+  return blist_topo_reply(context, c, local_cache, MSG_TYPE_TMAN, TMAN_REPLY, max_peers);
 }
 
-int blist_ncast_query_peer(struct peer_cache *local_cache, struct nodeID *dst)
+int blist_ncast_query_peer(struct blist_proto_context *context, struct peer_cache *local_cache, struct nodeID *dst)
 {
-  return blist_topo_query_peer(local_cache, dst, MSG_TYPE_TOPOLOGY, NCAST_QUERY, 0);
+  return blist_topo_query_peer(context, local_cache, dst, MSG_TYPE_TOPOLOGY, NCAST_QUERY, 0);
 }
 
-int blist_tman_query_peer(struct peer_cache *local_cache, struct nodeID *dst, int max_peers)
+int blist_tman_query_peer(struct blist_proto_context *context, struct peer_cache *local_cache, struct nodeID *dst, int max_peers)
 {
-  return blist_topo_query_peer(local_cache, dst, MSG_TYPE_TMAN, TMAN_QUERY, max_peers);
+  return blist_topo_query_peer(context, local_cache, dst, MSG_TYPE_TMAN, TMAN_QUERY, max_peers);
 }
 
-int blist_ncast_query(struct peer_cache *local_cache)
+int blist_ncast_query(struct blist_proto_context *context, struct peer_cache *local_cache)
 {
   struct nodeID *dst;
 
@@ -106,23 +108,38 @@ int blist_ncast_query(struct peer_cache *local_cache)
   if (dst == NULL) {
     return 0;
   }
-  return blist_topo_query_peer(local_cache, dst, MSG_TYPE_TOPOLOGY, NCAST_QUERY, 0);
+  return blist_topo_query_peer(context, local_cache, dst, MSG_TYPE_TOPOLOGY, NCAST_QUERY, 0);
 }
 
-int blist_proto_metadata_update(void *meta, int meta_size)
+int blist_proto_metadata_update(struct blist_proto_context *context, void *meta, int meta_size)
 {
-  if (blist_cache_metadata_update(myEntry, blist_nodeid(myEntry, 0), meta, meta_size) > 0) {
+  if (blist_cache_metadata_update(context->myEntry, blist_nodeid(context->myEntry, 0), meta, meta_size) > 0) {
     return 1;
   }
 
   return -1;
 }
 
-int blist_proto_init(struct nodeID *s, void *meta, int meta_size)
+struct blist_proto_context *blist_proto_init(struct nodeID *s, void *meta, int meta_size)
 {
-  if (!myEntry) {
-	myEntry = blist_cache_init(1, meta_size, 0);
-	blist_cache_add(myEntry, s, meta, meta_size);
+  struct blist_proto_context *con;
+
+  con = malloc(sizeof(struct blist_proto_context));
+  if (!con) return NULL;
+
+  con->myEntry = blist_cache_init(1, meta_size, 0);
+  if (!con->myEntry) {
+    free(con);
+
+    return NULL;
   }
-  return 0;
+  blist_cache_add(con->myEntry, s, meta, meta_size);
+
+  return con;
+}
+
+void blist_proto_destroy(struct blist_proto_context *context)
+{
+  blist_cache_free(context->myEntry);
+  free(context);
 }
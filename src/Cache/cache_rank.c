@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "grapes_alloc.h"
+#include "cache_rank.h"
+
+struct ranking {
+  int (*rank)(const void *target, const void *p1, const void *p2);
+  const void *target;
+  const uint8_t *metadata;
+  int metadata_size;
+  const double *keys;
+};
+
+/* Non zero if the entry in position a is ranked before the one in position b */
+static int before(const struct ranking *r, int a, int b)
+{
+  if (r->keys) {
+    if (r->keys[a] != r->keys[b]) {
+      return r->keys[a] < r->keys[b];
+    }
+  } else {
+    switch (r->rank(r->target, r->metadata + a * r->metadata_size, r->metadata + b * r->metadata_size)) {
+      case 1:
+        return 1;
+      case 2:
+        return 0;
+    }
+  }
+
+  /*
+   * On a tie, the entry coming last goes first: this is what inserting
+   * the entries one by one before the ones ranking the same did.
+   */
+  return a > b;
+}
+
+/* Bottom-up merge sort, with O(n log n) calls to the ranking function */
+static int rank_sort(int *order, int n, const struct ranking *r)
+{
+  int *tmp, *src, *dst;
+  int width, i;
+
+  if (n < 2) {
+    return 0;
+  }
+  tmp = grapes_malloc(sizeof(int) * n);
+  if (tmp == NULL) {
+    return -1;
+  }
+  src = order;
+  dst = tmp;
+  for (width = 1; width < n; width *= 2) {
+    int *t;
+
+    for (i = 0; i < n; i += 2 * width) {
+      int l = i, k = i;
+      int m = i + width < n ? i + width : n;
+      int h = i + 2 * width < n ? i + 2 * width : n;
+      int j = m;
+
+      while (l < m && j < h) {
+        dst[k++] = before(r, src[j], src[l]) ? src[j++] : src[l++];
+      }
+      while (l < m) {
+        dst[k++] = src[l++];
+      }
+      while (j < h) {
+        dst[k++] = src[j++];
+      }
+    }
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != order) {
+    memcpy(order, src, sizeof(int) * n);
+  }
+  grapes_free(tmp);
+
+  return 0;
+}
+
+int rank_by_function(int *order, int n, int (*rank)(const void *target, const void *p1, const void *p2),
+                     const void *target, const uint8_t *metadata, int metadata_size)
+{
+  struct ranking r = {
+    .rank = rank,
+    .target = target,
+    .metadata = metadata,
+    .metadata_size = metadata_size,
+  };
+
+  return rank_sort(order, n, &r);
+}
+
+int rank_by_key(int *order, int n, const double *keys)
+{
+  struct ranking r = {.keys = keys};
+
+  return rank_sort(order, n, &r);
+}
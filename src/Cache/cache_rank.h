@@ -0,0 +1,25 @@
+#ifndef CACHE_RANK
+#define CACHE_RANK
+
+/*
+ * Ranking engine shared by the peer caches: it sorts the positions of
+ * the entries instead of inserting them one by one, so that the caller
+ * can build the ranked cache with a single pass over the entries.
+ */
+
+/*
+ * Sort the n positions in order[] using a ranking function (returning 1
+ * if the first metadata is ranked first, 2 if the second one is, 0 on a
+ * tie) on the metadata of the entries.
+ * Returns 0 on success, < 0 on error.
+ */
+int rank_by_function(int *order, int n, int (*rank)(const void *target, const void *p1, const void *p2),
+                     const void *target, const uint8_t *metadata, int metadata_size);
+
+/*
+ * Sort the n positions in order[] by increasing keys[position].
+ * Returns 0 on success, < 0 on error.
+ */
+int rank_by_key(int *order, int n, const double *keys);
+
+#endif	/* CACHE_RANK */
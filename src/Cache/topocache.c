@@ -13,7 +13,9 @@
 #include <assert.h>
 
 #include "net_helper.h"
+#include "grapes_alloc.h"
 #include "topocache.h"
+#include "cache_rank.h"
 #include "int_coding.h"
 
 struct cache_entry {
@@ -21,6 +23,8 @@ struct cache_entry {
   uint32_t timestamp;
 };
 
+#define MIN_INDEX_SIZE 8
+
 struct peer_cache {
   struct cache_entry *entries;
   int cache_size;
@@ -28,51 +32,186 @@ struct peer_cache {
   int metadata_size;
   uint8_t *metadata;
   int max_timestamp;
+  int *index;		/* hash index: position in entries + 1, 0 if empty */
+  int index_size;
 };
 
-static int cache_insert(struct peer_cache *c, struct cache_entry *e, const void *meta)
+/*
+ * The entries are ordered by timestamp (or rank), so they are moved
+ * around when inserting or removing one. An open addressing (linear
+ * probing) hash table on the nodeID maps each node to its position;
+ * it is kept at most half full, and every function moving the entries
+ * updates it.
+ */
+static int home_slot(const struct peer_cache *c, const struct nodeID *id)
 {
-  int i, position;
+  return nodeid_hash(id) & (c->index_size - 1);
+}
 
-  if (c->current_size == c->cache_size) {
-    return -2;
+static int index_find(const struct peer_cache *c, const struct nodeID *id)
+{
+  int s;
+
+  for (s = home_slot(c, id); c->index[s]; s = (s + 1) & (c->index_size - 1)) {
+    if (nodeid_equal(c->entries[c->index[s] - 1].id, id)) {
+      return c->index[s] - 1;
+    }
   }
-  position = 0;
-  for (i = 0; i < c->current_size; i++) {
-    assert(e->id);
-    assert(c->entries[i].id);
 
-    if (nodeid_equal(e->id, c->entries[i].id)) {
-      if (c->entries[i].timestamp > e->timestamp) {
-        assert(i >= position);
-        nodeid_free(c->entries[i].id);
+  return -1;
+}
 
-        if (position != i) {
-          memmove(c->entries + position + 1, c->entries + position, sizeof(struct cache_entry) * (i - position));
-          memmove(c->metadata + (position + 1) * c->metadata_size, c->metadata + position * c->metadata_size, (i -position) * c->metadata_size);
-        }
+/* The slot of the entry at position i, which was at position old before being moved */
+static int index_slot(const struct peer_cache *c, int i, int old)
+{
+  int s;
 
-        c->entries[position] = *e;
-        memcpy(c->metadata + position * c->metadata_size, meta, c->metadata_size);
+  for (s = home_slot(c, c->entries[i].id); c->index[s] != old + 1; s = (s + 1) & (c->index_size - 1));
 
-        return position;
-      }
+  return s;
+}
+
+static void index_add(const struct peer_cache *c, int i)
+{
+  int s;
+
+  for (s = home_slot(c, c->entries[i].id); c->index[s]; s = (s + 1) & (c->index_size - 1));
+  c->index[s] = i + 1;
+}
+
+static void index_remove(const struct peer_cache *c, int i)
+{
+  int mask = c->index_size - 1;
+  int hole, s;
+
+  /* Backward shift deletion: no tombstones are needed */
+  hole = index_slot(c, i, i);
+  c->index[hole] = 0;
+  for (s = (hole + 1) & mask; c->index[s]; s = (s + 1) & mask) {
+    int home = home_slot(c, c->entries[c->index[s] - 1].id);
+
+    if (((s - home) & mask) >= ((s - hole) & mask)) {
+      c->index[hole] = c->index[s];
+      c->index[s] = 0;
+      hole = s;
+    }
+  }
+}
+
+/*
+ * Make the index large enough for n entries, and fill it with the current
+ * ones. If a smaller index cannot be allocated, the old one is kept, so
+ * this can fail only when the index grows.
+ */
+static int index_resize(struct peer_cache *c, int n)
+{
+  int size, i;
+
+  for (size = MIN_INDEX_SIZE; size < n * 2; size *= 2);
+  if (size != c->index_size) {
+    int *index = grapes_malloc(sizeof(int) * size);
 
+    if (index) {
+      grapes_free(c->index);
+      c->index = index;
+      c->index_size = size;
+    } else if (size > c->index_size) {
       return -1;
     }
+  }
+  memset(c->index, 0, sizeof(int) * c->index_size);
+  for (i = 0; i < c->current_size; i++) {
+    index_add(c, i);
+  }
+
+  return 0;
+}
+
+static int index_rebuild(struct peer_cache *c)
+{
+  return index_resize(c, c->cache_size);
+}
+
+/*
+ * Move the entries in [first, last) (and their metadata) one position up
+ * (delta = 1) or down (delta = -1). The position they move to must not
+ * be in the index.
+ */
+static void entries_move(struct peer_cache *c, int first, int last, int delta)
+{
+  int i;
+
+  if (first >= last) {
+    return;
+  }
+  memmove(c->entries + first + delta, c->entries + first, sizeof(struct cache_entry) * (last - first));
+  if (c->metadata_size) {
+    memmove(c->metadata + (first + delta) * c->metadata_size, c->metadata + first * c->metadata_size, (last - first) * c->metadata_size);
+  }
+  /* Renumber starting from the free position, so that positions are never duplicated */
+  if (delta > 0) {
+    for (i = last; i > first; i--) {
+      c->index[index_slot(c, i, i - 1)] = i + 1;
+    }
+  } else {
+    for (i = first - 1; i < last - 1; i++) {
+      c->index[index_slot(c, i, i + 1)] = i + 1;
+    }
+  }
+}
 
+/* Remove the i-th entry, without freeing its nodeID */
+static void entry_remove(struct peer_cache *c, int i)
+{
+  index_remove(c, i);
+  entries_move(c, i + 1, c->current_size, -1);
+  c->current_size--;
+  c->entries[c->current_size].id = NULL;
+}
+
+/* Append an entry, with its metadata */
+static void entry_append(struct peer_cache *c, const struct cache_entry *e, const uint8_t *meta)
+{
+  if (c->metadata_size) {
+    memcpy(c->metadata + c->current_size * c->metadata_size, meta, c->metadata_size);
+  }
+  c->entries[c->current_size] = *e;
+  index_add(c, c->current_size++);
+}
+
+static int cache_insert(struct peer_cache *c, struct cache_entry *e, const void *meta)
+{
+  int i, last, position;
+
+  if (c->current_size == c->cache_size) {
+    return -2;
+  }
+  assert(e->id);
+  i = index_find(c, e->id);
+  if (i >= 0 && c->entries[i].timestamp <= e->timestamp) {
+    return -1;
+  }
+  last = i >= 0 ? i : c->current_size;
+  position = 0;
+  for (i = 0; i < last; i++) {
     if (c->entries[i].timestamp <= e->timestamp) {
       position = i + 1;
     }
   }
 
-  if (position != c->current_size) {
-    memmove(c->entries + position + 1, c->entries + position, sizeof(struct cache_entry) * (c->current_size - position));
-    memmove(c->metadata + (position + 1) * c->metadata_size, c->metadata + position * c->metadata_size, (c->current_size - position) * c->metadata_size);
+  if (last < c->current_size) {
+    /* Replace the older entry for the same node */
+    index_remove(c, last);
+    nodeid_free(c->entries[last].id);
+  } else {
+    c->current_size++;
   }
-  c->current_size++;
+  entries_move(c, position, last, 1);
   c->entries[position] = *e;
-  memcpy(c->metadata + position * c->metadata_size, meta, c->metadata_size);
+  if (c->metadata_size) {
+    memcpy(c->metadata + position * c->metadata_size, meta, c->metadata_size);
+  }
+  index_add(c, position);
 
   return position;
 }
@@ -80,7 +219,7 @@ static int cache_insert(struct peer_cache *c, struct cache_entry *e, const void
 int cache_add_cache(struct peer_cache *dst, const struct peer_cache *src)
 {
   struct cache_entry *e_orig;
-  int count, j;
+  int count, j, pos;
   struct cache_entry e_dup;
 cache_check(dst);
 cache_check(src);
@@ -91,6 +230,12 @@ cache_check(src);
     count++;
 
     e_orig = src->entries + j;
+    pos = index_find(dst, e_orig->id);
+    if (pos >= 0 && dst->entries[pos].timestamp <= e_orig->timestamp) {
+      /* Already known, with fresher information */
+      j++;
+      continue;
+    }
 
     e_dup.id = nodeid_dup(e_orig->id);
     e_dup.timestamp = e_orig->timestamp;
@@ -128,14 +273,13 @@ int cache_metadata_update(struct peer_cache *c, const struct nodeID *p, const vo
   if (!meta_size || meta_size != c->metadata_size) {
     return -3;
   }
-  for (i = 0; i < c->current_size; i++) {
-    if (nodeid_equal(c->entries[i].id, p)) {
-      memcpy(c->metadata + i * meta_size, meta, meta_size);
-      return 1;
-    }
+  i = index_find(c, p);
+  if (i < 0) {
+    return 0;
   }
+  memcpy(c->metadata + i * meta_size, meta, meta_size);
 
-  return 0;
+  return 1;
 }
 
 int cache_add_ranked(struct peer_cache *c, struct nodeID *neighbour, const void *meta, int meta_size, ranking_function f, const void *tmeta)
@@ -145,37 +289,37 @@ int cache_add_ranked(struct peer_cache *c, struct nodeID *neighbour, const void
   if (meta_size && meta_size != c->metadata_size) {
     return -3;
   }
-  for (i = 0; i < c->current_size; i++) {
-    if (nodeid_equal(c->entries[i].id, neighbour)) {
-      if (f != NULL) {
-        cache_del(c,neighbour);
-        if (i == c->current_size) break;
-      } else {
-          cache_metadata_update(c,neighbour,meta,meta_size);
-          return -1;
-      }
+  if (index_find(c, neighbour) >= 0) {
+    if (f == NULL) {
+      cache_metadata_update(c, neighbour, meta, meta_size);
+
+      return -1;
     }
-    if ((f != NULL) && f(tmeta, meta, c->metadata+(c->metadata_size * i)) == 2) {
-      pos++;
+    /* Re-insert it in its new rank position */
+    cache_del(c, neighbour);
+  }
+  if (f != NULL) {
+    for (i = 0; i < c->current_size; i++) {
+      if (f(tmeta, meta, c->metadata+(c->metadata_size * i)) == 2) {
+        pos++;
+      }
     }
   }
   if (c->current_size == c->cache_size) {
     return -2;
   }
+  entries_move(c, pos, c->current_size, 1);
   if (c->metadata_size) {
-    memmove(c->metadata + (pos + 1) * c->metadata_size, c->metadata + pos * c->metadata_size, (c->current_size - pos) * c->metadata_size);
     if (meta_size) {
       memcpy(c->metadata + pos * c->metadata_size, meta, meta_size);
     } else {
       memset(c->metadata + pos * c->metadata_size, 0, c->metadata_size);
     }
   }
-  for (i = c->current_size; i > pos; i--) {
-    c->entries[i] = c->entries[i - 1];
-  }
   c->entries[pos].id = nodeid_dup(neighbour);
   c->entries[pos].timestamp = 1;
   c->current_size++;
+  index_add(c, pos);
 
   return c->current_size;
 }
@@ -188,22 +332,13 @@ int cache_add(struct peer_cache *c, struct nodeID *neighbour, const void *meta,
 int cache_del(struct peer_cache *c, const struct nodeID *neighbour)
 {
   int i;
-  int found = 0;
 
-  for (i = 0; i < c->current_size; i++) {
-    if (nodeid_equal(c->entries[i].id, neighbour)) {
-      nodeid_free(c->entries[i].id);
-      c->current_size--;
-      found = 1;
-      if (c->metadata_size && (i < c->current_size)) {
-        memmove(c->metadata + c->metadata_size * i,
-                c->metadata + c->metadata_size * (i + 1),
-                c->metadata_size * (c->current_size - i));
-      }
-    }
-    if (found && (i < c->current_size)) {
-      c->entries[i] = c->entries[i + 1];
-    }
+  i = index_find(c, neighbour);
+  if (i >= 0) {
+    struct nodeID *id = c->entries[i].id;
+
+    entry_remove(c, i);
+    nodeid_free(id);
   }
 
   return c->current_size;
@@ -218,6 +353,7 @@ void cache_delay(struct peer_cache *c, int dts)
       int j = i;
 
       while(j < c->current_size && c->entries[j].id) {
+        index_remove(c, j);
         nodeid_free(c->entries[j].id);
         c->entries[j++].id = NULL;
       }
@@ -237,27 +373,43 @@ void cache_update(struct peer_cache *c)
 }
 
 
+static struct grapes_slab *cache_slab;
+
 struct peer_cache *cache_init(int n, int metadata_size, int max_timestamp)
 {
   struct peer_cache *res;
 
-  res = malloc(sizeof(struct peer_cache));
+  if (cache_slab == NULL) {
+    cache_slab = grapes_slab_create("peer_cache", sizeof(struct peer_cache));
+    if (cache_slab == NULL) {
+      return NULL;
+    }
+  }
+  res = grapes_slab_alloc(cache_slab);
   if (res == NULL) {
     return NULL;
   }
   res->max_timestamp = max_timestamp;
   res->cache_size = n;
   res->current_size = 0;
-  res->entries = malloc(sizeof(struct cache_entry) * n);
+  res->entries = grapes_malloc(sizeof(struct cache_entry) * n);
   if (res->entries == NULL) {
-    free(res);
+    grapes_free(res);
 
     return NULL;
   }
   
   memset(res->entries, 0, sizeof(struct cache_entry) * n);
+  res->index = NULL;
+  res->index_size = 0;
+  if (index_rebuild(res) < 0) {
+    grapes_free(res->entries);
+    grapes_free(res);
+
+    return NULL;
+  }
   if (metadata_size) {
-    res->metadata = malloc(metadata_size * n);
+    res->metadata = grapes_malloc(metadata_size * n);
   } else {
     res->metadata = NULL;
   }
@@ -284,7 +436,8 @@ struct peer_cache *cache_copy(const struct peer_cache *c1)
 
   for (n = 0; n < c1->current_size; n++) {
     new_cache->entries[new_cache->current_size].id = nodeid_dup(c1->entries[n].id);
-    new_cache->entries[new_cache->current_size++].timestamp = c1->entries[n].timestamp;
+    new_cache->entries[new_cache->current_size].timestamp = c1->entries[n].timestamp;
+    index_add(new_cache, new_cache->current_size++);
   }
   if (new_cache->metadata_size) {
     memcpy(new_cache->metadata, c1->metadata, c1->metadata_size * c1->current_size);
@@ -302,22 +455,15 @@ void cache_free(struct peer_cache *c)
       nodeid_free(c->entries[i].id);
     }
   }
-  free(c->entries);
-  free(c->metadata);
-  free(c);
+  grapes_free(c->entries);
+  grapes_free(c->metadata);
+  grapes_free(c->index);
+  grapes_free(c);
 }
 
 int cache_pos(const struct peer_cache *c, const struct nodeID *n)
 {
-  int i;
-
-  for (i = 0; i < c->current_size; i++) {
-    if (nodeid_equal(c->entries[i].id, n)) {
-      return i;
-    }
-  }
-
-  return -1;
+  return index_find(c, n);
 }
 
 static int in_cache(const struct peer_cache *c, const struct cache_entry *elem)
@@ -463,10 +609,7 @@ cache_check(c);
     if (flag) continue;
 
     cache_insert(res, c->entries + j, c->metadata + c->metadata_size * j);
-    c->current_size--;
-    memmove(c->entries + j, c->entries + j + 1, sizeof(struct cache_entry) * (c->current_size - j));
-    memmove(c->metadata + c->metadata_size * j, c->metadata + c->metadata_size * (j + 1), c->metadata_size * (c->current_size - j));
-    c->entries[c->current_size].id = NULL;
+    entry_remove(c, j);
 cache_check(c);
   }
 
@@ -488,10 +631,7 @@ cache_check(c);
 
     j = ((double)rand() / (double)RAND_MAX) * c->current_size;
     cache_insert(res, c->entries + j, c->metadata + c->metadata_size * j);
-    c->current_size--;
-    memmove(c->entries + j, c->entries + j + 1, sizeof(struct cache_entry) * (c->current_size - j));
-    memmove(c->metadata + c->metadata_size * j, c->metadata + c->metadata_size * (j + 1), c->metadata_size * (c->current_size - j));
-    c->entries[c->current_size].id = NULL;
+    entry_remove(c, j);
 cache_check(c);
   }
 
@@ -510,14 +650,33 @@ struct peer_cache *entries_undump(const uint8_t *buff, int size)
   metadata_size = int_rcpy(buff + 4);
   p = buff + 8;
   res = cache_init(cache_size, metadata_size, 0);
+  if (res == NULL) {
+    return NULL;
+  }
   meta = res->metadata;
-  while (p - buff < size) {
+  while (p - buff < size && i < res->cache_size) {
     int len;
 
     res->entries[i].timestamp = int_rcpy(p);
     p += sizeof(uint32_t);
-    res->entries[i++].id = nodeid_undump(p, &len);
+    res->entries[i].id = nodeid_undump(p, &len);
+    if (res->entries[i].id == NULL || len <= 0) {
+      /* Malformed nodeID: keep the entries decoded so far */
+      nodeid_free(res->entries[i].id);
+      res->entries[i].id = NULL;
+      res->current_size = i;
+
+      return res;
+    }
     p += len;
+    if (index_find(res, res->entries[i].id) >= 0) {
+      /* Duplicated entry: drop it */
+      nodeid_free(res->entries[i].id);
+      res->entries[i].id = NULL;
+      p += metadata_size;
+      continue;
+    }
+    index_add(res, i++);
     if (metadata_size) {
       memcpy(meta, p, metadata_size);
       p += metadata_size;
@@ -530,6 +689,69 @@ struct peer_cache *entries_undump(const uint8_t *buff, int size)
   return res;
 }
 
+struct peer_cache *entries_undump_into(struct peer_cache *c, const uint8_t *buff, int size)
+{
+  const uint8_t *p;
+  int i, n, cache_size, metadata_size;
+
+  cache_size = int_rcpy(buff);
+  metadata_size = int_rcpy(buff + 4);
+  if (c == NULL) {
+    c = cache_init(cache_size, metadata_size, 0);
+    if (c == NULL) {
+      return NULL;
+    }
+  }
+  if (metadata_size != c->metadata_size) {
+    grapes_free(c->metadata);
+    c->metadata = metadata_size ? grapes_malloc(metadata_size * c->cache_size) : NULL;
+    c->metadata_size = c->metadata ? metadata_size : 0;
+  }
+  /*
+   * The nodeIDs of the old entries are overwritten with the received
+   * ones (some of them can have been taken by cache_merge())
+   */
+  n = c->current_size;
+  c->current_size = 0;
+  if (cache_size > c->cache_size) {
+    cache_resize(c, cache_size);
+  }
+  memset(c->index, 0, sizeof(int) * c->index_size);
+  p = buff + 8;
+  i = 0;
+  while (p - buff < size && i < c->cache_size) {
+    int len;
+
+    if (c->entries[i].id) {
+      len = nodeid_undump_into(c->entries[i].id, p + sizeof(uint32_t));
+    } else {
+      c->entries[i].id = nodeid_undump(p + sizeof(uint32_t), &len);
+    }
+    if (c->entries[i].id == NULL || len <= 0) {
+      break;
+    }
+    c->entries[i].timestamp = int_rcpy(p);
+    p += sizeof(uint32_t) + len;
+    if (index_find(c, c->entries[i].id) >= 0) {
+      /* Duplicated entry: drop it, and reuse its nodeID */
+      p += metadata_size;
+      continue;
+    }
+    if (c->metadata_size) {
+      memcpy(c->metadata + i * c->metadata_size, p, c->metadata_size);
+    }
+    p += metadata_size;
+    index_add(c, i++);
+  }
+  c->current_size = i;
+  for (; i < n || (i < c->cache_size && c->entries[i].id); i++) {
+    nodeid_free(c->entries[i].id);
+    c->entries[i].id = NULL;
+  }
+
+  return c;
+}
+
 int cache_header_dump(uint8_t *b, const struct peer_cache *c, int include_me)
 {
   int_cpy(b, c->cache_size + (include_me ? 1 : 0));
@@ -564,37 +786,98 @@ int entry_dump(uint8_t *b, const struct peer_cache *c, int i, size_t max_write_s
   return size;
 }
 
-struct peer_cache *cache_rank (const struct peer_cache *c, ranking_function rank, const struct nodeID *target, const void *target_meta)
+/* The positions of the entries to be ranked (all but target) */
+static int *rank_candidates(const struct peer_cache *c, const struct nodeID *target, int *n)
+{
+  int *order;
+  int i, skip;
+
+  order = grapes_malloc(sizeof(int) * (c->current_size + 1));
+  if (order == NULL) {
+    return NULL;
+  }
+  skip = target ? index_find(c, target) : -1;
+  *n = 0;
+  for (i = 0; i < c->current_size; i++) {
+    if (i != skip) {
+      order[(*n)++] = i;
+    }
+  }
+
+  return order;
+}
+
+/* A new cache with the entries of c in the given order */
+static struct peer_cache *ranked_copy(const struct peer_cache *c, const int *order, int n)
 {
   struct peer_cache *res;
-  int i,j,pos;
+  int i;
 
   res = cache_init(c->cache_size, c->metadata_size, c->max_timestamp);
   if (res == NULL) {
-    return res;
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    res->entries[i].id = nodeid_dup(c->entries[order[i]].id);
+    res->entries[i].timestamp = c->entries[order[i]].timestamp;
+    if (res->metadata_size) {
+      memcpy(res->metadata + i * res->metadata_size, c->metadata + order[i] * c->metadata_size, res->metadata_size);
+    }
+    index_add(res, res->current_size++);
   }
 
-  for (i = 0; i < c->current_size; i++) {
-    if (!target || !nodeid_equal(c->entries[i].id,target)) {
-      pos = 0;
-      for (j=0; j<res->current_size;j++) {
-        if (((rank != NULL) && rank(target_meta, c->metadata+(c->metadata_size * i), res->metadata+(res->metadata_size * j)) == 2) ||
-            ((rank == NULL) && res->entries[j].timestamp < c->entries[i].timestamp)) {
-          pos++;
-        }
-      }
-      if (c->metadata_size) {
-        memmove(res->metadata + (pos + 1) * res->metadata_size, res->metadata + pos * res->metadata_size, (res->current_size - pos) * res->metadata_size);
-        memcpy(res->metadata + pos * res->metadata_size, c->metadata+(c->metadata_size * i), res->metadata_size);
-      }
-      for (j = res->current_size; j > pos; j--) {
-        res->entries[j] = res->entries[j - 1];
-      }
-      res->entries[pos].id = nodeid_dup(c->entries[i].id);
-      res->entries[pos].timestamp = c->entries[i].timestamp;
-      res->current_size++;
+  return res;
+}
+
+struct peer_cache *cache_rank (const struct peer_cache *c, ranking_function rank, const struct nodeID *target, const void *target_meta)
+{
+  struct peer_cache *res = NULL;
+  double *keys = NULL;
+  int *order;
+  int i, n, err;
+
+  order = rank_candidates(c, target, &n);
+  if (order == NULL) {
+    return NULL;
+  }
+  if (rank) {
+    err = rank_by_function(order, n, rank, target_meta, c->metadata, c->metadata_size);
+  } else {
+    /* Oldest entries last */
+    keys = grapes_malloc(sizeof(double) * (c->current_size + 1));
+    for (i = 0; keys && i < c->current_size; i++) {
+      keys[i] = c->entries[i].timestamp;
     }
+    err = keys ? rank_by_key(order, n, keys) : -1;
+  }
+  if (err == 0) {
+    res = ranked_copy(c, order, n);
   }
+  grapes_free(keys);
+  grapes_free(order);
+
+  return res;
+}
+
+struct peer_cache *cache_rank_key(const struct peer_cache *c, ranking_key key, const struct nodeID *target, const void *target_meta)
+{
+  struct peer_cache *res = NULL;
+  double *keys;
+  int *order;
+  int i, n;
+
+  order = rank_candidates(c, target, &n);
+  keys = grapes_malloc(sizeof(double) * (c->current_size + 1));
+  if (order && keys) {
+    for (i = 0; i < c->current_size; i++) {
+      keys[i] = key(target_meta, c->metadata + c->metadata_size * i);
+    }
+    if (rank_by_key(order, n, keys) == 0) {
+      res = ranked_copy(c, order, n);
+    }
+  }
+  grapes_free(keys);
+  grapes_free(order);
 
   return res;
 }
@@ -603,7 +886,6 @@ struct peer_cache *cache_union(const struct peer_cache *c1, const struct peer_ca
 {
   int n, pos;
   struct peer_cache *new_cache;
-  uint8_t *meta;
 
   if (c1->metadata_size != c2->metadata_size) {
     return NULL;
@@ -614,29 +896,21 @@ struct peer_cache *cache_union(const struct peer_cache *c1, const struct peer_ca
     return NULL;
   }
 
-  meta = new_cache->metadata;
-
   for (n = 0; n < c1->current_size; n++) {
-    if (new_cache->metadata_size) {
-      memcpy(meta, c1->metadata + n * c1->metadata_size, c1->metadata_size);
-      meta += new_cache->metadata_size;
-    }
-    new_cache->entries[new_cache->current_size++] = c1->entries[n];
+    entry_append(new_cache, &c1->entries[n], c1->metadata + n * c1->metadata_size);
     c1->entries[n].id = NULL;
   }
   
   for (n = 0; n < c2->current_size; n++) {
     pos = in_cache(new_cache, &c2->entries[n]);
     if (pos >= 0 && new_cache->entries[pos].timestamp > c2->entries[n].timestamp) {
-      cache_metadata_update(new_cache, c2->entries[n].id, c2->metadata + n * c2->metadata_size, c2->metadata_size);
+      if (new_cache->metadata_size) {
+        memcpy(new_cache->metadata + pos * new_cache->metadata_size, c2->metadata + n * c2->metadata_size, c2->metadata_size);
+      }
       new_cache->entries[pos].timestamp = c2->entries[n].timestamp;
     }
     if (pos < 0) {
-      if (new_cache->metadata_size) {
-        memcpy(meta, c2->metadata + n * c2->metadata_size, c2->metadata_size);
-        meta += new_cache->metadata_size;
-      }
-      new_cache->entries[new_cache->current_size++] = c2->entries[n];
+      entry_append(new_cache, &c2->entries[n], c2->metadata + n * c2->metadata_size);
       c2->entries[n].id = NULL;
     }
   }
@@ -658,27 +932,46 @@ int cache_current_size(const struct peer_cache *c)
 
 int cache_resize (struct peer_cache *c, int size)
 {
+  struct cache_entry *entries;
   int dif = size - c->cache_size;
 
   if (!dif) {
     return c->current_size;
   }
 
-  c->entries = realloc(c->entries, sizeof(struct cache_entry) * size);
-  if (dif > 0) {
-    memset(c->entries + c->cache_size, 0, sizeof(struct cache_entry) * dif);
-  } else if (c->current_size > size) {
-    c->current_size = size;
+  /*
+   * Grow the index first, so that rebuilding it at the end cannot fail.
+   * When shrinking, the old arrays can be kept if they cannot be resized.
+   */
+  if (dif > 0 && index_resize(c, size) < 0) {
+    return -1;
+  }
+  entries = grapes_realloc(c->entries, sizeof(struct cache_entry) * size);
+  if (entries) {
+    c->entries = entries;
+  } else if (dif > 0) {
+    return -1;
   }
-
   if (c->metadata_size) {
-    c->metadata = realloc(c->metadata, c->metadata_size * size);
+    uint8_t *metadata = grapes_realloc(c->metadata, c->metadata_size * size);
+
+    if (metadata) {
+      c->metadata = metadata;
+    } else if (dif > 0) {
+      return -1;
+    }
     if (dif > 0) {
       memset(c->metadata + c->metadata_size * c->cache_size, 0, c->metadata_size * dif);
     }
   }
+  if (dif > 0) {
+    memset(c->entries + c->cache_size, 0, sizeof(struct cache_entry) * dif);
+  } else if (c->current_size > size) {
+    c->current_size = size;
+  }
 
   c->cache_size = size;
+  index_rebuild(c);
 
   return c->current_size;
 }
@@ -687,82 +980,134 @@ struct peer_cache *merge_caches(const struct peer_cache *c1, const struct peer_c
 {
   int n1, n2;
   struct peer_cache *new_cache;
-  uint8_t *meta;
 
   new_cache = cache_init(newsize, c1->metadata_size, c1->max_timestamp);
   if (new_cache == NULL) {
     return NULL;
   }
 
-  meta = new_cache->metadata;
   *source = 0;
   for (n1 = 0, n2 = 0; new_cache->current_size < new_cache->cache_size;) {
     if ((n1 == c1->current_size) && (n2 == c2->current_size)) {
       return new_cache;
     }
-    if (n1 == c1->current_size) {
+    if (n2 == c2->current_size ||
+        (n1 < c1->current_size && c2->entries[n2].timestamp > c1->entries[n1].timestamp)) {
+      if (in_cache(new_cache, &c1->entries[n1]) < 0) {
+        entry_append(new_cache, &c1->entries[n1], c1->metadata + n1 * c1->metadata_size);
+        c1->entries[n1].id = NULL;
+        *source |= 0x01;
+      }
+      n1++;
+    } else {
       if (in_cache(new_cache, &c2->entries[n2]) < 0) {
-        if (new_cache->metadata_size) {
-          memcpy(meta, c2->metadata + n2 * c2->metadata_size, c2->metadata_size);
-          meta += new_cache->metadata_size;
-        }
-        new_cache->entries[new_cache->current_size++] = c2->entries[n2];
+        entry_append(new_cache, &c2->entries[n2], c2->metadata + n2 * c2->metadata_size);
         c2->entries[n2].id = NULL;
         *source |= 0x02;
       }
       n2++;
-    } else if (n2 == c2->current_size) {
-      if (in_cache(new_cache, &c1->entries[n1]) < 0) {
-        if (new_cache->metadata_size) {
-          memcpy(meta, c1->metadata + n1 * c1->metadata_size, c1->metadata_size);
-          meta += new_cache->metadata_size;
+    }
+  }
+
+  return new_cache;
+}
+
+int cache_merge(struct peer_cache *c, struct peer_cache *remote, int newsize, int *source)
+{
+  struct cache_entry *entries;
+  uint8_t *metadata = NULL, *taken;
+  int n1, n2, i, n = 0;
+
+  if (remote->metadata_size != c->metadata_size) {
+    return -1;
+  }
+  entries = grapes_malloc(sizeof(struct cache_entry) * newsize);
+  taken = grapes_malloc(c->current_size + 1);
+  if (c->metadata_size) {
+    metadata = grapes_malloc(c->metadata_size * newsize);
+  }
+  /* Grow the index first, so that rebuilding it at the end cannot fail */
+  if (entries == NULL || taken == NULL || (c->metadata_size && metadata == NULL) ||
+      index_resize(c, newsize > c->cache_size ? newsize : c->cache_size) < 0) {
+    grapes_free(entries);
+    grapes_free(taken);
+    grapes_free(metadata);
+
+    return -1;
+  }
+
+  /* Same order as merge_caches(); taken[i] is set when the i-th local node is in the result */
+  memset(taken, 0, c->current_size);
+  *source = 0;
+  for (n1 = 0, n2 = 0; n < newsize && (n1 < c->current_size || n2 < remote->current_size);) {
+    if (n2 == remote->current_size ||
+        (n1 < c->current_size && remote->entries[n2].timestamp > c->entries[n1].timestamp)) {
+      if (!taken[n1]) {
+        taken[n1] = 1;
+        entries[n] = c->entries[n1];
+        if (c->metadata_size) {
+          memcpy(metadata + n * c->metadata_size, c->metadata + n1 * c->metadata_size, c->metadata_size);
         }
-        new_cache->entries[new_cache->current_size++] = c1->entries[n1];
-        c1->entries[n1].id = NULL;
+        n++;
         *source |= 0x01;
       }
       n1++;
     } else {
-      if (c2->entries[n2].timestamp > c1->entries[n1].timestamp) {
-        if (in_cache(new_cache, &c1->entries[n1]) < 0) {
-          if (new_cache->metadata_size) {
-            memcpy(meta, c1->metadata + n1 * c1->metadata_size, c1->metadata_size);
-            meta += new_cache->metadata_size;
-          }
-          new_cache->entries[new_cache->current_size++] = c1->entries[n1];
-          c1->entries[n1].id = NULL;
-          *source |= 0x01;
+      int pos = index_find(c, remote->entries[n2].id);
+
+      if (pos < 0 || !taken[pos]) {
+        entries[n] = remote->entries[n2];
+        if (pos < 0) {
+          /* A new node: take its nodeID */
+          remote->entries[n2].id = NULL;
+        } else {
+          /* Fresher information about a known node */
+          entries[n].id = c->entries[pos].id;
+          taken[pos] = 1;
         }
-        n1++;
-      } else {
-        if (in_cache(new_cache, &c2->entries[n2]) < 0) {
-          if (new_cache->metadata_size) {
-            memcpy(meta, c2->metadata + n2 * c2->metadata_size, c2->metadata_size);
-            meta += new_cache->metadata_size;
-          }
-          new_cache->entries[new_cache->current_size++] = c2->entries[n2];
-          c2->entries[n2].id = NULL;
-          *source |= 0x02;
+        if (c->metadata_size) {
+          memcpy(metadata + n * c->metadata_size, remote->metadata + n2 * c->metadata_size, c->metadata_size);
         }
-        n2++;
+        n++;
+        *source |= 0x02;
       }
+      n2++;
     }
   }
 
-  return new_cache;
+  for (i = 0; i < c->current_size; i++) {
+    if (!taken[i]) {
+      nodeid_free(c->entries[i].id);
+    }
+  }
+  memset(entries + n, 0, sizeof(struct cache_entry) * (newsize - n));
+  if (c->metadata_size) {
+    memset(metadata + n * c->metadata_size, 0, c->metadata_size * (newsize - n));
+  }
+  grapes_free(taken);
+  grapes_free(c->entries);
+  grapes_free(c->metadata);
+  c->entries = entries;
+  c->metadata = metadata;
+  c->cache_size = newsize;
+  c->current_size = n;
+  index_rebuild(c);
+
+  return n;
 }
 
 static int swap_entries(const struct peer_cache *c, int i, int j)
 {
   struct cache_entry t;
   uint8_t *metadata;
+  int si, sj;
 
   if (i == j) {
     return 1;
   }
 
   if (c->metadata_size) {
-    metadata = malloc(c->metadata_size);
+    metadata = grapes_malloc(c->metadata_size);
     if (! metadata) {
       return -1;
     }
@@ -771,9 +1116,13 @@ static int swap_entries(const struct peer_cache *c, int i, int j)
     memcpy(c->metadata + i * c->metadata_size, c->metadata + j * c->metadata_size, c->metadata_size);
     memcpy(c->metadata + j * c->metadata_size, metadata,                           c->metadata_size);
 
-    free(metadata);
+    grapes_free(metadata);
   }
 
+  si = index_slot(c, i, i);
+  sj = index_slot(c, j, j);
+  c->index[si] = j + 1;
+  c->index[sj] = i + 1;
   t = c->entries[i];
   c->entries[i] = c->entries[j];
   c->entries[j] = t;
@@ -811,7 +1160,7 @@ void cache_randomize(const struct peer_cache *c)
 
 void cache_check(const struct peer_cache *c)
 {
-  int i, j;
+  int i;
   int ts = 0;
 
   for (i = 0; i < c->current_size; i++) {
@@ -821,9 +1170,8 @@ void cache_check(const struct peer_cache *c)
       *((char *)0) = 1;
     }
     ts = c->entries[i].timestamp;
-    for (j = i + 1; j < c->current_size; j++) {
-      assert(!nodeid_equal(c->entries[i].id, c->entries[j].id));
-    }
+    /* Finds a different position if the node is duplicated */
+    assert(index_find(c, c->entries[i].id) == i);
   }
 }
 
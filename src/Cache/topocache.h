@@ -4,6 +4,7 @@
 struct peer_cache;
 struct cache_entry;
 typedef int (*ranking_function)(const void *target, const void *p1, const void *p2);    // FIXME!
+typedef double (*ranking_key)(const void *target, const void *p);	// distance of p from target
 
 struct peer_cache *cache_init(int n, int metadata_size, int max_timestamp);
 struct peer_cache *cache_copy(const struct peer_cache *c);
@@ -26,11 +27,14 @@ struct peer_cache *rand_cache_except(struct peer_cache *c, int n, struct nodeID
 void cache_randomize(const struct peer_cache *c);
 
 struct peer_cache *entries_undump(const uint8_t *buff, int size);
+struct peer_cache *entries_undump_into(struct peer_cache *c, const uint8_t *buff, int size);
 int cache_header_dump(uint8_t *b, const struct peer_cache *c, int include_me);
 int entry_dump(uint8_t *b, const struct peer_cache *e, int i, size_t max_write_size);
 
 struct peer_cache *merge_caches(const struct peer_cache *c1, const struct peer_cache *c2, int newsize, int *source);
+int cache_merge(struct peer_cache *c, struct peer_cache *remote, int newsize, int *source);
 struct peer_cache *cache_rank (const struct peer_cache *c, ranking_function rank, const struct nodeID *target, const void *target_meta);
+struct peer_cache *cache_rank_key(const struct peer_cache *c, ranking_key key, const struct nodeID *target, const void *target_meta);
 struct peer_cache *cache_union(const struct peer_cache *c1, const struct peer_cache *c2, int *size);
 int cache_resize (struct peer_cache *c, int size);
 
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *  Copyright (c) 2010 Csaba Kiraly
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+/*
+ * Chunk buffer keeping the chunks in a ring indexed by chunk ID: chunk
+ * "id" can only live in slot id & (window - 1), so lookup, duplicate
+ * detection, insertion and eviction of the oldest chunk do not need to
+ * scan the buffer. At most "size" chunks are stored, and all of them must
+ * fit in a window of "window" consecutive IDs (by default, 4 * size
+ * rounded up to a power of 2).
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "chunk_pool.h"
+#include "chunkbuffer.h"
+#include "chunkbuffer_iface.h"
+#include "grapes_config.h"
+
+struct cb_context {
+  int size;
+  int num_chunks;
+  unsigned int mask;
+  int first;		/* ID of the oldest chunk in the buffer */
+  int last;		/* ID of the newest chunk in the buffer */
+  struct chunk *ring;
+  struct chunk *view;
+};
+
+static int ring_clear(struct cb_context *cb);
+
+static inline struct chunk *slot(const struct cb_context *cb, int id)
+{
+  return &cb->ring[(unsigned int)id & cb->mask];
+}
+
+static inline int occupied(const struct cb_context *cb, int id)
+{
+  return id != -1 && slot(cb, id)->id == id;
+}
+
+static void chunk_free(struct chunk *c)
+{
+    chunk_data_free(c->data);
+    c->data = NULL;
+    chunk_data_free(c->attributes);
+    c->attributes = NULL;
+    c->id = -1;
+}
+
+/* Differences are computed on unsigned values, to survive ID wrap-around */
+static inline unsigned int distance(int from, int to)
+{
+  return (unsigned int)to - (unsigned int)from;
+}
+
+static void remove_oldest_chunk(struct cb_context *cb)
+{
+  chunk_free(slot(cb, cb->first));
+  if (--cb->num_chunks == 0) {
+    return;
+  }
+  do {
+    cb->first++;
+  } while (!occupied(cb, cb->first));
+}
+
+static struct cb_context *ring_init(const char *config)
+{
+  struct tag *cfg_tags;
+  struct cb_context *cb;
+  int res, window, i;
+
+  cb = malloc(sizeof(struct cb_context));
+  if (cb == NULL) {
+    return cb;
+  }
+  memset(cb, 0, sizeof(struct cb_context));
+
+  cfg_tags = grapes_config_parse(config);
+  if (!cfg_tags) {
+    free(cb);
+    return NULL;
+  }
+  res = grapes_config_value_int(cfg_tags, "size", &cb->size);
+  if (!res || cb->size <= 0) {
+    free(cb);
+    free(cfg_tags);
+
+    return NULL;
+  }
+  grapes_config_value_int_default(cfg_tags, "window", &window, cb->size * 4);
+  free(cfg_tags);
+  if (window < cb->size) {
+    window = cb->size;
+  }
+  for (cb->mask = 1; cb->mask < (unsigned int)window; cb->mask <<= 1);
+
+  cb->ring = malloc(sizeof(struct chunk) * cb->mask);
+  cb->view = malloc(sizeof(struct chunk) * cb->size);
+  if (cb->ring == NULL || cb->view == NULL) {
+    free(cb->ring);
+    free(cb->view);
+    free(cb);
+    return NULL;
+  }
+  memset(cb->ring, 0, sizeof(struct chunk) * cb->mask);
+  for (i = 0; i < cb->mask; i++) {
+    cb->ring[i].id = -1;
+  }
+  cb->mask--;
+
+  return cb;
+}
+
+static int ring_add_chunk(struct cb_context *cb, const struct chunk *c)
+{
+  int offset;
+
+  if (cb->num_chunks == 0) {
+    cb->first = cb->last = c->id;
+  } else if (occupied(cb, c->id)) {
+    return E_CB_DUPLICATE;
+  } else {
+    offset = distance(cb->first, c->id);
+    if (offset < 0) {
+      /* Older than all the chunks in the buffer */
+      if (cb->num_chunks == cb->size || distance(c->id, cb->last) > cb->mask) {
+        // check for ID looparound and other anomalies
+        if (slot(cb, cb->first)->timestamp >= c->timestamp) {
+          return E_CB_OLD;
+        }
+        ring_clear(cb);
+        cb->last = c->id;
+      }
+      cb->first = c->id;
+    } else if (offset > distance(cb->first, cb->last)) {
+      /* Newer than all the chunks in the buffer: slide the window */
+      while (cb->num_chunks && distance(cb->first, c->id) > cb->mask) {
+        remove_oldest_chunk(cb);
+      }
+      if (cb->num_chunks == cb->size) {
+        remove_oldest_chunk(cb);
+      }
+      if (cb->num_chunks == 0) {
+        cb->first = c->id;
+      }
+      cb->last = c->id;
+    } else if (cb->num_chunks == cb->size) {
+      /* Fills a hole: the oldest chunk is older than this one */
+      remove_oldest_chunk(cb);
+      if ((int)distance(cb->first, c->id) < 0) {
+        cb->first = c->id;
+      }
+    }
+  }
+
+  *slot(cb, c->id) = *c;
+  cb->num_chunks++;
+
+  return 0;
+}
+
+static struct chunk *ring_get_chunks(const struct cb_context *cb, int *n)
+{
+  int id, i;
+
+  *n = cb->num_chunks;
+  if (*n == 0) {
+    return NULL;
+  }
+
+  for (id = cb->first, i = 0; i < cb->num_chunks; id++) {
+    if (occupied(cb, id)) {
+      cb->view[i++] = *slot(cb, id);
+    }
+  }
+
+  return cb->view;
+}
+
+static const struct chunk *ring_get_chunk(const struct cb_context *cb, int id)
+{
+  if (cb->num_chunks == 0 || !occupied(cb, id)) {
+    return NULL;
+  }
+
+  return slot(cb, id);
+}
+
+static int ring_clear(struct cb_context *cb)
+{
+  int id;
+
+  for (id = cb->first; cb->num_chunks; id++) {
+    if (occupied(cb, id)) {
+      chunk_free(slot(cb, id));
+      cb->num_chunks--;
+    }
+  }
+
+  return 0;
+}
+
+static void ring_destroy(struct cb_context *cb)
+{
+  ring_clear(cb);
+  free(cb->ring);
+  free(cb->view);
+  free(cb);
+}
+
+struct cb_iface cb_ring = {
+  .init = ring_init,
+  .add_chunk = ring_add_chunk,
+  .get_chunks = ring_get_chunks,
+  .get_chunk = ring_get_chunk,
+  .clear = ring_clear,
+  .destroy = ring_destroy,
+};
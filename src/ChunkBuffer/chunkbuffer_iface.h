@@ -0,0 +1,15 @@
+#ifndef CHUNKBUFFER_IFACE
+#define CHUNKBUFFER_IFACE
+
+struct cb_context;
+
+struct cb_iface {
+  struct cb_context *(*init)(const char *config);
+  int (*add_chunk)(struct cb_context *cb, const struct chunk *c);
+  struct chunk *(*get_chunks)(const struct cb_context *cb, int *n);
+  const struct chunk *(*get_chunk)(const struct cb_context *cb, int id);
+  int (*clear)(struct cb_context *cb);
+  void (*destroy)(struct cb_context *cb);
+};
+
+#endif	/* CHUNKBUFFER_IFACE */
@@ -15,16 +15,8 @@
 #include "trade_sig_la.h"
 #include "int_coding.h"
 
-static const char *type_name(uint32_t type)
-{
-  if (type == CIST_PRIORITY) {
-    return "priority";
-  } else if (type == CIST_BITMAP) {
-    return "bitmap";
-  }
-
-  return "Unknown";
-}
+extern struct cids_encoding_iface compact_encoding;
+uint32_t compact_set_type(const uint8_t *buff, int buff_len);
 
 int encodeChunkSignaling(const struct chunkID_set *h, const void *meta, int meta_len, uint8_t *buff, int buff_len)
 {
@@ -35,7 +27,14 @@ int encodeChunkSignaling(const struct chunkID_set *h, const void *meta, int meta
   int_cpy(buff + 8, meta_len);
 
   if (h) {
-    meta_p = h->enc->encode(h, buff, buff_len, meta_len);
+    const struct cids_encoding_iface *enc = h->enc;
+
+    /* Use the compact format when it saves some bytes */
+    if (h->compact && compact_encoding.encoded_size(h) < enc->encoded_size(h)) {
+      enc = &compact_encoding;
+      int_cpy(buff + 4, CIST_COMPACT);
+    }
+    meta_p = enc->encode(h, buff, buff_len, meta_len);
   } else {
     int_cpy(buff, 0);
     meta_p = buff + 12;
@@ -51,32 +50,78 @@ int encodeChunkSignaling(const struct chunkID_set *h, const void *meta, int meta
   return meta_p + meta_len - buff;
 }
 
-struct chunkID_set *decodeChunkSignaling(void **meta, int *meta_len, const uint8_t *buff, int buff_len)
+int decodeChunkSignalingInto(struct chunkID_set *h, const void **meta, int *meta_len,
+                             const uint8_t *buff, int buff_len)
 {
-  uint32_t size;
-  uint32_t type;
-  struct chunkID_set *h;
+  const struct cids_encoding_iface *enc;
+  uint32_t size, type, set_type;
   const uint8_t *meta_p;
 
+  if (buff_len < 12) {
+    return -1;
+  }
   size = int_rcpy(buff);
   type = int_rcpy(buff + 4);
   *meta_len = int_rcpy(buff + 8);
+  *meta = NULL;
+  if (*meta_len < 0 || *meta_len > buff_len - 12) {
+    return -1;
+  }
 
-  if (type != -1) {
-    char cfg[32];
+  if (type == -1) {
+    chunkID_set_trim(h, 0);
+    meta_p = buff + 12;
+  } else {
+    set_type = type == CIST_COMPACT ? compact_set_type(buff, buff_len) : type;
+    /* Do not trust the size in the header beyond what the payload can hold */
+    if (type == CIST_PRIORITY && size > (buff_len - 12) / 4) {
+      size = (buff_len - 12) / 4;
+    } else if ((int64_t)size > (int64_t)(buff_len - 12) * 8) {
+      size = (buff_len - 12) * 8;
+    }
+    if (chunkID_set_prepare(h, set_type, size) < 0) {
+      fprintf(stderr, "Error in decoding chunkid set - unknown type %d or not enough memory.\n", type);
 
-    memset(cfg, 0, sizeof(cfg));
-    sprintf(cfg, "size=%d,type=%s", size, type_name(type));
-    h = chunkID_set_init(cfg);
-    if (h == NULL) {
-      fprintf(stderr, "Error in decoding chunkid set - not enough memory to create a chunkID set.\n");
+      return -1;
+    }
+    enc = type == CIST_COMPACT ? &compact_encoding : h->enc;
+    meta_p = enc->decode(h, buff, buff_len, meta_len);
+    if (meta_p == NULL) {
+      chunkID_set_trim(h, 0);
 
-      return NULL;
+      return -1;
     }
-    meta_p = h->enc->decode(h, buff, buff_len, meta_len);
-  } else {
+  }
+  if (*meta_len) {
+    *meta = meta_p;
+  }
+
+  return type != -1;
+}
+
+struct chunkID_set *decodeChunkSignaling(void **meta, int *meta_len, const uint8_t *buff, int buff_len)
+{
+  struct chunkID_set *h;
+  const void *meta_p;
+  int res;
+
+  *meta = NULL;
+  h = chunkID_set_init("size=0");
+  if (h == NULL) {
+    fprintf(stderr, "Error in decoding chunkid set - not enough memory to create a chunkID set.\n");
+    *meta_len = 0;
+
+    return NULL;
+  }
+  res = decodeChunkSignalingInto(h, &meta_p, meta_len, buff, buff_len);
+  if (res <= 0) {
+    chunkID_set_free(h);
     h = NULL;
-    meta_p = buff + 12;
+  }
+  if (res < 0) {
+    *meta_len = 0;
+
+    return NULL;
   }
 
   if (*meta_len) {
@@ -86,8 +131,6 @@ struct chunkID_set *decodeChunkSignaling(void **meta, int *meta_len, const uint8
     } else {
       *meta_len = 0;
     }
-  } else {
-    *meta = NULL;
   }
 
   return h;
@@ -0,0 +1,394 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "chunkids_private.h"
+#include "chunkids_iface.h"
+#include "int_coding.h"
+#include "chunkidset.h"
+
+/*
+ * Compact wire format (type CIST_COMPACT), used when it is smaller than
+ * the native encoding of the set. After the 12 bytes header (number of
+ * chunk IDs, type, metadata length) one byte selects the format:
+ * - COMPACT_DELTA: increasing chunk IDs, each one coded as the distance
+ *   from the previous one, minus 1 (the first one is coded as is)
+ * - COMPACT_ORDERED: chunk IDs in priority order, each one coded as the
+ *   zigzag difference from the previous one (0 for the first one)
+ * - COMPACT_RLE: the first (smallest) chunk ID, followed by the bitmap
+ *   starting from it, as runs of 64 bit words: a (count << 2 | kind)
+ *   integer, kind being RUN_ZERO, RUN_ONES or RUN_LITERAL. Literal runs
+ *   are followed by count words (8 bytes, little endian) and contain at
+ *   most MAX_LITERALS words, so that their header is one byte.
+ * All the integers are varints (7 bits per byte, least significant first).
+ */
+#define COMPACT_DELTA 0
+#define COMPACT_ORDERED 1
+#define COMPACT_RLE 2
+
+#define RUN_ZERO 0
+#define RUN_ONES 1
+#define RUN_LITERAL 2
+#define MAX_LITERALS 31
+
+#define DEFAULT_SIZE 32
+
+/* If p is NULL, only compute the length */
+static int varint_put(uint8_t *p, uint64_t v)
+{
+  int len = 0;
+
+  do {
+    uint8_t b = v & 0x7f;
+
+    v >>= 7;
+    if (p) {
+      p[len] = v ? b | 0x80 : b;
+    }
+    len++;
+  } while (v);
+
+  return len;
+}
+
+static const uint8_t *varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+  int shift;
+
+  *v = 0;
+  for (shift = 0; p < end && shift < 64; shift += 7) {
+    *v |= (uint64_t)(*p & 0x7f) << shift;
+    if ((*p++ & 0x80) == 0) {
+      return p;
+    }
+  }
+
+  return NULL;
+}
+
+static int delta_encode(const struct chunkID_set *h, uint8_t *p)
+{
+  int64_t prev = -1;
+  int i, len = 0;
+
+  for (i = 0; i < chunkID_set_size(h); i++) {
+    int64_t id = chunkID_set_get_chunk(h, i);
+
+    len += varint_put(p ? p + len : NULL, id - prev - 1);
+    prev = id;
+  }
+
+  return len;
+}
+
+static int ordered_encode(const struct chunkID_set *h, uint8_t *p)
+{
+  int64_t prev = 0;
+  int i, len = 0;
+
+  for (i = 0; i < chunkID_set_size(h); i++) {
+    int64_t id = chunkID_set_get_chunk(h, i);
+    int64_t d = id - prev;
+
+    len += varint_put(p ? p + len : NULL, d < 0 ? ~((uint64_t)d << 1) : (uint64_t)d << 1);
+    prev = id;
+  }
+
+  return len;
+}
+
+struct rle_state {
+  uint8_t *p;		/* NULL if only computing the length */
+  int len;
+  int literal_pos;	/* position of the header of the open literal run */
+  int literals;
+  int ones;
+};
+
+static void rle_close(struct rle_state *s)
+{
+  if (s->ones) {
+    s->len += varint_put(s->p ? s->p + s->len : NULL, (uint64_t)s->ones << 2 | RUN_ONES);
+    s->ones = 0;
+  }
+  if (s->literals) {
+    if (s->p) {
+      s->p[s->literal_pos] = s->literals << 2 | RUN_LITERAL;
+    }
+    s->literals = 0;
+  }
+}
+
+static void rle_word(struct rle_state *s, uint64_t w)
+{
+  int i;
+
+  if (w == ~0ULL) {
+    if (s->literals) {
+      rle_close(s);
+    }
+    s->ones++;
+
+    return;
+  }
+  if (s->ones || s->literals == MAX_LITERALS) {
+    rle_close(s);
+  }
+  if (s->literals == 0) {
+    s->literal_pos = s->len++;
+  }
+  if (s->p) {
+    for (i = 0; i < 8; i++) {
+      s->p[s->len + i] = w >> (i * 8);
+    }
+  }
+  s->len += 8;
+  s->literals++;
+}
+
+static int rle_encode(const struct chunkID_set *h, uint8_t *p)
+{
+  struct rle_state s = {.p = p};
+  int64_t base, word = 0;
+  uint64_t bits = 0;
+  int i;
+
+  if (chunkID_set_size(h) == 0) {
+    return 0;
+  }
+  base = chunkID_set_get_chunk(h, 0);
+  s.len = varint_put(p, base);
+  for (i = 0; i < chunkID_set_size(h); i++) {
+    int64_t offset = chunkID_set_get_chunk(h, i) - base;
+
+    if (offset >> 6 != word) {
+      rle_word(&s, bits);
+      if ((offset >> 6) - word > 1) {
+        rle_close(&s);
+        s.len += varint_put(p ? p + s.len : NULL, (uint64_t)((offset >> 6) - word - 1) << 2 | RUN_ZERO);
+      }
+      word = offset >> 6;
+      bits = 0;
+    }
+    bits |= 1ULL << (offset & 63);
+  }
+  rle_word(&s, bits);
+  rle_close(&s);
+
+  return s.len;
+}
+
+/* Choose the smallest format */
+static int compact_format(const struct chunkID_set *h, int *len)
+{
+  int rle_len;
+
+  if (h->type == CIST_PRIORITY) {
+    *len = ordered_encode(h, NULL);
+
+    return COMPACT_ORDERED;
+  }
+  *len = delta_encode(h, NULL);
+  rle_len = rle_encode(h, NULL);
+  if (rle_len < *len) {
+    *len = rle_len;
+
+    return COMPACT_RLE;
+  }
+
+  return COMPACT_DELTA;
+}
+
+static int compact_size(const struct chunkID_set *h)
+{
+  int len;
+
+  compact_format(h, &len);
+
+  return 13 + len;
+}
+
+static uint8_t *compact_encode(const struct chunkID_set *h, uint8_t *buff, int buff_len, int meta_len)
+{
+  int format, len;
+
+  format = compact_format(h, &len);
+  int_cpy(buff, h->n_elements);
+  if (buff_len < 13 + len + meta_len) {
+    return NULL;
+  }
+  buff[12] = format;
+  switch (format) {
+    case COMPACT_DELTA:
+      delta_encode(h, buff + 13);
+      break;
+    case COMPACT_ORDERED:
+      ordered_encode(h, buff + 13);
+      break;
+    case COMPACT_RLE:
+      rle_encode(h, buff + 13);
+      break;
+  }
+
+  return buff + 13 + len;
+}
+
+static int append(struct chunkID_set *h, int64_t id)
+{
+  if (id < 0 || id > INT_MAX) {
+    return -1;
+  }
+  if (h->ops->get_chunk) {
+    /* Not stored in the elements array */
+    return chunkID_set_add_chunk(h, id) < 0 ? -1 : 0;
+  }
+  if (h->n_elements >= h->size) {
+    /* Runs of ones can contain more IDs than the bits of the message */
+    int size = h->size ? 2 * h->size : DEFAULT_SIZE;
+    int *res = realloc(h->elements, size * sizeof(int));
+
+    if (res == NULL) {
+      return -1;
+    }
+    h->elements = res;
+    h->size = size;
+  }
+  h->elements[h->n_elements++] = id;
+
+  return 0;
+}
+
+/*
+ * The chunk IDs are counted while decoding (not in the set, which might
+ * drop some of them, as the "window" sets do), and a message cannot
+ * contain more than the n announced in the header
+ */
+static const uint8_t *rle_decode(struct chunkID_set *h, int n, const uint8_t *p, const uint8_t *end)
+{
+  int64_t id, i, decoded = 0;
+  uint64_t v;
+
+  if (n == 0) {
+    return p;
+  }
+  p = varint_get(p, end, &v);
+  id = v;
+  while (p && decoded < n) {
+    int64_t count;
+
+    p = varint_get(p, end, &v);
+    if (p == NULL) {
+      return NULL;
+    }
+    count = v >> 2;
+    if (count > 1LL << 32) {
+      return NULL;
+    }
+    switch (v & 3) {
+      case RUN_ZERO:
+        id += count * 64;
+        if (id > INT_MAX) {
+          return NULL;
+        }
+        break;
+      case RUN_ONES:
+        if (count * 64 > n - decoded) {
+          return NULL;
+        }
+        for (i = 0; i < count * 64; i++) {
+          if (append(h, id++) < 0) {
+            return NULL;
+          }
+        }
+        decoded += count * 64;
+        break;
+      case RUN_LITERAL:
+        if (end - p < count * 8) {
+          return NULL;
+        }
+        for (; count; count--, id += 64) {
+          uint64_t w = 0;
+
+          for (i = 0; i < 8; i++) {
+            w |= (uint64_t)*p++ << (i * 8);
+          }
+          for (; w; w &= w - 1) {
+            if (++decoded > n || append(h, id + __builtin_ctzll(w)) < 0) {
+              return NULL;
+            }
+          }
+        }
+        break;
+      default:
+        return NULL;
+    }
+  }
+
+  return p;
+}
+
+static const uint8_t *compact_decode(struct chunkID_set *h, const uint8_t *buff, int buff_len, int *meta_len)
+{
+  const uint8_t *p = buff + 13, *end = buff + buff_len - *meta_len;
+  int64_t prev = buff[12] == COMPACT_DELTA ? -1 : 0;
+  int n = int_rcpy(buff), decoded;
+  uint64_t v;
+
+  if (buff_len < 13 + *meta_len || n < 0) {
+    p = NULL;
+  } else if (buff[12] == COMPACT_RLE) {
+    p = rle_decode(h, n, p, end);
+  } else {
+    for (decoded = 0; p && decoded < n; decoded++) {
+      p = varint_get(p, end, &v);
+      if (p == NULL || v > UINT32_MAX) {
+        p = NULL;
+      } else {
+        if (buff[12] == COMPACT_DELTA) {
+          prev += v + 1;
+        } else {
+          prev += (v & 1) ? ~(v >> 1) : v >> 1;
+        }
+        if (append(h, prev) < 0) {
+          p = NULL;
+        }
+      }
+    }
+  }
+  if (p == NULL) {
+    fprintf(stderr, "Error in decoding chunkid set - wrong compact encoding\n");
+  }
+
+  return p;
+}
+
+/* The type of set a compact message decodes to */
+uint32_t compact_set_type(const uint8_t *buff, int buff_len)
+{
+  if (buff_len < 13) {
+    return -1;
+  }
+  switch (buff[12]) {
+    case COMPACT_DELTA:
+    case COMPACT_RLE:
+      return CIST_BITMAP;
+    case COMPACT_ORDERED:
+      return CIST_PRIORITY;
+    default:
+      return -1;
+  }
+}
+
+struct cids_encoding_iface compact_encoding = {
+  .encode = compact_encode,
+  .decode = compact_decode,
+  .encoded_size = compact_size,
+};
@@ -8,19 +8,28 @@
 #include "int_coding.h"
 #include "chunkidset.h"
 
-static uint8_t *bmap_encode(const struct chunkID_set *h, uint8_t *buff, int buff_len, int meta_len)
+static int bmap_range(const struct chunkID_set *h, uint32_t *c_min)
 {
-  int i, elements;
-  uint32_t c_min, c_max;
+  int i;
+  uint32_t c_max;
 
-  c_min = c_max = h->n_elements ? h->elements[0] : 0;
+  *c_min = c_max = h->n_elements ? h->elements[0] : 0;
   for (i = 1; i < h->n_elements; i++) {
-    if (h->elements[i] < c_min)
-      c_min = h->elements[i];
+    if (h->elements[i] < *c_min)
+      *c_min = h->elements[i];
     else if (h->elements[i] > c_max)
       c_max = h->elements[i];
   }
-  elements = h->n_elements ? c_max - c_min + 1 : 0;
+
+  return h->n_elements ? c_max - *c_min + 1 : 0;
+}
+
+static uint8_t *bmap_encode(const struct chunkID_set *h, uint8_t *buff, int buff_len, int meta_len)
+{
+  int i, elements;
+  uint32_t c_min;
+
+  elements = bmap_range(h, &c_min);
   int_cpy(buff, elements);
   elements = elements / 8 + (elements % 8 ? 1 : 0);
   if (buff_len < elements + 16 + meta_len) {
@@ -40,24 +49,34 @@ static const uint8_t *bmap_decode(struct chunkID_set *h, const uint8_t *buff, in
   int i;
   int base;
   int byte_cnt;
+  int elements = int_rcpy(buff);
 
-  byte_cnt = h->size / 8 + (h->size % 8 ? 1 : 0);
-  if (buff_len < 16 + byte_cnt + *meta_len) {
+  byte_cnt = elements / 8 + (elements % 8 ? 1 : 0);
+  if (buff_len < 16 + byte_cnt + *meta_len || elements > h->size) {
     fprintf(stderr, "Error in decoding chunkid set - wrong length\n");
-    chunkID_set_free(h);
 
     return NULL;
   }
   base = int_rcpy(buff + 12);
-  for (i = h->size - 1; i >= 0; i--) {
-  if (buff[16 + (i / 8)] & 1 << (i % 8))
-    h->elements[h->n_elements++] = base + i;
+  /* Increasing order, as the "bitmap" sets are sorted */
+  for (i = 0; i < elements; i++) {
+    if (buff[16 + (i / 8)] & 1 << (i % 8))
+      h->elements[h->n_elements++] = base + i;
   }
 
   return buff + 16 + byte_cnt;
 }
 
+static int bmap_size(const struct chunkID_set *h)
+{
+  uint32_t c_min;
+  int elements = bmap_range(h, &c_min);
+
+  return 16 + elements / 8 + (elements % 8 ? 1 : 0);
+}
+
 struct cids_encoding_iface bmap_encoding = {
   .encode = bmap_encode,
   .decode = bmap_decode,
+  .encoded_size = bmap_size,
 };
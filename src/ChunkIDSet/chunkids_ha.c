@@ -9,12 +9,17 @@
 #include <assert.h>
 
 #include "chunkidset.h"
+#include "chunkids_private.h"
+#include "chunkids_iface.h"
 
 uint32_t chunkID_set_get_earliest(const struct chunkID_set *h)
 {
   int i;
   uint32_t min;
 
+  if (h->ops->earliest) {
+    return h->ops->earliest(h);
+  }
   if (chunkID_set_size(h) == 0) {
     return CHUNKID_INVALID;
   }
@@ -33,6 +38,9 @@ uint32_t chunkID_set_get_latest(const struct chunkID_set *h)
   int i;
   uint32_t  max;
 
+  if (h->ops->latest) {
+    return h->ops->latest(h);
+  }
   if (chunkID_set_size(h) == 0) {
     return CHUNKID_INVALID;
   }
@@ -46,10 +54,18 @@ uint32_t chunkID_set_get_latest(const struct chunkID_set *h)
   return max;
 }
 
-int chunkID_set_union(struct chunkID_set *h, struct chunkID_set *a)
+static int same_ops(const struct chunkID_set *h, const struct chunkID_set *a)
+{
+  return h->ops == a->ops;
+}
+
+int chunkID_set_union(struct chunkID_set *h, const struct chunkID_set *a)
 {
   int i;
 
+  if (same_ops(h, a) && h->ops->combine) {
+    return h->ops->combine(h, a, CIDS_UNION);
+  }
   for (i = 0; i < chunkID_set_size(a); i++) {
     int ret = chunkID_set_add_chunk(h, chunkID_set_get_chunk(a, i));
     if (ret < 0) return ret;
@@ -57,3 +73,131 @@ int chunkID_set_union(struct chunkID_set *h, struct chunkID_set *a)
 
   return chunkID_set_size(h);
 }
+
+/* Keep the chunks of h that are (keep != 0) or are not (keep == 0) in a */
+static int filter(struct chunkID_set *h, const struct chunkID_set *a, int keep)
+{
+  int i, n = 0;
+  int *ids;
+
+  if (h->ops->get_chunk == NULL) {
+    /* Sets stored in the elements array are compacted in place */
+    for (i = 0; i < h->n_elements; i++) {
+      if ((chunkID_set_check(a, h->elements[i]) >= 0) == keep) {
+        h->elements[n++] = h->elements[i];
+      }
+    }
+    h->n_elements = n;
+
+    return n;
+  }
+
+  ids = malloc(h->n_elements * sizeof(int) + 1);
+  if (ids == NULL) {
+    return -1;
+  }
+  for (i = 0; i < h->n_elements; i++) {
+    int c = chunkID_set_get_chunk(h, i);
+
+    if ((chunkID_set_check(a, c) >= 0) == keep) {
+      ids[n++] = c;
+    }
+  }
+  chunkID_set_clear(h, n);
+  for (i = 0; i < n; i++) {
+    chunkID_set_add_chunk(h, ids[i]);
+  }
+  free(ids);
+
+  return chunkID_set_size(h);
+}
+
+int chunkID_set_intersect(struct chunkID_set *h, const struct chunkID_set *a)
+{
+  if (same_ops(h, a) && h->ops->combine) {
+    return h->ops->combine(h, a, CIDS_INTERSECT);
+  }
+
+  return filter(h, a, 1);
+}
+
+int chunkID_set_difference(struct chunkID_set *h, const struct chunkID_set *a)
+{
+  if (same_ops(h, a) && h->ops->combine) {
+    return h->ops->combine(h, a, CIDS_DIFFERENCE);
+  }
+
+  return filter(h, a, 0);
+}
+
+int chunkID_set_xor(struct chunkID_set *h, const struct chunkID_set *a)
+{
+  int i, n = 0, res;
+  int *added;
+
+  if (same_ops(h, a) && h->ops->combine) {
+    return h->ops->combine(h, a, CIDS_XOR);
+  }
+  added = malloc(chunkID_set_size(a) * sizeof(int) + 1);
+  if (added == NULL) {
+    return -1;
+  }
+  for (i = 0; i < chunkID_set_size(a); i++) {
+    int c = chunkID_set_get_chunk(a, i);
+
+    if (chunkID_set_check(h, c) < 0) {
+      added[n++] = c;
+    }
+  }
+  res = filter(h, a, 0);
+  for (i = 0; i < n && res >= 0; i++) {
+    res = chunkID_set_add_chunk(h, added[i]);
+  }
+  free(added);
+
+  return res < 0 ? res : chunkID_set_size(h);
+}
+
+static int count(const struct chunkID_set *h, const struct chunkID_set *a, int op)
+{
+  int i, common = 0;
+
+  if (same_ops(h, a) && h->ops->count) {
+    return h->ops->count(h, a, op);
+  }
+  for (i = 0; i < chunkID_set_size(h); i++) {
+    if (chunkID_set_check(a, chunkID_set_get_chunk(h, i)) >= 0) {
+      common++;
+    }
+  }
+
+  return op == CIDS_INTERSECT ? common : chunkID_set_size(h) - common;
+}
+
+int chunkID_set_intersect_count(const struct chunkID_set *h, const struct chunkID_set *a)
+{
+  return count(h, a, CIDS_INTERSECT);
+}
+
+int chunkID_set_difference_count(const struct chunkID_set *h, const struct chunkID_set *a)
+{
+  return count(h, a, CIDS_DIFFERENCE);
+}
+
+int chunkID_set_count_in_range(const struct chunkID_set *h, int from, int to)
+{
+  int i, cnt = 0;
+
+  if (h->ops->count_in_range) {
+    return h->ops->count_in_range(h, from, to);
+  }
+  for (i = 0; i < chunkID_set_size(h); i++) {
+    int c = chunkID_set_get_chunk(h, i);
+
+    if (c >= from && c < to) {
+      cnt++;
+    }
+  }
+
+  return cnt;
+}
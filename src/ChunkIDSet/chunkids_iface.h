@@ -3,13 +3,31 @@
 
 struct chunkID_set;
 
+#define CIDS_UNION 0
+#define CIDS_INTERSECT 1
+#define CIDS_DIFFERENCE 2
+#define CIDS_XOR 3
+
 struct cids_ops_iface {
   int (*add_chunk)(struct chunkID_set *h, int chunk_id);
   int (*check)(const struct chunkID_set *h, int chunk_id);
+  /* Optional: sets not stored in the elements array */
+  int (*init)(struct chunkID_set *h);
+  int (*get_chunk)(const struct chunkID_set *h, int i);
+  uint32_t (*earliest)(const struct chunkID_set *h);
+  uint32_t (*latest)(const struct chunkID_set *h);
+  void (*clear)(struct chunkID_set *h);
+  void (*trim)(struct chunkID_set *h, int size);
+  void (*destroy)(struct chunkID_set *h);
+  /* Optional: bulk operations between two sets of the same type */
+  int (*combine)(struct chunkID_set *h, const struct chunkID_set *a, int op);
+  int (*count)(const struct chunkID_set *h, const struct chunkID_set *a, int op);
+  int (*count_in_range)(const struct chunkID_set *h, int from, int to);
 };
 struct cids_encoding_iface {
   uint8_t *(*encode)(const struct chunkID_set *h, uint8_t *buff, int buff_len, int meta_len);
   const uint8_t *(*decode)(struct chunkID_set *h, const uint8_t *buff, int buff_len, int *meta_len);
+  int (*encoded_size)(const struct chunkID_set *h);	/* without metadata */
 };
 
 #endif	/* CHUNKIDS_IFACE */
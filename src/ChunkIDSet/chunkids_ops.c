@@ -21,6 +21,8 @@ extern struct cids_encoding_iface prio_encoding;
 extern struct cids_encoding_iface bmap_encoding;
 extern struct cids_ops_iface list_ops;
 extern struct cids_ops_iface set_ops;
+extern struct cids_encoding_iface window_encoding;
+extern struct cids_ops_iface window_ops;
 
 struct chunkID_set *chunkID_set_init(const char *config)
 {
@@ -34,6 +36,7 @@ struct chunkID_set *chunkID_set_init(const char *config)
     return NULL;
   }
   p->n_elements = 0;
+  p->window = NULL;
   cfg_tags = grapes_config_parse(config);
   if (!cfg_tags) {
     free(p);
@@ -43,6 +46,7 @@ struct chunkID_set *chunkID_set_init(const char *config)
   if (!res) {
     p->size = 0;
   }
+  grapes_config_value_int_default(cfg_tags, "compact", &p->compact, 1);
   if (p->size) {
     p->elements = malloc(p->size * sizeof(int));
     if (p->elements == NULL) {
@@ -64,6 +68,11 @@ struct chunkID_set *chunkID_set_init(const char *config)
       p->enc = &bmap_encoding;
       p->ops = &set_ops;
       p->type = CIST_BITMAP;
+    } else if (!memcmp(type, "window", strlen(type) - 1)) {
+      /* Encoded as a bitmap */
+      p->enc = &window_encoding;
+      p->ops = &window_ops;
+      p->type = CIST_BITMAP;
     } else {
       chunkID_set_free(p);
       free(cfg_tags);
@@ -73,6 +82,12 @@ struct chunkID_set *chunkID_set_init(const char *config)
   }
   free(cfg_tags);
   assert(p->type == CIST_PRIORITY || p->type == CIST_BITMAP);
+  if (p->ops->init && p->ops->init(p) < 0) {
+    p->ops = &list_ops;
+    chunkID_set_free(p);
+
+    return NULL;
+  }
 
   return p;
 }
@@ -90,6 +105,9 @@ int chunkID_set_size(const struct chunkID_set *h)
 
 int chunkID_set_get_chunk(const struct chunkID_set *h, int i)
 {
+  if (h->ops->get_chunk) {
+    return h->ops->get_chunk(h, i);
+  }
   if (i < h->n_elements) {
     return h->elements[i];
   }
@@ -105,6 +123,11 @@ int chunkID_set_check(const struct chunkID_set *h, int chunk_id)
 void chunkID_set_clear(struct chunkID_set *h, int size)
 {
   h->n_elements = 0;
+  if (h->ops->clear) {
+    h->ops->clear(h);
+
+    return;
+  }
   h->size = size;
   h->elements = realloc(h->elements, size * sizeof(int));
   if (h->elements == NULL) {
@@ -115,12 +138,56 @@ void chunkID_set_clear(struct chunkID_set *h, int size)
 void chunkID_set_free(struct chunkID_set *h)
 {
   chunkID_set_clear(h,0);
+  if (h->ops->destroy) {
+    h->ops->destroy(h);
+  }
   free(h->elements);
   free(h);
 }
 
+int chunkID_set_prepare(struct chunkID_set *h, uint32_t type, int size)
+{
+  if (type != CIST_PRIORITY && type != CIST_BITMAP) {
+    return -1;
+  }
+  if (h->type != type) {
+    if (h->ops->destroy) {
+      h->ops->destroy(h);
+    }
+    h->type = type;
+    h->ops = type == CIST_PRIORITY ? &list_ops : &set_ops;
+    h->enc = type == CIST_PRIORITY ? &prio_encoding : &bmap_encoding;
+  }
+  h->n_elements = 0;
+  if (h->ops->clear) {
+    h->ops->clear(h);
+
+    return 0;
+  }
+  if (size > 0 && (h->elements == NULL || size > (int)h->size)) {
+    int *res;
+
+    if (size < 2 * (int)h->size) {
+      size = 2 * h->size;
+    }
+    res = realloc(h->elements, size * sizeof(int));
+    if (res == NULL) {
+      return -1;
+    }
+    h->elements = res;
+    h->size = size;
+  }
+
+  return 0;
+}
+
 void chunkID_set_trim(struct chunkID_set *h, int size)
 {
+  if (h->ops->trim) {
+    h->ops->trim(h, size);
+
+    return;
+  }
   if (h->n_elements > size) {
     memmove(h->elements, h->elements + h->n_elements - size, sizeof(h->elements[0]) * size);
     h->n_elements = size;
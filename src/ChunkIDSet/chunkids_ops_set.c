@@ -82,7 +82,127 @@ static int chunkID_set_check_set(const struct chunkID_set *h, int chunk_id)
   return p ? p - h->elements : -1;
 }
 
+/* Position of the first element >= id */
+static int lower_bound(const struct chunkID_set *h, int id)
+{
+  int a = 0, b = h->n_elements;
+
+  while (a < b) {
+    int m = (a + b) / 2;
+
+    if (h->elements[m] < id) {
+      a = m + 1;
+    } else {
+      b = m;
+    }
+  }
+
+  return a;
+}
+
+/* Linear merges of the two sorted arrays */
+static int chunkID_set_combine_set(struct chunkID_set *h, const struct chunkID_set *a, int op)
+{
+  int i = 0, j = 0, n = 0;
+
+  if (op == CIDS_UNION || op == CIDS_XOR) {
+    int k = h->n_elements + a->n_elements;
+
+    if (a->n_elements == 0) {
+      return h->n_elements;
+    }
+    if (h->size < k) {
+      int size = k > 2 * h->size ? k : 2 * h->size;
+      int *res;
+
+      /* Grow geometrically, so that sets reused across calls stop reallocating */
+      res = realloc(h->elements, size * sizeof(int));
+      if (res == NULL) {
+        return -1;
+      }
+      h->elements = res;
+      h->size = size;
+    }
+    /* Merge from the end, so that the result can be built in place */
+    i = h->n_elements - 1;
+    j = a->n_elements - 1;
+    while (i >= 0 && j >= 0) {
+      if (h->elements[i] > a->elements[j]) {
+        h->elements[--k] = h->elements[i--];
+      } else if (h->elements[i] < a->elements[j]) {
+        h->elements[--k] = a->elements[j--];
+      } else {
+        if (op == CIDS_UNION) {
+          h->elements[--k] = h->elements[i];
+        }
+        i--;
+        j--;
+      }
+    }
+    while (j >= 0) {
+      h->elements[--k] = a->elements[j--];
+    }
+    while (i >= 0) {
+      h->elements[--k] = h->elements[i--];
+    }
+    n = h->n_elements + a->n_elements - k;
+    memmove(h->elements, h->elements + k, n * sizeof(int));
+    h->n_elements = n;
+
+    return n;
+  }
+
+  /* Intersection and difference are computed in place */
+  while (i < h->n_elements) {
+    while (j < a->n_elements && a->elements[j] < h->elements[i]) {
+      j++;
+    }
+    if ((j < a->n_elements && a->elements[j] == h->elements[i]) == (op == CIDS_INTERSECT)) {
+      h->elements[n++] = h->elements[i];
+    }
+    i++;
+  }
+  h->n_elements = n;
+
+  return n;
+}
+
+static int chunkID_set_count_set(const struct chunkID_set *h, const struct chunkID_set *a, int op)
+{
+  int i = 0, j = 0, common = 0;
+
+  while (i < h->n_elements && j < a->n_elements) {
+    if (h->elements[i] < a->elements[j]) {
+      i++;
+    } else if (h->elements[i] > a->elements[j]) {
+      j++;
+    } else {
+      common++;
+      i++;
+      j++;
+    }
+  }
+  switch (op) {
+    case CIDS_INTERSECT:
+      return common;
+    case CIDS_DIFFERENCE:
+      return h->n_elements - common;
+    case CIDS_XOR:
+      return h->n_elements + a->n_elements - 2 * common;
+    default:
+      return h->n_elements + a->n_elements - common;
+  }
+}
+
+static int chunkID_set_count_in_range_set(const struct chunkID_set *h, int from, int to)
+{
+  return from < to ? lower_bound(h, to) - lower_bound(h, from) : 0;
+}
+
 struct cids_ops_iface set_ops = {
   .add_chunk = chunkID_set_add_chunk_set,
   .check = chunkID_set_check_set,
+  .combine = chunkID_set_combine_set,
+  .count = chunkID_set_count_set,
+  .count_in_range = chunkID_set_count_in_range_set,
 };
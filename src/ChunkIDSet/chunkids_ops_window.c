@@ -0,0 +1,500 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "chunkids_private.h"
+#include "chunkids_iface.h"
+#include "int_coding.h"
+#include "chunkidset.h"
+
+#define MIN_WORDS 4
+#define MAX_WORDS 4096	/* Span of 262144 chunk IDs (32KB of bitmap) */
+
+/*
+ * The set is a bitmap covering the IDs from first to latest, stored in a
+ * circular array of 64 bit words: chunk ID i is bit i % 64 of word
+ * (i / 64) % words. Words outside the window are kept to 0, so the window
+ * slides (or grows) without moving the bits. The window spans at most
+ * MAX_WORDS words: adding a later ID drops the earliest ones, and earlier
+ * IDs are refused, so that a far-off ID cannot make the bitmap huge.
+ * chunkID_set_get_chunk() returns the IDs in increasing order, selecting
+ * the i^th set bit; the position of the last selection is cached, so that
+ * iterating on the set costs O(1) per chunk.
+ */
+struct cids_window {
+  uint64_t *bits;
+  int words;
+  int first;
+  int last;
+  int cursor_i;
+  int cursor_w;
+  int cursor_rank;
+};
+
+static uint64_t *word(const struct cids_window *w, int n)
+{
+  return &w->bits[n & (w->words - 1)];
+}
+
+static int window_init(struct chunkID_set *h)
+{
+  struct cids_window *w;
+  int words = MIN_WORDS;
+
+  while (words < MAX_WORDS && words * 64 < (int)h->size) {
+    words *= 2;
+  }
+  w = malloc(sizeof(struct cids_window));
+  if (w == NULL) {
+    return -1;
+  }
+  w->bits = calloc(words, sizeof(uint64_t));
+  if (w->bits == NULL) {
+    free(w);
+
+    return -1;
+  }
+  w->words = words;
+  w->cursor_i = -1;
+  free(h->elements);
+  h->elements = NULL;
+  h->window = w;
+
+  return 0;
+}
+
+static int window_grow(struct cids_window *w, int first, int last)
+{
+  uint64_t *bits;
+  int words = w->words, n;
+
+  while ((last >> 6) - (first >> 6) >= words) {
+    words *= 2;
+  }
+  bits = calloc(words, sizeof(uint64_t));
+  if (bits == NULL) {
+    return -1;
+  }
+  for (n = w->first >> 6; n <= w->last >> 6; n++) {
+    bits[n & (words - 1)] = *word(w, n);
+  }
+  free(w->bits);
+  w->bits = bits;
+  w->words = words;
+
+  return 0;
+}
+
+/* Drop the IDs in the words before from */
+static void window_slide(struct chunkID_set *h, int from)
+{
+  struct cids_window *w = h->window;
+  int n;
+
+  for (n = w->first >> 6; n < from && n <= w->last >> 6; n++) {
+    uint64_t *p = word(w, n);
+
+    h->n_elements -= __builtin_popcountll(*p);
+    *p = 0;
+  }
+  w->cursor_i = -1;
+  if (h->n_elements == 0) {
+    w->first = w->last = 0;
+
+    return;
+  }
+  for (n = from; *word(w, n) == 0; n++);
+  w->first = n * 64 + __builtin_ctzll(*word(w, n));
+}
+
+static int window_add_chunk(struct chunkID_set *h, int chunk_id)
+{
+  struct cids_window *w = h->window;
+  uint64_t *p, bit = 1ULL << (chunk_id & 63);
+
+  if (chunk_id < 0) {
+    return -1;
+  }
+  if (h->n_elements && chunk_id < w->first && (w->last >> 6) - (chunk_id >> 6) >= MAX_WORDS) {
+    return -1;
+  }
+  if (h->n_elements && chunk_id > w->last && (chunk_id >> 6) - (w->first >> 6) >= MAX_WORDS) {
+    window_slide(h, (chunk_id >> 6) - MAX_WORDS + 1);
+  }
+  if (h->n_elements == 0) {
+    w->first = w->last = chunk_id;
+  } else {
+    int first = chunk_id < w->first ? chunk_id : w->first;
+    int last = chunk_id > w->last ? chunk_id : w->last;
+
+    if ((last >> 6) - (first >> 6) >= w->words && window_grow(w, first, last) < 0) {
+      return -1;
+    }
+    w->first = first;
+    w->last = last;
+  }
+  p = word(w, chunk_id >> 6);
+  if (*p & bit) {
+    return 0;
+  }
+  *p |= bit;
+  w->cursor_i = -1;
+
+  return ++h->n_elements;
+}
+
+static int window_check(const struct chunkID_set *h, int chunk_id)
+{
+  const struct cids_window *w = h->window;
+
+  if (h->n_elements == 0 || chunk_id < w->first || chunk_id > w->last) {
+    return -1;
+  }
+
+  return (*word(w, chunk_id >> 6) & (1ULL << (chunk_id & 63))) ? chunk_id - w->first : -1;
+}
+
+static int window_get_chunk(const struct chunkID_set *h, int i)
+{
+  struct cids_window *w = h->window;
+  int n, rank;
+
+  if (i < 0 || i >= h->n_elements) {
+    return -1;
+  }
+  if (w->cursor_i >= 0 && w->cursor_i <= i) {
+    n = w->cursor_w;
+    rank = w->cursor_rank;
+  } else {
+    n = w->first >> 6;
+    rank = 0;
+  }
+  for (;; n++) {
+    uint64_t x = *word(w, n);
+    int cnt = __builtin_popcountll(x);
+
+    if (rank + cnt > i) {
+      int k;
+
+      for (k = i - rank; k; k--) {
+        x &= x - 1;
+      }
+      w->cursor_i = i;
+      w->cursor_w = n;
+      w->cursor_rank = rank;
+
+      return n * 64 + __builtin_ctzll(x);
+    }
+    rank += cnt;
+  }
+}
+
+static uint32_t window_earliest(const struct chunkID_set *h)
+{
+  return h->n_elements ? (uint32_t)h->window->first : CHUNKID_INVALID;
+}
+
+static uint32_t window_latest(const struct chunkID_set *h)
+{
+  return h->n_elements ? (uint32_t)h->window->last : CHUNKID_INVALID;
+}
+
+static void window_clear(struct chunkID_set *h)
+{
+  struct cids_window *w = h->window;
+
+  memset(w->bits, 0, w->words * sizeof(uint64_t));
+  w->cursor_i = -1;
+}
+
+/* Keep the size latest chunks */
+static void window_trim(struct chunkID_set *h, int size)
+{
+  struct cids_window *w = h->window;
+  int drop = h->n_elements - size;
+  int n;
+
+  if (drop <= 0) {
+    return;
+  }
+  if (size == 0) {
+    window_clear(h);
+    h->n_elements = 0;
+
+    return;
+  }
+  for (n = w->first >> 6;; n++) {
+    uint64_t *p = word(w, n);
+    int cnt = __builtin_popcountll(*p);
+
+    if (cnt > drop) {
+      for (; drop; drop--) {
+        *p &= *p - 1;
+      }
+      w->first = n * 64 + __builtin_ctzll(*p);
+      break;
+    }
+    *p = 0;
+    drop -= cnt;
+  }
+  h->n_elements = size;
+  w->cursor_i = -1;
+}
+
+static void window_destroy(struct chunkID_set *h)
+{
+  free(h->window->bits);
+  free(h->window);
+  h->window = NULL;
+}
+
+/* Recompute size, first and last after a bulk operation */
+static int window_refresh(struct chunkID_set *h, int from, int to)
+{
+  struct cids_window *w = h->window;
+  int n, first = -1, last = -1, cnt = 0;
+
+  for (n = from; n <= to; n++) {
+    uint64_t x = *word(w, n);
+
+    if (x) {
+      if (first < 0) {
+        first = n * 64 + __builtin_ctzll(x);
+      }
+      last = n * 64 + 63 - __builtin_clzll(x);
+      cnt += __builtin_popcountll(x);
+    }
+  }
+  h->n_elements = cnt;
+  w->first = first;
+  w->last = last;
+  w->cursor_i = -1;
+
+  return cnt;
+}
+
+/*
+ * Word-wise operations: the loops only touch the words covering the
+ * two windows.
+ */
+static int window_combine(struct chunkID_set *h, const struct chunkID_set *a, int op)
+{
+  struct cids_window *w = h->window;
+  const struct cids_window *wa = a->window;
+  int n, from, to;
+
+  if (h->n_elements == 0 || a->n_elements == 0) {
+    if (op == CIDS_INTERSECT) {
+      window_clear(h);
+      h->n_elements = 0;
+    } else if ((op == CIDS_UNION || op == CIDS_XOR) && a->n_elements) {
+      /* h is empty, so its window can be moved on the one of a */
+      w->first = w->last = wa->first;
+      if ((wa->last >> 6) - (wa->first >> 6) >= w->words && window_grow(w, wa->first, wa->last) < 0) {
+        return -1;
+      }
+      for (n = wa->first >> 6; n <= wa->last >> 6; n++) {
+        *word(w, n) = *word(wa, n);
+      }
+      w->last = wa->last;
+      h->n_elements = a->n_elements;
+      w->cursor_i = -1;
+    }
+
+    return h->n_elements;
+  }
+
+  if (op == CIDS_UNION || op == CIDS_XOR) {
+    int first = wa->first < w->first ? wa->first : w->first;
+    int last = wa->last > w->last ? wa->last : w->last;
+
+    from = wa->first >> 6;
+    if ((last >> 6) - (first >> 6) >= MAX_WORDS) {
+      /* Keep the latest MAX_WORDS words of the result */
+      first = ((last >> 6) - MAX_WORDS + 1) * 64;
+      if (w->first < first) {
+        window_slide(h, first >> 6);
+        if (h->n_elements == 0) {
+          w->first = w->last = first;
+        }
+      }
+      if (from < first >> 6) {
+        from = first >> 6;
+      }
+    }
+    if ((last >> 6) - (first >> 6) >= w->words && window_grow(w, first, last) < 0) {
+      return -1;
+    }
+    for (n = from; n <= wa->last >> 6; n++) {
+      if (op == CIDS_UNION) {
+        *word(w, n) |= *word(wa, n);
+      } else {
+        *word(w, n) ^= *word(wa, n);
+      }
+    }
+    if (window_refresh(h, first >> 6, last >> 6) == 0) {
+      w->first = w->last = 0;
+    }
+
+    return h->n_elements;
+  }
+
+  from = w->first >> 6;
+  to = w->last >> 6;
+  for (n = from; n <= to; n++) {
+    uint64_t x = (n >= wa->first >> 6 && n <= wa->last >> 6) ? *word(wa, n) : 0;
+
+    if (op == CIDS_INTERSECT) {
+      *word(w, n) &= x;
+    } else {
+      *word(w, n) &= ~x;
+    }
+  }
+  if (window_refresh(h, from, to) == 0) {
+    /* Keep the invariant: first and last are meaningful only if not empty */
+    w->first = w->last = 0;
+  }
+
+  return h->n_elements;
+}
+
+static int window_count(const struct chunkID_set *h, const struct chunkID_set *a, int op)
+{
+  const struct cids_window *w = h->window;
+  const struct cids_window *wa = a->window;
+  int n, from, to, common = 0;
+
+  if (h->n_elements && a->n_elements) {
+    from = (w->first > wa->first ? w->first : wa->first) >> 6;
+    to = (w->last < wa->last ? w->last : wa->last) >> 6;
+    for (n = from; n <= to; n++) {
+      common += __builtin_popcountll(*word(w, n) & *word(wa, n));
+    }
+  }
+  switch (op) {
+    case CIDS_INTERSECT:
+      return common;
+    case CIDS_DIFFERENCE:
+      return h->n_elements - common;
+    case CIDS_XOR:
+      return h->n_elements + a->n_elements - 2 * common;
+    default:
+      return h->n_elements + a->n_elements - common;
+  }
+}
+
+static int window_count_in_range(const struct chunkID_set *h, int from, int to)
+{
+  const struct cids_window *w = h->window;
+  int n, cnt = 0;
+
+  if (h->n_elements == 0) {
+    return 0;
+  }
+  if (from < w->first) {
+    from = w->first;
+  }
+  if (to > w->last + 1) {
+    to = w->last + 1;
+  }
+  if (from >= to) {
+    return 0;
+  }
+  for (n = from >> 6; n <= (to - 1) >> 6; n++) {
+    uint64_t x = *word(w, n);
+
+    if (n == from >> 6) {
+      x &= ~0ULL << (from & 63);
+    }
+    if (n == (to - 1) >> 6 && ((to - 1) & 63) != 63) {
+      x &= (1ULL << (((to - 1) & 63) + 1)) - 1;
+    }
+    cnt += __builtin_popcountll(x);
+  }
+
+  return cnt;
+}
+
+struct cids_ops_iface window_ops = {
+  .add_chunk = window_add_chunk,
+  .check = window_check,
+  .init = window_init,
+  .get_chunk = window_get_chunk,
+  .earliest = window_earliest,
+  .latest = window_latest,
+  .clear = window_clear,
+  .trim = window_trim,
+  .destroy = window_destroy,
+  .combine = window_combine,
+  .count = window_count,
+  .count_in_range = window_count_in_range,
+};
+
+/* Same wire format as the "bitmap" sets */
+static uint8_t *window_encode(const struct chunkID_set *h, uint8_t *buff, int buff_len, int meta_len)
+{
+  const struct cids_window *w = h->window;
+  int elements, n;
+
+  elements = h->n_elements ? w->last - w->first + 1 : 0;
+  int_cpy(buff, elements);
+  elements = elements / 8 + (elements % 8 ? 1 : 0);
+  if (buff_len < elements + 16 + meta_len) {
+    return NULL;
+  }
+  int_cpy(buff + 12, h->n_elements ? w->first : 0);
+  memset(buff + 16, 0, elements);
+  for (n = w->first >> 6; h->n_elements && n <= w->last >> 6; n++) {
+    uint64_t x = *word(w, n);
+
+    while (x) {
+      int i = n * 64 + __builtin_ctzll(x) - w->first;
+
+      buff[16 + i / 8] |= 1 << (i % 8);
+      x &= x - 1;
+    }
+  }
+
+  return buff + 16 + elements;
+}
+
+static const uint8_t *window_decode(struct chunkID_set *h, const uint8_t *buff, int buff_len, int *meta_len)
+{
+  int i, base, elements, byte_cnt;
+
+  elements = int_rcpy(buff);
+  byte_cnt = elements / 8 + (elements % 8 ? 1 : 0);
+  if (buff_len < 16 + byte_cnt + *meta_len) {
+    fprintf(stderr, "Error in decoding chunkid set - wrong length\n");
+
+    return NULL;
+  }
+  base = int_rcpy(buff + 12);
+  for (i = 0; i < elements; i++) {
+    if (buff[16 + (i / 8)] & 1 << (i % 8)) {
+      window_add_chunk(h, base + i);
+    }
+  }
+
+  return buff + 16 + byte_cnt;
+}
+
+static int window_size(const struct chunkID_set *h)
+{
+  int elements = h->n_elements ? h->window->last - h->window->first + 1 : 0;
+
+  return 16 + elements / 8 + (elements % 8 ? 1 : 0);
+}
+
+struct cids_encoding_iface window_encoding = {
+  .encode = window_encode,
+  .decode = window_decode,
+  .encoded_size = window_size,
+};
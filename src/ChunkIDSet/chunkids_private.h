@@ -3,6 +3,7 @@
 
 #define CIST_BITMAP 1
 #define CIST_PRIORITY 2
+#define CIST_COMPACT 3	/* only on the wire: see chunkids_encoding_compact.c */
 
 struct chunkID_set {
   uint32_t type;
@@ -11,6 +12,15 @@ struct chunkID_set {
   int *elements;
   struct cids_ops_iface *ops;
   struct cids_encoding_iface *enc;
+  struct cids_window *window;	/* state of "type=window" sets */
+  int compact;			/* the compact wire format can be used */
 };
 
+/*
+ * Empty h, and make it able to store size chunk IDs received with the
+ * given wire type (CIST_PRIORITY or CIST_BITMAP). A set already of that
+ * type keeps its ops (and its memory, if large enough).
+ */
+int chunkID_set_prepare(struct chunkID_set *h, uint32_t type, int size);
+
 #endif /* CHUNKID_SET_PRIVATE */
@@ -24,7 +24,7 @@ int parseChunkMsg(const uint8_t *buff, int buff_len, struct chunk *c, uint16_t *
     return -1;
   }
 
-  res = decodeChunk(c, buff + sizeof(*transid), buff_len - sizeof(*transid));
+  res = decodeChunkBorrow(c, buff + sizeof(*transid), buff_len - sizeof(*transid));
   if (res < 0) {
     return -1;
   }
@@ -43,29 +43,22 @@ int parseChunkMsg(const uint8_t *buff, int buff_len, struct chunk *c, uint16_t *
  * @param[in] c Chunk to send
  * @return 0 on success, <0 on error
  */
-//TO CHECK AND CORRECT
-//XXX Send data is in char while our buffer is in uint8
 int sendChunk(const struct nodeID *to, const struct chunk *c, uint16_t transid)
 {
-  int buff_len;
-  uint8_t *buff;
-  int res;
+  uint8_t buff[1 + sizeof(transid) + CHUNK_HEADER_SIZE];
+  struct iovec iov[3];
+  int n;
 
-  buff_len  = CHUNK_HEADER_SIZE + sizeof(transid) + c->size + c->attributes_size;
-  buff = malloc(buff_len + 1);
-  if (buff == NULL) {
-      return -1;
-  }
+  /* Message type, transaction ID and chunk header are the only copied data */
   buff[0] = MSG_TYPE_CHUNK;
   int16_cpy(buff + 1, transid);
-  res = encodeChunk(c, buff + 1 + sizeof(transid), buff_len);
-  if (res < 0) {
-    free(buff);
-
+  iov[0].iov_base = buff;
+  iov[0].iov_len = sizeof(buff);
+  n = encodeChunkIov(c, buff + 1 + sizeof(transid), iov + 1);
+  if (n < 0) {
     return -2;
   }
-  send_to_peer(localID, to, buff, buff_len + 1);
-  free(buff);
+  send_to_peer_iov(localID, to, iov, n + 1);
 
   return EXIT_SUCCESS;
 }
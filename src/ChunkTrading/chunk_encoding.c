@@ -11,19 +11,17 @@
 #include <stdint.h>
 
 #include "chunk.h"
+#include "chunk_pool.h"
+#include "grapes_alloc.h"
+#include "net_helper.h"
 #include "trade_msg_la.h"
 #include "int_coding.h"
 
 
-int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len)
+static void encode_header(const struct chunk *c, uint8_t *buff)
 {
   uint32_t half_ts;
 
-  if (buff_len < CHUNK_HEADER_SIZE + c->size + c->attributes_size) {
-    /* Not enough space... */
-    return -1;
-  }
-
   int_cpy(buff, c->id);
   half_ts = c->timestamp >> 32;
   int_cpy(buff + 4, half_ts);
@@ -31,6 +29,16 @@ int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len)
   int_cpy(buff + 8, half_ts);
   int_cpy(buff + 12, c->size);
   int_cpy(buff + 16, c->attributes_size);
+}
+
+int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len)
+{
+  if (buff_len < CHUNK_HEADER_SIZE + c->size + c->attributes_size) {
+    /* Not enough space... */
+    return -1;
+  }
+
+  encode_header(c, buff);
   memcpy(buff + CHUNK_HEADER_SIZE, c->data, c->size);
   if (c->attributes_size) {
     memcpy(buff + CHUNK_HEADER_SIZE + c->size, c->attributes, c->attributes_size);
@@ -39,7 +47,22 @@ int encodeChunk(const struct chunk *c, uint8_t *buff, int buff_len)
   return CHUNK_HEADER_SIZE + c->size + c->attributes_size;
 }
 
-int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len)
+int encodeChunkIov(const struct chunk *c, uint8_t *header, struct iovec *iov)
+{
+  int n = 0;
+
+  encode_header(c, header);
+  iov[n].iov_base = c->data;
+  iov[n++].iov_len = c->size;
+  if (c->attributes_size) {
+    iov[n].iov_base = c->attributes;
+    iov[n++].iov_len = c->attributes_size;
+  }
+
+  return n;
+}
+
+static int decode_chunk(struct chunk *c, const uint8_t *buff, int buff_len, int pooled)
 {
   if (buff_len < CHUNK_HEADER_SIZE) {
     return -1;
@@ -54,7 +77,7 @@ int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len)
   if (buff_len < c->size + CHUNK_HEADER_SIZE) {
     return -2;
   }
-  c->data = malloc(c->size);
+  c->data = pooled ? grapes_malloc(c->size) : malloc(c->size);
   if (c->data == NULL) {
     return -3;
   }
@@ -64,7 +87,7 @@ int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len)
     if (buff_len < c->size + c->attributes_size) {
       return -4;
     }
-    c->attributes = malloc(c->attributes_size);
+    c->attributes = pooled ? grapes_malloc(c->attributes_size) : malloc(c->attributes_size);
     if (c->attributes == NULL) {
       return -5;
     }
@@ -73,3 +96,38 @@ int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len)
 
   return CHUNK_HEADER_SIZE + c->size + c->attributes_size;
 }
+
+int decodeChunk(struct chunk *c, const uint8_t *buff, int buff_len)
+{
+  return decode_chunk(c, buff, buff_len, 0);
+}
+
+int decodeChunkBorrow(struct chunk *c, const uint8_t *buff, int buff_len)
+{
+  if (!chunk_pool_owns(buff)) {
+    /* Whoever set up the pool releases the chunks with chunk_data_free() */
+    return decode_chunk(c, buff, buff_len, chunk_pool_enabled());
+  }
+  if (buff_len < CHUNK_HEADER_SIZE) {
+    return -1;
+  }
+  c->id = int_rcpy(buff);
+  c->timestamp = int_rcpy(buff + 4);
+  c->timestamp = c->timestamp << 32;
+  c->timestamp |= int_rcpy(buff + 8);
+  c->size = int_rcpy(buff + 12);
+  c->attributes_size = int_rcpy(buff + 16);
+  if (c->size < 0 || c->attributes_size < 0 ||
+      buff_len < CHUNK_HEADER_SIZE + c->size + c->attributes_size) {
+    return -2;
+  }
+
+  /* Payload and attributes hold one reference each to the receive buffer */
+  c->data = chunk_pool_ref(buff + CHUNK_HEADER_SIZE);
+  c->attributes = NULL;
+  if (c->attributes_size > 0) {
+    c->attributes = chunk_pool_ref(buff + CHUNK_HEADER_SIZE + c->size);
+  }
+
+  return CHUNK_HEADER_SIZE + c->size + c->attributes_size;
+}
@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chunk_pool.h"
+#include "grapes_alloc.h"
+#include "grapes_config.h"
+
+#define DEFAULT_BUFFERS 64
+#define DEFAULT_BUFFER_SIZE 65536
+
+/*
+ * All the buffers are allocated in one single arena, so that a pointer
+ * inside a buffer is mapped to its index (and reference count) with a
+ * division, and membership is a range check.
+ */
+static uint8_t *arena;
+static int buffer_size;
+static int n_buffers;
+static int *refs;
+static int *free_stack;
+static int n_free;
+
+int chunk_pool_init(const char *config)
+{
+  struct tag *cfg_tags;
+  int i;
+
+  chunk_pool_destroy();
+  cfg_tags = grapes_config_parse(config);
+  if (!cfg_tags) {
+    return -1;
+  }
+  grapes_config_value_int_default(cfg_tags, "buffers", &n_buffers, DEFAULT_BUFFERS);
+  grapes_config_value_int_default(cfg_tags, "buffer_size", &buffer_size, DEFAULT_BUFFER_SIZE);
+  free(cfg_tags);
+  if (n_buffers <= 0 || buffer_size <= 0) {
+    n_buffers = 0;
+
+    return -1;
+  }
+
+  arena = malloc((size_t)n_buffers * buffer_size);
+  refs = malloc(n_buffers * sizeof(int));
+  free_stack = malloc(n_buffers * sizeof(int));
+  if (arena == NULL || refs == NULL || free_stack == NULL) {
+    chunk_pool_destroy();
+
+    return -1;
+  }
+  for (i = 0; i < n_buffers; i++) {
+    refs[i] = 0;
+    free_stack[i] = n_buffers - 1 - i;
+  }
+  n_free = n_buffers;
+
+  return 0;
+}
+
+static int buffer_index(const void *p)
+{
+  return ((const uint8_t *)p - arena) / buffer_size;
+}
+
+uint8_t *chunk_pool_get(int size)
+{
+  int i;
+
+  if (n_free == 0 || size > buffer_size) {
+    return NULL;
+  }
+  i = free_stack[--n_free];
+  refs[i] = 1;
+
+  return arena + (size_t)i * buffer_size;
+}
+
+int chunk_pool_enabled(void)
+{
+  return arena != NULL;
+}
+
+int chunk_pool_owns(const void *p)
+{
+  const uint8_t *b = p;
+
+  return arena && b >= arena && b < arena + (size_t)n_buffers * buffer_size;
+}
+
+uint8_t *chunk_pool_ref(const void *p)
+{
+  refs[buffer_index(p)]++;
+
+  return arena + ((const uint8_t *)p - arena);
+}
+
+void chunk_pool_put(const void *p)
+{
+  int i = buffer_index(p);
+
+  if (--refs[i] == 0) {
+    free_stack[n_free++] = i;
+  }
+}
+
+void chunk_data_free(void *p)
+{
+  if (chunk_pool_owns(p)) {
+    chunk_pool_put(p);
+  } else {
+    grapes_free(p);
+  }
+}
+
+void chunk_pool_destroy(void)
+{
+  free(arena);
+  arena = NULL;
+  free(refs);
+  refs = NULL;
+  free(free_stack);
+  free_stack = NULL;
+  n_buffers = 0;
+  n_free = 0;
+}
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 
 #include "chunk.h"
+#include "peer.h"
 #include "grapes_msg_types.h"
 #include "chunkidset.h"
 #include "trade_sig_la.h"
@@ -38,6 +39,10 @@
 #define MSG_SIG_ACK 11
 //Request the BufferMap
 #define MSG_SIG_BMREQ 12
+//Receive the differences from the previous BufferMap
+#define MSG_SIG_BMDIFF 13
+//Acknowledge a BufferMap
+#define MSG_SIG_BMACK 14
 
 #define SIG_META_LEN 1024
 #define SIG_BUF_LEN 2048
@@ -53,6 +58,41 @@ struct sig_nal {
 //set the local node ID
 static struct nodeID *localID;
 
+//buffers for the outgoing messages (no allocations per message)
+static uint8_t sig_meta[SIG_META_LEN];
+static uint8_t sig_buff[SIG_BUF_LEN];
+//scratch sets for the buffer map differences
+static struct chunkID_set *diff_set, *added_set, *removed_set;
+
+//a whole buffer map this much older than the stored one comes from a
+//sender that restarted its sequence numbers, and is not a stale one
+#define BMAP_SEQ_WINDOW 1024
+//send a whole buffer map after this many ones without acknowledgements
+#define BMAP_MAX_UNACKED 32
+
+/*
+ * Buffer maps sent to a peer as differences. The differences are computed
+ * from a base buffer map that the peer acknowledged, and contain all the
+ * chunk IDs changed in any buffer map sent since the base: so, they can be
+ * applied to whichever of these buffer maps the peer has, and each
+ * difference needs no acknowledgement. The first buffer map sent after the
+ * base becomes the next base when the peer acknowledges it, or any later one.
+ * Whole buffer maps are sent while there is no base (the peer requested one
+ * because it lost its copy, see applyBufferMap()) or when acknowledgements
+ * stop arriving.
+ */
+struct bmap_diff {
+  struct chunkID_set *base;         //acknowledged by the peer, if has_base
+  struct chunkID_set *changed;      //chunk IDs changed since base
+  struct chunkID_set *next;         //next base, if has_next
+  struct chunkID_set *next_changed; //chunk IDs changed since next
+  uint16_t seq;                     //sequence number of the last buffer map
+  uint16_t next_seq;                //sequence number of next
+  int has_base;
+  int has_next;
+  int unacked;                      //buffer maps sent since the last ACK
+};
+
 int chunkSignalingInit(struct nodeID *myID)
 {
   if(!myID)
@@ -62,70 +102,124 @@ int chunkSignalingInit(struct nodeID *myID)
   return 1;
 }
 
+static int parse_meta(const void *meta, int meta_len, struct nodeID **owner_id,
+                      int *max_deliver, uint16_t *trans_id, enum signaling_type *sig_type)
+{
+  const struct sig_nal *signal = meta;
+  int dummy;
+
+  if (meta_len == 0) {
+    return -1;
+  }
+  switch (signal->type) {
+    case MSG_SIG_OFF:
+      *sig_type = sig_offer;
+      break;
+    case MSG_SIG_ACC:
+      *sig_type = sig_accept;
+      break;
+    case MSG_SIG_REQ:
+      *sig_type = sig_request;
+      break;
+    case MSG_SIG_DEL:
+      *sig_type = sig_deliver;
+      break;
+    case MSG_SIG_BMOFF:
+      *sig_type = sig_send_buffermap;
+      break;
+    case MSG_SIG_ACK:
+      *sig_type = sig_ack;
+      break;
+    case MSG_SIG_BMREQ:
+      *sig_type = sig_request_buffermap;
+      break;
+    case MSG_SIG_BMDIFF:
+      *sig_type = sig_send_buffermap_diff;
+      break;
+    case MSG_SIG_BMACK:
+      *sig_type = sig_ack_buffermap;
+      break;
+    default:
+      fprintf(stderr, "Error invalid signaling message: type %d\n", signal->type);
+      return -1;
+  }
+  *max_deliver = signal->max_deliver;
+  *trans_id = signal->trans_id;
+  *owner_id = (meta_len > sizeof(struct sig_nal) - 1 ? nodeid_undump(&(signal->third_peer), &dummy) : NULL);
+
+  return 1;
+}
+
 int parseSignaling(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
                    struct chunkID_set **cset, int *max_deliver, uint16_t *trans_id,
                    enum signaling_type *sig_type)
 {
   int meta_len = 0;
   void *meta;
+  int res;
 
   *cset = decodeChunkSignaling(&meta, &meta_len, buff, buff_len);
-  if (meta_len) {
-    struct sig_nal *signal = meta;
-    int dummy;
-
-    switch (signal->type) {
-      case MSG_SIG_OFF:
-        *sig_type = sig_offer;
-        break;
-      case MSG_SIG_ACC:
-        *sig_type = sig_accept;
-        break;
-      case MSG_SIG_REQ:
-        *sig_type = sig_request;
-        break;
-      case MSG_SIG_DEL:
-        *sig_type = sig_deliver;
-        break;
-      case MSG_SIG_BMOFF:
-        *sig_type = sig_send_buffermap;
-        break;
-      case MSG_SIG_ACK:
-        *sig_type = sig_ack;
-        break;
-      case MSG_SIG_BMREQ:
-        *sig_type = sig_request_buffermap;
-        break;
-      default:
-        fprintf(stderr, "Error invalid signaling message: type %d\n", signal->type);
-        return -1;
-    }
-    *max_deliver = signal->max_deliver;
-    *trans_id = signal->trans_id;
-    *owner_id = (meta_len > sizeof(struct sig_nal) - 1 ? nodeid_undump(&(signal->third_peer), &dummy) : NULL);
-    free(meta);
-  } else {
+  res = parse_meta(meta, meta_len, owner_id, max_deliver, trans_id, sig_type);
+  free(meta);
+
+  return res;
+}
+
+int parseSignalingInto(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
+                       struct chunkID_set *cset, int *max_deliver, uint16_t *trans_id,
+                       enum signaling_type *sig_type)
+{
+  const void *meta;
+  int meta_len;
+
+  if (decodeChunkSignalingInto(cset, &meta, &meta_len, buff, buff_len) < 0) {
     return -1;
   }
 
-  return 1;
+  return parse_meta(meta, meta_len, owner_id, max_deliver, trans_id, sig_type);
 }
 
-static int sendSignaling(int type, const struct nodeID *to_id,
-                         const struct nodeID *owner_id,
-                         const struct chunkID_set *cset, int max_deliver,
-                         uint16_t trans_id)
+int parseSignalingDiff(const uint8_t *buff, int buff_len, struct nodeID **owner_id,
+                       struct chunkID_set *added, struct chunkID_set *removed,
+                       int *max_deliver, uint16_t *trans_id, enum signaling_type *sig_type)
 {
-  int meta_len, msg_len;
-  uint8_t *buff;
-  struct sig_nal *sigmex;
-
-  sigmex = malloc(SIG_META_LEN);
-  if (!sigmex) {
-    fprintf(stderr, "Error allocating meta-buffer\n");
+  const uint8_t *end = buff + buff_len;
+  const void *meta;
+  int meta_len, res;
 
+  if (decodeChunkSignalingInto(added, &meta, &meta_len, buff, buff_len) < 0) {
     return -1;
   }
+  res = parse_meta(meta, meta_len, owner_id, max_deliver, trans_id, sig_type);
+  if (res < 0) {
+    return res;
+  }
+  chunkID_set_trim(removed, 0);
+  if (*sig_type == sig_send_buffermap_diff) {
+    buff = (const uint8_t *)meta + meta_len;
+    if (decodeChunkSignalingInto(removed, &meta, &meta_len, buff, end - buff) < 0) {
+      if (*owner_id) {
+        nodeid_free(*owner_id);
+        *owner_id = NULL;
+      }
+
+      return -1;
+    }
+  }
+
+  return res;
+}
+
+static int send_signaling(int type, const struct nodeID *to_id,
+                          const struct nodeID *owner_id,
+                          const struct chunkID_set *cset,
+                          const struct chunkID_set *removed, int max_deliver,
+                          uint16_t trans_id)
+{
+  int meta_len, msg_len;
+  uint8_t *buff = sig_buff;
+  struct sig_nal *sigmex = (struct sig_nal *)sig_meta;
+
   sigmex->type = type;
   sigmex->max_deliver = max_deliver;    
   sigmex->trans_id = trans_id;
@@ -134,30 +228,34 @@ static int sendSignaling(int type, const struct nodeID *to_id,
   if (owner_id) {
     meta_len += nodeid_dump(&sigmex->third_peer, owner_id, SIG_META_LEN - meta_len);
   }
-  buff = malloc(SIG_BUF_LEN);
-  if (!buff) {
-    fprintf(stderr, "Error allocating buffer\n");
-    free(sigmex);
-
-    return -1;
-  }
 
   buff[0] = MSG_TYPE_SIGNALLING;
   msg_len = 1 + encodeChunkSignaling(cset, sigmex, meta_len, buff+1, SIG_BUF_LEN-1);
-  free(sigmex);
+  if (removed && msg_len > 0) {
+    /* The chunk IDs removed from a buffer map follow the message */
+    int len = encodeChunkSignaling(removed, NULL, 0, buff + msg_len, SIG_BUF_LEN - msg_len);
+
+    msg_len = len > 0 ? msg_len + len : -1;
+  }
   if (msg_len <= 0) {
     fprintf(stderr, "Error in encoding chunk set for sending a buffermap\n");
-    free(buff);
 
     return -1;
   } else {
     send_to_peer(localID, to_id, buff, msg_len);
   }    
-  free(buff);
 
   return 1;
 }
 
+static int sendSignaling(int type, const struct nodeID *to_id,
+                         const struct nodeID *owner_id,
+                         const struct chunkID_set *cset, int max_deliver,
+                         uint16_t trans_id)
+{
+  return send_signaling(type, to_id, owner_id, cset, NULL, max_deliver, trans_id);
+}
+
 int requestChunks(const struct nodeID *to, const ChunkIDSet *cset,
                   int max_deliver, uint16_t trans_id)
 {
@@ -198,3 +296,186 @@ int requestBufferMap(const struct nodeID *to, const struct nodeID *owner,
   return sendSignaling(MSG_SIG_BMREQ, to, (!owner?localID:owner), NULL,
                        0, trans_id);
 }
+
+static struct chunkID_set *set_empty(struct chunkID_set **s)
+{
+  if (*s == NULL) {
+    *s = chunkID_set_init("type=bitmap");
+  } else {
+    chunkID_set_trim(*s, 0);
+  }
+
+  return *s;
+}
+
+static int set_copy(struct chunkID_set **dst, const struct chunkID_set *src)
+{
+  if (set_empty(dst) == NULL) {
+    return -1;
+  }
+
+  return chunkID_set_union(*dst, src);
+}
+
+/* Add to changed the chunk IDs that are in only one of from and to */
+static int add_changes(struct chunkID_set *changed, const struct chunkID_set *from,
+                       const struct chunkID_set *to)
+{
+  if (set_copy(&diff_set, from) < 0 || chunkID_set_xor(diff_set, to) < 0) {
+    return -1;
+  }
+
+  return chunkID_set_union(changed, diff_set);
+}
+
+int sendBufferMapDiff(struct peer *to, const struct nodeID *owner,
+                      const struct chunkID_set *bmap, int cb_size)
+{
+  struct bmap_diff *d = to->bmap_sent;
+  uint16_t seq;
+  int res;
+
+  if (d == NULL) {
+    d = calloc(1, sizeof(struct bmap_diff));
+    if (d == NULL) {
+      return -1;
+    }
+    to->bmap_sent = d;
+  }
+  seq = d->seq + 1;
+
+  if (d->has_base && add_changes(d->changed, d->base, bmap) < 0) {
+    return -1;
+  }
+  if (d->has_base && d->unacked < BMAP_MAX_UNACKED &&
+      chunkID_set_size(d->changed) < chunkID_set_size(bmap)) {
+    /* Send the current state of all the chunk IDs changed since the base */
+    if (set_copy(&added_set, d->changed) < 0 || chunkID_set_intersect(added_set, bmap) < 0 ||
+        set_copy(&removed_set, d->changed) < 0 || chunkID_set_difference(removed_set, bmap) < 0) {
+      return -1;
+    }
+    res = send_signaling(MSG_SIG_BMDIFF, to->id, (!owner ? localID : owner),
+                         added_set, removed_set, cb_size, seq);
+  } else {
+    res = sendSignaling(MSG_SIG_BMOFF, to->id, (!owner ? localID : owner),
+                        bmap, cb_size, seq);
+  }
+  if (res < 0) {
+    return res;
+  }
+  d->seq = seq;
+  d->unacked++;
+
+  if (d->has_next) {
+    if (add_changes(d->next_changed, d->next, bmap) < 0) {
+      d->has_next = 0;
+
+      return -1;
+    }
+  } else {
+    if (set_copy(&d->next, bmap) < 0 || set_empty(&d->next_changed) == NULL) {
+      return -1;
+    }
+    d->next_seq = seq;
+    d->has_next = 1;
+  }
+
+  return res;
+}
+
+int ackBufferMap(const struct nodeID *to, uint16_t seq)
+{
+  return sendSignaling(MSG_SIG_BMACK, to, NULL, NULL, 0, seq);
+}
+
+int applyBufferMap(struct peer *p, const struct chunkID_set *added,
+                   const struct chunkID_set *removed, enum signaling_type type, uint16_t seq)
+{
+  int16_t age = seq - p->bmap_seq;
+  int known = p->bmap && timerisset(&p->bmap_timestamp);
+
+  if (added == NULL) {
+    return -1;
+  }
+  if (type == sig_send_buffermap) {
+    if (known && age < 0 && age > -BMAP_SEQ_WINDOW) {
+      /* Reordered: older than the stored buffer map */
+      return -1;
+    }
+    if (set_copy(&p->bmap, added) < 0) {
+      timerclear(&p->bmap_timestamp);
+
+      return -1;
+    }
+  } else if (type == sig_send_buffermap_diff) {
+    if (known && age <= 0) {
+      /* Reordered: older than the stored buffer map */
+      return -1;
+    }
+    if (!known || chunkID_set_union(p->bmap, added) < 0 ||
+        (removed && chunkID_set_difference(p->bmap, removed) < 0)) {
+      /* No (consistent) buffer map to apply differences to: ask for a whole one */
+      timerclear(&p->bmap_timestamp);
+      if (localID) {
+        requestBufferMap(p->id, p->id, seq);
+      }
+
+      return -1;
+    }
+  } else {
+    return -1;
+  }
+  p->bmap_seq = seq;
+  gettimeofday(&p->bmap_timestamp, NULL);
+
+  return 0;
+}
+
+void bufferMapAcked(struct peer *p, uint16_t seq)
+{
+  struct bmap_diff *d = p->bmap_sent;
+  struct chunkID_set *tmp;
+
+  /* The peer has the buffer map seq, or a later one: next can be the base */
+  if (d && d->has_next && (int16_t)(seq - d->next_seq) >= 0 && (int16_t)(d->seq - seq) >= 0) {
+    tmp = d->base;
+    d->base = d->next;
+    d->next = tmp;
+    tmp = d->changed;
+    d->changed = d->next_changed;
+    d->next_changed = tmp;
+    d->has_base = 1;
+    d->has_next = 0;
+    d->unacked = 0;
+  }
+}
+
+void bufferMapRequested(struct peer *p)
+{
+  if (p->bmap_sent) {
+    p->bmap_sent->has_base = 0;
+  }
+}
+
+void freeBufferMapDiff(struct peer *p)
+{
+  struct bmap_diff *d = p->bmap_sent;
+
+  if (d == NULL) {
+    return;
+  }
+  if (d->base) {
+    chunkID_set_free(d->base);
+  }
+  if (d->changed) {
+    chunkID_set_free(d->changed);
+  }
+  if (d->next) {
+    chunkID_set_free(d->next);
+  }
+  if (d->next_changed) {
+    chunkID_set_free(d->next_changed);
+  }
+  free(d);
+  p->bmap_sent = NULL;
+}
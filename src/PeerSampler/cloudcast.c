@@ -150,7 +150,7 @@ static struct peersampler_context* cloudcast_init(struct nodeID *myID, const voi
 
   con->proto_context = cloudcast_proto_init(myID, metadata, metadata_size);
   if (!con->proto_context){
-    free(con->local_cache);
+    cache_free(con->local_cache);
     free(con);
     return NULL;
   }
@@ -36,6 +36,7 @@ struct peersampler_context{
   int period;
   
   struct peer_cache *flying_cache;
+  struct peer_cache *remote_cache;	/* entries of the last received message */
   struct nodeID *dst;
 
   struct cyclon_proto_context *pc;
@@ -119,7 +120,7 @@ static struct peersampler_context* cyclon_init(struct nodeID *myID, const void *
 
   con->pc = cyclon_proto_init(myID, metadata, metadata_size);
   if (!con->pc){
-    free(con->local_cache);
+    cache_free(con->local_cache);
     free(con);
     return NULL;
   }
@@ -159,7 +160,11 @@ static int cyclon_parse_data(struct peersampler_context *context, const uint8_t
       }
     }
 
-    remote_cache = entries_undump(buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
+    remote_cache = entries_undump_into(context->remote_cache, buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
+    if (remote_cache == NULL) {
+      return -1;
+    }
+    context->remote_cache = remote_cache;
     if (h->type == CYCLON_QUERY) {
       sent_cache = rand_cache(context->local_cache, context->sent_entries);
       cyclon_reply(context->pc, remote_cache, sent_cache);
@@ -168,7 +173,6 @@ static int cyclon_parse_data(struct peersampler_context *context, const uint8_t
     }
     cache_check(context->local_cache);
     cache_add_cache(context->local_cache, remote_cache);
-    cache_free(remote_cache);
     if (sent_cache) {
       cache_add_cache(context->local_cache, sent_cache);
       cache_free(sent_cache);
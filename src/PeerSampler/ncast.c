@@ -32,6 +32,7 @@ struct peersampler_context{
   int cache_size;
   int cache_size_threshold;
   struct peer_cache *local_cache;
+  struct peer_cache *remote_cache;	/* entries of the last received message */
   bool bootstrap;
   struct nodeID *bootstrap_node;
   int bootstrap_period;
@@ -123,7 +124,7 @@ static struct peersampler_context* init(struct nodeID *myID, const void *metadat
 
   context->tc = ncast_proto_init(myID, metadata, metadata_size);
   if (!context->tc){
-    free(context->local_cache);
+    cache_free(context->local_cache);
     free(context);
     return NULL;
   }
@@ -173,7 +174,7 @@ static int ncast_parse_data(struct peersampler_context *context, const uint8_t *
 
   if (len) {
     const struct topo_header *h = (const struct topo_header *)buff;
-    struct peer_cache *new, *remote_cache;
+    struct peer_cache *remote_cache;
 
     if (h->protocol != MSG_TYPE_TOPOLOGY) {
       fprintf(stderr, "NCAST: Wrong protocol!\n");
@@ -187,7 +188,11 @@ static int ncast_parse_data(struct peersampler_context *context, const uint8_t *
       ncast_proto_myentry_update(context->tc, NULL , - context->first_ts, NULL, 0);  // reset the timestamp of our own ID, we are in normal cycle, we will not disturb the algorithm
     }
 
-    remote_cache = entries_undump(buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
+    remote_cache = entries_undump_into(context->remote_cache, buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
+    if (remote_cache == NULL) {
+      return -1;
+    }
+    context->remote_cache = remote_cache;
     if (h->type == NCAST_QUERY) {
       context->reply_tokens--;	//sending a reply to someone who presumably receives it
       cache_randomize(context->local_cache);
@@ -197,12 +202,7 @@ static int ncast_parse_data(struct peersampler_context *context, const uint8_t *
     }
     cache_randomize(context->local_cache);
     cache_randomize(remote_cache);
-    new = merge_caches(context->local_cache, remote_cache, context->cache_size, &dummy);
-    cache_free(remote_cache);
-    if (new != NULL) {
-      cache_free(context->local_cache);
-      context->local_cache = new;
-    }
+    cache_merge(context->local_cache, remote_cache, context->cache_size, &dummy);
   }
 
   if (time_to_send(context)) {
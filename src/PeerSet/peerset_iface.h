@@ -0,0 +1,16 @@
+#ifndef PEERSET_IFACE
+#define PEERSET_IFACE
+
+struct peerset;
+struct peer;
+struct nodeID;
+
+struct pset_ops_iface {
+  int (*lookup)(const struct peerset *h, const struct nodeID *id, int *hint);
+  int (*insert)(struct peerset *h, struct peer *e, int hint);
+  void (*remove)(struct peerset *h, int i);
+  void (*clear)(struct peerset *h);
+  void (*destroy)(struct peerset *h);
+};
+
+#endif	/* PEERSET_IFACE */
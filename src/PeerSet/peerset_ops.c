@@ -12,70 +12,50 @@
 #include <limits.h>
 
 #include "peerset_private.h"
+#include "peerset_iface.h"
 #include "peer.h"
 #include "peerset.h"
 #include "chunkidset.h"
 #include "net_helper.h"
+#include "trade_sig_ha.h"
 #include "grapes_config.h"
+#include "grapes_alloc.h"
 
 #define DEFAULT_SIZE_INCREMENT 32
 
-static int nodeid_peer_cmp(const void *id, const void *p)
-{
-  const struct peer *peer = *(struct peer *const *)p;
+extern struct pset_ops_iface sorted_ops;
+extern struct pset_ops_iface hash_ops;
 
-  if(id && p)
-    return nodeid_cmp( (const struct nodeID *) id, peer->id);
-  else
-  {
-    //fprintf(stderr,"[DEBUG] wrong peer or id\n");
-    return 0;
-  }
-}
+static struct grapes_slab *peer_slab;
 
-static int peerset_check_insert_pos(const struct peerset *h, const struct nodeID *id)
+static void peer_free(struct peer *e)
 {
-  int a, b, c, r;
-
-  if (! h->n_elements) {
-    return 0;
-  }
-
-  a = 0;
-  b = c = h->n_elements - 1;
-
-  while ((r = nodeid_peer_cmp(id, &h->elements[b])) != 0) {
-    if (r > 0) {
-      if (b == c) {
-        return b + 1;
-      } else {
-        a = b + 1;
-      }
-    } else {
-      if (b == a) {
-        return b;
-      } else {
-        c = b;
-      }
-    }
-    b = (a + c) / 2;
-  }
-
-  return -1;
+  nodeid_free(e->id);
+  chunkID_set_free(e->bmap);
+  freeBufferMapDiff(e);
+  grapes_free(e);
 }
 
-
 struct peerset *peerset_init(const char *config)
 {
   struct peerset *p;
   struct tag *cfg_tags;
+  const char *type;
   int res;
 
+  if (peer_slab == NULL) {
+    peer_slab = grapes_slab_create("peer", sizeof(struct peer));
+    if (peer_slab == NULL) {
+      return NULL;
+    }
+  }
   p = malloc(sizeof(struct peerset));
   if (p == NULL) {
     return NULL;
   }
   p->n_elements = 0;
+  p->index = NULL;
+  p->index_size = 0;
   cfg_tags = grapes_config_parse(config);
   if (!cfg_tags) {
     free(p);
@@ -85,6 +65,18 @@ struct peerset *peerset_init(const char *config)
   if (!res) {
     p->size = 0;
   }
+  p->ops = &sorted_ops;
+  type = grapes_config_value_str(cfg_tags, "type");
+  if (type) {
+    if (!strcmp(type, "hash")) {
+      p->ops = &hash_ops;
+    } else if (strcmp(type, "sorted")) {
+      free(cfg_tags);
+      free(p);
+
+      return NULL;
+    }
+  }
   free(cfg_tags);
   if (p->size) {
     p->elements = malloc(p->size * sizeof(struct peer *));
@@ -98,33 +90,40 @@ struct peerset *peerset_init(const char *config)
 void peerset_destroy(struct peerset **h)
 {
 	peerset_clear(*h,0);
+	if ((*h)->ops->destroy) {
+		(*h)->ops->destroy(*h);
+	}
 	free(*h);
 	*h = NULL;
 }
 
-int peerset_push_peer(struct peerset *h, struct peer *e)
+static int peerset_grow(struct peerset *h)
 {
-  int pos;
+  struct peer **res;
 
-  pos = peerset_check_insert_pos(h, e->id);
-  if (pos < 0){
+  if (h->n_elements < h->size) {
     return 0;
   }
-
-  if (h->n_elements == h->size) {
-    struct peer **res;
-
-    res = realloc(h->elements, (h->size + DEFAULT_SIZE_INCREMENT) * sizeof(struct peer *));
-    if (res == NULL) {
-      return -1;
-    }
-    h->size += DEFAULT_SIZE_INCREMENT;
-    h->elements = res;
+  res = realloc(h->elements, (h->size + DEFAULT_SIZE_INCREMENT) * sizeof(struct peer *));
+  if (res == NULL) {
+    return -1;
   }
+  h->size += DEFAULT_SIZE_INCREMENT;
+  h->elements = res;
+
+  return 0;
+}
 
-  memmove(&h->elements[pos + 1], &h->elements[pos] , ((h->n_elements++) - pos) * sizeof(struct peer *));
+int peerset_push_peer(struct peerset *h, struct peer *e)
+{
+  int hint;
 
-  h->elements[pos] = e;;
+  if (h->ops->lookup(h, e->id, &hint) >= 0) {
+    return 0;
+  }
+  if (peerset_grow(h) < 0 || h->ops->insert(h, e, hint) < 0) {
+    return -1;
+  }
 
   return h->n_elements;
 }
@@ -132,34 +131,32 @@ int peerset_push_peer(struct peerset *h, struct peer *e)
 int peerset_add_peer(struct peerset *h,const  struct nodeID *id)
 {
   struct peer *e;
-  int pos;
+  int hint;
 
-  pos = peerset_check_insert_pos(h, id);
-  if (pos < 0){
+  if (h->ops->lookup(h, id, &hint) >= 0) {
     return 0;
   }
-
-  if (h->n_elements == h->size) {
-    struct peer **res;
-
-    res = realloc(h->elements, (h->size + DEFAULT_SIZE_INCREMENT) * sizeof(struct peer *));
-    if (res == NULL) {
-      return -1;
-    }
-    h->size += DEFAULT_SIZE_INCREMENT;
-    h->elements = res;
+  if (peerset_grow(h) < 0) {
+    return -1;
   }
 
-  memmove(&h->elements[pos + 1], &h->elements[pos] , ((h->n_elements++) - pos) * sizeof(struct peer *));
-
-  e = malloc(sizeof(struct peer));
-  h->elements[pos] = e;;
+  e = grapes_slab_alloc(peer_slab);
+  if (e == NULL) {
+    return -1;
+  }
   e->id = nodeid_dup(id);
   gettimeofday(&e->creation_timestamp,NULL);
   e->bmap = chunkID_set_init("type=bitmap");
   timerclear(&e->bmap_timestamp);
+  e->bmap_seq = 0;
+  e->bmap_sent = NULL;
   e->cb_size = 0;
   e->capacity = 0;
+  if (h->ops->insert(h, e, hint) < 0) {
+    peer_free(e);
+
+    return -1;
+  }
 
   return h->n_elements;
 }
@@ -193,7 +190,7 @@ struct peer *peerset_pop_peer(struct peerset *h, const struct nodeID *id){
   int i = peerset_check(h,id);
   if (i >= 0) {
     struct peer *e = h->elements[i];
-    memmove(&h->elements[i], &h->elements[i+1], ((h->n_elements--) - (i+1)) * sizeof(struct peer *));
+    h->ops->remove(h, i);
 
     return e;
   }
@@ -204,10 +201,8 @@ int peerset_remove_peer(struct peerset *h, const struct nodeID *id){
   int i = peerset_check(h,id);
   if (i >= 0) {
     struct peer *e = h->elements[i];
-    nodeid_free(e->id);
-    chunkID_set_free(e->bmap);
-    memmove(&h->elements[i], &h->elements[i+1], ((h->n_elements--) - (i+1)) * sizeof(struct peer *));
-    free(e);
+    h->ops->remove(h, i);
+    peer_free(e);
 
     return i;
   }
@@ -216,11 +211,9 @@ int peerset_remove_peer(struct peerset *h, const struct nodeID *id){
 
 int peerset_check(const struct peerset *h, const struct nodeID *id)
 {
-  struct peer **p;
+  int hint;
 
-  p = bsearch(id, h->elements, (size_t) h->n_elements, sizeof(h->elements[0]), nodeid_peer_cmp);
-
-  return p ? p - h->elements : -1;
+  return h->ops->lookup(h, id, &hint);
 }
 
 void peerset_clear(struct peerset *h, int size)
@@ -229,12 +222,13 @@ void peerset_clear(struct peerset *h, int size)
 
   for (i = 0; i < h->n_elements; i++) {
     struct peer *e = h->elements[i];
-    nodeid_free(e->id);
-    chunkID_set_free(e->bmap);
-    free(e);
+    peer_free(e);
   }
 
   h->n_elements = 0;
+  if (h->ops->clear) {
+    h->ops->clear(h);
+  }
   h->size = size;
   h->elements = realloc(h->elements, size * sizeof(struct peer *));
   if (h->elements == NULL) {
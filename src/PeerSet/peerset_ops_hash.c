@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "peerset_private.h"
+#include "peerset_iface.h"
+#include "peer.h"
+#include "net_helper.h"
+
+#define MIN_INDEX_SIZE 16
+
+/*
+ * Peers are stored in insertion order in the dense array, and an open
+ * addressing (linear probing) hash table on the nodeID maps them to
+ * their position. The table is kept at most half full; removing a peer
+ * moves the last one in its position.
+ */
+static int home_slot(const struct peerset *h, const struct nodeID *id)
+{
+  return nodeid_hash(id) & (h->index_size - 1);
+}
+
+static int slot_of(const struct peerset *h, int i)
+{
+  int s;
+
+  for (s = home_slot(h, h->elements[i]->id); h->index[s] != i + 1; s = (s + 1) & (h->index_size - 1));
+
+  return s;
+}
+
+static int hash_lookup(const struct peerset *h, const struct nodeID *id, int *hint)
+{
+  int s;
+
+  *hint = -1;
+  if (h->index_size == 0) {
+    return -1;
+  }
+  for (s = home_slot(h, id); h->index[s]; s = (s + 1) & (h->index_size - 1)) {
+    if (nodeid_equal(h->elements[h->index[s] - 1]->id, id)) {
+      return h->index[s] - 1;
+    }
+  }
+  *hint = s;
+
+  return -1;
+}
+
+static int hash_resize(struct peerset *h, int size)
+{
+  int *index;
+  int i;
+
+  index = calloc(size, sizeof(int));
+  if (index == NULL) {
+    return -1;
+  }
+  free(h->index);
+  h->index = index;
+  h->index_size = size;
+  for (i = 0; i < h->n_elements; i++) {
+    int s;
+
+    for (s = home_slot(h, h->elements[i]->id); h->index[s]; s = (s + 1) & (size - 1));
+    h->index[s] = i + 1;
+  }
+
+  return 0;
+}
+
+static int hash_insert(struct peerset *h, struct peer *e, int slot)
+{
+  if ((h->n_elements + 1) * 2 > h->index_size) {
+    int size = h->index_size ? h->index_size * 2 : MIN_INDEX_SIZE;
+
+    while (size < h->size * 2) {
+      size *= 2;
+    }
+    if (hash_resize(h, size) < 0) {
+      return -1;
+    }
+    hash_lookup(h, e->id, &slot);
+  }
+  h->elements[h->n_elements] = e;
+  h->index[slot] = ++h->n_elements;
+
+  return h->n_elements - 1;
+}
+
+static void hash_remove(struct peerset *h, int i)
+{
+  int mask = h->index_size - 1;
+  int hole, s, last = h->n_elements - 1;
+
+  /* Backward shift deletion: no tombstones are needed */
+  hole = slot_of(h, i);
+  h->index[hole] = 0;
+  for (s = (hole + 1) & mask; h->index[s]; s = (s + 1) & mask) {
+    int home = home_slot(h, h->elements[h->index[s] - 1]->id);
+
+    if (((s - home) & mask) >= ((s - hole) & mask)) {
+      h->index[hole] = h->index[s];
+      h->index[s] = 0;
+      hole = s;
+    }
+  }
+
+  if (i != last) {
+    h->index[slot_of(h, last)] = i + 1;
+    h->elements[i] = h->elements[last];
+  }
+  h->n_elements--;
+}
+
+static void hash_clear(struct peerset *h)
+{
+  if (h->index) {
+    memset(h->index, 0, h->index_size * sizeof(int));
+  }
+}
+
+static void hash_destroy(struct peerset *h)
+{
+  free(h->index);
+  h->index = NULL;
+  h->index_size = 0;
+}
+
+struct pset_ops_iface hash_ops = {
+  .lookup = hash_lookup,
+  .insert = hash_insert,
+  .remove = hash_remove,
+  .clear = hash_clear,
+  .destroy = hash_destroy,
+};
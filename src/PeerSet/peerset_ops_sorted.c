@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *  Copyright (c) 2010 Csaba Kiraly
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "peerset_private.h"
+#include "peerset_iface.h"
+#include "peer.h"
+#include "net_helper.h"
+
+/*
+ * Peers sorted by nodeID: binary search, and the array is shifted on
+ * insertion and removal.
+ */
+static int sorted_lookup(const struct peerset *h, const struct nodeID *id, int *hint)
+{
+  int a = 0, b = h->n_elements;
+
+  while (a < b) {
+    int m = (a + b) / 2;
+    int r = nodeid_cmp(id, h->elements[m]->id);
+
+    if (r == 0) {
+      *hint = m;
+
+      return m;
+    }
+    if (r > 0) {
+      a = m + 1;
+    } else {
+      b = m;
+    }
+  }
+  *hint = a;
+
+  return -1;
+}
+
+static int sorted_insert(struct peerset *h, struct peer *e, int pos)
+{
+  memmove(&h->elements[pos + 1], &h->elements[pos], (h->n_elements - pos) * sizeof(struct peer *));
+  h->elements[pos] = e;
+  h->n_elements++;
+
+  return pos;
+}
+
+static void sorted_remove(struct peerset *h, int i)
+{
+  memmove(&h->elements[i], &h->elements[i + 1], (h->n_elements - (i + 1)) * sizeof(struct peer *));
+  h->n_elements--;
+}
+
+struct pset_ops_iface sorted_ops = {
+  .lookup = sorted_lookup,
+  .insert = sorted_insert,
+  .remove = sorted_remove,
+};
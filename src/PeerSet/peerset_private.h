@@ -5,6 +5,9 @@ struct peerset {
   int size;  //  
   int n_elements; // Number of ids in this array of chunks ids
   struct peer **elements;  // id number
+  int *index;	// hash index: position in elements + 1, 0 if empty
+  int index_size;
+  struct pset_ops_iface *ops;
 };
 
 #endif /* PEERSET_PRIVATE */
@@ -6,124 +6,410 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 #include "scheduler_la.h"
+#include "grapes_config.h"
 
 #include<stdio.h>
 
 #define MAX(A,B)    ((A)>(B) ? (A) : (B))
 #define MIN(A,B)    ((A)<(B) ? (A) : (B))
 
-struct iw {
-  int index;
-  double weight;
+enum {SCRATCH_HEAP, SCRATCH_ELEMENTS, SCRATCH_SELECTED, SCRATCH_BATCH, SCRATCH_N};
+
+// candidates passed to the batch filters and evaluators at a time
+#define BATCH 64
+
+/*
+ * Scheduler context: the user data passed to the filter and evaluator
+ * functions, the random number generator (xoshiro256**), the batch
+ * filter and evaluators (if registered) and scratch buffers that are
+ * kept from one call to the next.
+ * The functions without a context use one on the stack, drawing from
+ * rand(), and free its buffers before returning (see legacy_done()).
+ */
+struct sched_ctx {
+  int use_rand;
+  uint64_t rng[4];
+  void *data;
+  filterBatchFunction filter_batch;
+  peerBatchEvaluateFunction peer_batch;
+  chunkBatchEvaluateFunction chunk_batch;
+  pairBatchEvaluateFunction pair_batch;
+  void *scratch[SCRATCH_N];
+  size_t scratch_size[SCRATCH_N];
 };
 
-static int cmp_iw_reverse(const void *a, const void *b)
+static uint64_t splitmix64(uint64_t *x)
 {
-  const struct iw *a1 = (const struct iw *) a;
-  const struct iw *b1 = (const struct iw *) b;
-  return a1->weight==b1->weight ? 0 : (a1->weight<b1->weight ? 1 : -1);
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
 }
 
-/**
-  * Select best N of K based using a given evaluator function
-  */
-void selectBests(size_t size,unsigned char *base, size_t nmemb, double(*evaluate)(void *),unsigned char *bests,size_t *bests_len){
-  struct iw iws[nmemb];
+static inline uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t xoshiro256ss(uint64_t *s)
+{
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+// random key for ties
+static inline int rng_tie(struct sched_ctx *ctx)
+{
+  return ctx->use_rand ? rand() : (int)(xoshiro256ss(ctx->rng) >> 33);
+}
+
+// uniform in [0, 1)
+static inline double rng_uniform(struct sched_ctx *ctx)
+{
+  return ctx->use_rand ? rand() / (RAND_MAX + 1.0) : (xoshiro256ss(ctx->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void *scratch_get(struct sched_ctx *ctx, int i, size_t size)
+{
+  void *res;
+
+  if (size > ctx->scratch_size[i]) {
+    size = MAX(size, 2 * ctx->scratch_size[i]);
+    res = realloc(ctx->scratch[i], size);
+    if (res == NULL) return NULL;
+    ctx->scratch[i] = res;
+    ctx->scratch_size[i] = size;
+  }
+
+  return ctx->scratch[i];
+}
+
+// release the buffers of a context used for a single call
+static void legacy_done(struct sched_ctx *ctx)
+{
   int i;
 
-  // calculate weights
-  for (i=0; i<nmemb; i++){
-     iws[i].index = i;
-     iws[i].weight = evaluate(base + size*i);
+  for (i = 0; i < SCRATCH_N; i++) {
+    free(ctx->scratch[i]);
   }
+}
 
-  // sort in descending order
-  qsort(iws, nmemb, sizeof(struct iw), cmp_iw_reverse);
+struct sched_ctx *sched_ctx_init(const char *config, void *data)
+{
+  struct sched_ctx *ctx;
+  struct tag *cfg_tags;
+  uint64_t seed;
+  int i, s;
+
+  cfg_tags = grapes_config_parse(config);
+  if (!cfg_tags) {
+    return NULL;
+  }
+  ctx = malloc(sizeof(struct sched_ctx));
+  if (ctx == NULL) {
+    free(cfg_tags);
+    return NULL;
+  }
+  if (grapes_config_value_int(cfg_tags, "seed", &s)) {
+    seed = s;
+  } else {
+    seed = rand();
+  }
+  free(cfg_tags);
+  ctx->use_rand = 0;
+  for (i = 0; i < 4; i++) {
+    ctx->rng[i] = splitmix64(&seed);
+  }
+  ctx->data = data;
+  ctx->filter_batch = NULL;
+  ctx->peer_batch = NULL;
+  ctx->chunk_batch = NULL;
+  ctx->pair_batch = NULL;
+  for (i = 0; i < SCRATCH_N; i++) {
+    ctx->scratch[i] = NULL;
+    ctx->scratch_size[i] = 0;
+  }
 
-  // ensure uniform random tie
-  for (i=0; i<nmemb; i++){
-    int j, k;
-    for (j=i; j<nmemb && iws[i].weight == iws[j].weight; j++);
-    for (k=i; k<j; k++){
-      struct iw iwt = iws[k];
-      int r = i + (rand() % (j-i));
-      iws[k] = iws[r];
-      iws[r] = iwt;
+  return ctx;
+}
+
+void sched_ctx_destroy(struct sched_ctx **ctx)
+{
+  int i;
+
+  if (*ctx == NULL) return;
+  for (i = 0; i < SCRATCH_N; i++) {
+    free((*ctx)->scratch[i]);
+  }
+  free(*ctx);
+  *ctx = NULL;
+}
+
+void *sched_ctx_data(const struct sched_ctx *ctx)
+{
+  return ctx->data;
+}
+
+void sched_ctx_set_batch(struct sched_ctx *ctx, filterBatchFunction filter, peerBatchEvaluateFunction peerevaluate,
+                         chunkBatchEvaluateFunction chunkevaluate, pairBatchEvaluateFunction pairevaluate)
+{
+  ctx->filter_batch = filter;
+  ctx->peer_batch = peerevaluate;
+  ctx->chunk_batch = chunkevaluate;
+  ctx->pair_batch = pairevaluate;
+}
+
+/*
+ * Streaming selection of k elements: only the k elements with the
+ * highest keys are kept, in a heap with the worst of them at the root,
+ * so selecting among n elements costs O(n log k) time and O(k) memory.
+ * With SCHED_BEST the key is the weight, and ties are broken by a random
+ * key, so that their order is uniformly random. With SCHED_WEIGHTED the
+ * key is log(u) / weight, u being uniform in (0, 1] (Efraimidis and
+ * Spirakis): the elements with the highest keys, in decreasing order,
+ * are distributed as successive weighted draws without replacement.
+ * Zero weights are ranked after all the others, and dropped from the
+ * result unless all the weights are zero.
+ */
+struct sel_item {
+  int positive;	// SCHED_WEIGHTED: weight > 0
+  double key;
+  int tie;	// random key, to break ties uniformly
+  int slot;	// where the element is stored
+};
+
+struct selector {
+  struct sched_ctx *ctx;
+  SchedOrdering ordering;
+  size_t size;
+  int k, len;
+  struct sel_item *heap;
+  unsigned char *elements;
+};
+
+// true if a should be ranked after b
+static inline int sel_worse(const struct sel_item *a, const struct sel_item *b)
+{
+  if (a->positive != b->positive) return a->positive < b->positive;
+  return a->key < b->key || (a->key == b->key && a->tie < b->tie);
+}
+
+static int cmp_sel_reverse(const void *a, const void *b)
+{
+  const struct sel_item *a1 = (const struct sel_item *) a;
+  const struct sel_item *b1 = (const struct sel_item *) b;
+  return sel_worse(a1, b1) ? 1 : (sel_worse(b1, a1) ? -1 : 0);
+}
+
+static int sel_init(struct selector *s, struct sched_ctx *ctx, SchedOrdering ordering, size_t size, int k)
+{
+  s->ctx = ctx;
+  s->ordering = ordering;
+  s->size = size;
+  s->k = k;
+  s->len = 0;
+  s->heap = NULL;
+  s->elements = NULL;
+  if (k == 0) return 0;
+  s->heap = scratch_get(ctx, SCRATCH_HEAP, k * sizeof(struct sel_item));
+  s->elements = scratch_get(ctx, SCRATCH_ELEMENTS, k * size);
+  if (s->heap == NULL || s->elements == NULL) {
+    s->k = 0;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+static void sel_add(struct selector *s, const void *element, double weight)
+{
+  struct sel_item it;
+  int pos;
+
+  if (s->k == 0) return;
+  if (s->ordering == SCHED_BEST && s->len == s->k && weight < s->heap[0].key) {
+    return;	// cannot enter, whatever its tie key
+  }
+  it.tie = rng_tie(s->ctx);
+  if (s->ordering == SCHED_WEIGHTED) {
+    double l = log(1.0 - rng_uniform(s->ctx));
+
+    it.positive = weight > 0;
+    it.key = it.positive ? l / weight : l;
+  } else {
+    it.positive = 1;
+    it.key = weight;
+  }
+
+  if (s->len < s->k) {
+    // sift up
+    it.slot = pos = s->len++;
+    while (pos > 0 && sel_worse(&it, &s->heap[(pos - 1) / 2])) {
+      s->heap[pos] = s->heap[(pos - 1) / 2];
+      pos = (pos - 1) / 2;
+    }
+  } else if (sel_worse(&s->heap[0], &it)) {
+    // replace the worst, and sift down
+    it.slot = s->heap[0].slot;
+    pos = 0;
+    while (2 * pos + 1 < s->len) {
+      int c = 2 * pos + 1;
+
+      if (c + 1 < s->len && sel_worse(&s->heap[c + 1], &s->heap[c])) c++;
+      if (!sel_worse(&s->heap[c], &it)) break;
+      s->heap[pos] = s->heap[c];
+      pos = c;
     }
+  } else {
+    return;
+  }
+  s->heap[pos] = it;
+  memcpy(s->elements + s->size * it.slot, element, s->size);
+}
+
+// copy the selected elements in decreasing order
+static size_t sel_done(struct selector *s, unsigned char *selected)
+{
+  int i, len = s->len;
+
+  if (s->k == 0) return 0;
+  qsort(s->heap, len, sizeof(struct sel_item), cmp_sel_reverse);
+  if (len && s->heap[0].positive) {
+    while (!s->heap[len - 1].positive) len--;
   }
+  for (i=0; i<len; i++){
+    memcpy(selected + s->size*i, s->elements + s->size*s->heap[i].slot, s->size);
+  }
+
+  return len;
+}
+
+/*
+ * The functions without a context wrap their filter and evaluator in
+ * the ones with a data pointer, passing them as the data.
+ */
+struct legacy {
+  filterFunction filter;
+  evaluateFunction evaluate;
+  peerEvaluateFunction peerevaluate;
+  chunkEvaluateFunction chunkevaluate;
+  pairEvaluateFunction pairevaluate;
+};
 
-  *bests_len = MIN(*bests_len, nmemb);
+static int legacy_filter(schedPeerID peer, schedChunkID chunk, void *data)
+{
+  return ((struct legacy *)data)->filter(peer, chunk);
+}
+
+static double legacy_evaluate(void *element, void *data)
+{
+  return ((struct legacy *)data)->evaluate(element);
+}
+
+static double legacy_peer(schedPeerID *peer, void *data)
+{
+  return ((struct legacy *)data)->peerevaluate(peer);
+}
 
-  // copy bests in their place
-  for (i=0; i<*bests_len; i++){
-     memcpy(bests + size*i, base + size*iws[i].index, size);
+static double legacy_chunk(schedChunkID *chunk, void *data)
+{
+  return ((struct legacy *)data)->chunkevaluate(chunk);
+}
+
+static double legacy_pair(struct PeerChunk *pc, void *data)
+{
+  return ((struct legacy *)data)->pairevaluate(pc);
+}
+
+static filterFunction_r legacy_filter_r(filterFunction filter)
+{
+  return filter ? legacy_filter : NULL;
+}
+
+static void select_bests(struct sched_ctx *ctx, size_t size, unsigned char *base, size_t nmemb,
+                         evaluateFunction_r evaluate, void *data, unsigned char *bests, size_t *bests_len)
+{
+  struct selector s;
+  int i;
+
+  sel_init(&s, ctx, SCHED_BEST, size, MIN(*bests_len, nmemb));
+  for (i=0; i<nmemb; i++){
+    sel_add(&s, base + size*i, evaluate(base + size*i, data));
   }
-  
+  *bests_len = sel_done(&s, bests);
 }
 
 /**
-  * Select N of K with weigthed random choice, without replacement (multiple selection), based on a given evaluator function
+  * Select best N of K based using a given evaluator function
   */
-void selectWeighted(size_t size,unsigned char *base, size_t nmemb, double(*weight)(void *),unsigned char *selected,size_t *selected_len){
-  int i,j,k;
-  double weights[nmemb];
-  double w_sum=0;
-  double selected_index[nmemb];
-  int s=0;
-  int s_max = MIN (*selected_len, nmemb);
-  int zeros = 0;
-
-  // calculate weights
+void selectBests(size_t size,unsigned char *base, size_t nmemb, double(*evaluate)(void *),unsigned char *bests,size_t *bests_len){
+  struct legacy l = {.evaluate = evaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
+
+  select_bests(&ctx, size, base, nmemb, legacy_evaluate, &l, bests, bests_len);
+  legacy_done(&ctx);
+}
+
+// weighted random choice without replacement, with the streaming selector
+static void select_weighted(struct sched_ctx *ctx, size_t size, unsigned char *base, size_t nmemb,
+                            evaluateFunction_r weight, void *data, unsigned char *selected, size_t *selected_len)
+{
+  struct selector s;
+  int i;
+
+  sel_init(&s, ctx, SCHED_WEIGHTED, size, MIN(*selected_len, nmemb));
   for (i=0; i<nmemb; i++){
-     weights[i] = weight(base + size*i);
-     // weights should not be negative
-     weights[i] = MAX (weights[i], 0);
-     if (weights[i] == 0) zeros += 1;
-     w_sum += weights[i];
+    sel_add(&s, base + size*i, weight(base + size*i, data));
   }
+  *selected_len = sel_done(&s, selected);
+}
 
-  // all weights shuold not be zero, but if if happens, do something
-  if (w_sum == 0) {
-    for (i=0; i<nmemb; i++){
-      weights[i] = 1;
-      w_sum += weights[i];
-    }
-  } else { //exclude 0 weight from selection
-    s_max = MIN (s_max, nmemb - zeros);
-  }
+/**
+  * Select N of K with weigthed random choice, without replacement (multiple selection), based on a given evaluator function
+  */
+void selectWeighted(size_t size,unsigned char *base, size_t nmemb, double(*weight)(void *),unsigned char *selected,size_t *selected_len){
+  struct legacy l = {.evaluate = weight};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-  while (s < s_max) {
-    // select one randomly
-    double t = w_sum * (rand() / (RAND_MAX + 1.0));
-    //search for it in the CDF
-    double cdf = 0;
-    for (j=0; j<nmemb; j++){
-      cdf += weights[j];
-      //printf("(%f <? %f\n",t,cdf);
-      if (t < cdf) {
-        int already_selected=0;
-        for (k=0; k<s; k++) {
-          if (selected_index[k] == j)  already_selected=1;
-        }
-        if (!already_selected){ 
-          //printf("selected %d(%f) for %d\n",j,weights[j],k);
-          memcpy(selected + size*s, base + size*j, size);
-          selected_index[s++]=j;
-        }
-        break;
-      }
-    }
-  }
-  *selected_len=s;
+  select_weighted(&ctx, size, base, nmemb, legacy_evaluate, &l, selected, selected_len);
+  legacy_done(&ctx);
+}
+
+static void select_with_ordering(struct sched_ctx *ctx, SchedOrdering ordering, size_t size, unsigned char *base, size_t nmemb,
+                                 evaluateFunction_r evaluate, void *data, unsigned char *selected, size_t *selected_len)
+{
+  if (ordering == SCHED_WEIGHTED) select_weighted(ctx, size, base, nmemb, evaluate, data, selected, selected_len);
+  else select_bests(ctx, size, base, nmemb, evaluate, data, selected, selected_len);
 }
 
 /**
   * Select best N of K with the given ordering method
   */
 void selectWithOrdering(SchedOrdering ordering, size_t size, unsigned char *base, size_t nmemb, double(*evaluate)(void *), unsigned char *selected,size_t *selected_len){
-  if (ordering == SCHED_WEIGHTED) selectWeighted(size, base, nmemb, evaluate, selected, selected_len);
-  else selectBests(size, base, nmemb, evaluate, selected, selected_len);
+  struct legacy l = {.evaluate = evaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
+
+  select_with_ordering(&ctx, ordering, size, base, nmemb, legacy_evaluate, &l, selected, selected_len);
+  legacy_done(&ctx);
+}
+
+void selectWithOrdering_r(struct sched_ctx *ctx, SchedOrdering ordering, size_t size, unsigned char *base, size_t nmemb, evaluateFunction_r evaluate, unsigned char *selected, size_t *selected_len){
+  select_with_ordering(ctx, ordering, size, base, nmemb, evaluate, ctx->data, selected, selected_len);
 }
 
 /**
@@ -203,6 +489,92 @@ void filterPairs(struct PeerChunk *pairs, size_t *pairs_len,
   *pairs_len=f;
 }
 
+// bit i is set if peers[i] (i < n <= BATCH) passes the filter with chunk
+static uint64_t filter_block(struct sched_ctx *ctx, filterFunction_r filter, void *data,
+                             const schedPeerID *peers, int n, schedChunkID chunk)
+{
+  uint64_t mask = 0;
+  int i;
+
+  if (ctx->filter_batch) return ctx->filter_batch(peers, n, chunk, data);
+  for (i=0; i<n; i++){
+    if (!filter || filter(peers[i],chunk,data)) mask |= 1ULL << i;
+  }
+
+  return mask;
+}
+
+static void add_peers(struct selector *s, schedPeerID *peers, int n, peerEvaluateFunction_r evaluate, void *data)
+{
+  double w[BATCH];
+  int i;
+
+  if (s->ctx->peer_batch) s->ctx->peer_batch(peers, n, w, data);
+  else for (i=0; i<n; i++) w[i] = evaluate(&peers[i],data);
+  for (i=0; i<n; i++) sel_add(s, &peers[i], w[i]);
+}
+
+static void add_chunks(struct selector *s, schedChunkID *chunks, int n, chunkEvaluateFunction_r evaluate, void *data)
+{
+  double w[BATCH];
+  int i;
+
+  if (s->ctx->chunk_batch) s->ctx->chunk_batch(chunks, n, w, data);
+  else for (i=0; i<n; i++) w[i] = evaluate(&chunks[i],data);
+  for (i=0; i<n; i++) sel_add(s, &chunks[i], w[i]);
+}
+
+static void peers_for_chunks(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                             schedPeerID *selected, size_t *selected_len,
+                             filterFunction_r filter, peerEvaluateFunction_r evaluate, void *data)
+{
+  struct selector s;
+  schedPeerID passed[BATCH];
+  int p,c;
+
+  // filter and select in a single pass, BATCH peers at a time
+  sel_init(&s, ctx, ordering, sizeof(peers[0]), MIN(*selected_len, peers_len));
+  for (p=0; p<peers_len; p+=BATCH){
+    int i, n = MIN(BATCH, peers_len - p), f = 0;
+    uint64_t all = n == 64 ? ~0ULL : (1ULL << n) - 1, mask = 0;
+
+    for (c=0; c<chunks_len && mask != all; c++){
+      mask |= filter_block(ctx, filter, data, peers + p, n, chunks[c]);
+    }
+    for (i=0; i<n; i++){
+      if (mask & (1ULL << i)) passed[f++] = peers[p + i];
+    }
+    add_peers(&s, passed, f, evaluate, data);
+  }
+  *selected_len = sel_done(&s, (void*)selected);
+}
+
+static void chunks_for_peers(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                             schedChunkID *selected, size_t *selected_len,
+                             filterFunction_r filter, chunkEvaluateFunction_r evaluate, void *data)
+{
+  struct selector s;
+  schedChunkID passed[BATCH];
+  int p,c,f=0;
+
+  // filter and select in a single pass, evaluating BATCH chunks at a time
+  sel_init(&s, ctx, ordering, sizeof(chunks[0]), MIN(*selected_len, chunks_len));
+  for (c=0; c<chunks_len; c++){
+    for (p=0; p<peers_len; p+=BATCH){
+      if (filter_block(ctx, filter, data, peers + p, MIN(BATCH, peers_len - p), chunks[c])) {
+        passed[f++] = chunks[c];
+        break;
+      }
+    }
+    if (f == BATCH) {
+      add_chunks(&s, passed, f, evaluate, data);
+      f = 0;
+    }
+  }
+  add_chunks(&s, passed, f, evaluate, data);
+  *selected_len = sel_done(&s, (void*)selected);
+}
+
 /**
   * Select at most N of K peers, among those where filter is true with at least one of the chunks.
   */
@@ -210,27 +582,22 @@ void selectPeersForChunks(SchedOrdering ordering, schedPeerID *peers, size_t pee
                      schedPeerID *selected, size_t *selected_len,	//out, inout
                      filterFunction filter,
                      peerEvaluateFunction evaluate){
+  struct legacy l = {.filter = filter, .peerevaluate = evaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-  size_t filtered_len=peers_len;
-  schedPeerID filtered[filtered_len];
-
-  filterPeers2(peers, peers_len, chunks,chunks_len, filtered, &filtered_len, filter);
-	//fprintf(stderr,"[DEBUG] Filtered peers for offer: %d\n",filtered_len);
-
-  selectPeers(ordering, filtered, filtered_len, evaluate, selected, selected_len);
+  peers_for_chunks(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_peer, &l);
+  legacy_done(&ctx);
 }
 
 void selectChunksForPeers(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len, 	//in
                      schedChunkID *selected, size_t *selected_len,	//out, inout
                      filterFunction filter,
                      chunkEvaluateFunction evaluate){
+  struct legacy l = {.filter = filter, .chunkevaluate = evaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-  size_t filtered_len=chunks_len;
-  schedChunkID filtered[filtered_len];
-
-  filterChunks2(peers, peers_len, chunks,chunks_len, filtered, &filtered_len, filter);
-
-  selectChunks(ordering, filtered, filtered_len, evaluate, selected, selected_len);
+  chunks_for_peers(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_chunk, &l);
+  legacy_done(&ctx);
 }
 
 
@@ -268,6 +635,125 @@ void toPairs(schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t
   toPairsChunkFirst(peers, peers_len, chunks, chunks_len, pairs, pairs_len);
 }
 
+static void peer_first(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                       struct PeerChunk *selected, size_t *selected_len,
+                       filterFunction_r filter, peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate, void *data)
+{
+  size_t p_len=1;
+  schedPeerID p[1];
+  size_t c_len=*selected_len;
+  schedChunkID *c = scratch_get(ctx, SCRATCH_SELECTED, c_len * sizeof(schedChunkID));
+
+  if (c == NULL) {
+    *selected_len = 0;
+    return;
+  }
+  peers_for_chunks(ctx, ordering, peers, peers_len, chunks, chunks_len, p, &p_len, filter, peerevaluate, data);
+  chunks_for_peers(ctx, ordering, p, p_len, chunks, chunks_len, c, &c_len, filter, chunkevaluate, data);
+
+  toPairsPeerFirst(p,p_len,c,c_len,selected,selected_len);
+}
+
+static void chunk_first(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                        struct PeerChunk *selected, size_t *selected_len,
+                        filterFunction_r filter, peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate, void *data)
+{
+  size_t p_len=*selected_len;
+  schedPeerID *p = scratch_get(ctx, SCRATCH_SELECTED, p_len * sizeof(schedPeerID));
+  size_t c_len=1;
+  schedChunkID c[1];
+
+  if (p == NULL) {
+    *selected_len = 0;
+    return;
+  }
+  chunks_for_peers(ctx, ordering, peers, peers_len, chunks, chunks_len, c, &c_len, filter, chunkevaluate, data);
+  peers_for_chunks(ctx, ordering, peers, peers_len, c, c_len, p, &p_len, filter, peerevaluate, data);
+
+  toPairsChunkFirst(p,p_len,c,c_len,selected,selected_len);
+}
+
+/*
+ * The evaluators of schedSelectComposed(). With batch evaluators, the
+ * weights of all the peers and all the chunks are computed first, with
+ * one call each, and only combined for each pair.
+ */
+struct composed {
+  peerEvaluateFunction_r peerevaluate;
+  chunkEvaluateFunction_r chunkevaluate;
+  double2op weightcombine;
+  const double *peer_w;	// NULL if not precomputed
+  const double *chunk_w;
+};
+
+/*
+ * Select among the pairs that pass the filter, streaming over them chunk
+ * first (as toPairs()) without storing them. The pairs are evaluated by
+ * the pair evaluator, or by combining the peer and chunk weights if c is
+ * not NULL.
+ */
+static void hybrid(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                   struct PeerChunk *selected, size_t *selected_len,
+                   filterFunction_r filter, pairEvaluateFunction_r pairevaluate, const struct composed *comp, void *data)
+{
+  struct selector s;
+  struct PeerChunk pcs[BATCH];
+  int index[BATCH];
+  double w[BATCH];
+  size_t p,c;
+
+  sel_init(&s, ctx, ordering, sizeof(struct PeerChunk), MIN(*selected_len, peers_len*chunks_len));
+  for (c=0; c<chunks_len; c++){
+    for (p=0; p<peers_len; p+=BATCH){
+      int i, f = 0, n = MIN(BATCH, peers_len - p);
+      uint64_t mask = filter_block(ctx, filter, data, peers + p, n, chunks[c]);
+
+      for (; mask; mask &= mask - 1){
+        i = __builtin_ctzll(mask);
+        pcs[f].peer = peers[p + i];
+        pcs[f].chunk = chunks[c];
+        index[f++] = p + i;
+      }
+      if (comp && comp->peer_w) {
+        for (i=0; i<f; i++) w[i] = comp->weightcombine(comp->peer_w[index[i]], comp->chunk_w[c]);
+      } else if (comp) {
+        for (i=0; i<f; i++) w[i] = comp->weightcombine(comp->peerevaluate(&pcs[i].peer, data), comp->chunkevaluate(&pcs[i].chunk, data));
+      } else if (ctx->pair_batch) {
+        ctx->pair_batch(pcs, f, w, data);
+      } else {
+        for (i=0; i<f; i++) w[i] = pairevaluate(&pcs[i],data);
+      }
+      for (i=0; i<f; i++) sel_add(&s, &pcs[i], w[i]);
+    }
+  }
+  *selected_len = sel_done(&s, (void*)selected);
+}
+
+static void composed(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter, peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate, double2op weightcombine, void *data)
+{
+  struct composed c = {peerevaluate, chunkevaluate, weightcombine, NULL, NULL};
+  double *peer_w = NULL, *chunk_w;
+  size_t i;
+
+  if (ctx->peer_batch || ctx->chunk_batch) {
+    peer_w = scratch_get(ctx, SCRATCH_BATCH, (peers_len + chunks_len) * sizeof(double));
+    if (peer_w == NULL) {
+      *selected_len = 0;
+      return;
+    }
+    chunk_w = peer_w + peers_len;
+    if (ctx->peer_batch) ctx->peer_batch(peers, peers_len, peer_w, data);
+    else for (i=0; i<peers_len; i++) peer_w[i] = peerevaluate(&peers[i], data);
+    if (ctx->chunk_batch) ctx->chunk_batch(chunks, chunks_len, chunk_w, data);
+    else for (i=0; i<chunks_len; i++) chunk_w[i] = chunkevaluate(&chunks[i], data);
+    c.peer_w = peer_w;
+    c.chunk_w = chunk_w;
+  }
+  hybrid(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, NULL, &c, data);
+}
+
 /*----------------- scheduler_la implementations --------------*/
 void schedSelectChunksForPeers(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len, 	//in
                      schedChunkID *selected, size_t *selected_len,	//out, inout
@@ -280,30 +766,22 @@ void schedSelectPeerFirst(SchedOrdering ordering, schedPeerID *peers, size_t pee
                      struct PeerChunk *selected, size_t *selected_len,	//out, inout
                      filterFunction filter,
                      peerEvaluateFunction peerevaluate, chunkEvaluateFunction chunkevaluate){
+  struct legacy l = {.filter = filter, .peerevaluate = peerevaluate, .chunkevaluate = chunkevaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-  size_t p_len=1;
-  schedPeerID p[p_len];
-  size_t c_len=*selected_len;
-  schedChunkID c[c_len];
-  selectPeersForChunks(ordering, peers, peers_len, chunks, chunks_len, p, &p_len, filter, peerevaluate);
-  selectChunksForPeers(ordering, p, p_len, chunks, chunks_len, c, &c_len, filter, chunkevaluate);
-
-  toPairsPeerFirst(p,p_len,c,c_len,selected,selected_len);
+  peer_first(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_peer, legacy_chunk, &l);
+  legacy_done(&ctx);
 }
 
 void schedSelectChunkFirst(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len, 	//in
                      struct PeerChunk *selected, size_t *selected_len,	//out, inout
                      filterFunction filter,
                      peerEvaluateFunction peerevaluate, chunkEvaluateFunction chunkevaluate){
+  struct legacy l = {.filter = filter, .peerevaluate = peerevaluate, .chunkevaluate = chunkevaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-  size_t p_len=*selected_len;
-  schedPeerID p[p_len];
-  size_t c_len=1;
-  schedChunkID c[c_len];
-  selectChunksForPeers(ordering, peers, peers_len, chunks, chunks_len, c, &c_len, filter, chunkevaluate);
-  selectPeersForChunks(ordering, peers, peers_len, c, c_len, p, &p_len, filter, peerevaluate);
-
-  toPairsChunkFirst(p,p_len,c,c_len,selected,selected_len);
+  chunk_first(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_peer, legacy_chunk, &l);
+  legacy_done(&ctx);
 }
 
 void schedSelectHybrid(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len, 	//in
@@ -311,36 +789,26 @@ void schedSelectHybrid(SchedOrdering ordering, schedPeerID *peers, size_t peers_
                      filterFunction filter,
                      pairEvaluateFunction pairevaluate)
 {
-  size_t pairs_len=peers_len*chunks_len;
-  struct PeerChunk pairs[pairs_len];
-  toPairs(peers,peers_len,chunks,chunks_len,pairs,&pairs_len);
-  filterPairs(pairs,&pairs_len,filter);
-  selectPairs(ordering,pairs,pairs_len,pairevaluate,selected,selected_len);
-}
+  struct legacy l = {.filter = filter, .pairevaluate = pairevaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
-
-peerEvaluateFunction peer_ev;
-chunkEvaluateFunction chunk_ev;
-double2op peerchunk_wc;
-
-double combinedWeight(struct PeerChunk* pc){
-  return peerchunk_wc(peer_ev(&pc->peer),chunk_ev(&pc->chunk));
+  hybrid(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_pair, NULL, &l);
+  legacy_done(&ctx);
 }
 
 /**
   * Convenience function for combining peer and chunk weights
-  * not thread safe!
   */
 void schedSelectComposed(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len, 	//in
                      struct PeerChunk *selected, size_t *selected_len,	//out, inout
                      filterFunction filter,
                      peerEvaluateFunction peerevaluate, chunkEvaluateFunction chunkevaluate, double2op weightcombine)
 {
-  peer_ev=peerevaluate;
-  chunk_ev=chunkevaluate;
-  peerchunk_wc=weightcombine;
-  schedSelectHybrid(ordering,peers,peers_len,chunks,chunks_len,selected,selected_len,filter,combinedWeight);
+  struct legacy l = {.filter = filter, .peerevaluate = peerevaluate, .chunkevaluate = chunkevaluate};
+  struct sched_ctx ctx = {.use_rand = 1};
 
+  composed(&ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, legacy_filter_r(filter), legacy_peer, legacy_chunk, weightcombine, &l);
+  legacy_done(&ctx);
 }
 
 void schedSelectPeersForChunks(SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,        //in
@@ -353,6 +821,45 @@ void schedSelectPeersForChunks(SchedOrdering ordering, schedPeerID *peers, size_
                       evaluate);
 }
 
+/*----------------- reentrant versions --------------*/
+void schedSelectPeersForChunks_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     schedPeerID *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r evaluate){
+  peers_for_chunks(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, evaluate, ctx->data);
+}
+
+void schedSelectChunksForPeers_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     schedChunkID *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     chunkEvaluateFunction_r evaluate){
+  chunks_for_peers(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, evaluate, ctx->data);
+}
 
+void schedSelectPeerFirst_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate){
+  peer_first(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, peerevaluate, chunkevaluate, ctx->data);
+}
 
+void schedSelectChunkFirst_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate){
+  chunk_first(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, peerevaluate, chunkevaluate, ctx->data);
+}
 
+void schedSelectHybrid_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     pairEvaluateFunction_r pairevaluate){
+  hybrid(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, pairevaluate, NULL, ctx->data);
+}
+
+void schedSelectComposed_r(struct sched_ctx *ctx, SchedOrdering ordering, schedPeerID *peers, size_t peers_len, schedChunkID *chunks, size_t chunks_len,
+                     struct PeerChunk *selected, size_t *selected_len,
+                     filterFunction_r filter,
+                     peerEvaluateFunction_r peerevaluate, chunkEvaluateFunction_r chunkevaluate, double2op weightcombine){
+  composed(ctx, ordering, peers, peers_len, chunks, chunks_len, selected, selected_len, filter, peerevaluate, chunkevaluate, weightcombine, ctx->data);
+}
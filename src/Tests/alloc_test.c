@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Check the grapes allocator, and compare it with malloc() on the
+ *  nodeID and peer churn caused by a large neighbourhood.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+#include "peerset.h"
+#include "grapes_alloc.h"
+
+#define N_OBJS 1000
+#define NEIGHBOURS 500
+#define ROUNDS 200
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int slab_check(void)
+{
+  struct grapes_slab *s;
+  void *objs[N_OBJS];
+  uint8_t *p;
+  int i, sizes[] = {1, 16, 17, 1000, 4096, 65536, 100000};
+
+  s = grapes_slab_create("test", 24);
+  if (s == NULL || grapes_slab_create("test", 24) != s) {
+    fprintf(stderr, "Error creating the slab\n");
+
+    return -1;
+  }
+  for (i = 0; i < N_OBJS; i++) {
+    objs[i] = grapes_slab_alloc(s);
+    memset(objs[i], i, 24);
+  }
+  for (i = 0; i < N_OBJS; i++) {
+    if (((uint8_t *)objs[i])[23] != (uint8_t)i) {
+      fprintf(stderr, "Object %d overwritten\n", i);
+
+      return -1;
+    }
+    grapes_free(objs[i]);
+  }
+  for (i = 0; i < N_OBJS; i++) {
+    objs[i] = grapes_slab_alloc(s);
+  }
+  for (i = 0; i < N_OBJS; i++) {
+    grapes_free(objs[i]);
+  }
+
+  /* Memory from malloc() can be released with grapes_free() */
+  grapes_free(malloc(10));
+
+  for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+    p = grapes_malloc(sizes[i]);
+    memset(p, 0xaa, sizes[i]);
+    p = grapes_realloc(p, sizes[i] * 2);
+    if (p[sizes[i] - 1] != 0xaa) {
+      fprintf(stderr, "Realloc to %d bytes lost the data\n", sizes[i] * 2);
+
+      return -1;
+    }
+    grapes_free(p);
+  }
+
+  return 0;
+}
+
+static double churn(struct nodeID **ids)
+{
+  struct peerset *ps;
+  double start;
+  int r, i;
+
+  ps = peerset_init("size=0");
+  start = now();
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < NEIGHBOURS; i++) {
+      peerset_add_peer(ps, ids[i]);
+    }
+    for (i = 0; i < NEIGHBOURS; i++) {
+      struct nodeID *id = nodeid_dup(ids[(i + r) % NEIGHBOURS]);
+
+      peerset_remove_peer(ps, id);
+      nodeid_free(id);
+    }
+  }
+  peerset_destroy(&ps);
+
+  return (double)ROUNDS * NEIGHBOURS / (now() - start);
+}
+
+static void stats_print(void)
+{
+  struct grapes_alloc_stats st[32];
+  int i, n;
+
+  n = grapes_alloc_stats(st, 32);
+  for (i = 0; i < n && i < 32; i++) {
+    printf("%12s (%5d bytes): %8lu hits %6lu misses %6d in use\n",
+           st[i].name, st[i].size, st[i].hits, st[i].misses, st[i].in_use);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct nodeID *ids[NEIGHBOURS];
+  double with_malloc, with_slabs;
+  char addr[16];
+  int i;
+
+  if (slab_check() < 0) {
+    return -1;
+  }
+  for (i = 0; i < NEIGHBOURS; i++) {
+    sprintf(addr, "10.0.%d.%d", i / 250, i % 250 + 1);
+    ids[i] = create_node(addr, 6000 + i);
+  }
+
+  grapes_alloc_init("allocator=malloc");
+  with_malloc = churn(ids);
+  grapes_alloc_init("allocator=slab");
+  with_slabs = churn(ids);
+  printf("%d neighbours: malloc %.0f peers/s, slabs %.0f peers/s (%.2fx)\n",
+         NEIGHBOURS, with_malloc, with_slabs, with_slabs / with_malloc);
+
+  for (i = 0; i < NEIGHBOURS; i++) {
+    nodeid_free(ids[i]);
+  }
+  stats_print();
+
+  return 0;
+}
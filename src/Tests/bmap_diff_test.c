@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Send a sliding buffer map over loopback, as whole buffer maps or as
+ *  differences, checking that the receiver rebuilds it correctly (also
+ *  when messages are lost or reordered, and with only some buffer maps
+ *  acknowledged, late, and when the receiver forgets the buffer map) and comparing the bytes sent and the CPU time. The heap
+ *  allocations are counted too: in steady state, signaling should not
+ *  allocate memory.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "net_helper.h"
+#include "peer.h"
+#include "peerset.h"
+#include "chunkidset.h"
+#include "trade_sig_ha.h"
+
+#define ROUNDS 1000
+#define BMAP_SIZE 500
+#define NEW_CHUNKS 4
+#define LOSS_PERIOD 100
+#define REORDER 50	/* Round (modulo LOSS_PERIOD) delivered late */
+#define ACK_PERIOD 8
+#define ACK_DELAY 3	/* Rounds: the RTT is longer than the sending period */
+#define RESTART 375	/* Round when the receiver drops and re-adds the sender */
+#define WARMUP 500
+
+static struct nodeID *a, *b;
+static int allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  allocs++;
+
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+  allocs++;
+
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  allocs++;
+
+  return __real_realloc(ptr, size);
+}
+
+static int receive(struct nodeID *local, struct chunkID_set *added,
+                   struct chunkID_set *removed, uint16_t *seq, enum signaling_type *type)
+{
+  static uint8_t buff[4096];
+  struct nodeID *remote, *owner;
+  struct timeval tout = {1, 0};
+  int len, max_deliver;
+
+  if (wait4data(local, &tout, NULL) <= 0) {
+    fprintf(stderr, "Message lost?\n");
+
+    return -1;
+  }
+  len = recv_from_peer(local, &remote, buff, sizeof(buff));
+  nodeid_free(remote);
+  if (parseSignalingDiff(buff + 1, len - 1, &owner, added, removed, &max_deliver, seq, type) < 0) {
+    return -1;
+  }
+  if (owner) {
+    nodeid_free(owner);
+  }
+
+  return len;
+}
+
+static int same(const struct chunkID_set *s1, const struct chunkID_set *s2)
+{
+  return chunkID_set_size(s1) == chunkID_set_size(s2) && chunkID_set_difference_count(s1, s2) == 0;
+}
+
+static int run(int diff, int *bytes, double *cpu, int *steady_allocs)
+{
+  struct peerset *a_neighbours, *b_neighbours;
+  struct chunkID_set *bmap, *added, *removed, *late_added, *late_removed;
+  struct peer *to_b, *from_a;
+  enum signaling_type late_type;
+  uint16_t late_seq, ack_seq = 0;
+  clock_t start;
+  int i, r, full = 0, ack_round = -1;
+
+  a_neighbours = peerset_init("size=1");
+  b_neighbours = peerset_init("size=1");
+  peerset_add_peer(a_neighbours, b);
+  peerset_add_peer(b_neighbours, a);
+  to_b = peerset_get_peer(a_neighbours, b);
+  from_a = peerset_get_peer(b_neighbours, a);
+  bmap = chunkID_set_init("type=bitmap");
+  added = chunkID_set_init("type=bitmap");
+  removed = chunkID_set_init("type=bitmap");
+  late_added = chunkID_set_init("type=bitmap");
+  late_removed = chunkID_set_init("type=bitmap");
+  srand(1);
+
+  *bytes = 0;
+  start = clock();
+  for (r = 0; r < ROUNDS; r++) {
+    enum signaling_type type;
+    uint16_t seq;
+    int len;
+
+    for (i = 0; i < NEW_CHUNKS; i++) {
+      if (rand() % 10) {
+        chunkID_set_add_chunk(bmap, r * NEW_CHUNKS + i);
+      }
+    }
+    chunkID_set_trim(bmap, BMAP_SIZE);
+    if (r == WARMUP) {
+      /* The buffer map is full and the sets have grown to their final size */
+      allocs = 0;
+    }
+
+    if (ack_round >= 0 && r - ack_round == ACK_DELAY) {
+      bufferMapAcked(to_b, ack_seq);
+      ack_round = -1;
+    }
+    chunkSignalingInit(a);
+    if (diff) {
+      sendBufferMapDiff(to_b, NULL, bmap, BMAP_SIZE);
+    } else {
+      sendBufferMap(b, NULL, bmap, BMAP_SIZE, r);
+    }
+    len = receive(b, added, removed, &seq, &type);
+    if (len < 0) {
+      return -1;
+    }
+    *bytes += len;
+    full += type == sig_send_buffermap;
+    if (r % LOSS_PERIOD == REORDER) {
+      struct chunkID_set *tmp;
+
+      /* Delivered after the next one (swapping the sets, so that all of them stay in use) */
+      tmp = late_added;
+      late_added = added;
+      added = tmp;
+      tmp = late_removed;
+      late_removed = removed;
+      removed = tmp;
+      late_seq = seq;
+      late_type = type;
+      continue;
+    }
+    if (r % LOSS_PERIOD == LOSS_PERIOD - 1) {
+      /* Lost message */
+      continue;
+    }
+    if (r == RESTART) {
+      peerset_remove_peer(b_neighbours, a);
+      peerset_add_peer(b_neighbours, a);
+      from_a = peerset_get_peer(b_neighbours, a);
+    }
+    chunkSignalingInit(b);
+    if (diff && r == RESTART) {
+      /* The difference cannot be applied: the whole buffer map is requested */
+      if (applyBufferMap(from_a, added, removed, type, seq) == 0 ||
+          receive(a, added, removed, &seq, &type) < 0 || type != sig_request_buffermap) {
+        fprintf(stderr, "Buffer map not requested at round %d\n", r);
+
+        return -1;
+      }
+      bufferMapRequested(to_b);
+      continue;
+    }
+    if (applyBufferMap(from_a, added, removed, type, seq) < 0 || !same(from_a->bmap, bmap)) {
+      fprintf(stderr, "Wrong buffer map at round %d\n", r);
+
+      return -1;
+    }
+    if (r % LOSS_PERIOD == REORDER + 1 &&
+        (applyBufferMap(from_a, late_added, late_removed, late_type, late_seq) == 0 ||
+         !same(from_a->bmap, bmap))) {
+      fprintf(stderr, "Stale buffer map applied at round %d\n", r);
+
+      return -1;
+    }
+    if (diff && ack_round < 0 && (type == sig_send_buffermap || r % ACK_PERIOD == 0)) {
+      ackBufferMap(a, seq);
+      if (receive(a, added, removed, &ack_seq, &type) < 0 || type != sig_ack_buffermap) {
+        return -1;
+      }
+      ack_round = r;
+    }
+  }
+  *cpu = (double)(clock() - start) / CLOCKS_PER_SEC;
+  *steady_allocs = allocs;
+
+  chunkID_set_free(bmap);
+  chunkID_set_free(added);
+  chunkID_set_free(removed);
+  chunkID_set_free(late_added);
+  chunkID_set_free(late_removed);
+  peerset_destroy(&a_neighbours);
+  peerset_destroy(&b_neighbours);
+
+  return full;
+}
+
+int main(int argc, char *argv[])
+{
+  int full_bytes, diff_bytes, full_allocs, diff_allocs, n;
+  double full_cpu, diff_cpu;
+
+  a = net_helper_init("127.0.0.1", 7100, "");
+  b = net_helper_init("127.0.0.1", 7101, "");
+  if (a == NULL || b == NULL) {
+    fprintf(stderr, "Error creating the sockets\n");
+
+    return -1;
+  }
+  if (run(0, &full_bytes, &full_cpu, &full_allocs) < 0) {
+    return -1;
+  }
+  n = run(1, &diff_bytes, &diff_cpu, &diff_allocs);
+  if (n < 0) {
+    return -1;
+  }
+  printf("Whole buffer maps: %d bytes/map, %.1f us/map, %d allocations\n",
+         full_bytes / ROUNDS, full_cpu * 1e6 / ROUNDS, full_allocs);
+  printf("Differences: %d bytes/map, %.1f us/map, %d allocations (%d whole maps)\n",
+         diff_bytes / ROUNDS, diff_cpu * 1e6 / ROUNDS, diff_allocs, n);
+
+  return full_allocs || diff_allocs ? -1 : 0;
+}
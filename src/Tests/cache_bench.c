@@ -0,0 +1,557 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Check that the peer cache finds its nodes after random insertions,
+ *  removals, reorderings and merges, and measure how long merging two
+ *  caches (as done when parsing a gossip message) takes as the cache
+ *  size grows. Check that ranking a cache (as TMan does) gives the same
+ *  order as inserting the entries one by one in rank order, and measure
+ *  its cost. Finally, check that merging received gossip messages in
+ *  place gives the same caches as undumping and merging them into new
+ *  caches, and count the nodeIDs allocated per message.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "net_helper.h"
+#include "grapes_alloc.h"
+#include "../Cache/topocache.h"
+#include "../Cache/blist_cache.h"
+
+#define NODES 400
+#define CHECK_SIZE 100
+#define CHECK_ROUNDS 20000
+#define WORK 200000
+#define TARGET 500
+#define GOSSIP_SIZE 50
+#define GOSSIP_NODES 200
+#define GOSSIP_ROUNDS 2000
+
+static struct nodeID *nodes[NODES * 2];
+static long rank_calls;
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct nodeID *node(int i)
+{
+  char addr[32];
+
+  sprintf(addr, "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+  return create_node(addr, 6000 + i % 7);
+}
+
+/* cache_pos() must agree with a linear search */
+static int find(const struct peer_cache *c, const struct nodeID *id)
+{
+  int i;
+
+  for (i = 0; i < cache_current_size(c); i++) {
+    if (nodeid_equal(nodeid(c, i), id)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static int verify(const struct peer_cache *c)
+{
+  int i;
+
+  cache_check(c);
+  for (i = 0; i < 8; i++) {
+    const struct nodeID *id = nodes[rand() % (NODES * 2)];
+
+    if (cache_pos(c, id) != find(c, id)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int check(void)
+{
+  struct peer_cache *c, *r, *m;
+  int i, meta, size, source;
+
+  c = cache_init(CHECK_SIZE, sizeof(int), 40);
+  for (i = 0; i < CHECK_ROUNDS; i++) {
+    int n = rand() % NODES;
+
+    meta = n;
+    switch (rand() % 8) {
+      case 0:
+      case 1:
+      case 2:
+        cache_add(c, nodes[n], &meta, sizeof(meta));
+        break;
+      case 3:
+        cache_del(c, nodes[n]);
+        break;
+      case 4:
+        cache_update(c);
+        break;
+      case 5:
+        cache_randomize(c);
+        break;
+      case 6:
+        r = rand_cache(c, rand() % 10);
+        cache_fill_ordered(c, r, 0);
+        cache_free(r);
+        break;
+      case 7:
+        r = cache_init(CHECK_SIZE, sizeof(int), 40);
+        cache_fill_rand(r, c, rand() % CHECK_SIZE);
+        cache_add(r, nodes[n], &meta, sizeof(meta));
+        cache_update(c);
+        m = merge_caches(r, c, CHECK_SIZE, &source);
+        if (verify(m) < 0) {
+          return -1;
+        }
+        cache_free(r);
+        cache_free(c);
+        c = m;
+        break;
+    }
+    if (verify(c) < 0) {
+      fprintf(stderr, "Wrong position at round %d\n", i);
+
+      return -1;
+    }
+    cache_metadata_update(c, nodes[n], &meta, sizeof(meta));
+    if (cache_pos(c, nodes[n]) >= 0) {
+      const int *v = get_metadata(c, &size);
+
+      if (v[cache_pos(c, nodes[n])] != n) {
+        fprintf(stderr, "Wrong metadata at round %d\n", i);
+
+        return -1;
+      }
+    }
+  }
+  r = cache_copy(c);
+  m = cache_union(c, r, &size);
+  if (size != cache_current_size(r) || verify(m) < 0) {
+    return -1;
+  }
+  cache_free(m);
+  cache_free(r);
+  cache_free(c);
+
+  return 0;
+}
+
+/* Two caches of n nodes, with timestamps from 1 to 10, sharing half of the nodes */
+static void fill(struct peer_cache **c1, struct peer_cache **c2, struct nodeID **ids, int n)
+{
+  int i, meta = 0;
+
+  *c1 = cache_init(n, sizeof(int), 0);
+  *c2 = cache_init(n, sizeof(int), 0);
+  for (i = 0; i < n; i++) {
+    cache_add(*c1, ids[i], &meta, sizeof(meta));
+    cache_add(*c2, ids[i + n / 2], &meta, sizeof(meta));
+    if (i % (n / 10) == n / 10 - 1) {
+      cache_update(*c1);
+      cache_update(*c2);
+    }
+  }
+}
+
+static void bench(int n)
+{
+  struct peer_cache *c1, *c2;
+  struct nodeID **ids;
+  double merge = 0, merge_union = 0, t;
+  int i, r, rounds, size;
+
+  ids = malloc(sizeof(struct nodeID *) * n * 2);
+  for (i = 0; i < n * 2; i++) {
+    ids[i] = node(i);
+  }
+  fill(&c1, &c2, ids, n);
+  rounds = WORK / n + 1;
+  for (r = 0; r < rounds; r++) {
+    struct peer_cache *l, *remote, *m;
+
+    /* Merging steals the nodeIDs from the caches: merge copies */
+    l = cache_copy(c1);
+    remote = cache_copy(c2);
+    t = now();
+    m = merge_caches(l, remote, n, &size);
+    merge += now() - t;
+    cache_free(m);
+    cache_free(l);
+    cache_free(remote);
+
+    l = cache_copy(c1);
+    remote = cache_copy(c2);
+    t = now();
+    m = cache_union(l, remote, &size);
+    merge_union += now() - t;
+    cache_free(m);
+    cache_free(l);
+    cache_free(remote);
+  }
+  printf("%5d entries: merge_caches %8.1f us, cache_union %8.1f us\n",
+         n, merge * 1e6 / rounds, merge_union * 1e6 / rounds);
+
+  cache_free(c1);
+  cache_free(c2);
+  for (i = 0; i < n * 2; i++) {
+    nodeid_free(ids[i]);
+  }
+  free(ids);
+}
+
+static int distance_rank(const void *target, const void *p1, const void *p2)
+{
+  int d1 = abs(*(const int *)target - *(const int *)p1);
+  int d2 = abs(*(const int *)target - *(const int *)p2);
+
+  rank_calls++;
+
+  return d1 == d2 ? 0 : d1 < d2 ? 1 : 2;
+}
+
+static double distance_key(const void *target, const void *p)
+{
+  return abs(*(const int *)target - *(const int *)p);
+}
+
+/* The positions of the metadata in rank order, inserting them one by one as cache_rank() did */
+static void insertion_rank(int *order, const int *meta, int n, int skip)
+{
+  int target = TARGET;
+  int i, j, pos, placed = 0;
+
+  for (i = 0; i < n; i++) {
+    if (i == skip) {
+      continue;
+    }
+    pos = 0;
+    for (j = 0; j < placed; j++) {
+      if (distance_rank(&target, &meta[i], &meta[order[j]]) == 2) {
+        pos++;
+      }
+    }
+    for (j = placed; j > pos; j--) {
+      order[j] = order[j - 1];
+    }
+    order[pos] = i;
+    placed++;
+  }
+}
+
+static int same_order(const struct peer_cache *c, const struct peer_cache *ranked, const int *order, int n)
+{
+  const int *meta, *ranked_meta;
+  int i, size;
+
+  meta = get_metadata(c, &size);
+  ranked_meta = get_metadata(ranked, &size);
+  if (cache_current_size(ranked) != n) {
+    return 0;
+  }
+  for (i = 0; i < n; i++) {
+    if (!nodeid_equal(nodeid(ranked, i), nodeid(c, order[i])) || ranked_meta[i] != meta[order[i]]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int check_rank(void)
+{
+  struct peer_cache *c, *ranked;
+  int order[NODES];
+  int i, r, target = TARGET;
+
+  for (r = 0; r < 50; r++) {
+    int n = 1 + rand() % NODES;
+    int skip = rand() % n;
+    const int *meta;
+
+    c = cache_init(n, sizeof(int), 0);
+    for (i = 0; i < n; i++) {
+      /* Few different distances: lots of ties */
+      int m = TARGET + rand() % 41 - 20;
+
+      cache_add(c, nodes[i], &m, sizeof(m));
+    }
+    meta = get_metadata(c, &i);
+
+    insertion_rank(order, meta, n, -1);
+    ranked = cache_rank(c, distance_rank, NULL, &target);
+    if (!same_order(c, ranked, order, n)) {
+      fprintf(stderr, "Wrong ranking for %d entries\n", n);
+
+      return -1;
+    }
+    cache_free(ranked);
+
+    insertion_rank(order, meta, n, skip);
+    ranked = cache_rank(c, distance_rank, nodeid(c, skip), &target);
+    if (!same_order(c, ranked, order, n - 1)) {
+      fprintf(stderr, "Wrong ranking for %d entries, excluding the target\n", n);
+
+      return -1;
+    }
+    cache_free(ranked);
+    ranked = cache_rank_key(c, distance_key, nodeid(c, skip), &target);
+    if (!same_order(c, ranked, order, n - 1)) {
+      fprintf(stderr, "Wrong ranking by key for %d entries\n", n);
+
+      return -1;
+    }
+    cache_free(ranked);
+    cache_free(c);
+  }
+
+  return 0;
+}
+
+static void bench_rank(int n)
+{
+  struct peer_cache *c, *b;
+  double t_rank = 0, t_key = 0, t_blist = 0, t;
+  long calls = 0;
+  int i, r, rounds, target = TARGET;
+
+  c = cache_init(n, sizeof(int), 0);
+  b = blist_cache_init(n, sizeof(int), 0);
+  for (i = 0; i < n; i++) {
+    struct nodeID *id = node(i);
+    int m = rand() % 1000;
+
+    cache_add(c, id, &m, sizeof(m));
+    blist_cache_add(b, id, &m, sizeof(m));
+    nodeid_free(id);
+  }
+  rounds = WORK / n + 1;
+  for (r = 0; r < rounds; r++) {
+    struct peer_cache *ranked;
+
+    rank_calls = 0;
+    t = now();
+    ranked = cache_rank(c, distance_rank, NULL, &target);
+    t_rank += now() - t;
+    calls += rank_calls;
+    cache_free(ranked);
+
+    t = now();
+    ranked = cache_rank_key(c, distance_key, NULL, &target);
+    t_key += now() - t;
+    cache_free(ranked);
+
+    t = now();
+    ranked = blist_cache_rank(b, distance_rank, NULL, &target);
+    t_blist += now() - t;
+    blist_cache_free(ranked);
+  }
+  printf("%5d entries: cache_rank %8.1f us (%ld calls), by key %8.1f us, blist_cache_rank %8.1f us\n",
+         n, t_rank * 1e6 / rounds, calls / rounds, t_key * 1e6 / rounds, t_blist * 1e6 / rounds);
+
+  cache_free(c);
+  blist_cache_free(b);
+}
+
+/* Number of nodeIDs allocated so far */
+static unsigned long nodeid_allocs(void)
+{
+  struct grapes_alloc_stats stats[64];
+  int i, n;
+
+  n = grapes_alloc_stats(stats, 64);
+  for (i = 0; i < n && i < 64; i++) {
+    if (strcmp(stats[i].name, "nodeID") == 0) {
+      return stats[i].hits + stats[i].misses;
+    }
+  }
+
+  return 0;
+}
+
+/* A gossip message: the sender's entry and a random part of its cache */
+static int gossip_msg(uint8_t *buff, int blist)
+{
+  struct peer_cache *c;
+  int i, len, m, size = 1 + rand() % GOSSIP_SIZE;
+
+  c = blist ? blist_cache_init(size + 2, sizeof(int), 0) : cache_init(size + 2, sizeof(int), 0);
+  for (i = 0; i < size; i++) {
+    m = rand() % 1000;
+    if (blist) {
+      blist_cache_add(c, nodes[rand() % GOSSIP_NODES], &m, sizeof(m));
+    } else {
+      cache_add(c, nodes[rand() % GOSSIP_NODES], &m, sizeof(m));
+      if (rand() % 4 == 0) {
+        cache_update(c);
+      }
+    }
+  }
+  if (blist) {
+    len = blist_cache_header_dump(buff, c);
+    for (i = 0; blist_nodeid(c, i); i++) {
+      len += blist_entry_dump(buff + len, c, i, 4096);
+    }
+    blist_cache_free(c);
+  } else {
+    len = cache_header_dump(buff, c, 0);
+    for (i = 0; nodeid(c, i); i++) {
+      len += entry_dump(buff + len, c, i, 4096);
+    }
+    cache_free(c);
+  }
+
+  return len;
+}
+
+static int same_cache(const struct peer_cache *c1, const struct peer_cache *c2, int blist)
+{
+  const int *m1, *m2;
+  int i, size;
+
+  m1 = blist ? blist_get_metadata(c1, &size) : get_metadata(c1, &size);
+  m2 = blist ? blist_get_metadata(c2, &size) : get_metadata(c2, &size);
+  for (i = 0; blist ? blist_nodeid(c1, i) || blist_nodeid(c2, i) : nodeid(c1, i) || nodeid(c2, i); i++) {
+    if (blist && (!blist_nodeid(c1, i) || !blist_nodeid(c2, i) || !nodeid_equal(blist_nodeid(c1, i), blist_nodeid(c2, i)))) {
+      return 0;
+    }
+    if (!blist && (!nodeid(c1, i) || !nodeid(c2, i) || !nodeid_equal(nodeid(c1, i), nodeid(c2, i)))) {
+      return 0;
+    }
+    if (m1[i] != m2[i]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* As ncast does, and as TMan does (blist != 0), the old way and in place */
+static int check_gossip(int blist)
+{
+  static uint8_t buff[65536];
+  struct peer_cache *old_local, *local, *remote = NULL;
+  unsigned long old_allocs = 0, new_allocs = 0, changes = 0, a;
+  int r, i, j, len, size, source, target = TARGET;
+
+  if (blist) {
+    old_local = blist_cache_init(GOSSIP_SIZE, sizeof(int), 0);
+    local = blist_cache_init(GOSSIP_SIZE, sizeof(int), 0);
+  } else {
+    old_local = cache_init(GOSSIP_SIZE, sizeof(int), 5);
+    local = cache_init(GOSSIP_SIZE, sizeof(int), 5);
+  }
+  for (r = 0; r < GOSSIP_ROUNDS; r++) {
+    struct peer_cache *old_remote, *merged, *temp;
+    struct nodeID *before[GOSSIP_SIZE];
+
+    len = gossip_msg(buff, blist);
+
+    a = nodeid_allocs();
+    if (blist) {
+      old_remote = blist_entries_undump(buff, len);
+      temp = blist_cache_union(old_local, old_remote, &size);
+      merged = blist_cache_rank(temp, distance_rank, NULL, &target);
+      blist_cache_resize(merged, GOSSIP_SIZE);
+      blist_cache_free(temp);
+      blist_cache_free(old_remote);
+      blist_cache_free(old_local);
+    } else {
+      old_remote = entries_undump(buff, len);
+      merged = merge_caches(old_local, old_remote, GOSSIP_SIZE, &source);
+      cache_free(old_remote);
+      cache_free(old_local);
+    }
+    old_local = merged;
+    old_allocs += nodeid_allocs() - a;
+
+    for (i = 0; i < GOSSIP_SIZE; i++) {
+      before[i] = blist ? blist_nodeid(local, i) : nodeid(local, i);
+    }
+    a = nodeid_allocs();
+    if (blist) {
+      remote = blist_entries_undump_into(remote, buff, len);
+      blist_cache_merge_union(local, remote);
+      blist_cache_sort(local, distance_rank, &target);
+      blist_cache_resize(local, GOSSIP_SIZE);
+    } else {
+      remote = entries_undump_into(remote, buff, len);
+      cache_merge(local, remote, GOSSIP_SIZE, &source);
+    }
+    new_allocs += nodeid_allocs() - a;
+    /* The nodes which were already there keep their nodeIDs */
+    for (i = 0; blist ? blist_nodeid(local, i) != NULL : nodeid(local, i) != NULL; i++) {
+      for (j = 0; j < GOSSIP_SIZE && before[j] != (blist ? blist_nodeid(local, i) : nodeid(local, i)); j++);
+      changes += j == GOSSIP_SIZE;
+    }
+
+    if (!same_cache(local, old_local, blist)) {
+      fprintf(stderr, "Different %s caches at round %d\n", blist ? "TMan" : "ncast", r);
+
+      return -1;
+    }
+    if (blist) {
+      blist_cache_update(old_local);
+      blist_cache_update(local);
+    } else {
+      cache_check(local);
+      cache_update(old_local);
+      cache_update(local);
+    }
+  }
+  printf("%s merge: %.1f nodeIDs allocated per message (%.1f before), %.1f new entries\n",
+         blist ? "TMan" : "ncast", (double)new_allocs / GOSSIP_ROUNDS, (double)old_allocs / GOSSIP_ROUNDS,
+         (double)changes / GOSSIP_ROUNDS);
+  if (blist) {
+    blist_cache_free(old_local);
+    blist_cache_free(local);
+    blist_cache_free(remote);
+  } else {
+    cache_free(old_local);
+    cache_free(local);
+    cache_free(remote);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  srand(1);
+  for (i = 0; i < NODES * 2; i++) {
+    nodes[i] = node(i);
+  }
+  if (check() < 0 || check_rank() < 0 || check_gossip(0) < 0 || check_gossip(1) < 0) {
+    return -1;
+  }
+
+  bench(50);
+  bench(500);
+  bench(5000);
+
+  bench_rank(50);
+  bench_rank(500);
+  bench_rank(5000);
+
+  return 0;
+}
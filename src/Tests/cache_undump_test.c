@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Decode gossip messages containing a nodeID with an unknown encoding
+ *  tag, checking that the caches keep the entries preceding it.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+#include "../Cache/topocache.h"
+#include "../Cache/blist_cache.h"
+
+#define ENTRIES 4
+#define BAD 2		/* Position of the malformed entry */
+
+/* Build a message with ENTRIES entries, the BAD-th one having a bad tag */
+static int build(uint8_t *buff, int size, int flags)
+{
+  uint8_t *p = buff;
+  int i;
+
+  memset(buff, 0, size);
+  p[3] = ENTRIES;	/* cache size; the metadata size is 0 */
+  p += 8;
+  for (i = 0; i < ENTRIES; i++) {
+    struct nodeID *id;
+    int res;
+
+    p += 4 + flags;	/* Timestamp (and flags) */
+    id = create_node("127.0.0.1", 6000 + i);
+    res = nodeid_dump(p, id, size - (p - buff));
+    nodeid_free(id);
+    if (res <= 0) {
+      return -1;
+    }
+    if (i == BAD) {
+      p[0] = 0xff;
+    }
+    p += res;
+  }
+
+  return p - buff;
+}
+
+static int blist_entries(const struct peer_cache *c)
+{
+  int n = 0;
+
+  while (blist_nodeid(c, n)) {
+    n++;
+  }
+
+  return n;
+}
+
+static int check(const char *name, int n, int expected)
+{
+  printf("%s: %d entries\n", name, n);
+  if (n != expected) {
+    fprintf(stderr, "%s: %d entries instead of %d\n", name, n, expected);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct peer_cache *c;
+  uint8_t buff[1024];
+  int len, res = 0;
+
+  len = build(buff, sizeof(buff), 0);
+  if (len < 0) {
+    fprintf(stderr, "Error building the message\n");
+
+    return -1;
+  }
+  c = entries_undump(buff, len);
+  res |= c == NULL || check("entries_undump", cache_entries(c), BAD);
+  c = entries_undump_into(c, buff, len);
+  res |= c == NULL || check("entries_undump_into", cache_entries(c), BAD);
+  cache_free(c);
+
+  len = build(buff, sizeof(buff), 1);
+  if (len < 0) {
+    fprintf(stderr, "Error building the message\n");
+
+    return -1;
+  }
+  c = blist_entries_undump(buff, len);
+  res |= c == NULL || check("blist_entries_undump", blist_entries(c), BAD);
+  c = blist_entries_undump_into(c, buff, len);
+  res |= c == NULL || check("blist_entries_undump_into", blist_entries(c), BAD);
+  blist_cache_free(c);
+
+  return res ? -1 : 0;
+}
@@ -64,11 +64,12 @@ static void cb_print(const struct chunk_buffer *cb)
   }
 }
 
-int main(int argc, char *argv[])
+static int cb_run(const char *config)
 {
   struct chunk_buffer *b;
 
-  b = cb_init("size=8,time=now");
+  printf("Testing \"%s\"\n", config);
+  b = cb_init(config);
   if (b == NULL) {
     printf("Error initialising the Chunk Buffer\n");
 
@@ -102,7 +103,23 @@ int main(int argc, char *argv[])
   chunk_add(b, 33);
   cb_print(b);
 
+  chunk_add(b, 200);
+  chunk_add(b, 199);
+  chunk_add(b, 33);
+  printf("Chunk 199 is %sin the buffer\n", cb_get_chunk(b, 199) ? "" : "not ");
+  printf("Chunk 64 is %sin the buffer\n", cb_get_chunk(b, 64) ? "" : "not ");
+  cb_print(b);
+
   cb_destroy(b);
 
   return 0;
 }
+
+int main(int argc, char *argv[])
+{
+  if (cb_run("size=8,time=now") < 0) {
+    return -1;
+  }
+
+  return cb_run("type=ring,size=8,window=256,time=now");
+}
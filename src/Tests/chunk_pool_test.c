@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Send chunks over loopback, receive them in a chunk buffer and count
+ *  the memory allocations performed for each received chunk, copying the
+ *  payload (with malloc() or with the grapes allocator) and receiving it
+ *  in the chunk pool. Linked with -Wl,--wrap=malloc.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+#include "chunk.h"
+#include "chunk_pool.h"
+#include "grapes_alloc.h"
+#include "chunkbuffer.h"
+#include "trade_msg_la.h"
+#include "trade_msg_ha.h"
+#include "grapes_msg_types.h"
+
+#define BUFFSIZE 2048
+#define WARMUP 64
+#define CHUNKS 1000
+
+static int mallocs;
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  mallocs++;
+
+  return __real_malloc(size);
+}
+
+static int run(struct nodeID *src, struct nodeID *dst, const char *name, int pooled)
+{
+  struct chunk_buffer *cb;
+  struct nodeID *remote = NULL;
+  static uint8_t payload[1000], attributes[16];
+  static uint8_t static_buff[BUFFSIZE];
+  int i, start = 0, ok = 0;
+
+  cb = cb_init("type=ring,size=16,time=now");
+  if (cb == NULL) {
+    return -1;
+  }
+  for (i = 0; i < WARMUP + CHUNKS; i++) {
+    struct chunk c;
+    uint8_t *buff;
+    uint16_t transid;
+    int size = BUFFSIZE;
+
+    if (i == WARMUP) {
+      start = mallocs;
+    }
+    c.id = i;
+    c.timestamp = 40 * i;
+    c.size = sizeof(payload);
+    c.data = payload;
+    c.attributes_size = sizeof(attributes);
+    c.attributes = attributes;
+    memset(payload, i, sizeof(payload));
+    sendChunk(dst, &c, i);
+
+    buff = pooled ? chunk_pool_get(BUFFSIZE) : static_buff;
+    if (buff == NULL) {
+      fprintf(stderr, "Chunk pool exhausted at chunk %d\n", i);
+
+      return -1;
+    }
+    if (recv_from_peer_batch(dst, &remote, &buff, &size, 1) != 1 || buff[0] != MSG_TYPE_CHUNK ||
+        parseChunkMsg(buff + 1, size - 1, &c, &transid) < 0) {
+      fprintf(stderr, "Error receiving chunk %d\n", i);
+
+      return -1;
+    }
+    if (pooled) {
+      /* The chunk now holds its own references to the buffer */
+      chunk_pool_put(buff);
+    }
+    ok += c.id == i && transid == (uint16_t)i && c.data[c.size - 1] == (uint8_t)i;
+    if (cb_add_chunk(cb, &c) < 0) {
+      chunk_data_free(c.data);
+      chunk_data_free(c.attributes);
+    }
+  }
+  printf("%s: %d/%d chunks received correctly, %.2f allocations per chunk\n",
+         name, ok, WARMUP + CHUNKS,
+         (double)(mallocs - start) / CHUNKS);
+  cb_destroy(cb);
+  nodeid_free(remote);
+
+  return pooled ? mallocs - start : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct nodeID *src, *dst;
+  int res;
+
+  src = net_helper_init("127.0.0.1", 6668, "");
+  dst = net_helper_init("127.0.0.1", 6669, "");
+  if (src == NULL || dst == NULL) {
+    return -1;
+  }
+  chunkDeliveryInit(src);
+  if (chunk_pool_init("buffers=32,buffer_size=2048") < 0) {
+    return -1;
+  }
+
+  grapes_alloc_init("allocator=malloc");
+  res = run(src, dst, "copy (malloc)", 0);
+  grapes_alloc_init("allocator=slab");
+  if (res == 0) {
+    res = run(src, dst, "copy (grapes_alloc)", 0);
+  }
+  if (res == 0) {
+    res = run(src, dst, "pool", 1);
+  }
+
+  chunk_pool_destroy();
+  nodeid_free(dst);
+  nodeid_free(src);
+
+  return res;
+}
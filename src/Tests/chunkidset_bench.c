@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Compare the bulk set operations with the equivalent loops on single
+ *  chunk IDs, checking that they compute the same results.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chunkidset.h"
+
+#define CHUNKS 2000
+#define ROUNDS 2000
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* A buffer map: the chunks in [base, base + CHUNKS) that are received */
+static struct chunkID_set *bmap(const char *config, int base, int seed)
+{
+  struct chunkID_set *s;
+  int i;
+
+  s = chunkID_set_init(config);
+  srand(seed);
+  for (i = 0; i < CHUNKS; i++) {
+    if (rand() % 4) {
+      chunkID_set_add_chunk(s, base + i);
+    }
+  }
+
+  return s;
+}
+
+static int same(const struct chunkID_set *a, const struct chunkID_set *b)
+{
+  int i;
+
+  if (chunkID_set_size(a) != chunkID_set_size(b)) {
+    return 0;
+  }
+  for (i = 0; i < chunkID_set_size(a); i++) {
+    if (chunkID_set_check(b, chunkID_set_get_chunk(a, i)) < 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int check(const char *config, const char *other)
+{
+  struct chunkID_set *a, *b, *u, *i, *d, *ref;
+  int k, cnt;
+
+  a = bmap(config, 1000, 1);
+  b = bmap(other, 1500, 2);
+  u = bmap(config, 1000, 1);
+  i = bmap(config, 1000, 1);
+  d = bmap(config, 1000, 1);
+  chunkID_set_union(u, b);
+  chunkID_set_intersect(i, b);
+  chunkID_set_difference(d, b);
+
+  ref = chunkID_set_init("type=bitmap");
+  for (k = 0; k < chunkID_set_size(a); k++) {
+    chunkID_set_add_chunk(ref, chunkID_set_get_chunk(a, k));
+  }
+  for (k = 0; k < chunkID_set_size(b); k++) {
+    chunkID_set_add_chunk(ref, chunkID_set_get_chunk(b, k));
+  }
+  if (!same(u, ref)) {
+    fprintf(stderr, "%s/%s: wrong union\n", config, other);
+
+    return -1;
+  }
+  chunkID_set_clear(ref, 0);
+  for (k = 0; k < chunkID_set_size(a); k++) {
+    if (chunkID_set_check(b, chunkID_set_get_chunk(a, k)) >= 0) {
+      chunkID_set_add_chunk(ref, chunkID_set_get_chunk(a, k));
+    }
+  }
+  if (!same(i, ref) || chunkID_set_intersect_count(a, b) != chunkID_set_size(ref)) {
+    fprintf(stderr, "%s/%s: wrong intersection\n", config, other);
+
+    return -1;
+  }
+  if (chunkID_set_size(d) != chunkID_set_size(a) - chunkID_set_size(ref) ||
+      chunkID_set_difference_count(a, b) != chunkID_set_size(d) ||
+      chunkID_set_intersect_count(d, b) != 0) {
+    fprintf(stderr, "%s/%s: wrong difference\n", config, other);
+
+    return -1;
+  }
+  /* d xor b contains the chunks of a or b; xor b again gives d back */
+  chunkID_set_xor(d, b);
+  if (!same(d, u)) {
+    fprintf(stderr, "%s/%s: wrong symmetric difference\n", config, other);
+
+    return -1;
+  }
+  chunkID_set_xor(d, b);
+  if (chunkID_set_size(d) != chunkID_set_difference_count(a, b) || chunkID_set_intersect_count(d, b)) {
+    fprintf(stderr, "%s/%s: wrong symmetric difference\n", config, other);
+
+    return -1;
+  }
+  for (cnt = 0, k = 1100; k < 2345; k++) {
+    cnt += chunkID_set_check(a, k) >= 0;
+  }
+  if (chunkID_set_count_in_range(a, 1100, 2345) != cnt || chunkID_set_count_in_range(a, 50, 60) != 0) {
+    fprintf(stderr, "%s: wrong range count\n", config);
+
+    return -1;
+  }
+
+  chunkID_set_free(a);
+  chunkID_set_free(b);
+  chunkID_set_free(u);
+  chunkID_set_free(i);
+  chunkID_set_free(d);
+  chunkID_set_free(ref);
+
+  return 0;
+}
+
+static void bench(const char *config)
+{
+  struct chunkID_set *mine, *peer, *tmp;
+  double t0, t1, t2, t3, t4;
+  int r, k, c1 = 0, c2 = 0;
+
+  mine = bmap(config, 1000, 1);
+  peer = bmap(config, 1100, 2);
+  tmp = chunkID_set_init(config);
+
+  /* Chunks the peer has and the local node needs */
+  t0 = now();
+  for (r = 0; r < ROUNDS; r++) {
+    for (k = 0; k < chunkID_set_size(peer); k++) {
+      c1 += chunkID_set_check(mine, chunkID_set_get_chunk(peer, k)) < 0;
+    }
+  }
+  t1 = now();
+  for (r = 0; r < ROUNDS; r++) {
+    c2 += chunkID_set_difference_count(peer, mine);
+  }
+  t2 = now();
+  for (r = 0; r < ROUNDS / 10; r++) {
+    chunkID_set_clear(tmp, 0);
+    for (k = 0; k < chunkID_set_size(mine); k++) {
+      chunkID_set_add_chunk(tmp, chunkID_set_get_chunk(mine, k));
+    }
+    for (k = 0; k < chunkID_set_size(peer); k++) {
+      chunkID_set_add_chunk(tmp, chunkID_set_get_chunk(peer, k));
+    }
+  }
+  t3 = now();
+  for (r = 0; r < ROUNDS / 10; r++) {
+    chunkID_set_clear(tmp, 0);
+    chunkID_set_union(tmp, mine);
+    chunkID_set_union(tmp, peer);
+  }
+  t4 = now();
+  printf("%-12s difference: %.1f us per element loop, %.1f us bulk (%.1fx); "
+         "union: %.1f us per element, %.1f us bulk (%.1fx)\n", config,
+         (t1 - t0) * 1e6 / ROUNDS, (t2 - t1) * 1e6 / ROUNDS, (t1 - t0) / (t2 - t1),
+         (t3 - t2) * 1e7 / ROUNDS, (t4 - t3) * 1e7 / ROUNDS, (t3 - t2) / (t4 - t3));
+  if (c1 != c2) {
+    fprintf(stderr, "Different results: %d != %d\n", c1, c2);
+  }
+
+  chunkID_set_free(mine);
+  chunkID_set_free(peer);
+  chunkID_set_free(tmp);
+}
+
+int main(int argc, char *argv[])
+{
+  if (check("type=bitmap", "type=bitmap") < 0 || check("type=window", "type=window") < 0 ||
+      check("type=window", "type=bitmap") < 0 || check("type=bitmap", "type=priority") < 0) {
+    return -1;
+  }
+  printf("Bulk operations match the per element ones\n");
+  bench("type=bitmap");
+  bench("type=window");
+
+  return 0;
+}
@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <malloc.h>
 #include "chunkidset.h"
 #include "trade_sig_la.h"
 #include "chunkid_set_h.h"
@@ -89,12 +92,232 @@ static void metadata_test(void)
   free(meta);
 }
 
+static int same_sets(const struct chunkID_set *a, const struct chunkID_set *b)
+{
+  int i;
+
+  if (chunkID_set_size(a) != chunkID_set_size(b) ||
+      chunkID_set_get_earliest(a) != chunkID_set_get_earliest(b) ||
+      chunkID_set_get_latest(a) != chunkID_set_get_latest(b)) {
+    return 0;
+  }
+  for (i = 0; i < chunkID_set_size(a); i++) {
+    if (chunkID_set_get_chunk(a, i) != chunkID_set_get_chunk(b, i)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Compare the "window" sets with the sorted "bitmap" ones */
+static void window_test(void)
+{
+  struct chunkID_set *set, *window;
+  int i, j, base = 0, ok = 1;
+
+  set = chunkID_set_init("type=bitmap");
+  window = chunkID_set_init("type=window");
+  srand(1);
+  for (i = 0; i < 200 && ok; i++) {
+    for (j = 0; j < 50; j++) {
+      int id = base + rand() % 300;
+
+      ok &= (chunkID_set_add_chunk(set, id) > 0) == (chunkID_set_add_chunk(window, id) > 0);
+      id = base + rand() % 400;
+      ok &= (chunkID_set_check(set, id) >= 0) == (chunkID_set_check(window, id) >= 0);
+    }
+    ok &= same_sets(set, window);
+    /* Slide forward, and sometimes jump far away */
+    chunkID_set_trim(set, 100);
+    chunkID_set_trim(window, 100);
+    ok &= same_sets(set, window);
+    base += (i % 50 == 49) ? 100000 : 40;
+  }
+  printf("Window sets %s\n", ok ? "match the bitmap sets" : "differ from the bitmap sets!!!");
+  chunkID_set_free(set);
+  chunkID_set_free(window);
+}
+
+static long max_rss(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_maxrss;
+}
+
+/*
+ * A far-off chunk ID (added locally, or received in a message) must not
+ * make the "window" sets allocate a bitmap covering it
+ */
+static int window_outlier_test(void)
+{
+  struct chunkID_set *set, *window;
+  static uint8_t buff[2048];
+  const void *meta;
+  int len, meta_len, ok = 1;
+  long rss = max_rss();
+
+  window = chunkID_set_init("type=window");
+  chunkID_set_add_chunk(window, 5);
+  chunkID_set_add_chunk(window, 2000000000);
+  ok &= chunkID_set_size(window) == 1 && chunkID_set_check(window, 5) < 0 &&
+        chunkID_set_get_earliest(window) == 2000000000;
+  ok &= chunkID_set_add_chunk(window, 5) < 0;
+
+  set = chunkID_set_init("type=bitmap");
+  chunkID_set_add_chunk(set, 5);
+  chunkID_set_add_chunk(set, 2000000000);
+  len = encodeChunkSignaling(set, NULL, 0, buff, sizeof(buff));
+  ok &= len > 0 && decodeChunkSignalingInto(window, &meta, &meta_len, buff, len) >= 0 &&
+        chunkID_set_check(window, 2000000000) >= 0;
+  ok &= max_rss() - rss < 4096;
+  printf("Window sets with an outlier ID: %ld KB allocated%s\n", max_rss() - rss,
+         ok ? "" : " - unbounded window!!!");
+  chunkID_set_free(set);
+  chunkID_set_free(window);
+
+  return ok;
+}
+
+/* A message announcing more chunk IDs than it can contain must not preallocate them */
+static int header_size_test(void)
+{
+  static const uint8_t msg[][16] = {
+    {0x04, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0},	/* priority, 2^26 IDs */
+    {0x04, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0},	/* bitmap, 2^26 IDs */
+  };
+  struct chunkID_set *set;
+  const void *meta;
+  int i, meta_len;
+  size_t mem, max = 0;
+
+  set = chunkID_set_init("size=0");
+  for (i = 0; i < 2; i++) {
+    decodeChunkSignalingInto(set, &meta, &meta_len, msg[i], sizeof(msg[i]));
+    /* The pages are not touched, so look at the heap instead of the RSS */
+    mem = mallinfo2().hblkhd + mallinfo2().uordblks;
+    if (mem > max) {
+      max = mem;
+    }
+  }
+  printf("Wrong set size in the header: %zu KB in the heap%s\n", max / 1024,
+         max < 1024 * 1024 ? "" : " - size trusted!!!");
+  chunkID_set_free(set);
+
+  return max < 1024 * 1024;
+}
+
+/* A short compact message announcing a huge run of ones must be refused */
+static int compact_overflow_test(void)
+{
+  static const uint8_t msg[] = {
+    0, 0, 0, 1,			/* 1 chunk ID */
+    0, 0, 0, 3,			/* compact encoding */
+    0, 0, 0, 0,			/* no metadata */
+    2,				/* run-length format */
+    0,				/* starting from chunk ID 0 */
+    0x81, 0x80, 0x80, 0x80, 0x80, 0x01	/* 2^32 words of ones */
+  };
+  struct chunkID_set *window;
+  const void *meta;
+  int meta_len, ok;
+
+  window = chunkID_set_init("type=window");
+  ok = decodeChunkSignalingInto(window, &meta, &meta_len, msg, sizeof(msg)) < 0;
+  printf("Compact run larger than the set %s\n", ok ? "refused" : "accepted!!!");
+  chunkID_set_free(window);
+
+  return ok;
+}
+
+static void fill(struct chunkID_set *s, const char *shape)
+{
+  int i;
+
+  srand(1);
+  if (!strcmp(shape, "dense")) {
+    for (i = 0; i < 1000; i++) {
+      if (rand() % 50) {
+        chunkID_set_add_chunk(s, 10000 + i);
+      }
+    }
+  } else if (!strcmp(shape, "outlier")) {
+    for (i = 0; i < 200; i++) {
+      chunkID_set_add_chunk(s, 10000 + i);
+    }
+    chunkID_set_add_chunk(s, 200000);
+  } else if (!strcmp(shape, "sparse")) {
+    for (i = 0; i < 50; i++) {
+      chunkID_set_add_chunk(s, 10000 + rand() % 5000);
+    }
+  } else {
+    for (i = 0; i < 500; i++) {
+      if (rand() % 2) {
+        chunkID_set_add_chunk(s, 10000 + i);
+      }
+    }
+  }
+}
+
+/* Compare the size and the speed of the native and the compact encodings */
+static void compact_test(const char *type, const char *shape)
+{
+  struct chunkID_set *set, *res;
+  static uint8_t buff[100000];
+  char config[64];
+  int len[2], compact, i, j, meta_len, ok = 1;
+  double t[2];
+  void *meta;
+
+  for (compact = 0; compact < 2; compact++) {
+    clock_t start;
+
+    sprintf(config, "type=%s,compact=%d", type, compact);
+    set = chunkID_set_init(config);
+    fill(set, shape);
+    start = clock();
+    for (i = 0; i < 1000; i++) {
+      len[compact] = encodeChunkSignaling(set, NULL, 0, buff, sizeof(buff));
+      res = decodeChunkSignaling(&meta, &meta_len, buff, len[compact]);
+      if (res == NULL || chunkID_set_size(res) != chunkID_set_size(set)) {
+        ok = 0;
+        break;
+      }
+      for (j = 0; i == 0 && j < chunkID_set_size(set); j++) {
+        ok &= chunkID_set_check(res, chunkID_set_get_chunk(set, j)) >= 0;
+      }
+      chunkID_set_free(res);
+    }
+    t[compact] = (double)(clock() - start) / CLOCKS_PER_SEC * 1000;
+    chunkID_set_free(set);
+  }
+  printf("%-8s %-8s native %5d bytes (%.1f us), compact %5d bytes (%.1f us)%s\n", type, shape,
+         len[0], t[0], len[1], t[1], ok ? "" : " - decoding failed!!!");
+}
+
 int main(int argc, char *argv[])
 {
+  int ok;
+
   simple_test();
   encoding_test("priority");
   encoding_test("bitmap");
+  encoding_test("window");
   metadata_test();
+  window_test();
+  ok = window_outlier_test();
+  compact_test("bitmap", "dense");
+  compact_test("bitmap", "outlier");
+  compact_test("bitmap", "sparse");
+  compact_test("bitmap", "random");
+  compact_test("window", "outlier");
+  compact_test("priority", "dense");
+  compact_test("priority", "sparse");
+  ok &= compact_overflow_test();
+  ok &= header_size_test();
 
-  return 0;
+  return ok ? 0 : -1;
 }
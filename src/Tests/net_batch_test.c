@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Compare the single-message and the batched send/receive paths of the
+ *  net helper, over loopback.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "net_helper.h"
+
+#define BASE_PORT 7000
+#define MAX_DESTS 64
+#define BURST 16
+
+static int rounds = 2000;
+static int n_dests = 8;
+static int msg_size = 1024;
+
+static void cmdline_parse(int argc, char *argv[])
+{
+  int o;
+
+  while ((o = getopt(argc, argv, "r:d:s:")) != -1) {
+    switch(o) {
+      case 'r':
+        rounds = atoi(optarg);
+        break;
+      case 'd':
+        n_dests = atoi(optarg);
+        if (n_dests > MAX_DESTS) {
+          n_dests = MAX_DESTS;
+        }
+        break;
+      case 's':
+        msg_size = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Error: unknown option %c\n", o);
+
+        exit(-1);
+    }
+  }
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int recv_single(struct nodeID *d, uint8_t *buff, int n)
+{
+  int i, res;
+
+  for (i = 0; i < n; i++) {
+    struct nodeID *remote;
+
+    res = recv_from_peer(d, &remote, buff, msg_size);
+    if (res != msg_size) {
+      fprintf(stderr, "Error receiving: %d\n", res);
+
+      return -1;
+    }
+    nodeid_free(remote);
+  }
+
+  return n;
+}
+
+static int recv_batch(struct nodeID *d, struct nodeID **remote, uint8_t **buffs, int n)
+{
+  int i, res, sizes[BURST];
+
+  while (n > 0) {
+    for (i = 0; i < n; i++) {
+      sizes[i] = msg_size;
+    }
+    res = recv_from_peer_batch(d, remote, buffs, sizes, n);
+    if (res <= 0 || sizes[0] != msg_size) {
+      fprintf(stderr, "Error receiving batch: %d\n", res);
+
+      return -1;
+    }
+    n -= res;
+  }
+
+  return 0;
+}
+
+static double run(struct nodeID *src, struct nodeID **dst, int batch)
+{
+  const struct nodeID *to[MAX_DESTS * BURST];
+  const uint8_t *buffs[MAX_DESTS * BURST];
+  int sizes[MAX_DESTS * BURST];
+  struct nodeID *remote[BURST];
+  uint8_t *rbuffs[BURST];
+  uint8_t *msg;
+  double start;
+  int r, i, j;
+
+  msg = malloc(msg_size);
+  memset(msg, 'x', msg_size);
+  for (i = 0; i < BURST; i++) {
+    remote[i] = NULL;
+    rbuffs[i] = malloc(msg_size);
+  }
+  for (i = 0; i < n_dests * BURST; i++) {
+    to[i] = dst[i % n_dests];
+    buffs[i] = msg;
+    sizes[i] = msg_size;
+  }
+
+  start = now();
+  for (r = 0; r < rounds; r++) {
+    if (batch) {
+      if (send_to_peers(src, to, buffs, sizes, n_dests * BURST) < 0) {
+        fprintf(stderr, "Error sending batch\n");
+      }
+      for (j = 0; j < n_dests; j++) {
+        recv_batch(dst[j], remote, rbuffs, BURST);
+      }
+    } else {
+      for (i = 0; i < n_dests * BURST; i++) {
+        send_to_peer(src, to[i], msg, msg_size);
+      }
+      for (j = 0; j < n_dests; j++) {
+        recv_single(dst[j], rbuffs[0], BURST);
+      }
+    }
+  }
+
+  for (i = 0; i < BURST; i++) {
+    nodeid_free(remote[i]);
+    free(rbuffs[i]);
+  }
+  free(msg);
+
+  return (double)rounds * n_dests * BURST / (now() - start);
+}
+
+int main(int argc, char *argv[])
+{
+  struct nodeID *src, *dst[MAX_DESTS];
+  double single, batched;
+  int i;
+
+  cmdline_parse(argc, argv);
+
+  src = net_helper_init("127.0.0.1", BASE_PORT, "");
+  if (src == NULL) {
+    return -1;
+  }
+  for (i = 0; i < n_dests; i++) {
+    dst[i] = net_helper_init("127.0.0.1", BASE_PORT + 1 + i, "");
+    if (dst[i] == NULL) {
+      fprintf(stderr, "Error creating socket (127.0.0.1:%d)!\n", BASE_PORT + 1 + i);
+
+      return -1;
+    }
+  }
+
+  single = run(src, dst, 0);
+  batched = run(src, dst, 1);
+  printf("%d destinations, %d bytes messages, %d rounds of %d messages\n",
+         n_dests, msg_size, rounds, n_dests * BURST);
+  printf("single: %.0f msg/s\n", single);
+  printf("batch: %.0f msg/s (%.2fx)\n", batched, batched / single);
+
+  for (i = 0; i < n_dests; i++) {
+    nodeid_free(dst[i]);
+  }
+  nodeid_free(src);
+
+  return 0;
+}
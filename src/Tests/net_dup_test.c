@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Free the local nodeID while a copy of it is still around, and receive
+ *  a fragmented message (which needs the reassembly state shared by the
+ *  two) through the copy.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+
+#define MSG_SIZE (150 * 1024)
+
+int main(int argc, char *argv[])
+{
+  static uint8_t msg[MSG_SIZE], buff[MSG_SIZE];
+  struct nodeID *src, *dst, *copy, *remote;
+  int i, res;
+
+  src = net_helper_init("127.0.0.1", 6790, "");
+  dst = net_helper_init("127.0.0.1", 6791, "");
+  if (src == NULL || dst == NULL) {
+    return -1;
+  }
+  copy = nodeid_dup(dst);
+  nodeid_free(dst);
+
+  for (i = 0; i < MSG_SIZE; i++) {
+    msg[i] = i * 7;
+  }
+  res = send_to_peer(src, copy, msg, MSG_SIZE);
+  if (res < 0) {
+    fprintf(stderr, "Error sending the message\n");
+
+    return -1;
+  }
+  res = recv_from_peer(copy, &remote, buff, sizeof(buff));
+  printf("Received %d bytes (sent %d)\n", res, MSG_SIZE);
+  if (res != MSG_SIZE || memcmp(msg, buff, MSG_SIZE)) {
+    fprintf(stderr, "Wrong message received\n");
+
+    return -1;
+  }
+
+  nodeid_free(remote);
+  nodeid_free(copy);
+  nodeid_free(src);
+
+  return 0;
+}
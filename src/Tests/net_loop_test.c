@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Drive the network socket, some user FDs and a periodic timer (as the
+ *  one used for gossiping) through a net_helper event loop.
+ */
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+
+#define N_PIPES 4
+
+int main(int argc, char *argv[])
+{
+  struct nodeID *s;
+  struct net_helper_loop *l;
+  struct nh_event ev[N_PIPES + 2];
+  struct timeval period = {0, 100000};
+  int pipes[N_PIPES][2];
+  int i, n, net = 0, fds = 0, timers = 0;
+  uint8_t buff[64];
+
+  s = net_helper_init("127.0.0.1", 6789, "");
+  if (s == NULL) {
+    return -1;
+  }
+  l = net_helper_loop_create(s);
+  if (l == NULL) {
+    fprintf(stderr, "Error creating the event loop\n");
+
+    return -1;
+  }
+  for (i = 0; i < N_PIPES; i++) {
+    if (pipe(pipes[i]) < 0 || net_helper_loop_add_fd(l, pipes[i][0]) < 0) {
+      fprintf(stderr, "Error adding FD %d\n", i);
+
+      return -1;
+    }
+  }
+  if (net_helper_loop_add_timer(l, &period) < 0) {
+    fprintf(stderr, "Error adding the timer\n");
+
+    return -1;
+  }
+
+  /* All the pipes and the socket are ready at once */
+  send_to_peer(s, s, (const uint8_t *)"ciao", 5);
+  for (i = 0; i < N_PIPES; i++) {
+    if (write(pipes[i][1], "x", 1) != 1) {
+      return -1;
+    }
+  }
+  while (timers < 3) {
+    n = net_helper_loop_wait(l, NULL, ev, N_PIPES + 2);
+    printf("%d events:", n);
+    for (i = 0; i < n; i++) {
+      switch (ev[i].type) {
+        case NH_EV_NET:
+          {
+            struct nodeID *remote;
+
+            printf(" net");
+            recv_from_peer(s, &remote, buff, sizeof(buff));
+            nodeid_free(remote);
+            net++;
+          }
+          break;
+        case NH_EV_FD:
+          printf(" fd");
+          if (read(ev[i].id, buff, 1) != 1) {
+            return -1;
+          }
+          fds++;
+          break;
+        case NH_EV_TIMER:
+          printf(" timer %d", ev[i].id);
+          timers++;
+          break;
+      }
+    }
+    printf("\n");
+  }
+  printf("net: %d fd: %d timer: %d\n", net, fds, timers);
+
+  net_helper_loop_destroy(l);
+  nodeid_free(s);
+
+  return (net == 1 && fds == N_PIPES) ? 0 : -1;
+}
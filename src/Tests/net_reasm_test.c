@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Interleave the fragments of two messages when the reassembly memory
+ *  can hold only one of them: the message recv_from_peer() was assembling
+ *  in the caller's buffer must survive the timeout (the other one is
+ *  evicted), and be received once its last fragment arrives.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net_helper.h"
+
+#define FRAG_SIZE (1024 * 60)	/* MAX_MSG_SIZE in net_helper-udp.c */
+#define LAST_SIZE 1000
+#define MSG_SIZE (FRAG_SIZE + LAST_SIZE)
+#define PORT 6795
+
+static uint8_t msg[MSG_SIZE];
+
+/* Send a fragment with the header used by the UDP net helper */
+static int send_fragment(int fd, uint8_t m_seq, uint8_t frag_seq)
+{
+  static uint8_t buff[3 + FRAG_SIZE];
+  struct sockaddr_in to;
+  int len = frag_seq == 1 ? FRAG_SIZE : LAST_SIZE;
+
+  buff[0] = m_seq;
+  buff[1] = frag_seq;
+  buff[2] = 2;
+  memcpy(buff + 3, msg + (frag_seq - 1) * FRAG_SIZE, len);
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(PORT);
+  to.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  return sendto(fd, buff, 3 + len, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+int main(int argc, char *argv[])
+{
+  static uint8_t buff[2 * FRAG_SIZE];
+  struct nodeID *local, *remote;
+  char config[64];
+  int fd, i, res;
+
+  sprintf(config, "reassembly_mem=%d,reassembly_timeout=200", 2 * FRAG_SIZE);
+  local = net_helper_init("127.0.0.1", PORT, config);
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (local == NULL || fd < 0) {
+    return -1;
+  }
+  for (i = 0; i < MSG_SIZE; i++) {
+    msg[i] = i * 7;
+  }
+
+  /* Message 1 goes in the caller's buffer, message 2 in the table */
+  send_fragment(fd, 1, 1);
+  send_fragment(fd, 2, 1);
+  res = recv_from_peer(local, &remote, buff, sizeof(buff));
+  if (res >= 0) {
+    fprintf(stderr, "Incomplete message received\n");
+
+    return -1;
+  }
+
+  send_fragment(fd, 1, 2);
+  res = recv_from_peer(local, &remote, buff, sizeof(buff));
+  printf("Received %d bytes (sent %d)\n", res, MSG_SIZE);
+  if (res != MSG_SIZE || memcmp(msg, buff, MSG_SIZE)) {
+    fprintf(stderr, "The stashed message has been lost\n");
+
+    return -1;
+  }
+  nodeid_free(remote);
+
+  close(fd);
+  nodeid_free(local);
+
+  return 0;
+}
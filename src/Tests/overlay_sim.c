@@ -0,0 +1,413 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Run thousands of peer samplers in one process, on the in-memory network
+ *  of net_helper-sim.c and its virtual clock, and measure the overlay they
+ *  build. The nodes join during the first round (one sampler period),
+ *  each one knowing some random nodes which joined before it; at the end
+ *  of every round, the in-degree, the clustering coefficient and the
+ *  connected components of the overlay (the views taken as undirected
+ *  edges) are reported, together with the traffic.
+ *  The results only depend on the parameters (and on the seed): for
+ *  example,
+ *    ./overlay_sim -n 10000 -r 50 -c protocol=newscast,cache_size=30 -N latency=50000,loss=0.01
+ *  Cloudcast needs a cloud, and cannot be simulated.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "net_helper.h"
+#include "net_helper_sim.h"
+#include "peersampler.h"
+#include "grapes_config.h"
+
+#define DEFAULT_PERIOD 10*1000*1000	/* The samplers' default */
+#define BUFFSIZE 64 * 1024
+
+struct node {
+  struct nodeID *id;
+  struct psample_context *ps;
+};
+
+static int n_nodes = 1000;
+static int rounds = 30;
+static int bootstrap = 1;
+static int step = 100;		/* ms */
+static int seed = 1;
+static int histogram;
+static const char *ps_config = "protocol=cyclon";
+static const char *net_config = "latency=50000,jitter=50000";
+
+static struct node *nodes;
+
+/* The overlay: directed views and undirected edges, in CSR form */
+static int *out_start, *out_adj, out_size;
+static int *und_start, *und_adj;
+static int *edges, edges_size;
+static int *indegree, *mark, *parent;
+
+static void cmdline_parse(int argc, char *argv[])
+{
+  int o;
+
+  while ((o = getopt(argc, argv, "n:r:b:t:s:c:N:H")) != -1) {
+    switch(o) {
+      case 'n':
+        n_nodes = atoi(optarg);
+        break;
+      case 'r':
+        rounds = atoi(optarg);
+        break;
+      case 'b':
+        bootstrap = atoi(optarg);
+        break;
+      case 't':
+        step = atoi(optarg);
+        break;
+      case 's':
+        seed = atoi(optarg);
+        break;
+      case 'c':
+        ps_config = strdup(optarg);
+        break;
+      case 'N':
+        net_config = strdup(optarg);
+        break;
+      case 'H':
+        histogram = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n nodes] [-r rounds] [-b bootstrap peers] [-t step (ms)] [-s seed]\n"
+                        "          [-c peer sampler config] [-N network config] [-H]\n", argv[0]);
+
+        exit(-1);
+    }
+  }
+}
+
+static int node_join(int i)
+{
+  char addr[32];
+  int j;
+
+  sprintf(addr, "10.%d.%d.%d", ((i + 1) >> 16) & 0xff, ((i + 1) >> 8) & 0xff, (i + 1) & 0xff);
+  nodes[i].id = net_helper_init(addr, 6666, "");
+  if (nodes[i].id == NULL) {
+    return -1;
+  }
+  nodes[i].ps = psample_init(nodes[i].id, NULL, 0, ps_config);
+  if (nodes[i].ps == NULL) {
+    fprintf(stderr, "Error initialising the peer sampler (%s)\n", ps_config);
+
+    return -1;
+  }
+  for (j = 0; i && j < bootstrap; j++) {
+    psample_add_peer(nodes[i].ps, nodes[rand() % i].id, NULL, 0);
+  }
+
+  return 0;
+}
+
+static void node_run(int i)
+{
+  static uint8_t buff[BUFFSIZE];
+  struct nodeID *remote;
+  int len;
+
+  while (wait4data(nodes[i].id, NULL, NULL) == 1) {
+    len = recv_from_peer(nodes[i].id, &remote, buff, BUFFSIZE);
+    if (len > 0) {
+      psample_parse_data(nodes[i].ps, buff, len);
+    }
+    nodeid_free(remote);
+  }
+  psample_parse_data(nodes[i].ps, NULL, 0);
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+  const int *e1 = a, *e2 = b;
+
+  return e1[0] != e2[0] ? e1[0] - e2[0] : e1[1] - e2[1];
+}
+
+static void *grow(void *p, int *size, int needed, int elem)
+{
+  if (needed > *size) {
+    *size = needed * 2;
+    p = realloc(p, *size * elem);
+    if (p == NULL) {
+      fprintf(stderr, "Out of memory\n");
+
+      exit(-1);
+    }
+  }
+
+  return p;
+}
+
+/* Collect the views, and build the undirected graph */
+static void build_overlay(int n)
+{
+  int i, j, k, e;
+
+  for (i = 0, e = 0; i < n; i++) {
+    const struct nodeID *const *view;
+    int m;
+
+    view = psample_get_cache(nodes[i].ps, &m);
+    out_start[i] = e;
+    out_adj = grow(out_adj, &out_size, e + (m > 0 ? m : 0), sizeof(int));
+    for (j = 0; j < m; j++) {
+      int v = net_sim_index(view[j]);
+
+      if (v >= 0 && v < n && v != i) {
+        out_adj[e++] = v;
+      }
+    }
+  }
+  out_start[n] = e;
+
+  edges = grow(edges, &edges_size, 4 * e, sizeof(int));
+  for (i = 0, k = 0; i < n; i++) {
+    for (j = out_start[i]; j < out_start[i + 1]; j++) {
+      edges[2 * k] = i < out_adj[j] ? i : out_adj[j];
+      edges[2 * k + 1] = i < out_adj[j] ? out_adj[j] : i;
+      k++;
+    }
+  }
+  qsort(edges, k, 2 * sizeof(int), int_cmp);
+  for (i = 0, j = 0; i < k; i++) {
+    if (j == 0 || int_cmp(&edges[2 * i], &edges[2 * (j - 1)])) {
+      edges[2 * j] = edges[2 * i];
+      edges[2 * j + 1] = edges[2 * i + 1];
+      j++;
+    }
+  }
+  k = j;
+
+  /* Both directions of each edge, sorted by source */
+  for (i = 0; i < k; i++) {
+    edges[2 * (k + i)] = edges[2 * i + 1];
+    edges[2 * (k + i) + 1] = edges[2 * i];
+  }
+  qsort(edges, 2 * k, 2 * sizeof(int), int_cmp);
+  und_adj = realloc(und_adj, sizeof(int) * (2 * k + 1));
+  for (i = 0, j = 0; i < n; i++) {
+    und_start[i] = j;
+    while (j < 2 * k && edges[2 * j] == i) {
+      und_adj[j] = edges[2 * j + 1];
+      j++;
+    }
+  }
+  und_start[n] = j;
+}
+
+static double clustering(int n)
+{
+  double sum = 0;
+  int i, j, l, counted = 0;
+
+  for (i = 0; i < n; i++) {
+    mark[i] = -1;
+  }
+  for (i = 0; i < n; i++) {
+    int deg = und_start[i + 1] - und_start[i];
+    long links = 0;
+
+    if (deg < 2) {
+      continue;
+    }
+    for (j = und_start[i]; j < und_start[i + 1]; j++) {
+      mark[und_adj[j]] = i;
+    }
+    for (j = und_start[i]; j < und_start[i + 1]; j++) {
+      int u = und_adj[j];
+
+      for (l = und_start[u]; l < und_start[u + 1]; l++) {
+        links += mark[und_adj[l]] == i;
+      }
+    }
+    sum += (double)links / ((double)deg * (deg - 1));
+    counted++;
+  }
+
+  return counted ? sum / counted : 0;
+}
+
+static int find(int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+
+  return i;
+}
+
+static int components(int n, int *largest)
+{
+  int i, j, res = 0;
+
+  for (i = 0; i < n; i++) {
+    parent[i] = i;
+    mark[i] = 0;
+  }
+  for (i = 0; i < n; i++) {
+    for (j = und_start[i]; j < und_start[i + 1]; j++) {
+      int a = find(i), b = find(und_adj[j]);
+
+      if (a != b) {
+        parent[a] = b;
+      }
+    }
+  }
+  *largest = 0;
+  for (i = 0; i < n; i++) {
+    int r = find(i);
+
+    res += r == i;
+    if (++mark[r] > *largest) {
+      *largest = mark[r];
+    }
+  }
+
+  return res;
+}
+
+/* Print the statistics of a round, returning the number of connected components */
+static int report(int round, int n, uint64_t *bytes, uint64_t *msgs, uint64_t *lost)
+{
+  struct net_sim_counters c;
+  uint64_t b = 0, m = 0, l = 0;
+  double mean, var = 0;
+  int i, min, max, comps, largest;
+
+  build_overlay(n);
+  for (i = 0; i < n; i++) {
+    indegree[i] = 0;
+  }
+  for (i = 0; i < out_start[n]; i++) {
+    indegree[out_adj[i]]++;
+  }
+  mean = (double)out_start[n] / n;
+  min = max = indegree[0];
+  for (i = 0; i < n; i++) {
+    var += (indegree[i] - mean) * (indegree[i] - mean);
+    min = indegree[i] < min ? indegree[i] : min;
+    max = indegree[i] > max ? indegree[i] : max;
+    net_sim_counters(nodes[i].id, &c);
+    b += c.sent_bytes;
+    m += c.sent_msgs;
+    l += c.lost_msgs;
+  }
+  comps = components(n, &largest);
+  printf("%5d %6d %8.2f %7.2f %5d %5d %7.4f %5d %6d %10.1f %7.2f %7.2f\n", round, n,
+         mean, n > 1 ? sqrt(var / n) : 0, min, max, clustering(n), comps, largest,
+         (double)(b - *bytes) / n, (double)(m - *msgs) / n, (double)(l - *lost) / n);
+  *bytes = b;
+  *msgs = m;
+  *lost = l;
+
+  return comps;
+}
+
+static void print_histogram(int n)
+{
+  int i, d, max = 0;
+  int *count;
+
+  for (i = 0; i < n; i++) {
+    max = indegree[i] > max ? indegree[i] : max;
+  }
+  count = calloc(max + 1, sizeof(int));
+  if (count == NULL) {
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    count[indegree[i]]++;
+  }
+  printf("# In-degree distribution\n");
+  for (d = 0; d <= max; d++) {
+    if (count[d]) {
+      printf("%5d %6d\n", d, count[d]);
+    }
+  }
+  free(count);
+}
+
+int main(int argc, char *argv[])
+{
+  struct tag *cfg_tags;
+  uint64_t period, t, bytes = 0, msgs = 0, lost = 0;
+  int joined = 0, round = 0, comps, prev_comps = 1, partitions = 0;
+  clock_t start;
+
+  cmdline_parse(argc, argv);
+  if (n_nodes < 1 || rounds < 1 || step < 1 || net_sim_configure(net_config) < 0) {
+    fprintf(stderr, "Wrong parameters\n");
+
+    return -1;
+  }
+  cfg_tags = grapes_config_parse(ps_config);
+  if (!grapes_config_value_int(cfg_tags, "period", &comps)) {
+    comps = DEFAULT_PERIOD;
+  }
+  free(cfg_tags);
+  period = comps;
+  srand(seed);
+
+  nodes = calloc(n_nodes, sizeof(struct node));
+  out_start = malloc(sizeof(int) * (n_nodes + 1));
+  und_start = malloc(sizeof(int) * (n_nodes + 1));
+  indegree = malloc(sizeof(int) * n_nodes);
+  mark = malloc(sizeof(int) * n_nodes);
+  parent = malloc(sizeof(int) * n_nodes);
+  if (!nodes || !out_start || !und_start || !indegree || !mark || !parent) {
+    fprintf(stderr, "Out of memory\n");
+
+    return -1;
+  }
+
+  printf("# %d nodes, peer sampler: %s, network: %s, seed %d\n", n_nodes, ps_config, net_config, seed);
+  printf("# round  nodes  indeg_avg  sd   min   max  cluster comps largest  bytes/node msgs/node lost/node\n");
+  start = clock();
+  for (t = 0; round < rounds; t += step * 1000ull) {
+    int i;
+
+    net_sim_run(t);
+    /* Join during the first round, at regular intervals */
+    while (joined < n_nodes && joined * period <= t * n_nodes) {
+      if (node_join(joined) < 0) {
+        return -1;
+      }
+      joined++;
+    }
+    for (i = 0; i < joined; i++) {
+      node_run(i);
+    }
+    if (t >= (round + 1) * period) {
+      comps = report(++round, joined, &bytes, &msgs, &lost);
+      if (comps > prev_comps && joined == n_nodes) {
+        partitions++;
+      }
+      prev_comps = comps;
+    }
+  }
+  if (histogram) {
+    print_histogram(joined);
+  }
+  printf("# %d partition events\n", partitions);
+  fprintf(stderr, "%d rounds of %d nodes simulated in %.1fs\n", rounds, n_nodes,
+          (double)(clock() - start) / CLOCKS_PER_SEC);
+
+  return 0;
+}
@@ -14,6 +14,7 @@
 #include "net_helper.h"
 #include "chunkidset.h"
 #include "peer.h"
+#include "trade_sig_ha.h"
 
 struct peer *peerCreate (struct nodeID *id, int *size)
 {
@@ -26,12 +27,15 @@ struct peer *peerCreate (struct nodeID *id, int *size)
 	gettimeofday(&(res->bmap_timestamp),NULL);
 	res->cb_size = 0;
 	res->bmap = chunkID_set_init(0);
+	res->bmap_seq = 0;
+	res->bmap_sent = NULL;
 	return res;
 }
 
 void peerDelete (struct peer *p) {
 	nodeid_free(p->id);
 	chunkID_set_free(p->bmap);
+	freeBufferMapDiff(p);
 	free(p);
 }
 
@@ -61,6 +65,8 @@ struct peer* peerUndump(const uint8_t *buf, int *size) {
 	gettimeofday(&(p->creation_timestamp),NULL);
 	gettimeofday(&(p->bmap_timestamp),NULL);
 	p->bmap = chunkID_set_init(0);
+	p->bmap_seq = 0;
+	p->bmap_sent = NULL;
 
 	return p;
 
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Check that the sorted and the hash peer sets contain the same peers
+ *  after a random sequence of insertions and removals, and compare their
+ *  speed with a large number of peers.
+ */
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "net_helper.h"
+#include "peer.h"
+#include "peerset.h"
+
+#define N_IDS 4000
+#define OPS 200000
+
+static struct nodeID *ids[N_IDS];
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int consistent(const struct peerset *ps, const int *present)
+{
+  struct peer **peers = peerset_get_peers(ps);
+  int i, n = 0;
+
+  for (i = 0; i < N_IDS; i++) {
+    int pos = peerset_check(ps, ids[i]);
+
+    if (present[i] != (pos >= 0)) {
+      return 0;
+    }
+    if (pos >= 0) {
+      if (!nodeid_equal(peers[pos]->id, ids[i]) || peerset_get_peer(ps, ids[i]) != peers[pos]) {
+        return 0;
+      }
+      n++;
+    }
+  }
+
+  return n == peerset_size(ps);
+}
+
+static int cross_check(void)
+{
+  struct peerset *sorted, *hash;
+  int present[N_IDS] = {0};
+  int i;
+
+  sorted = peerset_init("size=0");
+  hash = peerset_init("type=hash,size=0");
+  srand(1);
+  for (i = 0; i < OPS / 10; i++) {
+    int n = rand() % N_IDS;
+
+    if (rand() % 3) {
+      int r1 = peerset_add_peer(sorted, ids[n]);
+      int r2 = peerset_add_peer(hash, ids[n]);
+
+      if ((r1 > 0) != (r2 > 0) || (r1 > 0) == present[n]) {
+        fprintf(stderr, "Insertion %d of peer %d differs\n", i, n);
+
+        return -1;
+      }
+      present[n] = 1;
+    } else {
+      int r1 = peerset_remove_peer(sorted, ids[n]);
+      int r2 = peerset_remove_peer(hash, ids[n]);
+
+      if ((r1 >= 0) != (r2 >= 0) || (r1 >= 0) != present[n]) {
+        fprintf(stderr, "Removal %d of peer %d differs\n", i, n);
+
+        return -1;
+      }
+      present[n] = 0;
+    }
+    if (i % 1000 == 0 && !(consistent(sorted, present) && consistent(hash, present))) {
+      fprintf(stderr, "Inconsistent sets after %d operations\n", i);
+
+      return -1;
+    }
+  }
+  if (!(consistent(sorted, present) && consistent(hash, present))) {
+    return -1;
+  }
+  peerset_clear(hash, 0);
+  if (peerset_size(hash) || peerset_check(hash, ids[0]) >= 0) {
+    return -1;
+  }
+  printf("Cross check passed (%d peers)\n", peerset_size(sorted));
+  peerset_destroy(&sorted);
+  peerset_destroy(&hash);
+
+  return 0;
+}
+
+static void bench(const char *config)
+{
+  struct peerset *ps;
+  double t0, t1, t2;
+  int i, found = 0;
+
+  ps = peerset_init(config);
+  t0 = now();
+  for (i = 0; i < N_IDS; i++) {
+    peerset_add_peer(ps, ids[i]);
+  }
+  t1 = now();
+  for (i = 0; i < OPS; i++) {
+    found += peerset_get_peer(ps, ids[(i * 7) % N_IDS]) != NULL;
+  }
+  t2 = now();
+  for (i = 0; i < N_IDS; i++) {
+    peerset_remove_peer(ps, ids[(i * 7) % N_IDS]);
+  }
+  printf("%-16s %d peers: %.0f insert/s, %.0f lookup/s, %.0f remove/s (%d found)\n",
+         config, N_IDS, N_IDS / (t1 - t0), OPS / (t2 - t1), N_IDS / (now() - t2), found);
+  peerset_destroy(&ps);
+}
+
+int main(int argc, char *argv[])
+{
+  char addr[16];
+  int i;
+
+  for (i = 0; i < N_IDS; i++) {
+    sprintf(addr, "10.%d.%d.%d", i / 62500, (i / 250) % 250, i % 250 + 1);
+    ids[i] = create_node(addr, 6000 + i % 7);
+  }
+  if (cross_check() < 0) {
+    fprintf(stderr, "Cross check failed\n");
+
+    return -1;
+  }
+  bench("type=sorted");
+  bench("type=hash");
+  for (i = 0; i < N_IDS; i++) {
+    nodeid_free(ids[i]);
+  }
+
+  return 0;
+}
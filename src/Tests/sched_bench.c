@@ -0,0 +1,604 @@
+/*
+ *  Copyright (c) 2010 Csaba Kiraly
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Compare the SCHED_BEST selection with the previous full sort one,
+ *  checking that they select candidates with the same weights and that
+ *  ties are broken uniformly. Check that SCHED_WEIGHTED picks sequences
+ *  with the probabilities of successive draws without replacement, both
+ *  on arrays and streaming over peer-chunk pairs (schedSelectHybrid()),
+ *  and with a scheduler context, that must not allocate memory per call,
+ *  while the functions without a context must work from different threads.
+ *  Check that the batch filter and evaluators select the same pairs as
+ *  the per element ones, and compare their speed.
+ */
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "scheduler_la.h"
+
+#define WORK 100000
+#define TIE_ROUNDS 100000
+#define WEIGHTED_ROUNDS 200000
+#define PEERS 500
+#define CHUNKS 1000
+
+static struct sched_ctx *ctx;
+static int allocs;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  __sync_fetch_and_add(&allocs, 1);
+
+  return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  __sync_fetch_and_add(&allocs, 1);
+
+  return __real_realloc(ptr, size);
+}
+
+struct iw {
+  int index;
+  double weight;
+};
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int cmp_iw_reverse(const void *a, const void *b)
+{
+  const struct iw *a1 = (const struct iw *) a;
+  const struct iw *b1 = (const struct iw *) b;
+  return a1->weight==b1->weight ? 0 : (a1->weight<b1->weight ? 1 : -1);
+}
+
+/* The previous implementation: sort everything, then shuffle the ties */
+static void select_sort(size_t size, unsigned char *base, size_t nmemb, double(*evaluate)(void *),
+                        unsigned char *bests, size_t *bests_len)
+{
+  struct iw *iws = malloc(nmemb * sizeof(struct iw));
+  int i;
+
+  for (i = 0; i < nmemb; i++) {
+    iws[i].index = i;
+    iws[i].weight = evaluate(base + size * i);
+  }
+  qsort(iws, nmemb, sizeof(struct iw), cmp_iw_reverse);
+  for (i = 0; i < nmemb; i++) {
+    int j, k;
+
+    for (j = i; j < nmemb && iws[i].weight == iws[j].weight; j++);
+    for (k = i; k < j; k++) {
+      struct iw iwt = iws[k];
+      int r = i + (rand() % (j - i));
+
+      iws[k] = iws[r];
+      iws[r] = iwt;
+    }
+  }
+  *bests_len = *bests_len < nmemb ? *bests_len : nmemb;
+  for (i = 0; i < *bests_len; i++) {
+    memcpy(bests + size * i, base + size * iws[i].index, size);
+  }
+  free(iws);
+}
+
+/* Few distinct weights, so that there are long runs of ties */
+static double weight(void *p)
+{
+  return *(int *)p % 16;
+}
+
+static int check(int n, int k)
+{
+  int *items, *b1, *b2;
+  size_t l1 = k, l2 = k;
+  int i;
+
+  items = malloc(n * sizeof(int));
+  b1 = malloc(k * sizeof(int));
+  b2 = malloc(k * sizeof(int));
+  for (i = 0; i < n; i++) {
+    items[i] = rand();
+  }
+  selectWithOrdering(SCHED_BEST, sizeof(int), (void *)items, n, weight, (void *)b1, &l1);
+  select_sort(sizeof(int), (void *)items, n, weight, (void *)b2, &l2);
+  if (l1 != l2) {
+    fprintf(stderr, "Selected %zu instead of %zu\n", l1, l2);
+
+    return -1;
+  }
+  for (i = 0; i < l1; i++) {
+    if (weight(&b1[i]) != weight(&b2[i])) {
+      fprintf(stderr, "%d of %d: wrong weight at position %d\n", k, n, i);
+
+      return -1;
+    }
+  }
+  free(items);
+  free(b1);
+  free(b2);
+
+  return 0;
+}
+
+/* All the candidates have the same weight: each one must be first 1/n of the times */
+static int check_ties(void)
+{
+  int items[8] = {0, 16, 32, 48, 64, 80, 96, 112}, count[8] = {0};
+  int i;
+
+  for (i = 0; i < TIE_ROUNDS; i++) {
+    int best;
+    size_t len = 2;
+    int b[2];
+
+    selectWithOrdering(SCHED_BEST, sizeof(int), (void *)items, 8, weight, (void *)b, &len);
+    best = b[0] / 16;
+    count[best]++;
+  }
+  for (i = 0; i < 8; i++) {
+    if (abs(count[i] - TIE_ROUNDS / 8) > TIE_ROUNDS / 80) {
+      fprintf(stderr, "Ties are not broken uniformly: %d selected %d times\n", i, count[i]);
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static double item_weight(void *p)
+{
+  return *(int *)p;
+}
+
+static double chunk_weight(struct PeerChunk *pc)
+{
+  return pc->chunk;
+}
+
+static double chunk_weight_r(struct PeerChunk *pc, void *data)
+{
+  return pc->chunk * *(double *)data;
+}
+
+/*
+ * Select among the items directly (mode 0), or as the chunks of pairs
+ * with a single peer, without (mode 1) or with (mode 2) a context
+ */
+static void select_items(int mode, SchedOrdering ordering, int *items, int n, int *selected, size_t *len)
+{
+  struct PeerChunk pairs[8];
+  schedPeerID peer = NULL;
+  int i;
+
+  if (mode == 0) {
+    selectWithOrdering(ordering, sizeof(int), (void *)items, n, item_weight, (void *)selected, len);
+
+    return;
+  }
+  if (mode == 1) {
+    schedSelectHybrid(ordering, &peer, 1, items, n, pairs, len, NULL, chunk_weight);
+  } else {
+    schedSelectHybrid_r(ctx, ordering, &peer, 1, items, n, pairs, len, NULL, chunk_weight_r);
+  }
+  for (i = 0; i < *len; i++) {
+    selected[i] = pairs[i].chunk;
+  }
+}
+
+/*
+ * Chi-square test on the ordered pairs selected among weights 0, 1, 2,
+ * 3 and 4: the pair (i, j) must come out with probability
+ * w_i / 10 * w_j / (10 - w_i), and the zero weight never.
+ */
+static int check_weighted(int mode)
+{
+  int items[5] = {1, 2, 0, 3, 4}, count[5][5] = {{0}};
+  double chi2 = 0;
+  int i, j;
+
+  for (i = 0; i < WEIGHTED_ROUNDS; i++) {
+    size_t len = 2;
+    int b[2];
+
+    select_items(mode, SCHED_WEIGHTED, items, 5, b, &len);
+    if (len != 2 || b[0] == b[1] || b[0] == 0 || b[1] == 0) {
+      fprintf(stderr, "Wrong weighted selection\n");
+
+      return -1;
+    }
+    count[b[0]][b[1]]++;
+  }
+  for (i = 1; i < 5; i++) {
+    for (j = 1; j < 5; j++) {
+      double expected;
+
+      if (i == j) {
+        continue;
+      }
+      expected = WEIGHTED_ROUNDS * i / 10.0 * j / (10.0 - i);
+      chi2 += (count[i][j] - expected) * (count[i][j] - expected) / expected;
+    }
+  }
+  /* 11 degrees of freedom, p = 0.001 */
+  if (chi2 > 31.26) {
+    fprintf(stderr, "Weighted selection has the wrong distribution (chi2 = %f)\n", chi2);
+
+    return -1;
+  }
+
+  /* Only the non zero weights can be selected; all of them if they are zero */
+  {
+    size_t len = 5;
+    int b[5];
+
+    select_items(mode, SCHED_WEIGHTED, items, 5, b, &len);
+    if (len != 4) {
+      fprintf(stderr, "Selected %zu elements with non zero weight\n", len);
+
+      return -1;
+    }
+    items[1] = items[3] = items[4] = items[0] = 0;
+    len = 3;
+    select_items(mode, SCHED_WEIGHTED, items, 5, b, &len);
+    if (len != 3) {
+      fprintf(stderr, "Selected %zu elements with zero weight\n", len);
+
+      return -1;
+    }
+  }
+  printf("Weighted selection%s: chi2 = %.1f\n", mode == 2 ? " (hybrid, context)" : mode ? " (hybrid)" : "", chi2);
+
+  return 0;
+}
+
+static int no_last_chunk(schedPeerID peer, schedChunkID chunk)
+{
+  return chunk != CHUNKS - 1;
+}
+
+static double pair_weight(struct PeerChunk *pc)
+{
+  return pc->chunk * 1000.0 + (intptr_t)pc->peer;
+}
+
+/* A large cross product of peers and chunks, that must not be stored */
+static int check_hybrid(void)
+{
+  schedPeerID peers[PEERS];
+  schedChunkID chunks[CHUNKS];
+  struct PeerChunk selected[5];
+  size_t len = 5;
+  int i;
+
+  for (i = 0; i < PEERS; i++) {
+    peers[i] = (schedPeerID)(intptr_t)(i + 1);
+  }
+  for (i = 0; i < CHUNKS; i++) {
+    chunks[i] = i;
+  }
+  schedSelectHybrid(SCHED_BEST, peers, PEERS, chunks, CHUNKS, selected, &len, no_last_chunk, pair_weight);
+  for (i = 0; i < 5; i++) {
+    if (len != 5 || selected[i].chunk != CHUNKS - 2 || (intptr_t)selected[i].peer != PEERS - i) {
+      fprintf(stderr, "Wrong hybrid selection\n");
+
+      return -1;
+    }
+  }
+  len = 5;
+  schedSelectHybrid(SCHED_WEIGHTED, peers, PEERS, chunks, CHUNKS, selected, &len, no_last_chunk, pair_weight);
+  for (i = 0; i < len; i++) {
+    if (selected[i].chunk == CHUNKS - 1) {
+      fprintf(stderr, "Filtered pair selected\n");
+
+      return -1;
+    }
+  }
+
+  return len == 5 ? 0 : -1;
+}
+
+/* Contexts with the same seed select the same pairs; no memory is allocated once the buffers have grown */
+/* Select the best K of N chunks without a context, over and over */
+static void *select_loop(void *arg)
+{
+  int n = (intptr_t)arg, k = n / 5;
+  schedPeerID peer = (schedPeerID)1;
+  schedChunkID chunks[CHUNKS];
+  struct PeerChunk selected[CHUNKS];
+  int i, r;
+
+  for (i = 0; i < n; i++) {
+    chunks[i] = i + 1;
+  }
+  for (r = 0; r < 2000; r++) {
+    size_t len = k;
+
+    schedSelectHybrid(SCHED_BEST, &peer, 1, chunks, n, selected, &len, NULL, chunk_weight);
+    if (len != k) {
+      return arg;
+    }
+    for (i = 0; i < k; i++) {
+      if (selected[i].chunk <= n - k || selected[i].peer != peer) {
+        return arg;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* The functions without a context must not share buffers between threads */
+static int check_threads(void)
+{
+  pthread_t th[2];
+  void *res[2];
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    pthread_create(&th[i], NULL, select_loop, (void *)(intptr_t)(i ? CHUNKS : 50));
+  }
+  for (i = 0; i < 2; i++) {
+    pthread_join(th[i], &res[i]);
+  }
+  if (res[0] || res[1]) {
+    fprintf(stderr, "Wrong selection without a context in a thread\n");
+
+    return -1;
+  }
+
+  return 0;
+}
+
+static int check_ctx(void)
+{
+  struct sched_ctx *c1, *c2;
+  double scale = 1;
+  schedPeerID peers[PEERS];
+  schedChunkID chunks[50];
+  struct PeerChunk s1[20], s2[20];
+  int i, r;
+
+  for (i = 0; i < PEERS; i++) {
+    peers[i] = (schedPeerID)(intptr_t)(i + 1);
+  }
+  for (i = 0; i < 50; i++) {
+    chunks[i] = i + 1;
+  }
+  c1 = sched_ctx_init("seed=42", &scale);
+  c2 = sched_ctx_init("seed=42", &scale);
+  for (r = 0; r < 100; r++) {
+    size_t l1 = 20, l2 = 20;
+
+    if (r == 1) {
+      allocs = 0;
+    }
+    schedSelectHybrid_r(c1, r % 2 ? SCHED_BEST : SCHED_WEIGHTED, peers, PEERS, chunks, 50, s1, &l1, NULL, chunk_weight_r);
+    schedSelectHybrid_r(c2, r % 2 ? SCHED_BEST : SCHED_WEIGHTED, peers, PEERS, chunks, 50, s2, &l2, NULL, chunk_weight_r);
+    for (i = 0; i < 20; i++) {
+      if (l1 != 20 || l1 != l2 || s1[i].peer != s2[i].peer || s1[i].chunk != s2[i].chunk) {
+        fprintf(stderr, "Contexts with the same seed selected different pairs\n");
+
+        return -1;
+      }
+    }
+  }
+  if (allocs) {
+    fprintf(stderr, "%d allocations with a scheduler context\n", allocs);
+
+    return -1;
+  }
+  sched_ctx_destroy(&c1);
+  sched_ctx_destroy(&c2);
+
+  return c1 == NULL ? 0 : -1;
+}
+
+/* Peers and chunks are small integers: chunk c is needed by peer p if (p + c) % 3 */
+static int need(schedPeerID peer, schedChunkID chunk, void *data)
+{
+  return ((intptr_t)peer + chunk) % 3 != 0;
+}
+
+static uint64_t need_batch(const schedPeerID *peers, int n, schedChunkID chunk, void *data)
+{
+  uint64_t mask = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    mask |= (uint64_t)(((intptr_t)peers[i] + chunk) % 3 != 0) << i;
+  }
+
+  return mask;
+}
+
+static double pair_w(struct PeerChunk *pc, void *data)
+{
+  return (intptr_t)pc->peer % 7 + pc->chunk * 0.01;
+}
+
+static void pair_w_batch(const struct PeerChunk *pcs, size_t n, double *w, void *data)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    w[i] = (intptr_t)pcs[i].peer % 7 + pcs[i].chunk * 0.01;
+  }
+}
+
+static double peer_w(schedPeerID *p, void *data)
+{
+  return (intptr_t)*p % 7;
+}
+
+static void peer_w_batch(const schedPeerID *p, size_t n, double *w, void *data)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    w[i] = (intptr_t)p[i] % 7;
+  }
+}
+
+static double chunk_w(schedChunkID *c, void *data)
+{
+  return *c * 0.01;
+}
+
+static void chunk_w_batch(const schedChunkID *c, size_t n, double *w, void *data)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    w[i] = c[i] * 0.01;
+  }
+}
+
+static double add(double a, double b)
+{
+  return a + b;
+}
+
+static int select_pairs(struct sched_ctx *c, int policy, SchedOrdering ordering, schedPeerID *peers, schedChunkID *chunks,
+                        struct PeerChunk *selected, size_t len)
+{
+  switch (policy) {
+    case 0:
+      schedSelectHybrid_r(c, ordering, peers, PEERS, chunks, CHUNKS, selected, &len, need, pair_w);
+      break;
+    case 1:
+      schedSelectComposed_r(c, ordering, peers, PEERS, chunks, CHUNKS, selected, &len, need, peer_w, chunk_w, add);
+      break;
+    case 2:
+      schedSelectPeerFirst_r(c, ordering, peers, PEERS, chunks, CHUNKS, selected, &len, need, peer_w, chunk_w);
+      break;
+    case 3:
+      schedSelectChunkFirst_r(c, ordering, peers, PEERS, chunks, CHUNKS, selected, &len, need, peer_w, chunk_w);
+      break;
+  }
+
+  return len;
+}
+
+static int check_batch(void)
+{
+  const char *policies[] = {"hybrid", "composed", "peer first", "chunk first"};
+  schedPeerID peers[PEERS];
+  schedChunkID chunks[CHUNKS];
+  struct PeerChunk s1[10], s2[10];
+  struct sched_ctx *c1, *c2;
+  int i, policy, ordering;
+
+  for (i = 0; i < PEERS; i++) {
+    peers[i] = (schedPeerID)(intptr_t)(i + 1);
+  }
+  for (i = 0; i < CHUNKS; i++) {
+    chunks[i] = i;
+  }
+  c1 = sched_ctx_init("seed=7", NULL);
+  c2 = sched_ctx_init("seed=7", NULL);
+  sched_ctx_set_batch(c2, need_batch, peer_w_batch, chunk_w_batch, pair_w_batch);
+  for (policy = 0; policy < 4; policy++) {
+    for (ordering = SCHED_BEST; ordering <= SCHED_WEIGHTED; ordering++) {
+      double t0, t1, t2;
+      int l1, l2;
+
+      t0 = now();
+      l1 = select_pairs(c1, policy, ordering, peers, chunks, s1, 10);
+      t1 = now();
+      l2 = select_pairs(c2, policy, ordering, peers, chunks, s2, 10);
+      t2 = now();
+      for (i = 0; i < l1; i++) {
+        if (l1 != l2 || s1[i].peer != s2[i].peer || s1[i].chunk != s2[i].chunk) {
+          fprintf(stderr, "%s: batch evaluators select different pairs\n", policies[policy]);
+
+          return -1;
+        }
+      }
+      printf("%-12s %s: per element %6.0f us, batch %6.0f us\n", policies[policy],
+             ordering == SCHED_BEST ? "best    " : "weighted", (t1 - t0) * 1e6, (t2 - t1) * 1e6);
+    }
+  }
+  sched_ctx_destroy(&c1);
+  sched_ctx_destroy(&c2);
+
+  return 0;
+}
+
+static void bench(int n, int k)
+{
+  int *items, *b;
+  double t0, t1, t2;
+  int i, rounds = WORK / n;
+
+  items = malloc(n * sizeof(int));
+  b = malloc(k * sizeof(int));
+  for (i = 0; i < n; i++) {
+    items[i] = rand();
+  }
+  t0 = now();
+  for (i = 0; i < rounds; i++) {
+    size_t len = k;
+
+    select_sort(sizeof(int), (void *)items, n, weight, (void *)b, &len);
+  }
+  t1 = now();
+  for (i = 0; i < rounds; i++) {
+    size_t len = k;
+
+    selectWithOrdering(SCHED_BEST, sizeof(int), (void *)items, n, weight, (void *)b, &len);
+  }
+  t2 = now();
+  printf("%d of %5d: sort %7.1f us, top-k %5.1f us (%.1fx)\n", k, n,
+         (t1 - t0) * 1e6 / rounds, (t2 - t1) * 1e6 / rounds, (t1 - t0) / (t2 - t1));
+  free(items);
+  free(b);
+}
+
+int main(int argc, char *argv[])
+{
+  int n[] = {10, 100, 1000, 5000}, k[] = {1, 5, 20};
+  int i, j;
+
+  srand(1);
+  ctx = sched_ctx_init("seed=1", &(double){1.0});
+  for (i = 0; i < sizeof(n) / sizeof(n[0]); i++) {
+    for (j = 0; j < sizeof(k) / sizeof(k[0]); j++) {
+      if (check(n[i], k[j]) < 0) {
+        return -1;
+      }
+    }
+  }
+  if (check_ties() < 0 || check_weighted(0) < 0 || check_weighted(1) < 0 || check_weighted(2) < 0 ||
+      check_hybrid() < 0 || check_ctx() < 0 || check_threads() < 0 || check_batch() < 0) {
+    return -1;
+  }
+  printf("Top-k selection matches the sorted one\n");
+  for (i = 0; i < sizeof(n) / sizeof(n[0]); i++) {
+    for (j = 0; j < 2; j++) {
+      bench(n[i], k[j]);
+    }
+  }
+  sched_ctx_destroy(&ctx);
+
+  return 0;
+}
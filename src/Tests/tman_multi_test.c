@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see gpl-3.0.txt
+ *
+ *  Run some Topology Manager instances with different ranking functions
+ *  and metadata in the same process, together with the global instance,
+ *  checking that each one of them ranks its neighbours on its own.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "net_helper.h"
+#include "tman.h"
+
+#define PEERS 8
+#define INSTANCES 3
+
+static int closer(const void *target, const void *p1, const void *p2)
+{
+  int d1 = abs(*(const int *)target - *(const int *)p1);
+  int d2 = abs(*(const int *)target - *(const int *)p2);
+
+  return d1 == d2 ? 0 : d1 < d2 ? 1 : 2;
+}
+
+static int farther(const void *target, const void *p1, const void *p2)
+{
+  int res = closer(target, p1, p2);
+
+  return res ? 3 - res : 0;
+}
+
+/* Check that the neighbours are sorted according to rank and me */
+static int check(const char *name, int n, const int *meta, tmanRankingFunction rank, const int *me)
+{
+  int i;
+
+  if (n != PEERS) {
+    fprintf(stderr, "%s: %d neighbours instead of %d\n", name, n, PEERS);
+
+    return -1;
+  }
+  for (i = 1; i < n; i++) {
+    if (rank(me, &meta[i], &meta[i - 1]) == 1) {
+      fprintf(stderr, "%s: %d ranked after %d (target %d)\n", name, meta[i], meta[i - 1], *me);
+
+      return -1;
+    }
+  }
+  printf("%s:", name);
+  for (i = 0; i < n; i++) {
+    printf(" %d", meta[i]);
+  }
+  printf("\n");
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  static int me[INSTANCES] = {35, 35, 70};
+  static int global_me = 10;
+  static tmanRankingFunction rank[INSTANCES] = {closer, farther, closer};
+  struct tman_context *tc[INSTANCES];
+  struct nodeID *peers[PEERS], *s;
+  struct nodeID *given[PEERS];
+  int meta[PEERS], given_meta[PEERS];
+  int i, j, n, res = 0;
+
+  s = net_helper_init("127.0.0.1", 7300, "");
+  if (s == NULL) {
+    fprintf(stderr, "Error creating the socket\n");
+
+    return -1;
+  }
+  for (i = 0; i < PEERS; i++) {
+    peers[i] = create_node("127.0.0.1", 7400 + i);
+    meta[i] = 1 + (i * 37) % 100;	/* 0 is for peers without metadata */
+  }
+
+  for (i = 0; i < INSTANCES; i++) {
+    tc[i] = tman_init(s, &me[i], sizeof(int), rank[i], "protocol=tman,cache_size=20");
+    if (tc[i] == NULL) {
+      fprintf(stderr, "Error creating TMan instance %d\n", i);
+
+      return -1;
+    }
+  }
+  if (tmanInit(s, &global_me, sizeof(int), closer, "protocol=tman,cache_size=20") < 0) {
+    fprintf(stderr, "Error initialising the global TMan instance\n");
+
+    return -1;
+  }
+  if (tman_init(s, &global_me, sizeof(int), closer, "protocol=unknown")) {
+    fprintf(stderr, "Unknown protocol accepted\n");
+
+    return -1;
+  }
+
+  /* Interleave the insertions, so that the instances see each other's calls */
+  for (j = 0; j < PEERS; j++) {
+    for (i = 0; i < INSTANCES; i++) {
+      tman_add_neighbour(tc[i], peers[j], &meta[j], sizeof(int));
+    }
+    tmanAddNeighbour(peers[j], &meta[j], sizeof(int));
+  }
+
+  for (i = 0; i < INSTANCES; i++) {
+    char name[16];
+
+    sprintf(name, "Instance %d", i);
+    n = tman_give_peers(tc[i], PEERS, given, given_meta);
+    res |= check(name, n, given_meta, rank[i], &me[i]);
+    res |= tman_get_neighbourhood_size(tc[i]) != PEERS;
+  }
+  n = tmanGivePeers(PEERS, given, given_meta);
+  res |= check("Global", n, given_meta, closer, &global_me);
+
+  /* Resizing an instance must not affect the others */
+  if (tman_grow_neighbourhood(tc[0], 5) != 25 || tman_grow_neighbourhood(tc[1], 5) != 25 ||
+      tman_shrink_neighbourhood(tc[2], 5) != 15 || tmanGrowNeighbourhood(1) != 21) {
+    fprintf(stderr, "Wrong neighbourhood size\n");
+    res = -1;
+  }
+
+  for (i = 0; i < INSTANCES; i++) {
+    tman_destroy(tc[i]);
+  }
+  for (i = 0; i < PEERS; i++) {
+    nodeid_free(peers[i]);
+  }
+
+  return res ? -1 : 0;
+}
@@ -9,12 +9,50 @@
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#endif
 
 #include "net_helper.h"
 #include "peersampler.h"
 
 static int cache_size = 100;
 
+/* Per gossip message, entries are: timestamp + nodeID (+ metadata) */
+static void report_savings(void)
+{
+  static const int sizes[] = {10, 20, 50, 100, 200, 500};
+  struct nodeID *v4, *v6;
+  uint8_t buff[sizeof(struct sockaddr_storage)];
+  int legacy_len, v4_len, v6_len, i;
+
+  v4 = create_node("127.0.0.1", 6666);
+  v6 = create_node("::1", 6666);
+  if (v4 == NULL || v6 == NULL) {
+    fprintf(stderr, "Error creating the test nodeIDs\n");
+
+    return;
+  }
+  legacy_len = sizeof(struct sockaddr_storage);
+  v4_len = nodeid_dump(buff, v4, sizeof(buff));
+  v6_len = nodeid_dump(buff, v6, sizeof(buff));
+  printf("nodeID size: legacy %d, IPv4 %d, IPv6 %d\n", legacy_len, v4_len, v6_len);
+  printf("cache_size\tlegacy\tIPv4\tsaved\tIPv6\tsaved\n");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int n = sizes[i];
+
+    printf("%d\t\t%d\t%d\t%d\t%d\t%d\n", n,
+           8 + n * (4 + legacy_len),
+           8 + n * (4 + v4_len), n * (legacy_len - v4_len),
+           8 + n * (4 + v6_len), n * (legacy_len - v6_len));
+  }
+
+  nodeid_free(v4);
+  nodeid_free(v6);
+}
+
 int main(int argc, char *argv[])
 {
   struct nodeID *myID;
@@ -56,6 +94,8 @@ int main(int argc, char *argv[])
     fprintf(stderr, "Error sending a gossiping message: %d\n", res);
   }
 
+  report_savings();
+
   nodeid_free(myID);
 
   return 0;
@@ -26,34 +26,48 @@
 #define TMAN_INIT_PERIOD 1000000
 #define TMAN_RESTART_COUNT 20;
 
-static  int max_preferred_peers;
-static  int max_gossiping_peers;
-static	int restart_countdown = TMAN_RESTART_COUNT;
-
-static uint64_t currtime;
-static int cache_size;
-static struct peer_cache *local_cache;
-static int default_period;
-static int init_cache_size;
-static int period = TMAN_INIT_PERIOD;
-static int active;
-static int do_resize;
-static void *mymeta;
-static int mymeta_size;
-static struct nodeID *restart_peer;
-static uint8_t *zero;
-
-static rankingFunction userRankFunct;
+struct topman_context {
+	int max_preferred_peers;
+	int max_gossiping_peers;
+	int restart_countdown;
+
+	uint64_t currtime;
+	int cache_size;
+	struct peer_cache *local_cache;
+	struct peer_cache *remote_cache;	// entries of the last received message
+	int default_period;
+	int init_cache_size;
+	int period;
+	int active;
+	int do_resize;
+	void *mymeta;
+	int mymeta_size;
+	struct nodeID *restart_peer;
+	uint8_t *zero;
+
+	rankingFunction userRankFunct;
+	struct blist_proto_context *proto;
+};
+
+// The target passed to tmanRankFunct: the ranking function depends on the instance
+struct tman_target {
+	const struct topman_context *context;
+	const void *meta;
+};
 
 static int tmanRankFunct (const void *target, const void *p1, const void *p2) {
+	const struct tman_target *t = target;
+	const struct topman_context *context = t->context;
+	const uint8_t *zero = context->zero;
+	int mymeta_size = context->mymeta_size;
 
-	if (memcmp(target,zero,mymeta_size) == 0 || (memcmp(p1,zero,mymeta_size) == 0 && memcmp(p2,zero,mymeta_size) == 0))
+	if (memcmp(t->meta,zero,mymeta_size) == 0 || (memcmp(p1,zero,mymeta_size) == 0 && memcmp(p2,zero,mymeta_size) == 0))
 		return 0;
 	if (memcmp(p1,zero,mymeta_size) == 0)
 		return 2;
 	if (memcmp(p2,zero,mymeta_size) == 0)
 		return 1;
-	return userRankFunct(target, p1, p2);
+	return context->userRankFunct(t->meta, p1, p2);
 }
 
 static uint64_t gettime(void)
@@ -65,56 +79,84 @@ static uint64_t gettime(void)
 	return tv.tv_usec + tv.tv_sec * 1000000ull;
 }
 
-static int tmanInit(struct nodeID *myID, void *metadata, int metadata_size, rankingFunction rfun, const char *config)
+static void tmanDestroy(struct topman_context *context)
+{
+	if (context->local_cache) {
+		blist_cache_free(context->local_cache);
+	}
+	if (context->remote_cache) {
+		blist_cache_free(context->remote_cache);
+	}
+	if (context->restart_peer) {
+		nodeid_free(context->restart_peer);
+	}
+	if (context->proto) {
+		blist_proto_destroy(context->proto);
+	}
+	free(context->zero);
+	free(context);
+}
+
+static struct topman_context *tmanInit(struct nodeID *myID, void *metadata, int metadata_size, rankingFunction rfun, const char *config)
 {
+	struct topman_context *context;
 	struct tag *cfg_tags;
 	int res;
 
+	context = calloc(1, sizeof(struct topman_context));
+	if (context == NULL) {
+		return NULL;
+	}
+	context->restart_countdown = TMAN_RESTART_COUNT;
+	context->period = TMAN_INIT_PERIOD;
+
 	cfg_tags = grapes_config_parse(config);
-	res = grapes_config_value_int(cfg_tags, "cache_size", &init_cache_size);
+	res = grapes_config_value_int(cfg_tags, "cache_size", &context->init_cache_size);
 	if (!res) {
-		init_cache_size = TMAN_INIT_PEERS;
+		context->init_cache_size = TMAN_INIT_PEERS;
 	}
-	cache_size = init_cache_size;
-	res = grapes_config_value_int(cfg_tags, "max_preferred_peers", &max_preferred_peers);
+	context->cache_size = context->init_cache_size;
+	res = grapes_config_value_int(cfg_tags, "max_preferred_peers", &context->max_preferred_peers);
 	if (!res) {
-		max_preferred_peers = TMAN_MAX_PREFERRED_PEERS;
+		context->max_preferred_peers = TMAN_MAX_PREFERRED_PEERS;
 	}
-	res = grapes_config_value_int(cfg_tags, "max_gossiping_peers", &max_gossiping_peers);
+	res = grapes_config_value_int(cfg_tags, "max_gossiping_peers", &context->max_gossiping_peers);
 	if (!res) {
-		max_gossiping_peers = TMAN_MAX_GOSSIPING_PEERS;
+		context->max_gossiping_peers = TMAN_MAX_GOSSIPING_PEERS;
 	}
-	res = grapes_config_value_int(cfg_tags, "period", &default_period);
+	res = grapes_config_value_int(cfg_tags, "period", &context->default_period);
 	if (!res) {
-		default_period = TMAN_STD_PERIOD;
+		context->default_period = TMAN_STD_PERIOD;
 	}
-	default_period *= 1000000;
-
-	userRankFunct = rfun;
-	blist_proto_init(myID, metadata, metadata_size);
-	mymeta = metadata;
-	mymeta_size = metadata_size;
-	zero = calloc(mymeta_size,1);
-
-	local_cache = blist_cache_init(cache_size, metadata_size, 0);
-	if (local_cache == NULL) {
-		return -1;
+	context->default_period *= 1000000;
+	free(cfg_tags);
+
+	context->userRankFunct = rfun;
+	context->proto = blist_proto_init(myID, metadata, metadata_size);
+	context->mymeta = metadata;
+	context->mymeta_size = metadata_size;
+	context->zero = calloc(metadata_size,1);
+
+	context->local_cache = blist_cache_init(context->cache_size, metadata_size, 0);
+	if (context->proto == NULL || context->zero == NULL || context->local_cache == NULL) {
+		tmanDestroy(context);
+		return NULL;
 	}
-	active = -1;
-	currtime = gettime();
+	context->active = -1;
+	context->currtime = gettime();
 
-	return 0;
+	return context;
 }
 
-static int tmanGivePeers (int n, struct nodeID **peers, void *metadata)
+static int tmanGivePeers (struct topman_context *context, int n, struct nodeID **peers, void *metadata)
 {
 	int metadata_size;
 	const uint8_t *mdata;
 	int i;
 
-	mdata = blist_get_metadata(local_cache, &metadata_size);
-	for (i=0; blist_nodeid(local_cache, i) && (i < n); i++) {
-		peers[i] = blist_nodeid(local_cache,i);
+	mdata = blist_get_metadata(context->local_cache, &metadata_size);
+	for (i=0; blist_nodeid(context->local_cache, i) && (i < n); i++) {
+		peers[i] = blist_nodeid(context->local_cache,i);
 		if (metadata_size)
 			memcpy((uint8_t *)metadata + i * metadata_size, mdata + i * metadata_size, metadata_size);
 	}
@@ -122,32 +164,34 @@ static int tmanGivePeers (int n, struct nodeID **peers, void *metadata)
 	return i;
 }
 
-static int tmanGetNeighbourhoodSize(void)
+static int tmanGetNeighbourhoodSize(struct topman_context *context)
 {
 	int i;
 
-	for (i = 0; blist_nodeid(local_cache, i); i++);
+	for (i = 0; blist_nodeid(context->local_cache, i); i++);
 
 	return i;
 }
 
-static int time_to_send(void)
+static int time_to_send(struct topman_context *context)
 {
-	if (gettime() - currtime > period) {
-		currtime += period;
+	if (gettime() - context->currtime > context->period) {
+		context->currtime += context->period;
 		return 1;
 	}
 
 	return 0;
 }
 
-static int tmanAddNeighbour(struct nodeID *neighbour, void *metadata, int metadata_size)
+static int tmanAddNeighbour(struct topman_context *context, struct nodeID *neighbour, void *metadata, int metadata_size)
 {
+	struct tman_target me = {context, context->mymeta};
+
 	if (!metadata_size) {
-		blist_tman_query_peer(local_cache, neighbour, max_gossiping_peers);
+		blist_tman_query_peer(context->proto, context->local_cache, neighbour, context->max_gossiping_peers);
 		return -1;
 	}
-	if (blist_cache_add_ranked(local_cache, neighbour, metadata, metadata_size, tmanRankFunct, mymeta) < 0) {
+	if (blist_cache_add_ranked(context->local_cache, neighbour, metadata, metadata_size, tmanRankFunct, &me) < 0) {
 		return -1;
 	}
 
@@ -156,26 +200,27 @@ static int tmanAddNeighbour(struct nodeID *neighbour, void *metadata, int metada
 
 
 // not self metadata, but neighbors'.
-static const void *tmanGetMetadata(int *metadata_size)
+static const void *tmanGetMetadata(struct topman_context *context, int *metadata_size)
 {
-	return blist_get_metadata(local_cache, metadata_size);
+	return blist_get_metadata(context->local_cache, metadata_size);
 }
 
 
-static int tmanChangeMetadata(void *metadata, int metadata_size)
+static int tmanChangeMetadata(struct topman_context *context, void *metadata, int metadata_size)
 {
+	struct tman_target me = {context, metadata};
 	struct peer_cache *new = NULL;
 
-	if (blist_proto_metadata_update(metadata, metadata_size) <= 0) {
+	if (blist_proto_metadata_update(context->proto, metadata, metadata_size) <= 0) {
 		return -1;
 	}
-	mymeta = metadata;
+	context->mymeta = metadata;
 
-	if (active >= 0) {
-		new = blist_cache_rank(local_cache, tmanRankFunct, NULL, mymeta);
+	if (context->active >= 0) {
+		new = blist_cache_rank(context->local_cache, tmanRankFunct, NULL, &me);
 		if (new) {
-			blist_cache_free(local_cache);
-			local_cache = new;
+			blist_cache_free(context->local_cache);
+			context->local_cache = new;
 		}
 	}
 
@@ -183,24 +228,28 @@ static int tmanChangeMetadata(void *metadata, int metadata_size)
 }
 
 
-static int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size)
+static int tmanParseData(struct topman_context *context, const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size)
 {
+	struct tman_target me = {context, context->mymeta}, other = {context, NULL};
 	int msize,s;
 	const uint8_t *mdata;
 	struct peer_cache *new = NULL, *temp;
 
-	if (len && active >= 0) {
+	if (len && context->active >= 0) {
 		const struct topo_header *h = (const struct topo_header *)buff;
-		struct peer_cache *remote_cache;
 
 	    if (h->protocol != MSG_TYPE_TMAN) {
 	      fprintf(stderr, "TMAN: Wrong protocol!\n");
 	      return -1;
 	    }
 
-		remote_cache = blist_entries_undump(buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
-		mdata = blist_get_metadata(remote_cache,&msize);
-		blist_get_metadata(local_cache,&s);
+		temp = blist_entries_undump_into(context->remote_cache, buff + sizeof(struct topo_header), len - sizeof(struct topo_header));
+		if (temp == NULL) {
+			return -1;
+		}
+		context->remote_cache = temp;
+		mdata = blist_get_metadata(context->remote_cache,&msize);
+		blist_get_metadata(context->local_cache,&s);
 
 		if (msize != s) {
 			fprintf(stderr, "TMAN: Metadata size mismatch! -> local (%d) != received (%d)\n",
@@ -209,65 +258,65 @@ static int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, in
 		}
 
 		if (h->type == TMAN_QUERY) {
-			new = blist_cache_rank(local_cache, tmanRankFunct, blist_nodeid(remote_cache, 0), blist_get_metadata(remote_cache, &msize));
+			other.meta = blist_get_metadata(context->remote_cache, &msize);
+			new = blist_cache_rank(context->local_cache, tmanRankFunct, blist_nodeid(context->remote_cache, 0), &other);
 			if (new) {
-				blist_tman_reply(remote_cache, new, max_gossiping_peers);
+				blist_tman_reply(context->proto, context->remote_cache, new, context->max_gossiping_peers);
 				blist_cache_free(new);
 				new = NULL;
 				// TODO: put sender in tabu list (check list size, etc.), if any...
 			}
 		}
 
-		if (restart_peer && nodeid_equal(restart_peer, blist_nodeid(remote_cache,0))) { // restart phase : receiving new cache from chosen alive peer...
-			new = blist_cache_rank(remote_cache,tmanRankFunct,NULL,mymeta);
+		if (context->restart_peer && nodeid_equal(context->restart_peer, blist_nodeid(context->remote_cache,0))) { // restart phase : receiving new cache from chosen alive peer...
+			new = blist_cache_rank(context->remote_cache,tmanRankFunct,NULL,&me);
 			if (new) {
-				cache_size = init_cache_size;
-				blist_cache_resize(new,cache_size);
-				period = default_period;
+				context->cache_size = context->init_cache_size;
+				blist_cache_resize(new,context->cache_size);
+				context->period = context->default_period;
 				fprintf(stderr,"RESTARTING TMAN!!!\n");
 			}
-			nodeid_free(restart_peer);
-			restart_peer = NULL;
-			active = 1;
+			nodeid_free(context->restart_peer);
+			context->restart_peer = NULL;
+			context->active = 1;
 		}
 		else {	// normal phase
-			temp = blist_cache_union(local_cache,remote_cache,&s);
-			if (temp) {
-				new = blist_cache_rank(temp,tmanRankFunct,NULL,mymeta);
-				cache_size = ((s/2)*2.5) > cache_size ? ((s/2)*2.5) : cache_size;
-				blist_cache_resize(new,cache_size);
-				blist_cache_free(temp);
+			s = blist_cache_merge_union(context->local_cache,context->remote_cache);
+			if (s >= 0) {
+				blist_cache_sort(context->local_cache,tmanRankFunct,&me);
+				context->cache_size = ((s/2)*2.5) > context->cache_size ? ((s/2)*2.5) : context->cache_size;
+				blist_cache_resize(context->local_cache,context->cache_size);
+				context->do_resize = 0;
 			}
-			if (restart_peer) {
-				restart_countdown--;
-				if (restart_countdown <= 0) {
-					nodeid_free(restart_peer);
-					restart_peer = NULL;
+			if (context->restart_peer) {
+				context->restart_countdown--;
+				if (context->restart_countdown <= 0) {
+					nodeid_free(context->restart_peer);
+					context->restart_peer = NULL;
 				}
 			}
 		}
 
-		blist_cache_free(remote_cache);
 		if (new!=NULL) {
-		  blist_cache_free(local_cache);
-		  local_cache = new;
-                  do_resize = 0;
+		  blist_cache_free(context->local_cache);
+		  context->local_cache = new;
+                  context->do_resize = 0;
 		}
 	}
 
-  if (time_to_send()) {
+  if (time_to_send(context)) {
 	uint8_t *meta;
 	struct nodeID *chosen;
 
-	blist_cache_update(local_cache);
+	blist_cache_update(context->local_cache);
 
-	if (active > 0 && tmanGetNeighbourhoodSize() < size && !restart_countdown) {
+	if (context->active > 0 && tmanGetNeighbourhoodSize(context) < size && !context->restart_countdown) {
 		fprintf(stderr, "TMAN: Too few peers in cache! Triggering a restart...\n");
-		active = 0;
-		period = TMAN_INIT_PERIOD;
+		context->active = 0;
+		context->period = TMAN_INIT_PERIOD;
 	}
 
-	if (active <= 0) {	// active < 0 -> bootstrap phase ; active = 0 -> restart phase
+	if (context->active <= 0) {	// active < 0 -> bootstrap phase ; active = 0 -> restart phase
 		struct peer_cache *ncache;
 		int j,nsize;
 
@@ -275,22 +324,23 @@ static int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, in
 		if (size) ncache = blist_cache_init(nsize, metadata_size, 0);
 		else {return 1;}
 		for (j=0;j<size;j++)
-			blist_cache_add_ranked(ncache, peers[j],(const uint8_t *)metadata + j * metadata_size, metadata_size, tmanRankFunct, mymeta);
+			blist_cache_add_ranked(ncache, peers[j],(const uint8_t *)metadata + j * metadata_size, metadata_size, tmanRankFunct, &me);
 		if (blist_nodeid(ncache, 0)) {
-			restart_peer = nodeid_dup(blist_nodeid(ncache, 0));
-			restart_countdown = TMAN_RESTART_COUNT;
+			context->restart_peer = nodeid_dup(blist_nodeid(ncache, 0));
+			context->restart_countdown = TMAN_RESTART_COUNT;
 			mdata = blist_get_metadata(ncache, &msize);
-			new = blist_cache_rank(active < 0 ? ncache : local_cache, tmanRankFunct, restart_peer, mdata);
+			other.meta = mdata;
+			new = blist_cache_rank(context->active < 0 ? ncache : context->local_cache, tmanRankFunct, context->restart_peer, &other);
 			if (new) {
-				blist_tman_query_peer(new, restart_peer, max_gossiping_peers);
+				blist_tman_query_peer(context->proto, new, context->restart_peer, context->max_gossiping_peers);
 				blist_cache_free(new);
 			}
-		if (active < 0) { // bootstrap
+		if (context->active < 0) { // bootstrap
 			fprintf(stderr,"BOOTSTRAPPING TMAN!!!\n");
-			blist_cache_free(local_cache);
-			local_cache = ncache;
-			cache_size = nsize;
-			active = 0;
+			blist_cache_free(context->local_cache);
+			context->local_cache = ncache;
+			context->cache_size = nsize;
+			context->active = 0;
 		} else { // restart
 			blist_cache_free(ncache);
 		}
@@ -302,13 +352,14 @@ static int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, in
 		}
 	}
 	else { // normal phase
-	chosen = blist_rand_peer(local_cache, (void **)&meta, max_preferred_peers);
-	new = blist_cache_rank(local_cache, tmanRankFunct, chosen, meta);
+	chosen = blist_rand_peer(context->local_cache, (void **)&meta, context->max_preferred_peers);
+	other.meta = meta;
+	new = blist_cache_rank(context->local_cache, tmanRankFunct, chosen, &other);
 	if (new==NULL) {
 		fprintf(stderr, "TMAN: No cache could be sent to remote peer!\n");
 		return 1;
 	}
-	blist_tman_query_peer(new, chosen, max_gossiping_peers);
+	blist_tman_query_peer(context->proto, new, chosen, context->max_gossiping_peers);
 	blist_cache_free(new);
 	}
   }
@@ -318,28 +369,28 @@ static int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, in
 
 
 // limit : at most it doubles the current cache size...
-static int tmanGrowNeighbourhood(int n)
+static int tmanGrowNeighbourhood(struct topman_context *context, int n)
 {
-	if (n<=0 || do_resize)
+	if (n<=0 || context->do_resize)
 		return -1;
-	n = n>cache_size?cache_size:n;
-	cache_size += n;
-	do_resize = 1;
-	return cache_size;
+	n = n>context->cache_size?context->cache_size:n;
+	context->cache_size += n;
+	context->do_resize = 1;
+	return context->cache_size;
 }
 
 
-static int tmanShrinkNeighbourhood(int n)
+static int tmanShrinkNeighbourhood(struct topman_context *context, int n)
 {
-	if (n<=0 || n>=cache_size || do_resize)
+	if (n<=0 || n>=context->cache_size || context->do_resize)
 		return -1;
-	cache_size -= n;
-	do_resize = 1;
-	return cache_size;
+	context->cache_size -= n;
+	context->do_resize = 1;
+	return context->cache_size;
 }
 
 
-static int tmanRemoveNeighbour(struct nodeID *neighbour)
+static int tmanRemoveNeighbour(struct topman_context *context, struct nodeID *neighbour)
 {
 	return 0;
 }
@@ -356,4 +407,5 @@ struct topman_iface tman = {
 	.shrinkNeighbourhood = tmanShrinkNeighbourhood,
 	.removeNeighbour = tmanRemoveNeighbour,
 	.getNeighbourhoodSize = tmanGetNeighbourhoodSize,
+	.destroy = tmanDestroy,
 };
@@ -1,73 +1,187 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "net_helper.h"
 #include "tman.h"
 #include "topman_iface.h"
+#include "grapes_config.h"
 
 extern struct topman_iface tman;
 extern struct topman_iface dumb;
 
-static struct topman_iface *tm;
+struct tman_context{
+  struct topman_iface *tm;
+  struct topman_context *tm_context;
+};
 
+static struct tman_context *tc;
 
+
+struct tman_context *tman_init(struct nodeID *myID, void *metadata, int metadata_size, tmanRankingFunction rfun, const char *config)
+{
+	struct tman_context *con;
+	struct tag *cfg_tags;
+	const char *proto;
+
+	con = malloc(sizeof(struct tman_context));
+	if (!con) return NULL;
+
+	con->tm = &dumb;
+	cfg_tags = grapes_config_parse(config);
+	proto = grapes_config_value_str(cfg_tags, "protocol");
+	if (proto) {
+		if (strcmp(proto, "tman") == 0) {
+			con->tm = &tman;
+		} else if (strcmp(proto, "dumb") == 0) {
+			con->tm = &dumb;
+		} else {
+			free(cfg_tags);
+			free(con);
+			return NULL;
+		}
+	}
+	free(cfg_tags);
+
+	con->tm_context = con->tm->init(myID, metadata, metadata_size, rfun, config);
+	if (!con->tm_context) {
+		free(con);
+		return NULL;
+	}
+
+	return con;
+}
+
+
+int tman_add_neighbour(struct tman_context *con, struct nodeID *neighbour, void *metadata, int metadata_size)
+{
+	return con->tm->addNeighbour(con->tm_context, neighbour, metadata, metadata_size);
+}
+
+
+int tman_parse_data(struct tman_context *con, const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size)
+{
+	return con->tm->parseData(con->tm_context, buff, len, peers, size, metadata, metadata_size);
+}
+
+
+int tman_change_metadata(struct tman_context *con, void *metadata, int metadata_size)
+{
+	return con->tm->changeMetadata(con->tm_context, metadata, metadata_size);
+}
+
+
+const void *tman_get_metadata(struct tman_context *con, int *metadata_size)
+{
+	return con->tm->getMetadata(con->tm_context, metadata_size);
+}
+
+
+int tman_get_neighbourhood_size(struct tman_context *con)
+{
+	return con->tm->getNeighbourhoodSize(con->tm_context);
+}
+
+
+int tman_give_peers(struct tman_context *con, int n, struct nodeID **peers, void *metadata)
+{
+	return con->tm->givePeers(con->tm_context, n, peers, metadata);
+}
+
+
+int tman_grow_neighbourhood(struct tman_context *con, int n)
+{
+	return con->tm->growNeighbourhood(con->tm_context, n);
+}
+
+
+int tman_shrink_neighbourhood(struct tman_context *con, int n)
+{
+	return con->tm->shrinkNeighbourhood(con->tm_context, n);
+}
+
+
+int tman_remove_neighbour(struct tman_context *con, struct nodeID *neighbour)
+{
+	return con->tm->removeNeighbour(con->tm_context, neighbour);
+}
+
+
+void tman_destroy(struct tman_context *con)
+{
+	con->tm->destroy(con->tm_context);
+	free(con);
+}
+
+
+/* The old API, working on a single, global instance */
 int tmanInit(struct nodeID *myID, void *metadata, int metadata_size, tmanRankingFunction rfun, const char *config)
 {
-	tm = &dumb;
-	return tm->init(myID, metadata, metadata_size, rfun, config);
+	struct tman_context *con;
+
+	con = tman_init(myID, metadata, metadata_size, rfun, config);
+	if (con == NULL) {
+		return -1;
+	}
+	if (tc) {
+		tman_destroy(tc);
+	}
+	tc = con;
+
+	return 0;
 }
 
 
 int tmanAddNeighbour(struct nodeID *neighbour, void *metadata, int metadata_size)
 {
-	return tm->addNeighbour(neighbour, metadata, metadata_size);
+	return tman_add_neighbour(tc, neighbour, metadata, metadata_size);
 }
 
 
 int tmanParseData(const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size)
 {
-	return tm->parseData(buff, len, peers, size, metadata, metadata_size);
+	return tman_parse_data(tc, buff, len, peers, size, metadata, metadata_size);
 }
 
 
 int tmanChangeMetadata(void *metadata, int metadata_size)
 {
-	return tm->changeMetadata(metadata, metadata_size);
+	return tman_change_metadata(tc, metadata, metadata_size);
 }
 
 
 const void *tmanGetMetadata(int *metadata_size)
 {
-	return tm->getMetadata(metadata_size);
+	return tman_get_metadata(tc, metadata_size);
 }
 
 
 int tmanGetNeighbourhoodSize(void)
 {
-	return tm->getNeighbourhoodSize();
+	return tman_get_neighbourhood_size(tc);
 }
 
 
 int tmanGivePeers (int n, struct nodeID **peers, void *metadata)
 {
-	return tm->givePeers (n, peers, metadata);
+	return tman_give_peers(tc, n, peers, metadata);
 }
 
 
 int tmanGrowNeighbourhood(int n)
 {
-	return tm->growNeighbourhood(n);
+	return tman_grow_neighbourhood(tc, n);
 }
 
 
 int tmanShrinkNeighbourhood(int n)
 {
-	return tm->shrinkNeighbourhood(n);
+	return tman_shrink_neighbourhood(tc, n);
 }
 
 
 int tmanRemoveNeighbour(struct nodeID *neighbour)
 {
-	return tm->removeNeighbour(neighbour);
+	return tman_remove_neighbour(tc, neighbour);
 }
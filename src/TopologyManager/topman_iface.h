@@ -1,14 +1,17 @@
 typedef int (*rankingFunction)(const void *target, const void *p1, const void *p2);	// FIXME!
 
+struct topman_context;
+
 struct topman_iface {
-  int (*init)(struct nodeID *myID, void *metadata, int metadata_size, rankingFunction rfun, const char *config);
-  int (*changeMetadata)(void *metadata, int metadata_size);
-  int (*addNeighbour)(struct nodeID *neighbour, void *metadata, int metadata_size);
-  int (*parseData)(const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size);
-  int (*givePeers)(int n, struct nodeID **peers, void *metadata);
-  const void *(*getMetadata)(int *metadata_size);
-  int (*growNeighbourhood)(int n);
-  int (*shrinkNeighbourhood)(int n);
-  int (*removeNeighbour)(struct nodeID *neighbour);
-  int (*getNeighbourhoodSize)(void);
+  struct topman_context *(*init)(struct nodeID *myID, void *metadata, int metadata_size, rankingFunction rfun, const char *config);
+  int (*changeMetadata)(struct topman_context *context, void *metadata, int metadata_size);
+  int (*addNeighbour)(struct topman_context *context, struct nodeID *neighbour, void *metadata, int metadata_size);
+  int (*parseData)(struct topman_context *context, const uint8_t *buff, int len, struct nodeID **peers, int size, const void *metadata, int metadata_size);
+  int (*givePeers)(struct topman_context *context, int n, struct nodeID **peers, void *metadata);
+  const void *(*getMetadata)(struct topman_context *context, int *metadata_size);
+  int (*growNeighbourhood)(struct topman_context *context, int n);
+  int (*shrinkNeighbourhood)(struct topman_context *context, int n);
+  int (*removeNeighbour)(struct topman_context *context, struct nodeID *neighbour);
+  int (*getNeighbourhoodSize)(struct topman_context *context);
+  void (*destroy)(struct topman_context *context);
 };
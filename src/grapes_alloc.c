@@ -0,0 +1,304 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "grapes_alloc.h"
+#include "grapes_config.h"
+
+#define MAX_SLABS 32
+#define NAME_SIZE 16
+#define ALIGNMENT 16
+#define MIN_CLASS 4	/* 16 bytes */
+#define MAX_CLASS 16	/* 64KB */
+#define MIN_OBJS 4
+#define DEFAULT_SLAB_SIZE 65536
+
+struct grapes_slab {
+  char name[NAME_SIZE];
+  int size;
+  int stride;
+  void *free_list;
+  unsigned long hits;
+  unsigned long misses;
+  int in_use;
+};
+
+/*
+ * Memory areas allocated to the pools, sorted by address: grapes_free()
+ * finds the pool of an object with a binary search.
+ */
+struct area {
+  uint8_t *start;
+  uint8_t *end;
+  struct grapes_slab *s;
+};
+
+static struct grapes_slab slabs[MAX_SLABS];
+static int n_slabs;
+static struct grapes_slab *classes[MAX_CLASS + 1];
+static struct area *areas;
+static int n_areas, max_areas;
+static int use_malloc;
+static int slab_size = DEFAULT_SLAB_SIZE;
+static volatile int lock;
+
+static void pools_lock(void)
+{
+  while (__sync_lock_test_and_set(&lock, 1));
+}
+
+static void pools_unlock(void)
+{
+  __sync_lock_release(&lock);
+}
+
+int grapes_alloc_init(const char *config)
+{
+  struct tag *cfg_tags;
+  const char *type;
+  int res = 0;
+
+  cfg_tags = grapes_config_parse(config);
+  if (!cfg_tags) {
+    return -1;
+  }
+  type = grapes_config_value_str_default(cfg_tags, "allocator", "slab");
+  if (!strcmp(type, "malloc")) {
+    use_malloc = 1;
+  } else if (!strcmp(type, "slab")) {
+    use_malloc = 0;
+  } else {
+    res = -1;
+  }
+  grapes_config_value_int_default(cfg_tags, "slab_size", &slab_size, DEFAULT_SLAB_SIZE);
+  free(cfg_tags);
+
+  return res;
+}
+
+static struct area *area_find(const void *p)
+{
+  int a = 0, b = n_areas - 1;
+
+  while (a <= b) {
+    int m = (a + b) / 2;
+
+    if ((const uint8_t *)p < areas[m].start) {
+      b = m - 1;
+    } else if ((const uint8_t *)p >= areas[m].end) {
+      a = m + 1;
+    } else {
+      return &areas[m];
+    }
+  }
+
+  return NULL;
+}
+
+static int slab_grow(struct grapes_slab *s)
+{
+  uint8_t *mem;
+  int i, n;
+
+  if (n_areas == max_areas) {
+    struct area *res;
+
+    res = realloc(areas, (max_areas + 64) * sizeof(struct area));
+    if (res == NULL) {
+      return -1;
+    }
+    areas = res;
+    max_areas += 64;
+  }
+  n = slab_size / s->stride;
+  if (n < MIN_OBJS) {
+    n = MIN_OBJS;
+  }
+  mem = malloc((size_t)n * s->stride);
+  if (mem == NULL) {
+    return -1;
+  }
+
+  for (i = n_areas; i > 0 && areas[i - 1].start > mem; i--) {
+    areas[i] = areas[i - 1];
+  }
+  areas[i].start = mem;
+  areas[i].end = mem + (size_t)n * s->stride;
+  areas[i].s = s;
+  n_areas++;
+
+  for (i = n - 1; i >= 0; i--) {
+    void **obj = (void **)(mem + (size_t)i * s->stride);
+
+    *obj = s->free_list;
+    s->free_list = obj;
+  }
+
+  return 0;
+}
+
+static struct grapes_slab *slab_new(const char *name, int size)
+{
+  struct grapes_slab *s;
+  int i;
+
+  for (i = 0; i < n_slabs; i++) {
+    if (slabs[i].size == size && !strncmp(slabs[i].name, name, NAME_SIZE - 1)) {
+      return &slabs[i];
+    }
+  }
+  if (n_slabs == MAX_SLABS || size <= 0) {
+    return NULL;
+  }
+  s = &slabs[n_slabs++];
+  memset(s, 0, sizeof(struct grapes_slab));
+  strncpy(s->name, name, NAME_SIZE - 1);
+  s->size = size;
+  s->stride = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  return s;
+}
+
+struct grapes_slab *grapes_slab_create(const char *name, int size)
+{
+  struct grapes_slab *s;
+
+  pools_lock();
+  s = slab_new(name, size);
+  pools_unlock();
+
+  return s;
+}
+
+void *grapes_slab_alloc(struct grapes_slab *s)
+{
+  void **obj;
+
+  pools_lock();
+  if (use_malloc) {
+    s->misses++;
+    pools_unlock();
+
+    return malloc(s->size);
+  }
+  if (s->free_list == NULL) {
+    if (slab_grow(s) < 0) {
+      pools_unlock();
+
+      return NULL;
+    }
+    s->misses++;
+  } else {
+    s->hits++;
+  }
+  obj = s->free_list;
+  s->free_list = *obj;
+  s->in_use++;
+  pools_unlock();
+
+  return obj;
+}
+
+void *grapes_malloc(int size)
+{
+  struct grapes_slab *s;
+  int c = MIN_CLASS;
+
+  if (size > 1 << MAX_CLASS) {
+    return malloc(size);
+  }
+  while ((1 << c) < size) {
+    c++;
+  }
+  pools_lock();
+  s = classes[c];
+  if (s == NULL) {
+    char name[NAME_SIZE];
+
+    sprintf(name, "size-%d", 1 << c);
+    s = slab_new(name, 1 << c);
+    classes[c] = s;
+  }
+  pools_unlock();
+  if (s == NULL) {
+    return malloc(size);
+  }
+
+  return grapes_slab_alloc(s);
+}
+
+void *grapes_realloc(void *p, int size)
+{
+  struct area *a;
+  void *res;
+  int old_size;
+
+  if (p == NULL) {
+    return grapes_malloc(size);
+  }
+  pools_lock();
+  a = area_find(p);
+  old_size = a ? a->s->size : 0;
+  pools_unlock();
+  if (a == NULL) {
+    return realloc(p, size);
+  }
+  if (size <= old_size) {
+    return p;
+  }
+
+  res = grapes_malloc(size);
+  if (res == NULL) {
+    return NULL;
+  }
+  memcpy(res, p, old_size);
+  grapes_free(p);
+
+  return res;
+}
+
+void grapes_free(void *p)
+{
+  struct area *a;
+
+  if (p == NULL) {
+    return;
+  }
+  pools_lock();
+  a = area_find(p);
+  if (a) {
+    *(void **)p = a->s->free_list;
+    a->s->free_list = p;
+    a->s->in_use--;
+    pools_unlock();
+
+    return;
+  }
+  pools_unlock();
+  free(p);
+}
+
+int grapes_alloc_stats(struct grapes_alloc_stats *stats, int n)
+{
+  int i;
+
+  pools_lock();
+  for (i = 0; i < n && i < n_slabs; i++) {
+    stats[i].name = slabs[i].name;
+    stats[i].size = slabs[i].size;
+    stats[i].hits = slabs[i].hits;
+    stats[i].misses = slabs[i].misses;
+    stats[i].in_use = slabs[i].in_use;
+  }
+  n = n_slabs;
+  pools_unlock();
+
+  return n;
+}
@@ -0,0 +1,667 @@
+/*
+ *  Copyright (c) 2010 Luca Abeni
+ *
+ *  This is free software; see lgpl-2.1.txt
+ *
+ *  In-memory network with a virtual clock, for simulating many peers in
+ *  one process. The messages sent by a node go in a heap ordered by their
+ *  delivery time; net_sim_run() moves the ones which are due to the
+ *  queues of their destinations, where recv_from_peer() finds them.
+ *  The nodes are looked up by address (the nodeIDs used as source of the
+ *  messages are often copies of the one returned by net_helper_init()).
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#else
+#include "win32-net.h"
+#endif
+
+#include "net_helper.h"
+#include "net_helper_sim.h"
+#include "grapes_config.h"
+#include "grapes_alloc.h"
+
+/* Same wire format as the compact IPv4 nodeIDs of net_helper-udp.c */
+#define COMPACT_ID_IPV4_TAG (0x90 | 4)
+#define COMPACT_ID_IPV4_LEN (1 + 4 + 2)
+#define MIN_SLOTS 64
+
+struct nodeID {
+  struct in_addr addr;
+  in_port_t port;		/* Network order */
+  int bound;			/* Returned by net_helper_init() */
+};
+
+struct sim_msg {
+  uint64_t due;
+  uint64_t seq;
+  int dst;			/* Index of the destination node */
+  struct nodeID from;
+  struct sim_msg *next;
+  int len;
+  uint8_t data[];
+};
+
+struct sim_node {
+  struct nodeID id;
+  int alive;
+  struct sim_msg *head, *tail;	/* Delivered messages, not received yet */
+  struct net_sim_counters cnt;
+};
+
+static struct sim_node *nodes;
+static int n_nodes, nodes_size;
+static int *slots;		/* Hash on the address: node index + 1, 0 if free */
+static int n_slots;
+
+static struct sim_msg **heap;	/* In flight messages, ordered by (due, seq) */
+static int heap_len, heap_size;
+
+static uint64_t now;
+static uint64_t next_seq;
+static int latency, jitter;
+static double loss;
+static uint64_t rnd_state = 1;
+
+static struct grapes_slab *nodeid_slab;
+
+/* xorshift64*: the samplers' rand() sequence is not disturbed */
+static double sim_random(void)
+{
+  rnd_state ^= rnd_state >> 12;
+  rnd_state ^= rnd_state << 25;
+  rnd_state ^= rnd_state >> 27;
+
+  return (double)((rnd_state * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+static struct nodeID *nodeid_alloc(void)
+{
+  if (nodeid_slab == NULL) {
+    nodeid_slab = grapes_slab_create("nodeID", sizeof(struct nodeID));
+    if (nodeid_slab == NULL) {
+      return malloc(sizeof(struct nodeID));
+    }
+  }
+
+  return grapes_slab_alloc(nodeid_slab);
+}
+
+static inline uint32_t hash_mix(uint32_t h, const uint8_t *b, int len)
+{
+  int i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++) {
+    h ^= b[i];
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+uint32_t nodeid_hash(const struct nodeID *s)
+{
+  uint32_t h = 2166136261U;
+
+  h = hash_mix(h, (const uint8_t *)&s->addr, sizeof(s->addr));
+  h = hash_mix(h, (const uint8_t *)&s->port, sizeof(s->port));
+
+  return h;
+}
+
+int nodeid_cmp(const struct nodeID *s1, const struct nodeID *s2)
+{
+  int res;
+
+  if (s1 == NULL || s2 == NULL) {
+    return 0;
+  }
+  res = memcmp(&s1->addr, &s2->addr, sizeof(s1->addr));
+  if (res) {
+    return res;
+  }
+
+  return ntohs(s1->port) - ntohs(s2->port);
+}
+
+int nodeid_equal(const struct nodeID *s1, const struct nodeID *s2)
+{
+  return nodeid_cmp(s1, s2) == 0;
+}
+
+/* Index of the node with the address of id, or -1 */
+static int node_find(const struct nodeID *id)
+{
+  int i;
+
+  if (n_slots == 0) {
+    return -1;
+  }
+  for (i = nodeid_hash(id) & (n_slots - 1); slots[i]; i = (i + 1) & (n_slots - 1)) {
+    if (nodeid_equal(&nodes[slots[i] - 1].id, id)) {
+      return slots[i] - 1;
+    }
+  }
+
+  return -1;
+}
+
+static void slot_add(int n)
+{
+  int i;
+
+  for (i = nodeid_hash(&nodes[n].id) & (n_slots - 1); slots[i]; i = (i + 1) & (n_slots - 1));
+  slots[i] = n + 1;
+}
+
+/* Backward shift deletion, so that no tombstones are needed */
+static void slot_remove(int n)
+{
+  int i, j, home;
+
+  for (i = nodeid_hash(&nodes[n].id) & (n_slots - 1); slots[i] != n + 1; i = (i + 1) & (n_slots - 1));
+  for (j = (i + 1) & (n_slots - 1); slots[j]; j = (j + 1) & (n_slots - 1)) {
+    home = nodeid_hash(&nodes[slots[j] - 1].id) & (n_slots - 1);
+    /* The entry in j can move to i if its home is not in (i, j] */
+    if (((j - home) & (n_slots - 1)) >= ((j - i) & (n_slots - 1))) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i] = 0;
+}
+
+static int node_add(const struct nodeID *id)
+{
+  int i;
+
+  if (n_nodes == nodes_size) {
+    struct sim_node *new;
+
+    new = realloc(nodes, sizeof(struct sim_node) * (nodes_size ? nodes_size * 2 : MIN_SLOTS));
+    if (new == NULL) {
+      return -1;
+    }
+    nodes = new;
+    nodes_size = nodes_size ? nodes_size * 2 : MIN_SLOTS;
+  }
+  if (n_nodes * 2 >= n_slots) {
+    int *new;
+
+    new = calloc(n_slots ? n_slots * 2 : MIN_SLOTS, sizeof(int));
+    if (new == NULL) {
+      return -1;
+    }
+    free(slots);
+    slots = new;
+    n_slots = n_slots ? n_slots * 2 : MIN_SLOTS;
+    for (i = 0; i < n_nodes; i++) {
+      if (nodes[i].alive) {
+        slot_add(i);
+      }
+    }
+  }
+  memset(&nodes[n_nodes], 0, sizeof(struct sim_node));
+  nodes[n_nodes].id = *id;
+  nodes[n_nodes].id.bound = 0;
+  nodes[n_nodes].alive = 1;
+  slot_add(n_nodes);
+
+  return n_nodes++;
+}
+
+static int msg_before(const struct sim_msg *m1, const struct sim_msg *m2)
+{
+  return m1->due < m2->due || (m1->due == m2->due && m1->seq < m2->seq);
+}
+
+static int heap_push(struct sim_msg *m)
+{
+  int i;
+
+  if (heap_len == heap_size) {
+    struct sim_msg **new;
+
+    new = realloc(heap, sizeof(struct sim_msg *) * (heap_size ? heap_size * 2 : MIN_SLOTS));
+    if (new == NULL) {
+      return -1;
+    }
+    heap = new;
+    heap_size = heap_size ? heap_size * 2 : MIN_SLOTS;
+  }
+  for (i = heap_len++; i > 0 && msg_before(m, heap[(i - 1) / 2]); i = (i - 1) / 2) {
+    heap[i] = heap[(i - 1) / 2];
+  }
+  heap[i] = m;
+
+  return 0;
+}
+
+static struct sim_msg *heap_pop(void)
+{
+  struct sim_msg *res, *last;
+  int i, child;
+
+  res = heap[0];
+  last = heap[--heap_len];
+  for (i = 0; (child = 2 * i + 1) < heap_len; i = child) {
+    if (child + 1 < heap_len && msg_before(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!msg_before(heap[child], last)) {
+      break;
+    }
+    heap[i] = heap[child];
+  }
+  heap[i] = last;
+
+  return res;
+}
+
+int net_sim_configure(const char *config)
+{
+  struct tag *cfg_tags;
+  int seed = 1;
+
+  cfg_tags = grapes_config_parse(config);
+  if (cfg_tags == NULL) {
+    return -1;
+  }
+  grapes_config_value_int_default(cfg_tags, "latency", &latency, 0);
+  grapes_config_value_int_default(cfg_tags, "jitter", &jitter, 0);
+  grapes_config_value_int_default(cfg_tags, "seed", &seed, 1);
+  if (!grapes_config_value_double(cfg_tags, "loss", &loss)) {
+    loss = 0;
+  }
+  free(cfg_tags);
+  if (latency < 0 || jitter < 0 || loss < 0 || loss > 1) {
+    return -1;
+  }
+  rnd_state = seed ? seed : 1;
+
+  return 0;
+}
+
+uint64_t net_sim_time(void)
+{
+  return now;
+}
+
+int net_sim_run(uint64_t t)
+{
+  int n = 0;
+
+  if (t > now) {
+    now = t;
+  }
+  while (heap_len && heap[0]->due <= now) {
+    struct sim_msg *m = heap_pop();
+    struct sim_node *dst = &nodes[m->dst];
+
+    if (!dst->alive) {
+      free(m);
+      continue;
+    }
+    m->next = NULL;
+    if (dst->tail) {
+      dst->tail->next = m;
+    } else {
+      dst->head = m;
+    }
+    dst->tail = m;
+    n++;
+  }
+
+  return n;
+}
+
+int net_sim_index(const struct nodeID *id)
+{
+  return node_find(id);
+}
+
+int net_sim_counters(const struct nodeID *id, struct net_sim_counters *c)
+{
+  int n = node_find(id);
+
+  if (n < 0) {
+    return -1;
+  }
+  *c = nodes[n].cnt;
+
+  return 0;
+}
+
+/* With -Wl,--wrap=gettimeofday, everyone gets the virtual time */
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+  tv->tv_sec = now / 1000000;
+  tv->tv_usec = now % 1000000;
+
+  return 0;
+}
+
+struct nodeID *create_node(const char *IPaddr, int port)
+{
+  struct nodeID *s;
+
+  s = nodeid_alloc();
+  if (s == NULL) {
+    return NULL;
+  }
+  memset(s, 0, sizeof(struct nodeID));
+  if (inet_pton(AF_INET, IPaddr, &s->addr) != 1) {
+    fprintf(stderr, "Could not convert address '%s' (only IPv4 is simulated)\n", IPaddr);
+    grapes_free(s);
+
+    return NULL;
+  }
+  s->port = htons(port);
+
+  return s;
+}
+
+struct nodeID *net_helper_init(const char *my_addr, int port, const char *config)
+{
+  struct nodeID *myself;
+
+  myself = create_node(my_addr, port);
+  if (myself == NULL) {
+    return NULL;
+  }
+  if (node_find(myself) >= 0 || node_add(myself) < 0) {
+    fprintf(stderr, "Error creating node %s:%d!\n", my_addr, port);
+    grapes_free(myself);
+
+    return NULL;
+  }
+  myself->bound = 1;
+
+  return myself;
+}
+
+void bind_msg_type (uint8_t msgtype)
+{
+}
+
+/*
+ * Account for a message of len bytes from "from" to "to", and allocate it
+ * if it is not lost: *m is NULL if the message does not have to be sent
+ */
+static int msg_new(const struct nodeID *from, const struct nodeID *to, int len, struct sim_msg **m)
+{
+  struct sim_node *src;
+  int src_index, dst_index;
+
+  *m = NULL;
+  src_index = node_find(from);
+  if (src_index < 0) {
+    return -1;
+  }
+  src = &nodes[src_index];
+  src->cnt.sent_msgs++;
+  src->cnt.sent_bytes += len;
+  dst_index = node_find(to);
+  if (dst_index < 0 || (loss > 0 && sim_random() < loss)) {
+    /* Like UDP, sending to nobody is not an error */
+    src->cnt.lost_msgs++;
+
+    return 0;
+  }
+
+  *m = malloc(sizeof(struct sim_msg) + len);
+  if (*m == NULL) {
+    return -1;
+  }
+  (*m)->due = now + latency + (jitter ? (uint64_t)(sim_random() * jitter) : 0);
+  (*m)->seq = next_seq++;
+  (*m)->dst = dst_index;
+  (*m)->from = src->id;
+  (*m)->len = len;
+
+  return 0;
+}
+
+static int msg_send(struct sim_msg *m)
+{
+  if (heap_push(m) < 0) {
+    free(m);
+
+    return -1;
+  }
+  if (latency == 0 && jitter == 0) {
+    net_sim_run(now);
+  }
+
+  return 0;
+}
+
+int send_to_peer_iov(const struct nodeID *from, const struct nodeID *to, const struct iovec *iov, int iovlen)
+{
+  struct sim_msg *m;
+  int i, len;
+
+  for (len = 0, i = 0; i < iovlen; i++) {
+    len += iov[i].iov_len;
+  }
+  if (msg_new(from, to, len, &m) < 0) {
+    return -1;
+  }
+  if (m) {
+    for (len = 0, i = 0; i < iovlen; i++) {
+      memcpy(m->data + len, iov[i].iov_base, iov[i].iov_len);
+      len += iov[i].iov_len;
+    }
+    if (msg_send(m) < 0) {
+      return -1;
+    }
+  }
+
+  return len;
+}
+
+int send_to_peer(const struct nodeID *from, const struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+{
+  struct sim_msg *m;
+
+  if (msg_new(from, to, buffer_size, &m) < 0) {
+    return -1;
+  }
+  if (m) {
+    memcpy(m->data, buffer_ptr, buffer_size);
+    if (msg_send(m) < 0) {
+      return -1;
+    }
+  }
+
+  return buffer_size;
+}
+
+int send_to_peers(const struct nodeID *from, const struct nodeID *const *to, const uint8_t *const *buffers, const int *buffer_sizes, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (send_to_peer(from, to[i], buffers[i], buffer_sizes[i]) < 0) {
+      return i ? i : -1;
+    }
+  }
+
+  return n;
+}
+
+int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size)
+{
+  struct sim_node *dst;
+  struct sim_msg *m;
+  int n, len;
+
+  n = node_find(local);
+  if (n < 0 || nodes[n].head == NULL) {
+    /* Nothing to wait for: time does not pass while blocking */
+    return -1;
+  }
+  dst = &nodes[n];
+  m = dst->head;
+  *remote = nodeid_alloc();
+  if (*remote == NULL) {
+    return -1;
+  }
+  **remote = m->from;
+  dst->head = m->next;
+  if (dst->head == NULL) {
+    dst->tail = NULL;
+  }
+  len = m->len < buffer_size ? m->len : buffer_size;
+  memcpy(buffer_ptr, m->data, len);
+  dst->cnt.recv_msgs++;
+  dst->cnt.recv_bytes += m->len;
+  free(m);
+
+  return len;
+}
+
+int recv_from_peer_batch(const struct nodeID *local, struct nodeID **remote, uint8_t **buffers, int *buffer_sizes, int n)
+{
+  int i;
+
+  for (i = 0; i < n && wait4data(local, NULL, NULL) == 1; i++) {
+    buffer_sizes[i] = recv_from_peer(local, &remote[i], buffers[i], buffer_sizes[i]);
+    if (buffer_sizes[i] < 0) {
+      break;
+    }
+  }
+
+  return i ? i : -1;
+}
+
+int wait4data(const struct nodeID *s, struct timeval *tout, int *user_fds)
+/* returns 1 if some message has been delivered to s, 0 otherwise:
+ * the virtual time only moves in net_sim_run(), so waiting is useless
+ */
+{
+  int n;
+
+  n = s ? node_find(s) : -1;
+
+  return n >= 0 && nodes[n].head ? 1 : 0;
+}
+
+int node_addr(const struct nodeID *s, char *addr, int len)
+{
+  int n;
+
+  if (s && node_ip(s, addr, len) >= 0) {
+    n = snprintf(addr + strlen(addr), len - strlen(addr) - 1, ":%d", node_port(s));
+  } else {
+    n = snprintf(addr, len , "None");
+  }
+
+  return n;
+}
+
+struct nodeID *nodeid_dup(const struct nodeID *s)
+{
+  struct nodeID *res;
+
+  res = nodeid_alloc();
+  if (res != NULL) {
+    *res = *s;
+    res->bound = 0;
+  }
+
+  return res;
+}
+
+int nodeid_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
+{
+  if (max_write_size < COMPACT_ID_IPV4_LEN) return -1;
+
+  b[0] = COMPACT_ID_IPV4_TAG;
+  memcpy(b + 1, &s->addr, 4);
+  memcpy(b + 5, &s->port, 2);
+
+  return COMPACT_ID_IPV4_LEN;
+}
+
+struct nodeID *nodeid_undump(const uint8_t *b, int *len)
+{
+  struct nodeID *res;
+
+  if (b[0] != COMPACT_ID_IPV4_TAG) {
+    fprintf(stderr, "net-helper: unknown nodeID encoding 0x%x\n", b[0]);
+    *len = 0;
+
+    return NULL;
+  }
+  res = nodeid_alloc();
+  if (res != NULL) {
+    memset(res, 0, sizeof(struct nodeID));
+    nodeid_undump_into(res, b);
+  }
+  *len = COMPACT_ID_IPV4_LEN;
+
+  return res;
+}
+
+int nodeid_undump_into(struct nodeID *s, const uint8_t *b)
+{
+  if (s->bound || b[0] != COMPACT_ID_IPV4_TAG) {
+    return -1;
+  }
+  memcpy(&s->addr, b + 1, 4);
+  memcpy(&s->port, b + 5, 2);
+
+  return COMPACT_ID_IPV4_LEN;
+}
+
+void nodeid_free(struct nodeID *s)
+{
+  int n;
+
+  if (s && s->bound) {
+    n = node_find(s);
+    if (n >= 0) {
+      /* The messages in flight are dropped by net_sim_run() */
+      while (nodes[n].head) {
+        struct sim_msg *m = nodes[n].head;
+
+        nodes[n].head = m->next;
+        free(m);
+      }
+      nodes[n].tail = NULL;
+      slot_remove(n);
+      nodes[n].alive = 0;
+    }
+  }
+  grapes_free(s);
+}
+
+int node_ip(const struct nodeID *s, char *ip, int len)
+{
+  if (inet_ntop(AF_INET, &s->addr, ip, len) == NULL) {
+    if (ip && len) {
+      ip[0] = '\0';
+    }
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int node_port(const struct nodeID *s)
+{
+  return ntohs(s->port);
+}
@@ -172,6 +172,60 @@ int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *
   return recv;
 }
 
+int send_to_peer_iov(const struct nodeID *from, const struct nodeID *to, const struct iovec *iov, int iovlen)
+{
+  uint8_t *buff, *p;
+  int i, size = 0, res;
+
+  for (i = 0; i < iovlen; i++) {
+    size += iov[i].iov_len;
+  }
+  buff = malloc(size);
+  if (buff == NULL) {
+    return -1;
+  }
+  for (i = 0, p = buff; i < iovlen; p += iov[i++].iov_len) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+  }
+  res = send_to_peer(from, (struct nodeID *)to, buff, size);
+  free(buff);
+
+  return res;
+}
+
+int send_to_peers(const struct nodeID *from, const struct nodeID *const *to, const uint8_t *const *buffers, const int *buffer_sizes, int n)
+{
+  int i, res = n;
+
+  for (i = 0; i < n; i++) {
+    if (send_to_peer(from, (struct nodeID *)to[i], buffers[i], buffer_sizes[i]) < 0) {
+      res = -1;
+    }
+  }
+
+  return res;
+}
+
+int recv_from_peer_batch(const struct nodeID *local, struct nodeID **remote, uint8_t **buffers, int *buffer_sizes, int n)
+{
+  struct nodeID *r;
+  int res;
+
+  res = recv_from_peer(local, &r, buffers[0], buffer_sizes[0]);
+  if (res < 0) {
+    return -1;
+  }
+  if (remote[0]) {
+    memcpy(&remote[0]->addr, &r->addr, sizeof(struct sockaddr_in));
+    free(r);
+  } else {
+    remote[0] = r;
+  }
+  buffer_sizes[0] = res;
+
+  return 1;
+}
+
 int node_addr(const struct nodeID *s, char *addr, int len)
 {
   int n;
@@ -203,6 +257,21 @@ int nodeid_cmp(const struct nodeID *s1, const struct nodeID *s2)
   return memcmp(&s1->addr, &s2->addr, sizeof(struct sockaddr_in));
 }
 
+uint32_t nodeid_hash(const struct nodeID *s)
+{
+  const uint8_t *b = (const uint8_t *)&s->addr;
+  uint32_t h = 2166136261U;
+  int i;
+
+  /* FNV-1a */
+  for (i = 0; i < sizeof(struct sockaddr_in); i++) {
+    h ^= b[i];
+    h *= 16777619;
+  }
+
+  return h;
+}
+
 int nodeid_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
 {
   if (max_write_size < sizeof(struct sockaddr_in)) return -1;
@@ -225,6 +294,13 @@ struct nodeID *nodeid_undump(const uint8_t *b, int *len)
   return res;
 }
 
+int nodeid_undump_into(struct nodeID *s, const uint8_t *b)
+{
+  memcpy(&s->addr, b, sizeof(struct sockaddr_in));
+
+  return sizeof(struct sockaddr_in);
+}
+
 void nodeid_free(struct nodeID *s)
 {
   free(s);
@@ -6,6 +6,9 @@
  *  This is free software; see lgpl-2.1.txt
  */
 
+#ifdef HAVE_SENDMMSG
+#define _GNU_SOURCE	/* For sendmmsg() and recvmmsg() */
+#endif
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
@@ -19,21 +22,78 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #else
 #define _WIN32_WINNT 0x0501 /* WINNT>=0x501 (WindowsXP) for supporting getaddrinfo/freeaddrinfo.*/
 #include "win32-net.h"
 #endif
 
 #include "net_helper.h"
-
-#define MAX_MSG_SIZE 1024 * 60
+#include "grapes_config.h"
+#include "grapes_alloc.h"
+
+#define MAX_MSG_SIZE (1024 * 60)
+#define MAX_BATCH 64
+#define MAX_SEND_IOV 16
+#define REASM_SLOTS 32
+#define SEQ_SLOTS 256
+#define DEFAULT_REASM_MEM (8 * 1024 * 1024)
+#define DEFAULT_REASM_TIMEOUT 1000
 enum L3PROTOCOL {IPv4, IPv6} l3 = IPv4;
 
+/*
+ * Compact nodeID encoding: one tag byte (COMPACT_ID_V1 | address family),
+ * followed by the address and the port in network order.
+ * Legacy peers dump the whole sockaddr_storage, whose first byte is never
+ * >= 0x80, so the two encodings can be told apart when undumping.
+ */
+#define COMPACT_ID_V1 0x90
+#define COMPACT_ID_IPV4 4
+#define COMPACT_ID_IPV6 6
+#define COMPACT_ID_IPV4_LEN (1 + 4 + 2)
+#define COMPACT_ID_IPV6_LEN (1 + 16 + 2)
+static int compact_ids = 1;
+
+/*
+ * A message being reassembled: its fragments are stored in data at offset
+ * (frag_seq - 1) * MAX_MSG_SIZE, in whatever order they arrive. While
+ * recv_from_peer() runs, the message it is assembling lives directly in the
+ * caller's buffer (in_place); all the other ones live in memory owned by
+ * the table, whose total size is bounded by max_mem.
+ */
+struct reasm_entry {
+  struct sockaddr_storage addr;
+  uint8_t m_seq;
+  uint8_t frags;		/* 0 if the entry is free */
+  uint8_t received;
+  uint8_t got[32];
+  int len;			/* -1 until the last fragment arrives */
+  uint64_t last;		/* Arrival time of the latest fragment (ms) */
+  uint8_t *data;
+  int size;
+  int in_place;
+};
+
+struct nh_state {
+  int refs;	/* The local nodeID and its copies */
+  struct reasm_entry reasm[REASM_SLOTS];
+  int mem;
+  int max_mem;
+  int timeout;
+  uint8_t seq[SEQ_SLOTS];	/* Message sequence numbers, per destination */
+};
+
 struct nodeID {
   struct sockaddr_storage addr;
   int fd;
+  struct nh_state *state;
 };
 
+static struct reasm_entry *reasm_ready(struct nh_state *st);
+
 #ifdef _WIN32
 static int inet_aton(const char *cp, struct in_addr *addr)
 {
@@ -46,11 +106,6 @@ static int inet_aton(const char *cp, struct in_addr *addr)
     return (addr->s_addr == INADDR_NONE) ? 0 : 1;
 }
 
-struct iovec {                    /* Scatter/gather array items */
-  void  *iov_base;              /* Starting address */
-  size_t iov_len;               /* Number of bytes to transfer */
-};
-
 struct msghdr {
   void         *msg_name;       /* optional address */
   socklen_t     msg_namelen;    /* size of address */
@@ -147,6 +202,72 @@ ssize_t sendmsg (int sd, struct msghdr * msg, int flags)
 
 #endif
 
+#ifndef _WIN32
+static int tv2ms(const struct timeval *tv)
+{
+  if (tv == NULL) {
+    return -1;
+  }
+
+  /* Round up, to avoid waking up before the timeout expires */
+  return tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+int wait4data(const struct nodeID *s, struct timeval *tout, int *user_fds)
+/* returns 0 if timeout expires 
+ * returns -1 in case of error of the poll function
+ * retruns 1 if the nodeID file descriptor is ready to be read
+ * 					(i.e., some data is ready from the network socket)
+ * returns 2 if some of the user_fds file descriptors is ready
+ */
+{
+  struct pollfd static_fds[16], *fds = static_fds;
+  int i, n, res;
+
+  if (s && s->state && reasm_ready(s->state)) {
+    return 1;
+  }
+  n = 0;
+  if (user_fds) {
+    while (user_fds[n] != -1) n++;
+  }
+  if (n + 1 > sizeof(static_fds) / sizeof(static_fds[0])) {
+    fds = malloc(sizeof(struct pollfd) * (n + 1));
+    if (fds == NULL) {
+      return -1;
+    }
+  }
+  for (i = 0; i < n; i++) {
+    fds[i].fd = user_fds[i];
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+  }
+  if (s) {
+    fds[n].fd = s->fd;
+    fds[n].events = POLLIN;
+    fds[n].revents = 0;
+  }
+  res = poll(fds, n + (s ? 1 : 0), tv2ms(tout));
+  if (res > 0) {
+    if (s && fds[n].revents) {
+      res = 1;
+    } else {
+      /* An FD is ready, and it's not s->fd */
+      for (i = 0; i < n; i++) {
+        if (!fds[i].revents) {
+          user_fds[i] = -2;
+        }
+      }
+      res = 2;
+    }
+  }
+  if (fds != static_fds) {
+    free(fds);
+  }
+
+  return res;
+}
+#else
 int wait4data(const struct nodeID *s, struct timeval *tout, int *user_fds)
 /* returns 0 if timeout expires 
  * returns -1 in case of error of the select function
@@ -158,6 +279,9 @@ int wait4data(const struct nodeID *s, struct timeval *tout, int *user_fds)
   fd_set fds;
   int i, res, max_fd;
 
+  if (s && s->state && reasm_ready(s->state)) {
+    return 1;
+  }
   FD_ZERO(&fds);
   if (s) {
     max_fd = s->fd;
@@ -192,6 +316,271 @@ int wait4data(const struct nodeID *s, struct timeval *tout, int *user_fds)
   return 2;
 }
 
+#endif
+
+#ifndef _WIN32
+/*
+ * Event loop: persistent registrations, all the ready FDs reported by one
+ * call, and periodic timers. Based on epoll on Linux, on poll elsewhere.
+ */
+struct loop_timer {
+  uint64_t period;		/* us; 0 if the timer is not used */
+  uint64_t next;
+};
+
+struct net_helper_loop {
+  const struct nodeID *s;
+#ifdef __linux__
+  int efd;
+  struct epoll_event *evs;
+  int evs_size;
+#else
+  struct pollfd *fds;
+  int n_fds;
+  int fds_size;
+#endif
+  struct loop_timer *timers;
+  int n_timers;
+};
+
+static uint64_t now_us(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+struct net_helper_loop *net_helper_loop_create(const struct nodeID *s)
+{
+  struct net_helper_loop *l;
+
+  l = malloc(sizeof(struct net_helper_loop));
+  if (l == NULL) {
+    return NULL;
+  }
+  memset(l, 0, sizeof(struct net_helper_loop));
+#ifdef __linux__
+  l->efd = epoll_create(16);
+  if (l->efd < 0) {
+    free(l);
+
+    return NULL;
+  }
+#endif
+  l->s = s;
+  if (s && net_helper_loop_add_fd(l, s->fd) < 0) {
+    net_helper_loop_destroy(l);
+
+    return NULL;
+  }
+
+  return l;
+}
+
+int net_helper_loop_add_fd(struct net_helper_loop *l, int fd)
+{
+#ifdef __linux__
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+
+  return epoll_ctl(l->efd, EPOLL_CTL_ADD, fd, &ev);
+#else
+  int i;
+
+  for (i = 0; i < l->n_fds; i++) {
+    if (l->fds[i].fd == fd) {
+      return -1;
+    }
+  }
+  if (l->n_fds == l->fds_size) {
+    struct pollfd *fds;
+
+    fds = realloc(l->fds, sizeof(struct pollfd) * (l->fds_size + 16));
+    if (fds == NULL) {
+      return -1;
+    }
+    l->fds = fds;
+    l->fds_size += 16;
+  }
+  l->fds[l->n_fds].fd = fd;
+  l->fds[l->n_fds].events = POLLIN;
+  l->fds[l->n_fds++].revents = 0;
+
+  return 0;
+#endif
+}
+
+int net_helper_loop_del_fd(struct net_helper_loop *l, int fd)
+{
+#ifdef __linux__
+  struct epoll_event ev;
+
+  return epoll_ctl(l->efd, EPOLL_CTL_DEL, fd, &ev);
+#else
+  int i;
+
+  for (i = 0; i < l->n_fds; i++) {
+    if (l->fds[i].fd == fd) {
+      l->fds[i] = l->fds[--l->n_fds];
+
+      return 0;
+    }
+  }
+
+  return -1;
+#endif
+}
+
+int net_helper_loop_add_timer(struct net_helper_loop *l, const struct timeval *period)
+{
+  int i;
+
+  if (period == NULL || (period->tv_sec == 0 && period->tv_usec == 0)) {
+    return -1;
+  }
+  for (i = 0; i < l->n_timers && l->timers[i].period; i++);
+  if (i == l->n_timers) {
+    struct loop_timer *t;
+
+    t = realloc(l->timers, sizeof(struct loop_timer) * (l->n_timers + 1));
+    if (t == NULL) {
+      return -1;
+    }
+    l->timers = t;
+    l->n_timers++;
+  }
+  l->timers[i].period = (uint64_t)period->tv_sec * 1000000 + period->tv_usec;
+  l->timers[i].next = now_us() + l->timers[i].period;
+
+  return i;
+}
+
+int net_helper_loop_del_timer(struct net_helper_loop *l, int id)
+{
+  if (id < 0 || id >= l->n_timers || l->timers[id].period == 0) {
+    return -1;
+  }
+  l->timers[id].period = 0;
+
+  return 0;
+}
+
+int net_helper_loop_wait(struct net_helper_loop *l, struct timeval *tout, struct nh_event *events, int max_events)
+{
+  int64_t timeout;
+  uint64_t now;
+  int i, n, res, net = 0;
+
+  if (max_events <= 0) {
+    return -1;
+  }
+  now = now_us();
+  timeout = tout ? (int64_t)tout->tv_sec * 1000000 + tout->tv_usec : -1;
+  for (i = 0; i < l->n_timers; i++) {
+    if (l->timers[i].period) {
+      int64_t t = l->timers[i].next > now ? l->timers[i].next - now : 0;
+
+      if (timeout < 0 || t < timeout) {
+        timeout = t;
+      }
+    }
+  }
+  if (l->s && l->s->state && reasm_ready(l->s->state)) {
+    timeout = 0;
+  }
+
+  n = 0;
+#ifdef __linux__
+  if (l->evs_size < max_events) {
+    struct epoll_event *evs;
+
+    evs = realloc(l->evs, sizeof(struct epoll_event) * max_events);
+    if (evs == NULL) {
+      return -1;
+    }
+    l->evs = evs;
+    l->evs_size = max_events;
+  }
+  res = epoll_wait(l->efd, l->evs, max_events, timeout < 0 ? -1 : (timeout + 999) / 1000);
+  if (res < 0 && errno != EINTR) {
+    return -1;
+  }
+  for (i = 0; i < res; i++) {
+    events[n].id = l->evs[i].data.fd;
+#else
+  res = poll(l->fds, l->n_fds, timeout < 0 ? -1 : (timeout + 999) / 1000);
+  if (res < 0 && errno != EINTR) {
+    return -1;
+  }
+  for (i = 0; i < l->n_fds && res > 0 && n < max_events; i++) {
+    if (l->fds[i].revents == 0) {
+      continue;
+    }
+    events[n].id = l->fds[i].fd;
+#endif
+    if (l->s && events[n].id == l->s->fd) {
+      events[n].type = NH_EV_NET;
+      net = 1;
+    } else {
+      events[n].type = NH_EV_FD;
+    }
+    n++;
+  }
+  if (!net && n < max_events && l->s && l->s->state && reasm_ready(l->s->state)) {
+    events[n].type = NH_EV_NET;
+    events[n++].id = l->s->fd;
+  }
+
+  now = now_us();
+  for (i = 0; i < l->n_timers && n < max_events; i++) {
+    struct loop_timer *t = &l->timers[i];
+
+    if (t->period && t->next <= now) {
+      events[n].type = NH_EV_TIMER;
+      events[n++].id = i;
+      t->next += t->period;
+      if (t->next <= now) {
+        /* Do not try to catch up with the missed periods */
+        t->next = now + t->period;
+      }
+    }
+  }
+
+  return n;
+}
+
+void net_helper_loop_destroy(struct net_helper_loop *l)
+{
+#ifdef __linux__
+  close(l->efd);
+  free(l->evs);
+#else
+  free(l->fds);
+#endif
+  free(l->timers);
+  free(l);
+}
+#endif
+
+static struct grapes_slab *nodeid_slab;
+
+static struct nodeID *nodeid_alloc(void)
+{
+  if (nodeid_slab == NULL) {
+    nodeid_slab = grapes_slab_create("nodeID", sizeof(struct nodeID));
+    if (nodeid_slab == NULL) {
+      return malloc(sizeof(struct nodeID));
+    }
+  }
+
+  return grapes_slab_alloc(nodeid_slab);
+}
+
 struct nodeID *create_node(const char *IPaddr, int port)
 {
   struct nodeID *s;
@@ -202,12 +591,16 @@ struct nodeID *create_node(const char *IPaddr, int port)
   hints.ai_family = AF_UNSPEC;
   hints.ai_flags = AI_NUMERICHOST;
 
-  s = malloc(sizeof(struct nodeID));
+  s = nodeid_alloc();
+  if (s == NULL) {
+    return NULL;
+  }
   memset(s, 0, sizeof(struct nodeID));
 
   if ((res = getaddrinfo(IPaddr, NULL, &hints, &result)))
   {
     fprintf(stderr, "Cannot resolve hostname '%s'\n", IPaddr);
+    grapes_free(s);
     return NULL;
   }
   s->addr.ss_family = result->ai_family;
@@ -230,7 +623,7 @@ struct nodeID *create_node(const char *IPaddr, int port)
   if (res != 1)
   {
     fprintf(stderr, "Could not convert address '%s'\n", IPaddr);
-    free(s);
+    grapes_free(s);
 
     return NULL;
   }
@@ -244,6 +637,8 @@ struct nodeID *net_helper_init(const char *my_addr, int port, const char *config
 {
   int res;
   struct nodeID *myself;
+  struct tag *cfg_tags;
+  const char *wire;
 
   myself = create_node(my_addr, port);
   if (myself == NULL) {
@@ -251,9 +646,32 @@ struct nodeID *net_helper_init(const char *my_addr, int port, const char *config
 
     return NULL;
   }
+  myself->state = malloc(sizeof(struct nh_state));
+  if (myself->state == NULL) {
+    grapes_free(myself);
+
+    return NULL;
+  }
+  memset(myself->state, 0, sizeof(struct nh_state));
+  myself->state->refs = 1;
+  myself->state->max_mem = DEFAULT_REASM_MEM;
+  myself->state->timeout = DEFAULT_REASM_TIMEOUT;
+  cfg_tags = grapes_config_parse(config);
+  if (cfg_tags) {
+    grapes_config_value_int(cfg_tags, "reassembly_mem", &myself->state->max_mem);
+    grapes_config_value_int(cfg_tags, "reassembly_timeout", &myself->state->timeout);
+    wire = grapes_config_value_str(cfg_tags, "nodeid_wire");
+    if (wire && strcmp(wire, "legacy") == 0) {
+      compact_ids = 0;
+    } else if (wire && strcmp(wire, "compact") == 0) {
+      compact_ids = 1;
+    }
+    free(cfg_tags);
+  }
   myself->fd =  socket(myself->addr.ss_family, SOCK_DGRAM, 0);
   if (myself->fd < 0) {
-    free(myself);
+    free(myself->state);
+    grapes_free(myself);
 
     return NULL;
   }
@@ -281,7 +699,8 @@ struct nodeID *net_helper_init(const char *my_addr, int port, const char *config
   if (res < 0) {
     /* bind failed: not a local address... Just close the socket! */
     close(myself->fd);
-    free(myself);
+    free(myself->state);
+    grapes_free(myself);
 
     return NULL;
   }
@@ -299,97 +718,636 @@ struct my_hdr_t {
   uint8_t frags;
 } __attribute__((packed));
 
-int send_to_peer(const struct nodeID *from, const struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+static uint8_t m_seq;
+
+static int addr_cmp(const struct sockaddr_storage *a1, const struct sockaddr_storage *a2);
+
+static uint8_t next_seq(const struct nodeID *from, const struct nodeID *to)
+{
+  uint8_t *seq = from->state ? &from->state->seq[nodeid_hash(to) % SEQ_SLOTS] : &m_seq;
+
+  return __sync_add_and_fetch(seq, 1);
+}
+
+static uint64_t now_ms(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static struct nodeID *remote_alloc(const struct sockaddr_storage *addr)
+{
+  struct nodeID *res;
+
+  res = nodeid_alloc();
+  if (res != NULL) {
+    memcpy(&res->addr, addr, sizeof(struct sockaddr_storage));
+    res->fd = -1;
+    res->state = NULL;
+  }
+
+  return res;
+}
+
+static void reasm_release(struct nh_state *st, struct reasm_entry *e)
+{
+  if (!e->in_place) {
+    free(e->data);
+    st->mem -= e->size;
+  }
+  e->data = NULL;
+  e->frags = 0;
+}
+
+static int reasm_complete(const struct reasm_entry *e)
+{
+  return e->frags && e->received == e->frags;
+}
+
+static struct reasm_entry *reasm_ready(struct nh_state *st)
+{
+  int i;
+
+  for (i = 0; i < REASM_SLOTS; i++) {
+    if (reasm_complete(&st->reasm[i])) {
+      return &st->reasm[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void reasm_expire(struct nh_state *st)
+{
+  uint64_t now = now_ms();
+  int i;
+
+  for (i = 0; i < REASM_SLOTS; i++) {
+    struct reasm_entry *e = &st->reasm[i];
+
+    if (e->frags && !reasm_complete(e) && now - e->last > st->timeout) {
+      reasm_release(st, e);
+    }
+  }
+}
+
+static struct reasm_entry *reasm_lookup(struct nh_state *st, const struct sockaddr_storage *addr, uint8_t seq)
+{
+  int i;
+
+  for (i = 0; i < REASM_SLOTS; i++) {
+    struct reasm_entry *e = &st->reasm[i];
+
+    if (e->frags && e->m_seq == seq && addr_cmp(&e->addr, addr) == 0) {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+/* Evict the incomplete entry not updated for the longest time */
+static int reasm_evict(struct nh_state *st)
+{
+  struct reasm_entry *victim = NULL;
+  int i;
+
+  for (i = 0; i < REASM_SLOTS; i++) {
+    struct reasm_entry *e = &st->reasm[i];
+
+    if (e->frags && !e->in_place && !reasm_complete(e) &&
+        (victim == NULL || e->last < victim->last)) {
+      victim = e;
+    }
+  }
+  if (victim == NULL) {
+    return -1;
+  }
+  reasm_release(st, victim);
+
+  return 0;
+}
+
+/*
+ * Allocate a new entry; if buffer is NULL, its storage is allocated in
+ * the table (for a message of "size" bytes).
+ */
+static struct reasm_entry *reasm_new(struct nh_state *st, const struct sockaddr_storage *addr, const struct my_hdr_t *hdr, uint8_t *buffer, int size)
+{
+  struct reasm_entry *e = NULL;
+  int i;
+
+  for (i = 0; i < REASM_SLOTS && e == NULL; i++) {
+    if (st->reasm[i].frags == 0) {
+      e = &st->reasm[i];
+    }
+  }
+  if (e == NULL) {
+    if (reasm_evict(st) < 0) {
+      return NULL;
+    }
+    return reasm_new(st, addr, hdr, buffer, size);
+  }
+  if (buffer) {
+    e->data = buffer;
+    e->in_place = 1;
+  } else {
+    while (st->mem + size > st->max_mem) {
+      if (reasm_evict(st) < 0) {
+        return NULL;
+      }
+    }
+    e->data = malloc(size);
+    if (e->data == NULL) {
+      return NULL;
+    }
+    e->in_place = 0;
+    st->mem += size;
+  }
+  e->size = size;
+  memcpy(&e->addr, addr, sizeof(struct sockaddr_storage));
+  e->m_seq = hdr->m_seq;
+  e->frags = hdr->frags;
+  e->received = 0;
+  memset(e->got, 0, sizeof(e->got));
+  e->len = -1;
+
+  return e;
+}
+
+static void reasm_mark(struct reasm_entry *e, const struct my_hdr_t *hdr, int len)
+{
+  int i = hdr->frag_seq - 1;
+
+  if (!(e->got[i / 8] & (1 << (i % 8)))) {
+    e->got[i / 8] |= 1 << (i % 8);
+    e->received++;
+  }
+  if (hdr->frag_seq == hdr->frags) {
+    e->len = i * MAX_MSG_SIZE + len;
+  }
+  e->last = now_ms();
+}
+
+/* Move the message being assembled in the caller's buffer to the table */
+static void reasm_stash(struct nh_state *st, struct reasm_entry *e)
+{
+  uint8_t *buffer = e->data;
+  int size = e->frags * MAX_MSG_SIZE;
+
+  /* Evict while e is still in place, so that it is not a victim */
+  while (st->mem + size > st->max_mem) {
+    if (reasm_evict(st) < 0) {
+      break;
+    }
+  }
+  if (e->frags == 0) {
+    return;
+  }
+  e->in_place = 0;
+  e->data = NULL;
+  if (st->mem + size <= st->max_mem) {
+    e->data = malloc(size);
+  }
+  if (e->data == NULL) {
+    e->frags = 0;
+
+    return;
+  }
+  memcpy(e->data, buffer, e->size < size ? e->size : size);
+  e->size = size;
+  st->mem += size;
+}
+
+static int reasm_deliver(struct nh_state *st, struct reasm_entry *e, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size)
+{
+  int len = e->len;
+
+  if (!e->in_place) {
+    if (len > buffer_size) {
+      fprintf(stderr, "net-helper: message too large (%d > %d)\n", len, buffer_size);
+      reasm_release(st, e);
+
+      return -1;
+    }
+    memcpy(buffer_ptr, e->data, len);
+  }
+  *remote = remote_alloc(&e->addr);
+  reasm_release(st, e);
+
+  return *remote ? len : -1;
+}
+
+/* Store a fragment received outside of recv_from_peer() */
+static void reasm_add(struct nh_state *st, const struct sockaddr_storage *addr, const struct my_hdr_t *hdr, const uint8_t *data, int len)
+{
+  struct reasm_entry *e;
+  int off = (hdr->frag_seq - 1) * MAX_MSG_SIZE;
+
+  if (hdr->frag_seq == 0 || hdr->frag_seq > hdr->frags) {
+    return;
+  }
+  e = reasm_lookup(st, addr, hdr->m_seq);
+  if (e == NULL) {
+    e = reasm_new(st, addr, hdr, NULL, hdr->frags * MAX_MSG_SIZE);
+  }
+  if (e == NULL || off + len > e->size) {
+    return;
+  }
+  memcpy(e->data + off, data, len);
+  reasm_mark(e, hdr, len);
+}
+
+static int recv_fragment(int fd, struct sockaddr_storage *raddr, struct my_hdr_t *hdr, uint8_t *buffer_ptr, int len, int flags, int *trunc)
 {
   struct msghdr msg = {0};
-  static struct my_hdr_t my_hdr;
   struct iovec iov[2];
   int res;
 
-  if (buffer_size <= 0) return -1;
-
-  iov[0].iov_base = &my_hdr;
+  iov[0].iov_base = hdr;
   iov[0].iov_len = sizeof(struct my_hdr_t);
-  msg.msg_name = &to->addr;
+  iov[1].iov_base = buffer_ptr;
+  iov[1].iov_len = len;
+  msg.msg_name = raddr;
   msg.msg_namelen = sizeof(struct sockaddr_storage);
-  msg.msg_iovlen = 2;
+  msg.msg_iovlen = len ? 2 : 1;
   msg.msg_iov = iov;
 
-  my_hdr.m_seq++;
-  my_hdr.frags = (buffer_size / (MAX_MSG_SIZE)) + 1;
+  res = recvmsg(fd, &msg, flags);
+  if (res < (int)sizeof(struct my_hdr_t)) {
+    return -1;
+  }
+  if (trunc) {
+    *trunc = (msg.msg_flags & MSG_TRUNC) != 0;
+  }
+  if (hdr->frag_seq == 0 || hdr->frag_seq > hdr->frags) {
+    return -1;
+  }
+
+  return res - sizeof(struct my_hdr_t);
+}
+
+static int wait_fragment(int fd, int timeout)
+{
+  struct timeval tout;
+  fd_set fds;
+
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  tout.tv_sec = timeout / 1000;
+  tout.tv_usec = (timeout % 1000) * 1000;
+
+  return select(fd + 1, &fds, NULL, NULL, &tout);
+}
+
+int send_to_peer_iov(const struct nodeID *from, const struct nodeID *to, const struct iovec *iov, int iovlen)
+{
+  struct msghdr msg = {0};
+  struct my_hdr_t my_hdr;
+  struct iovec frag_iov[MAX_SEND_IOV + 1];
+  int i, res = -1, size = 0, pos = 0, off = 0;
+
+  if (iovlen > MAX_SEND_IOV) return -1;
+  for (i = 0; i < iovlen; i++) {
+    size += iov[i].iov_len;
+  }
+  if (size <= 0) return -1;
+
+  frag_iov[0].iov_base = &my_hdr;
+  frag_iov[0].iov_len = sizeof(struct my_hdr_t);
+  msg.msg_name = &to->addr;
+  msg.msg_namelen = sizeof(struct sockaddr_storage);
+  msg.msg_iov = frag_iov;
+
+  my_hdr.m_seq = next_seq(from, to);
+  my_hdr.frags = (size + MAX_MSG_SIZE - 1) / MAX_MSG_SIZE;
   my_hdr.frag_seq = 0;
 
   do {
-    iov[1].iov_base = buffer_ptr;
-    if (buffer_size > MAX_MSG_SIZE) {
-      iov[1].iov_len = MAX_MSG_SIZE;
-    } else {
-      iov[1].iov_len = buffer_size;
+    int len = size > MAX_MSG_SIZE ? MAX_MSG_SIZE : size;
+
+    /* Gather the next fragment from the caller's buffers, without copying */
+    size -= len;
+    msg.msg_iovlen = 1;
+    while (len > 0) {
+      int l = iov[pos].iov_len - off;
+
+      if (l > len) {
+        l = len;
+      }
+      if (l > 0) {
+        frag_iov[msg.msg_iovlen].iov_base = (uint8_t *)iov[pos].iov_base + off;
+        frag_iov[msg.msg_iovlen++].iov_len = l;
+      }
+      off += l;
+      len -= l;
+      if (off == iov[pos].iov_len) {
+        pos++;
+        off = 0;
+      }
     }
     my_hdr.frag_seq++;
-
-    buffer_size -= iov[1].iov_len;
-    buffer_ptr += iov[1].iov_len;
     res = sendmsg(from->fd, &msg, 0);
 
     if (res  < 0){
       int error = errno;
       fprintf(stderr,"net-helper: sendmsg failed errno %d: %s\n", error, strerror(error));
     }
-  } while (buffer_size > 0);
+  } while (size > 0);
 
   return res;
 }
 
+int send_to_peer(const struct nodeID *from, const struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+{
+  struct iovec iov;
+
+  iov.iov_base = buffer_ptr;
+  iov.iov_len = buffer_size > 0 ? buffer_size : 0;
+
+  return send_to_peer_iov(from, to, &iov, 1);
+}
+
+/*
+ * Single-datagram messages are received directly in the caller's buffer.
+ * The fragments of larger messages are placed at their offset, in the
+ * caller's buffer for the message this call is assembling, and in the
+ * reassembly table for messages interleaved with it (which are returned
+ * by later calls, as soon as they are complete).
+ */
 int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size)
 {
-  int res, recv, m_seq, frag_seq;
+  struct nh_state *st = local->state;
+  struct reasm_entry *e, *cur = NULL;
   struct sockaddr_storage raddr;
-  struct msghdr msg = {0};
-  static struct my_hdr_t my_hdr;
-  struct iovec iov[2];
+  struct my_hdr_t my_hdr;
+  int res, off, trunc;
+  uint64_t deadline;
+
+  *remote = NULL;
+  if (st) {
+    reasm_expire(st);
+    e = reasm_ready(st);
+    if (e) {
+      return reasm_deliver(st, e, remote, buffer_ptr, buffer_size);
+    }
+  }
 
-  iov[0].iov_base = &my_hdr;
-  iov[0].iov_len = sizeof(struct my_hdr_t);
-  msg.msg_name = &raddr;
-  msg.msg_namelen = sizeof(struct sockaddr_storage);
-  msg.msg_iovlen = 2;
-  msg.msg_iov = iov;
+  res = recv_fragment(local->fd, &raddr, &my_hdr, buffer_ptr,
+                      buffer_size > MAX_MSG_SIZE ? MAX_MSG_SIZE : buffer_size, 0, NULL);
+  if (res < 0) {
+    return -1;
+  }
+  if (my_hdr.frags == 1) {
+    *remote = remote_alloc(&raddr);
 
-  *remote = malloc(sizeof(struct nodeID));
-  if (*remote == NULL) {
+    return *remote ? res : -1;
+  }
+  if (st == NULL) {
     return -1;
   }
 
-  recv = 0;
-  m_seq = -1;
-  frag_seq = 0;
-  do {
-    iov[1].iov_base = buffer_ptr;
-    if (buffer_size > MAX_MSG_SIZE) {
-      iov[1].iov_len = MAX_MSG_SIZE;
-    } else {
-      iov[1].iov_len = buffer_size;
+  off = (my_hdr.frag_seq - 1) * MAX_MSG_SIZE;
+  e = reasm_lookup(st, &raddr, my_hdr.m_seq);
+  if (e) {
+    if (off + res > e->size) {
+      return -1;
     }
-    buffer_size -= iov[1].iov_len;
-    buffer_ptr += iov[1].iov_len;
-    res = recvmsg(local->fd, &msg, 0);
-    recv += (res - sizeof(struct my_hdr_t));
-    if (m_seq != -1 && my_hdr.m_seq != m_seq) {
+    memcpy(e->data + off, buffer_ptr, res);
+  } else {
+    if (off + res > buffer_size) {
       return -1;
-    } else {
-      m_seq = my_hdr.m_seq;
     }
-    if (my_hdr.frag_seq != frag_seq + 1) {
+    e = cur = reasm_new(st, &raddr, &my_hdr, buffer_ptr, buffer_size);
+    if (e == NULL) {
       return -1;
+    }
+    memmove(buffer_ptr + off, buffer_ptr, res);
+  }
+  reasm_mark(e, &my_hdr, res);
+  if (reasm_complete(e)) {
+    return reasm_deliver(st, e, remote, buffer_ptr, buffer_size);
+  }
+
+  deadline = now_ms() + st->timeout;
+  while (1) {
+    uint64_t now = now_ms();
+
+    if (now >= deadline || wait_fragment(local->fd, deadline - now) <= 0) {
+      break;
+    }
+    /* Peek at the header, to know where the fragment must go */
+    if (recv_fragment(local->fd, &raddr, &my_hdr, NULL, 0, MSG_PEEK, NULL) < 0) {
+      recv_fragment(local->fd, &raddr, &my_hdr, NULL, 0, 0, NULL);
+      continue;
+    }
+    off = (my_hdr.frag_seq - 1) * MAX_MSG_SIZE;
+    e = reasm_lookup(st, &raddr, my_hdr.m_seq);
+    if (e == NULL) {
+      if (cur == NULL) {
+        e = cur = reasm_new(st, &raddr, &my_hdr, buffer_ptr, buffer_size);
+      } else {
+        e = reasm_new(st, &raddr, &my_hdr, NULL, my_hdr.frags * MAX_MSG_SIZE);
+      }
+    }
+    if (e == NULL || off >= e->size) {
+      recv_fragment(local->fd, &raddr, &my_hdr, NULL, 0, 0, NULL);
+      continue;
+    }
+    res = recv_fragment(local->fd, &raddr, &my_hdr, e->data + off,
+                        e->size - off > MAX_MSG_SIZE ? MAX_MSG_SIZE : e->size - off, 0, &trunc);
+    if (res < 0 || trunc) {
+      /* Does not fit in the caller's buffer */
+      reasm_release(st, e);
+      if (e == cur) {
+        return -1;
+      }
+      continue;
+    }
+    reasm_mark(e, &my_hdr, res);
+    if (e == cur) {
+      deadline = e->last + st->timeout;
+    }
+    if (reasm_complete(e)) {
+      if (cur && e != cur) {
+        /* Do not hold complete messages behind an incomplete one */
+        reasm_stash(st, cur);
+      }
+      return reasm_deliver(st, e, remote, buffer_ptr, buffer_size);
+    }
+  }
+
+  /* Timeout: keep the partial message for later */
+  if (cur) {
+    reasm_stash(st, cur);
+  }
+
+  return -1;
+}
+
+#ifndef HAVE_SENDMMSG
+/* Emulate sendmmsg() and recvmmsg(), sending one message per syscall */
+struct nh_mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#define mmsghdr nh_mmsghdr
+
+static int nh_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+  int i, res;
+
+  for (i = 0; i < n; i++) {
+    res = sendmsg(fd, &msgs[i].msg_hdr, flags);
+    if (res < 0) {
+      return i ? i : -1;
+    }
+    msgs[i].msg_len = res;
+  }
+
+  return n;
+}
+#define sendmmsg nh_sendmmsg
+
+static int nh_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags, struct timespec *tout)
+{
+  int res;
+
+  res = recvmsg(fd, &msgs[0].msg_hdr, flags);
+  if (res < 0) {
+    return -1;
+  }
+  msgs[0].msg_len = res;
+
+  return 1;
+}
+#define recvmmsg nh_recvmmsg
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0
+#endif
+#endif
+
+static int send_batch(const struct nodeID *from, struct mmsghdr *msgs, int n)
+{
+  int res, sent = 0, err = 0;
+
+  while (sent < n) {
+    res = sendmmsg(from->fd, msgs + sent, n - sent, 0);
+    if (res < 0) {
+      int error = errno;
+      fprintf(stderr,"net-helper: sendmmsg failed errno %d: %s\n", error, strerror(error));
+      /* Skip the failing datagram, and go on with the others */
+      res = 1;
+      err = -1;
+    }
+    sent += res;
+  }
+
+  return err;
+}
+
+int send_to_peers(const struct nodeID *from, const struct nodeID *const *to, const uint8_t *const *buffers, const int *buffer_sizes, int n)
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iov[MAX_BATCH][2];
+  struct my_hdr_t hdr[MAX_BATCH];
+  int i, j, res = 0;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0, j = 0; i < n; i++) {
+    const uint8_t *buffer_ptr = buffers[i];
+    int buffer_size = buffer_sizes[i];
+    uint8_t frag_seq = 0, seq;
+
+    if (buffer_size <= 0) {
+      res = -1;
+      continue;
+    }
+    seq = next_seq(from, to[i]);
+    do {
+      hdr[j].m_seq = seq;
+      hdr[j].frags = (buffer_sizes[i] + MAX_MSG_SIZE - 1) / MAX_MSG_SIZE;
+      hdr[j].frag_seq = ++frag_seq;
+      iov[j][0].iov_base = &hdr[j];
+      iov[j][0].iov_len = sizeof(struct my_hdr_t);
+      iov[j][1].iov_base = (void *)(uintptr_t)buffer_ptr;	/* Only read by sendmmsg() */
+      if (buffer_size > MAX_MSG_SIZE) {
+        iov[j][1].iov_len = MAX_MSG_SIZE;
+      } else {
+        iov[j][1].iov_len = buffer_size;
+      }
+      buffer_size -= iov[j][1].iov_len;
+      buffer_ptr += iov[j][1].iov_len;
+      msgs[j].msg_hdr.msg_name = (void *)(uintptr_t)&to[i]->addr;
+      msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+      msgs[j].msg_hdr.msg_iov = iov[j];
+      msgs[j].msg_hdr.msg_iovlen = 2;
+      if (++j == MAX_BATCH) {
+        if (send_batch(from, msgs, j) < 0) {
+          res = -1;
+        }
+        j = 0;
+      }
+    } while (buffer_size > 0);
+  }
+  if (j && send_batch(from, msgs, j) < 0) {
+    res = -1;
+  }
+
+  return res < 0 ? res : n;
+}
+
+int recv_from_peer_batch(const struct nodeID *local, struct nodeID **remote, uint8_t **buffers, int *buffer_sizes, int n)
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iov[MAX_BATCH][2];
+  struct my_hdr_t hdr[MAX_BATCH];
+  struct sockaddr_storage raddr[MAX_BATCH];
+  int i, res;
+
+  if (n > MAX_BATCH) {
+    n = MAX_BATCH;
+  }
+  memset(msgs, 0, sizeof(struct mmsghdr) * n);
+  for (i = 0; i < n; i++) {
+    iov[i][0].iov_base = &hdr[i];
+    iov[i][0].iov_len = sizeof(struct my_hdr_t);
+    iov[i][1].iov_base = buffers[i];
+    iov[i][1].iov_len = buffer_sizes[i] > MAX_MSG_SIZE ? MAX_MSG_SIZE : buffer_sizes[i];
+    msgs[i].msg_hdr.msg_name = &raddr[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    msgs[i].msg_hdr.msg_iov = iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 2;
+  }
+
+  res = recvmmsg(local->fd, msgs, n, MSG_WAITFORONE, NULL);
+  if (res <= 0) {
+    return -1;
+  }
+  for (i = 0; i < res; i++) {
+    if (remote[i] == NULL) {
+      remote[i] = remote_alloc(&raddr[i]);
+      if (remote[i] == NULL) {
+        return -1;
+      }
     } else {
-     frag_seq++;
+      memcpy(&remote[i]->addr, &raddr[i], sizeof(struct sockaddr_storage));
     }
-  } while ((my_hdr.frag_seq < my_hdr.frags) && (buffer_size > 0));
-  memcpy(&(*remote)->addr, &raddr, msg.msg_namelen);
-  (*remote)->fd = -1;
+    if (msgs[i].msg_len < sizeof(struct my_hdr_t) || hdr[i].frags != 1) {
+      /* Fragments of large messages go to the reassembly table */
+      if (local->state && msgs[i].msg_len > sizeof(struct my_hdr_t)) {
+        reasm_add(local->state, &raddr[i], &hdr[i], buffers[i], msgs[i].msg_len - sizeof(struct my_hdr_t));
+      }
+      buffer_sizes[i] = -1;
+    } else {
+      buffer_sizes[i] = msgs[i].msg_len - sizeof(struct my_hdr_t);
+    }
+  }
 
-  return recv;
+  return res;
 }
 
 int node_addr(const struct nodeID *s, char *addr, int len)
@@ -409,50 +1367,157 @@ struct nodeID *nodeid_dup(const struct nodeID *s)
 {
   struct nodeID *res;
 
-  res = malloc(sizeof(struct nodeID));
+  res = nodeid_alloc();
   if (res != NULL) {
     memcpy(res, s, sizeof(struct nodeID));
+    if (res->state) {
+      __sync_add_and_fetch(&res->state->refs, 1);
+    }
   }
 
   return res;
 }
 
+/*
+ * The comparisons work on the binary address: family first, then the
+ * address bytes (in network order) and finally the port.
+ */
+static int addr_cmp(const struct sockaddr_storage *a1, const struct sockaddr_storage *a2)
+{
+  const struct sockaddr_in *in1, *in2;
+  const struct sockaddr_in6 *in61, *in62;
+  int res;
+
+  if (a1->ss_family != a2->ss_family) {
+    return a1->ss_family < a2->ss_family ? -1 : 1;
+  }
+  switch (a1->ss_family) {
+    case AF_INET:
+      in1 = (const struct sockaddr_in *)a1;
+      in2 = (const struct sockaddr_in *)a2;
+      res = memcmp(&in1->sin_addr, &in2->sin_addr, sizeof(in1->sin_addr));
+      if (res) {
+        return res;
+      }
+      return ntohs(in1->sin_port) - ntohs(in2->sin_port);
+    case AF_INET6:
+      in61 = (const struct sockaddr_in6 *)a1;
+      in62 = (const struct sockaddr_in6 *)a2;
+      res = memcmp(&in61->sin6_addr, &in62->sin6_addr, sizeof(in61->sin6_addr));
+      if (res) {
+        return res;
+      }
+      return ntohs(in61->sin6_port) - ntohs(in62->sin6_port);
+    default:
+      return 0;
+  }
+}
+
 int nodeid_equal(const struct nodeID *s1, const struct nodeID *s2)
 {
 	return (nodeid_cmp(s1,s2) == 0);
-//  return (memcmp(&s1->addr, &s2->addr, sizeof(struct sockaddr_storage)) == 0);
 }
 
 int nodeid_cmp(const struct nodeID *s1, const struct nodeID *s2)
 {
-	char ip1[80], ip2[80];
-	int port1,port2,res;
-
   if(s1 && s2)
   {
-    port1=node_port(s1);
-    port2=node_port(s2);
-    node_ip(s1,ip1,80);
-    node_ip(s2,ip2,80);
-
-  //	int res = (port1^port2)|strcmp(ip1,ip2);
-  //	fprintf(stderr,"Comparing %s:%d and %s:%d\n",ip1,port1,ip2,port2);
-  //	fprintf(stderr,"Result: %d\n",res);
-    res  = strcmp(ip1,ip2);
-    if (res!=0)
-      return res;
-    else
-      return port1-port2;
-  //		return port1 == port2 ? 0 : 1;
-
-  //  return memcmp(&s1->addr, &s2->addr, sizeof(struct sockaddr_storage));
+    return addr_cmp(&s1->addr, &s2->addr);
   }
   else
     return 0;
 }
 
+static inline uint32_t hash_mix(uint32_t h, const uint8_t *b, int len)
+{
+  int i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++) {
+    h ^= b[i];
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+uint32_t nodeid_hash(const struct nodeID *s)
+{
+  uint32_t h = 2166136261U;
+
+  h = hash_mix(h, (const uint8_t *)&s->addr.ss_family, sizeof(s->addr.ss_family));
+  switch (s->addr.ss_family) {
+    case AF_INET:
+      h = hash_mix(h, (const uint8_t *)&((const struct sockaddr_in *)&s->addr)->sin_addr, sizeof(struct in_addr));
+      h = hash_mix(h, (const uint8_t *)&((const struct sockaddr_in *)&s->addr)->sin_port, sizeof(in_port_t));
+      break;
+    case AF_INET6:
+      h = hash_mix(h, (const uint8_t *)&((const struct sockaddr_in6 *)&s->addr)->sin6_addr, sizeof(struct in6_addr));
+      h = hash_mix(h, (const uint8_t *)&((const struct sockaddr_in6 *)&s->addr)->sin6_port, sizeof(in_port_t));
+      break;
+  }
+
+  return h;
+}
+
+static int compact_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
+{
+  const struct sockaddr_in *in;
+  const struct sockaddr_in6 *in6;
+
+  switch (s->addr.ss_family) {
+    case AF_INET:
+      if (max_write_size < COMPACT_ID_IPV4_LEN) return -1;
+      in = (const struct sockaddr_in *)&s->addr;
+      b[0] = COMPACT_ID_V1 | COMPACT_ID_IPV4;
+      memcpy(b + 1, &in->sin_addr, 4);
+      memcpy(b + 5, &in->sin_port, 2);
+
+      return COMPACT_ID_IPV4_LEN;
+    case AF_INET6:
+      if (max_write_size < COMPACT_ID_IPV6_LEN) return -1;
+      in6 = (const struct sockaddr_in6 *)&s->addr;
+      b[0] = COMPACT_ID_V1 | COMPACT_ID_IPV6;
+      memcpy(b + 1, &in6->sin6_addr, 16);
+      memcpy(b + 17, &in6->sin6_port, 2);
+
+      return COMPACT_ID_IPV6_LEN;
+    default:
+      return -1;
+  }
+}
+
+static int compact_undump(struct sockaddr_storage *addr, const uint8_t *b)
+{
+  struct sockaddr_in *in;
+  struct sockaddr_in6 *in6;
+
+  memset(addr, 0, sizeof(struct sockaddr_storage));
+  switch (b[0]) {
+    case COMPACT_ID_V1 | COMPACT_ID_IPV4:
+      in = (struct sockaddr_in *)addr;
+      in->sin_family = AF_INET;
+      memcpy(&in->sin_addr, b + 1, 4);
+      memcpy(&in->sin_port, b + 5, 2);
+
+      return COMPACT_ID_IPV4_LEN;
+    case COMPACT_ID_V1 | COMPACT_ID_IPV6:
+      in6 = (struct sockaddr_in6 *)addr;
+      in6->sin6_family = AF_INET6;
+      memcpy(&in6->sin6_addr, b + 1, 16);
+      memcpy(&in6->sin6_port, b + 17, 2);
+
+      return COMPACT_ID_IPV6_LEN;
+    default:
+      return -1;
+  }
+}
+
 int nodeid_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
 {
+  if (compact_ids) {
+    return compact_dump(b, s, max_write_size);
+  }
   if (max_write_size < sizeof(struct sockaddr_storage)) return -1;
 
   memcpy(b, &s->addr, sizeof(struct sockaddr_storage));
@@ -460,22 +1525,67 @@ int nodeid_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
   return sizeof(struct sockaddr_storage);
 }
 
+static int addr_undump(struct sockaddr_storage *addr, const uint8_t *b)
+{
+  int len;
+
+  if (b[0] & 0x80) {
+    len = compact_undump(addr, b);
+    if (len < 0) {
+      fprintf(stderr, "net-helper: unknown nodeID encoding 0x%x\n", b[0]);
+    }
+
+    return len;
+  }
+  memcpy(addr, b, sizeof(struct sockaddr_storage));
+
+  return sizeof(struct sockaddr_storage);
+}
+
 struct nodeID *nodeid_undump(const uint8_t *b, int *len)
 {
   struct nodeID *res;
-  res = malloc(sizeof(struct nodeID));
+  struct sockaddr_storage addr;
+
+  *len = addr_undump(&addr, b);
+  if (*len < 0) {
+    *len = 0;
+
+    return NULL;
+  }
+  res = nodeid_alloc();
   if (res != NULL) {
-    memcpy(&res->addr, b, sizeof(struct sockaddr_storage));
+    memcpy(&res->addr, &addr, sizeof(struct sockaddr_storage));
     res->fd = -1;
+    res->state = NULL;
   }
-  *len = sizeof(struct sockaddr_storage);
 
   return res;
 }
 
+int nodeid_undump_into(struct nodeID *s, const uint8_t *b)
+{
+  if (s->state) {
+    /* Bound to a socket */
+    return -1;
+  }
+
+  return addr_undump(&s->addr, b);
+}
+
 void nodeid_free(struct nodeID *s)
 {
-  free(s);
+  int i;
+
+  if (s && s->state && __sync_sub_and_fetch(&s->state->refs, 1) == 0) {
+    for (i = 0; i < REASM_SLOTS; i++) {
+      if (s->state->reasm[i].frags) {
+        reasm_release(s->state, &s->state->reasm[i]);
+      }
+    }
+    free(s->state);
+  }
+  grapes_free(s);
 }
 
 int node_ip(const struct nodeID *s, char *ip, int len)
@@ -5,6 +5,11 @@ ld-option = $(shell if echo "int main(){return 0;}" | \
 		$(CC) $(LDFLAGS) $(CFLAGS) $(1) -o /dev/null -xc - \
 		> /dev/null 2>&1; then echo "$(1)"; fi ;)
 
+# "y" if the C library provides sendmmsg() and recvmmsg()
+have-sendmmsg = $(shell echo "int main(void) {return sendmmsg(0, 0, 0, 0) + recvmmsg(0, 0, 0, 0, 0);}" | \
+		$(CC) -D_GNU_SOURCE -include sys/socket.h -Werror=implicit-function-declaration \
+		-o /dev/null -xc - > /dev/null 2>&1 && echo y)
+
 -include $(CFGDIR)/config.mk
 ifdef CROSS_COMPILE
 CC = $(CROSS_COMPILE)cc
@@ -37,6 +42,8 @@ endif
 
 CPPFLAGS = -I$(BASE)/include -I$(BASE)/src
 
+%net_helper-udp.o: CPPFLAGS += $(if $(have-sendmmsg),-DHAVE_SENDMMSG)
+
 LIBCOMMON = libgrapes.a
 COMMON = common.o
 